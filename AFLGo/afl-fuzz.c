@@ -54,6 +54,7 @@
 #include <math.h>
 #include "protocol.h"
 #include "../include/shmdata.h"
+#include "../include/aflgo_ext.h"
 
 #if defined(__APPLE__) || defined(__FreeBSD__) || defined (__OpenBSD__)
 #  include <sys/sysctl.h>
@@ -82,6 +83,23 @@ u8 common_subject = 0;
 u8 protocol_subject = 0;
 
 PREFIX_SMEM* prefix_shm;
+static u64 prefix_assigned_ms;        /* when the current prefix arrived, 0 for the first one */
+#if AUTOMATA_MAP_OFFSET != MAP_SIZE + 16
+#  error "AUTOMATA_MAP_OFFSET in shmdata.h must follow the distance slots"
+#endif
+
+/* Bytes the favored set covers: the edges, then the automaton transitions */
+
+#define FAV_MAP_SIZE (MAP_SIZE + AUTOMATA_MAP_SIZE)
+
+static u8 virgin_automata[AUTOMATA_MAP_SIZE]; /* Automaton transitions not hit yet */
+static u32 automata_transitions;      /* Automaton transitions hit so far  */
+static u8 new_transition;             /* The input being saved hit one     */
+static u8 snapshot_mode;              /* RERS: fork server forks after the prefix */
+static u32 forksrv_prefix_version;    /* prefix the fork server ran        */
+static char** forksrv_argv;
+VERDICT_SMEM* verdict_shm = (VERDICT_SMEM*)-1;  /* Property verdicts of the runtime */
+static u8* trace_file;                /* Trace of a violating run, if kept */
 
 EXP_ST u8 *in_dir,                    /* Input directory with test cases  */
           *out_file,                  /* File to fuzz, if any             */
@@ -147,6 +165,15 @@ static s32 forksrv_pid,               /* PID of the fork server           */
 
 EXP_ST u8* trace_bits;                /* SHM with instrumentation bitmap  */
 
+static RUNTIME_STATS* runtime_stats;  /* Phases of the LTL runtime (SHM)  */
+
+static DEFERRED_TRACE* deferred_trace;/* Trace left by the runtime (SHM)  */
+
+static u8  defer_checks;              /* AFL_LTL_DEFER: we model check    */
+static u32 defer_sample;              /* 1 in N discarded inputs checked  */
+static u64 deferred_checks,           /* Traces checked in-process        */
+           deferred_reruns;           /* Inputs run again with the checks */
+
 EXP_ST u8  virgin_bits[MAP_SIZE],     /* Regions yet untouched by fuzzing */
            virgin_tmout[MAP_SIZE],    /* Bits we haven't seen in tmouts   */
            virgin_crash[MAP_SIZE];    /* Bits we haven't seen in crashes  */
@@ -218,6 +245,8 @@ static u64 stage_finds[32],           /* Patterns found per fuzz stage    */
 
 static u32 rand_cnt;                  /* Random number counter            */
 
+static u8  fixed_seed;                /* AFL_RANDOM_SEED: no /dev/urandom */
+
 static u64 total_cal_us,              /* Total calibration time (us)      */
            total_cal_cycles;          /* Total calibration cycles         */
 
@@ -246,11 +275,15 @@ struct queue_entry {
       has_new_cov,                    /* Triggers new coverage?           */
       var_behavior,                   /* Variable behavior?               */
       favored,                        /* Currently favored?               */
-      fs_redundant;                   /* Marked as redundant in the fs?   */
+      fs_redundant,                   /* Marked as redundant in the fs?   */
+      evaluated;                      /* A run of it was checked in full  */
 
   u32 bitmap_size,                    /* Number of bits set in bitmap     */
       exec_cksum;                     /* Checksum of the execution trace  */
 
+  u32 prefix_len,                     /* RERS: prefix in front when        */
+      prefix_version;                 /* exec_cksum was taken             */
+
   u64 exec_us,                        /* Execution time (us)              */
       handicap,                       /* Number of queue cycles behind    */
       depth;                          /* Path depth                       */
@@ -259,6 +292,8 @@ struct queue_entry {
   u32 tc_ref;                         /* Trace bytes ref count            */
 
   double distance;                    /* Distance to targets              */
+  u32 automaton_distance;             /* 1 + distance to a violation, or 0 */
+  u8  no_events;                      /* Runtime reported no event offsets */
 
   struct queue_entry *next,           /* Next element, if any             */
                      *next_100;       /* 100 elements ahead               */
@@ -274,7 +309,7 @@ static struct queue_entry *queue,     /* Fuzzing queue (linked list)      */
                           *q_prev100; /* Previous 100 marker              */
 
 static struct queue_entry*
-  top_rated[MAP_SIZE];                /* Top entries for bitmap bytes     */
+  top_rated[FAV_MAP_SIZE];            /* Top entries for bitmap bytes     */
 
 struct extra_data {
   u8* data;                           /* Dictionary token data            */
@@ -293,6 +328,9 @@ static double max_distance = -1.0;     /* Maximal distance for any input   */
 static double min_distance = -1.0;     /* Minimal distance for any input   */
 static u32 t_x = 10;                  /* Time to exploitation (Default: 10 min) */
 
+static u32 max_automaton_distance;    /* Maximal automaton distance, 0 if none */
+static u32 min_automaton_distance;    /* Minimal automaton distance        */
+
 static u8* (*post_handler)(u8* buf, u32* len);
 
 /* Interesting values, as per config.h */
@@ -320,7 +358,8 @@ enum {
   /* 13 */ STAGE_EXTRAS_UI,
   /* 14 */ STAGE_EXTRAS_AO,
   /* 15 */ STAGE_HAVOC,
-  /* 16 */ STAGE_SPLICE
+  /* 16 */ STAGE_SPLICE,
+  /* 17 */ STAGE_EVENTS
 };
 
 /* Stage value types */
@@ -347,6 +386,7 @@ char** use_argv;  /* argument to run the target program. In vanilla AFL, this is
 static u8 run_target(char** argv, u32 timeout);
 static inline u32 UR(u32 limit);
 static inline u8 has_new_bits(u8* virgin_map);
+static u64 get_cur_time(void);
 
 /* protocol-specific variables & functions */
 u32 server_wait_usecs = 10000;
@@ -386,23 +426,101 @@ kliter_t(lms) *M2_prev, *M2_next;
 unsigned int* (*extract_response_codes)(unsigned char* buf, unsigned int buf_size, unsigned int* state_count_ref) = NULL;
 region_t* (*extract_requests)(unsigned char* buf, unsigned int buf_size, unsigned int* region_count_ref) = NULL;
 
+/* The prefix messages, rebuilt only when LTL-Fuzzer publishes a new prefix */
+static klist_t(lms) *prefix_messages = NULL;
+static u32 prefix_messages_version = 1;   /* odd: nothing built yet */
+static struct iovec *prefix_iov = NULL;   /* the same messages, for net_send_batch() */
+static u32 prefix_iov_count = 0;
+
 klist_t(lms) *add_prefix_protocol(){
+  u32 version = prefix_version(prefix_shm);
+  if(prefix_messages != NULL && (version == prefix_messages_version || (version & 1)))
+    return prefix_messages;
+
   klist_t(lms) *kl_messages_add = kl_init(lms);
   uint32_t prefix_size = prefix_shm->arr_size;
 
+  prefix_iov = ck_realloc(prefix_iov, (prefix_size + 1) * sizeof(struct iovec));
+  prefix_iov_count = 0;
+
   for(uint32_t i = 0; i < prefix_size; i++){
+    uint32_t msize;
+    const char* mdata = prefix_message(prefix_shm, i, &msize);
+    if(mdata == NULL || msize == 0) break;
     message_t *m = (message_t *) ck_alloc(sizeof(message_t));
-    m->msize = strlen((prefix_shm->array)[i]);
-    if(m->msize == 0) break;
+    m->msize = msize;
     m->mdata = (char *) ck_alloc(m->msize);
     if(m->mdata == NULL) {
         break;
     }
-    memcpy((char*)(m->mdata), (prefix_shm->array)[i], (m->msize)*sizeof(char));
+    memcpy((char*)(m->mdata), mdata, (m->msize)*sizeof(char));
     *kl_pushp(lms, kl_messages_add) = m;      
+    prefix_iov[prefix_iov_count].iov_base = m->mdata;
+    prefix_iov[prefix_iov_count].iov_len = m->msize;
+    prefix_iov_count++;
   }
+
+  if(prefix_messages != NULL) delete_kl_messages(prefix_messages);
+  prefix_messages = kl_messages_add;
+  /* overwritten while copying (or copied mid-write): build it again next time */
+  prefix_messages_version = prefix_version(prefix_shm) == version ? version : 1;
   
-  return kl_messages_add;
+  return prefix_messages;
+}
+
+/* Server events (see shmdata.h): the read end of the pipe the runtime of
+   the server writes to, and whether it ever did */
+static s32 server_event_fd = -1;
+static u8 server_notifies;
+
+static void setup_server_events(void) {
+
+  int fds[2];
+  u8 fd_str[12];
+
+  if (pipe(fds)) PFATAL("pipe() failed");
+  fcntl(fds[0], F_SETFL, O_NONBLOCK);
+  fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+
+  /* A server must never block on a full pipe: it drops the event instead. */
+
+  fcntl(fds[1], F_SETFL, O_NONBLOCK);
+
+  server_event_fd = fds[0];
+  sprintf(fd_str, "%d", fds[1]);
+  setenv(SERVER_EVENT_ENV_VAR, fd_str, 1);
+
+}
+
+/* Wait up to msecs for the server to report kind (0: any) after having read
+   at least received bytes. Stale events of earlier sessions are dropped. */
+static u8 wait_server_event(u32 kind, u64 received, u32 msecs) {
+
+  u64 deadline = get_cur_time() + msecs;
+  struct pollfd pfd = { server_event_fd, POLLIN, 0 };
+  SERVER_EVENT events[64];
+
+  if (server_event_fd < 0) return 0;
+
+  while (1) {
+
+    s32 n = read(server_event_fd, events, sizeof(events));
+
+    for (s32 i = 0; i < n / (s32)sizeof(SERVER_EVENT); i++) {
+      if (events[i].pid == (u32)child_pid && (!kind || events[i].kind == kind) &&
+          events[i].received >= received) {
+        server_notifies = 1;
+        return 1;
+      }
+    }
+
+    if (n > 0) continue;
+
+    u64 now = get_cur_time();
+    if (now >= deadline || poll(&pfd, 1, deadline - now) <= 0) return 0;
+
+  }
+
 }
 
 /* Send (mutated) messages in order to the server under test */
@@ -411,9 +529,12 @@ int send_over_network()
   int n;
   u8 likely_buggy = 0;
   struct sockaddr_in serv_addr;
+  u64 bytes_sent = 0;
 
-  //Wait a bit for the server initialization
-  usleep(server_wait_usecs);
+  //Wait for the server initialization: until it accepts or reads, if its
+  //runtime reports it, otherwise for server_wait_usecs
+  if (!wait_server_event(0, 0, server_notifies ? 1000 : server_wait_usecs / 1000) && !server_notifies)
+    usleep(server_wait_usecs % 1000);
 
   //Clear the response buffer and reset the response buffer size
   if (response_buf) {
@@ -453,14 +574,17 @@ int send_over_network()
 
   if(connect(sockfd, (struct sockaddr *)&serv_addr, sizeof(serv_addr)) < 0) {
     //If it cannot connect to the server under test
-    //try it again as the server initial startup time is varied
-    for (n=0; n < 1000; n++) {
-      if (connect(sockfd, (struct sockaddr *)&serv_addr, sizeof(serv_addr)) == 0) break;
-      usleep(1000);
-    }
-    if (n== 1000) {
-      close(sockfd);
-      return 1;
+    //try it again as the server initial startup time is varied,
+    //backing off up to 50ms between attempts for at most a second
+    u32 delay = 100, waited = 0;
+    while (connect(sockfd, (struct sockaddr *)&serv_addr, sizeof(serv_addr)) != 0) {
+      if (waited >= 1000000) {
+        close(sockfd);
+        return 1;
+      }
+      usleep(delay);
+      waited += delay;
+      if (delay < 50000) delay *= 2;
     }
   }
 
@@ -470,25 +594,19 @@ int send_over_network()
   //write the request messages
   messages_sent = 0;
   
+  //the prefix goes out in one batch, no response is awaited between its messages
   if(prefix_shm != (PREFIX_SMEM*)-1){
-    klist_t(lms) *kl_messages_add = add_prefix_protocol();
-	  kliter_t(lms) *it_add;
-	  for (it_add = kl_begin(kl_messages_add); it_add != kl_end(kl_messages_add); it_add = kl_next(it_add)) {
-      net_send(sockfd, timeout, kl_val(it_add)->mdata, kl_val(it_add)->msize);
-      messages_sent++;
-    }
+    add_prefix_protocol();
+    u32 sent = net_send_batch(sockfd, timeout, prefix_iov, prefix_iov_count, net_protocol == PRO_UDP);
+    for (u32 i = 0; i < sent; i++) bytes_sent += prefix_iov[i].iov_len;
+    messages_sent += prefix_iov_count;
   }
-  
-  char input_buffer[100000];
-  int index[20];
-  int counter = 0;
 
   kliter_t(lms) *it;
   for (it = kl_begin(kl_messages); it != kl_end(kl_messages); it = kl_next(it)) {
     n = net_send(sockfd, timeout, kl_val(it)->mdata, kl_val(it)->msize);
     messages_sent++;
-    strcat(input_buffer, kl_val(it)->mdata);
-    index[counter++] = kl_val(it)->msize;
+    if (n > 0) bytes_sent += n;
 
     //Allocate memory to store new accumulated response buffer size
     response_bytes = (u32 *) ck_realloc(response_bytes, messages_sent * sizeof(u32));
@@ -521,24 +639,24 @@ HANDLE_RESPONSES:
     response_bytes[messages_sent - 1] = response_buf_size;
   }
 
-  //wait a bit letting the server to complete its remaining task(s)
-  memset(session_virgin_bits, 255, MAP_SIZE);
-  while(1) {
-    if (has_new_bits(session_virgin_bits) != 2) break;
+  //wait a bit letting the server to complete its remaining task(s): until
+  //it waits for the next request, if its runtime reports it, otherwise
+  //while it keeps covering new edges, for at most poll_wait_msecs
+  if (!server_notifies || !wait_server_event(SERVER_IDLE, bytes_sent, poll_wait_msecs)) {
+    u64 drain_until = get_cur_time() + poll_wait_msecs;
+    memset(session_virgin_bits, 255, MAP_SIZE);
+    while (has_new_bits(session_virgin_bits) == 2 && get_cur_time() < drain_until)
+      usleep(100);
   }
 
   close(sockfd);
 
   if (likely_buggy && false_negative_reduction) return 0;
 
+  //the caller then blocks on the fork server status (or waitpid) until
+  //the server is gone
   if (terminate_child && (child_pid > 0)) kill(child_pid, SIGTERM);
 
-  //give the server a bit more time to gracefully terminate
-  while(1) {
-    int status = kill(child_pid, 0);
-    if ((status != 0) && (errno == ESRCH)) break;
-  }
-
   return 0;
 }
 /* End of protocol-specific variables & functions */
@@ -580,7 +698,10 @@ static inline u32 UR(u32 limit) {
 
     u32 seed[2];
 
-    ck_read(dev_urandom_fd, &seed, sizeof(seed), "/dev/urandom");
+    if (fixed_seed) {
+      seed[0] = random();
+      seed[1] = random();
+    } else ck_read(dev_urandom_fd, &seed, sizeof(seed), "/dev/urandom");
 
     srandom(seed[0]);
     rand_cnt = (RESEED_RNG / 2) + (seed[1] % RESEED_RNG);
@@ -992,6 +1113,27 @@ static void mark_as_redundant(struct queue_entry* q, u8 state) {
 }
 
 
+/* Take the automaton distance of the execution in trace_bits, which must be
+   one of q, and widen the range calculate_score() normalizes it over. */
+
+static void update_automaton_distance(struct queue_entry* q) {
+
+  u32 d = *(u32*)(trace_bits + AUTOMATA_DISTANCE_OFFSET);
+
+  q->automaton_distance = d;
+
+  if (!d) return;
+
+  if (!max_automaton_distance) {
+    max_automaton_distance = d;
+    min_automaton_distance = d;
+  }
+  if (d > max_automaton_distance) max_automaton_distance = d;
+  if (d < min_automaton_distance) min_automaton_distance = d;
+
+}
+
+
 /* Append new test case to the queue. */
 
 static void add_to_queue(u8* fname, u32 len, u8 passed_det) {
@@ -1187,7 +1329,6 @@ static inline u8 has_new_bits(u8* virgin_map) {
 
 #endif /* ^WORD_SIZE_64 */
 
-
   u8   ret = 0;
 
   while (i--) {
@@ -1502,17 +1643,27 @@ static void remove_shm(void) {
 }
 
 
+/* Byte i of the map the favored set covers: an edge below MAP_SIZE, an
+   automaton transition above. */
+
+static inline u8 fav_byte(u8* src, u32 i) {
+
+  return i < MAP_SIZE ? src[i] : src[AUTOMATA_MAP_OFFSET + i - MAP_SIZE];
+
+}
+
+
 /* Compact trace bytes into a smaller bitmap. We effectively just drop the
    count information here. This is called only sporadically, for some
-   new paths. */
+   new paths. The automaton transitions follow the edges. */
 
 static void minimize_bits(u8* dst, u8* src) {
 
   u32 i = 0;
 
-  while (i < MAP_SIZE) {
+  while (i < FAV_MAP_SIZE) {
 
-    if (*(src++)) dst[i >> 3] |= 1 << (i & 7);
+    if (fav_byte(src, i)) dst[i >> 3] |= 1 << (i & 7);
     i++;
 
   }
@@ -1527,7 +1678,8 @@ static void minimize_bits(u8* dst, u8* src) {
    the rest.
 
    The first step of the process is to maintain a list of top_rated[] entries
-   for every byte in the bitmap. We win that slot if there is no previous
+   for every byte in the bitmap, and for every automaton transition, so that
+   the only input reaching some automaton state is never culled. We win that slot if there is no previous
    contender, or if the contender has smaller unique state count or
    it has a more favorable speed x size factor. */
 
@@ -1540,9 +1692,9 @@ static void update_bitmap_score(struct queue_entry* q) {
   /* For every byte set in trace_bits[], see if there is a previous winner,
      and how it compares to us. */
 
-  for (i = 0; i < MAP_SIZE; i++)
+  for (i = 0; i < FAV_MAP_SIZE; i++)
 
-    if (trace_bits[i]) {
+    if (fav_byte(trace_bits, i)) {
 
        if (top_rated[i]) {
 
@@ -1565,7 +1717,7 @@ static void update_bitmap_score(struct queue_entry* q) {
        q->tc_ref++;
 
        if (!q->trace_mini) {
-         q->trace_mini = ck_alloc(MAP_SIZE >> 3);
+         q->trace_mini = ck_alloc(FAV_MAP_SIZE >> 3);
          minimize_bits(q->trace_mini, trace_bits);
        }
 
@@ -1585,14 +1737,14 @@ static void update_bitmap_score(struct queue_entry* q) {
 static void cull_queue(void) {
 
   struct queue_entry* q;
-  static u8 temp_v[MAP_SIZE >> 3];
+  static u8 temp_v[FAV_MAP_SIZE >> 3];
   u32 i;
 
   if (dumb_mode || !score_changed) return;
 
   score_changed = 0;
 
-  memset(temp_v, 255, MAP_SIZE >> 3);
+  memset(temp_v, 255, FAV_MAP_SIZE >> 3);
 
   queued_favored  = 0;
   pending_favored = 0;
@@ -1607,10 +1759,10 @@ static void cull_queue(void) {
   /* Let's see if anything in the bitmap isn't captured in temp_v.
      If yes, and if it has a top_rated[] contender, let's use it. */
 
-  for (i = 0; i < MAP_SIZE; i++)
+  for (i = 0; i < FAV_MAP_SIZE; i++)
     if (top_rated[i] && (temp_v[i >> 3] & (1 << (i & 7)))) {
 
-      u32 j = MAP_SIZE >> 3;
+      u32 j = FAV_MAP_SIZE >> 3;
 
       /* Remove all bits belonging to the current entry from temp_v. */
 
@@ -1646,9 +1798,11 @@ EXP_ST void setup_shm(void) {
 
   memset(virgin_tmout, 255, MAP_SIZE);
   memset(virgin_crash, 255, MAP_SIZE);
+  memset(virgin_automata, 255, AUTOMATA_MAP_SIZE);
 
-  /* Allocate 24 byte more for distance info */
-  shm_id = shmget(IPC_PRIVATE, MAP_SIZE + 16, IPC_CREAT | IPC_EXCL | 0600);
+  /* Allocate 16 bytes more for distance info, then the automaton
+     transitions of the LTL-Fuzzer runtime and its telemetry */
+  shm_id = shmget(IPC_PRIVATE, LTL_AFL_SHM_SIZE, IPC_CREAT | IPC_EXCL | 0600);
 
   if (shm_id < 0) PFATAL("shmget() failed");
 
@@ -1662,6 +1816,7 @@ EXP_ST void setup_shm(void) {
      later on, perhaps? */
 
   if (!dumb_mode) setenv(SHM_ENV_VAR, shm_str, 1);
+  setenv(AUTOMATA_MAP_ENV_VAR, "1", 1);
 
   ck_free(shm_str);
 
@@ -1669,6 +1824,61 @@ EXP_ST void setup_shm(void) {
 
   if (!trace_bits) PFATAL("shmat() failed");
 
+  /* Never cleared again: the runtime of every execution adds to it */
+  runtime_stats = (RUNTIME_STATS*)(trace_bits + RUNTIME_STATS_OFFSET);
+  memset(runtime_stats, 0, sizeof(RUNTIME_STATS));
+
+  deferred_trace = (DEFERRED_TRACE*)(trace_bits + DEFERRED_TRACE_OFFSET);
+  deferred_trace->mode = 0;
+
+}
+
+
+/* AFL_LTL_DEFER=N: the runtime of RERS subjects only steps the automata and
+   leaves the lassos and the acceptance of each trace to us (see
+   DEFERRED_TRACE in shmdata.h). Inputs we keep run again with the checks
+   on; one in N of the others is checked here, from the trace. */
+
+static void setup_deferred_checks(void) {
+
+  u8* x = getenv("AFL_LTL_DEFER");
+  u8* subject = getenv("SUBJECT");
+  u8* ltl_dir;
+  s32 properties;
+
+  if (!x) return;
+
+  if (!common_subject) {
+    WARNF("AFL_LTL_DEFER only applies to RERS subjects (-A), ignored.");
+    return;
+  }
+
+  if (!subject) {
+    WARNF("AFL_LTL_DEFER needs SUBJECT to find the automata, ignored.");
+    return;
+  }
+
+  ltl_dir = alloc_printf("%sltl_dir/", subject);
+  properties = ltl_check_init((char*)ltl_dir);
+  ck_free(ltl_dir);
+
+  if (!properties) {
+    WARNF("No automata in %sltl_dir/, AFL_LTL_DEFER ignored.", subject);
+    return;
+  }
+
+  /* The runtime defers from the main loop on: perform_dry_run() checks the
+     seeds in full. */
+
+  defer_sample = atoi(x);
+  defer_checks = 1;
+
+  if (defer_sample)
+    OKF("Deferred model checking of %d properties, one in %u discarded inputs checked.",
+        properties, defer_sample);
+  else
+    OKF("Deferred model checking of %d properties, kept inputs only.", properties);
+
 }
 
 
@@ -2288,6 +2498,8 @@ static void destroy_extras(void) {
    cloning a stopped child. So, we just execute once, and then send commands
    through a pipe. The other part of this logic is in afl-as.h. */
 
+static void write_to_testcase(void* mem, u32 len);
+
 EXP_ST void init_forkserver(char** argv) {
 
   static struct itimerval it;
@@ -2297,6 +2509,16 @@ EXP_ST void init_forkserver(char** argv) {
 
   ACTF("Spinning up the fork server...");
 
+  forksrv_argv = argv;
+
+  /* Snapshot mode: the subject reads the prefix alone, the fork server comes
+     up once it is consumed and every run only reads the suffix. */
+
+  if (snapshot_mode) {
+    write_to_testcase("", 0);
+    forksrv_prefix_version = common_prefix_version();
+  }
+
   if (pipe(st_pipe) || pipe(ctl_pipe)) PFATAL("pipe() failed");
 
   forksrv_pid = fork();
@@ -2587,7 +2809,9 @@ static u8 run_target(char** argv, u32 timeout) {
      must prevent any earlier operations from venturing into that
      territory. */
 
-  memset(trace_bits, 0, MAP_SIZE + 16);
+  memset(trace_bits, 0, MAP_SIZE + 16 + AUTOMATA_SHM_SIZE);
+  deferred_trace->status = DEFERRED_NONE;
+  reset_verdict(verdict_shm);
   MEM_BARRIER();
 
   /* If we're running in "dumb" mode, we can't rely on the fork server
@@ -2770,6 +2994,14 @@ static u8 run_target(char** argv, u32 timeout) {
     return FAULT_CRASH;
   }
 
+  /* The LTL-Fuzzer runtime reports property violations through the verdict
+     shm and exits normally; keep them as crashes. */
+
+  if (verdict_shm != (VERDICT_SMEM*)-1 && verdict_shm->violated) {
+    kill_signal = 0;
+    return FAULT_CRASH;
+  }
+
   if ((dumb_mode == 1 || no_forkserver) && tb4 == EXEC_FAIL_SIG)
     return FAULT_ERROR;
 
@@ -2778,17 +3010,30 @@ static u8 run_target(char** argv, u32 timeout) {
 }
 
 
+/* Snapshot mode: the fork server holds the state after the previous
+   prefix, bring up a new one behind the current prefix. */
+
+static void restart_forkserver(void) {
+
+  kill(forksrv_pid, SIGKILL);
+  waitpid(forksrv_pid, NULL, 0);
+  close(fsrv_ctl_fd);
+  close(fsrv_st_fd);
+  forksrv_pid = 0;
+
+  init_forkserver(forksrv_argv);
+
+}
+
 /* Write modified data to file for testing. If out_file is set, the old file
    is unlinked and a new one is created. Otherwise, out_fd is rewound and
    truncated. */
-//REPLACE_PREFIX
-//void replace_with_prefix(void** mem, uint32_t *len);
 
 static void write_to_testcase(void* mem, u32 len) {
-  //if(getenv("LTL") != NULL){
-       // printf("---replace input prefix---");
-        //replace_with_prefix(&mem, &len);
-  //} 
+  if (snapshot_mode && forksrv_pid) {
+    u32 version = prefix_version(prefix_shm);
+    if (!(version & 1) && version != forksrv_prefix_version) restart_forkserver();
+  }
   if(common_subject){
     if(prefix_shm != (PREFIX_SMEM*)-1){
       add_prefix_common(&mem, &len, prefix_shm);
@@ -2825,6 +3070,26 @@ static void write_with_gap(void* mem, u32 len, u32 skip_at, u32 skip_len) {
   s32 fd = out_fd;
   u32 tail_len = len - skip_at - skip_len;
 
+  /* RERS: the trimmed suffix still runs behind the prefix, or every trim
+     exec would compare a prefix-less trace against exec_cksum. */
+
+  if (common_subject && prefix_shm != (PREFIX_SMEM*)-1) {
+
+    static u8* gap_buf;
+    static u32 gap_cap;
+
+    if (len > gap_cap) {
+      gap_cap = len;
+      gap_buf = ck_realloc(gap_buf, gap_cap);
+    }
+
+    memcpy(gap_buf, mem, skip_at);
+    memcpy(gap_buf + skip_at, mem + skip_at + skip_len, tail_len);
+    write_to_testcase(gap_buf, skip_at + tail_len);
+    return;
+
+  }
+
   if (out_file) {
 
     unlink(out_file); /* Ignore errors. */
@@ -2897,6 +3162,11 @@ static u8 calibrate_case(char** argv, struct queue_entry* q, u8* use_mem,
 
     if (!first_run && !(stage_cur % stats_update_freq)) show_stats();
 
+    /* The runtime only checks the properties on an input the first time it
+       runs to its end: save_if_interesting() marks what it just ran. */
+
+    deferred_trace->repeat = q->evaluated;
+
     write_to_testcase(use_mem, q->len);
 
     fault = run_target(argv, use_tmout);
@@ -2906,6 +3176,8 @@ static u8 calibrate_case(char** argv, struct queue_entry* q, u8* use_mem,
 
     if (stop_soon || fault != crash_mode) goto abort_calibration;
 
+    q->evaluated = 1;
+
     if (!dumb_mode && !stage_cur && !count_bytes(trace_bits)) {
       fault = FAULT_NOINST;
       goto abort_calibration;
@@ -2934,6 +3206,8 @@ static u8 calibrate_case(char** argv, struct queue_entry* q, u8* use_mem,
 
     }
 
+    if (!q->automaton_distance) update_automaton_distance(q);
+
     if (q->exec_cksum != cksum) {
 
       u8 hnb = has_new_bits(virgin_bits);
@@ -2961,6 +3235,11 @@ static u8 calibrate_case(char** argv, struct queue_entry* q, u8* use_mem,
         q->exec_cksum = cksum;
         memcpy(first_trace, trace_bits, MAP_SIZE);
 
+        if (common_subject) {
+          common_prefix(&q->prefix_len);
+          q->prefix_version = common_prefix_version();
+        }
+
       }
 
     }
@@ -2993,6 +3272,8 @@ static u8 calibrate_case(char** argv, struct queue_entry* q, u8* use_mem,
 
 abort_calibration:
 
+  deferred_trace->repeat = 0;
+
   if (new_bits == 2 && !q->has_new_cov) {
     q->has_new_cov = 1;
     queued_with_cov++;
@@ -3384,6 +3665,44 @@ static void pivot_inputs(void) {
 /* Construct a file name for a new test case, capturing the operation
    that led to its discovery. Uses a static buffer. */
 
+/* Check if the last execution hit automaton transitions no earlier one hit,
+   and mark them as seen. */
+
+static u8 has_new_transitions(void) {
+
+  u64* current = (u64*)(trace_bits + AUTOMATA_MAP_OFFSET);
+  u64* virgin  = (u64*)virgin_automata;
+
+  u32 i = (AUTOMATA_MAP_SIZE >> 3);
+  u8  ret = 0;
+
+  while (i--) {
+
+    if (unlikely(*current & *virgin)) {
+
+      u8* cur = (u8*)current;
+      u8* vir = (u8*)virgin;
+      u32 j;
+
+      for (j = 0; j < 8; j++)
+        if (cur[j] && vir[j]) {
+          vir[j] = 0;
+          automata_transitions++;
+          ret = 1;
+        }
+
+    }
+
+    current++;
+    virgin++;
+
+  }
+
+  return ret;
+
+}
+
+
 static u8* describe_op(u8 hnb) {
 
   static u8 ret[256];
@@ -3416,6 +3735,8 @@ static u8* describe_op(u8 hnb) {
 
   if (hnb == 2) strcat(ret, ",+cov");
 
+  if (new_transition) strcat(ret, ",+ltl");
+
   return ret;
 
 }
@@ -3487,7 +3808,13 @@ static u8 save_if_interesting(char** argv, void* mem, u32 len, u8 fault) {
     /* Keep only if there are new bits in the map, add to queue for
        future fuzzing, etc. */
 
-    if (!(hnb = has_new_bits(virgin_bits))) {
+    /* New automaton transitions keep an input as new edges do: it took a
+       property somewhere no queued input took it. */
+
+    hnb = has_new_bits(virgin_bits);
+    new_transition = has_new_transitions();
+
+    if (!hnb && !new_transition) {
       if (crash_mode) total_crashes++;
       return 0;
     }
@@ -3514,12 +3841,16 @@ static u8 save_if_interesting(char** argv, void* mem, u32 len, u8 fault) {
       add_to_queue(fn, len, 0);
     }
 
-    if (hnb == 2) {
+    if (hnb == 2 || new_transition) {
       queue_top->has_new_cov = 1;
       queued_with_cov++;
     }
 
+    new_transition = 0;
+
     queue_top->exec_cksum = hash32(trace_bits, MAP_SIZE, HASH_CONST);
+    queue_top->evaluated = 1;
+    update_automaton_distance(queue_top);
 
     /* Try to calibrate inline; this also calls update_bitmap_score() when
        successful. */
@@ -3665,13 +3996,27 @@ keep_as_crash:
     save_kl_messages_to_file(kl_messages, fn, 1, messages_sent);
   }
 
+  /* RERS: queue entries stay suffixes, replayed behind whatever prefix is
+     current, but a crash only reproduces behind the prefix it ran with. */
+
   if(common_subject){
+    u32 prefix_len = 0;
+    const void* prefix = common_prefix(&prefix_len);
     fd = open(fn, O_WRONLY | O_CREAT | O_EXCL, 0600);
     if (fd < 0) PFATAL("Unable to create '%s'", fn);
+    if (prefix_len) ck_write(fd, prefix, prefix_len, fn);
     ck_write(fd, mem, len, fn);
     close(fd);
   }
 
+  /* With LTL_TRACES, the runtime wrote the trace of the violation too. */
+
+  if (trace_file && verdict_shm != (VERDICT_SMEM*)-1 && verdict_shm->violated) {
+    u8* trace_fn = alloc_printf("%s%s", fn, TRACE_FILE_SUFFIX);
+    rename(trace_file, trace_fn); /* Ignore errors */
+    ck_free(trace_fn);
+  }
+
   ck_free(fn);
   if(unique_crashes > 0){
       system("pkill ltl-fuzz && pkill afl-fuzz");
@@ -3802,6 +4147,7 @@ static void write_stats_file(double bitmap_cvg, double stability, double eps) {
              "variable_paths    : %u\n"
              "stability         : %0.02f%%\n"
              "bitmap_cvg        : %0.02f%%\n"
+             "automata_transitions : %u\n"
              "unique_crashes    : %llu\n"
              "unique_hangs      : %llu\n"
              "last_path         : %llu\n"
@@ -3817,7 +4163,7 @@ static void write_stats_file(double bitmap_cvg, double stability, double eps) {
              queue_cycle ? (queue_cycle - 1) : 0, total_execs, eps,
              queued_paths, queued_favored, queued_discovered, queued_imported,
              max_depth, current_entry, pending_favored, pending_not_fuzzed,
-             queued_variable, stability, bitmap_cvg, unique_crashes,
+             queued_variable, stability, bitmap_cvg, automata_transitions, unique_crashes,
              unique_hangs, last_path_time / 1000, last_crash_time / 1000,
              last_hang_time / 1000, total_execs - last_crash_execs,
              exec_tmout, use_banner,
@@ -3829,6 +4175,27 @@ static void write_stats_file(double bitmap_cvg, double stability, double eps) {
              orig_cmdline);
              /* ignore errors */
 
+  if (runtime_stats) {
+
+    static const char* phases[] = LTL_PHASE_NAMES;
+    u8 key[32];
+    u32 i;
+
+    for (i = 0; i < LTL_PHASES; i++) {
+
+      snprintf((char*)key, sizeof(key), "ltl_%s_calls", phases[i]);
+      fprintf(f, "%-18s: %llu\n", key, (u64)runtime_stats->count[i]);
+      snprintf((char*)key, sizeof(key), "ltl_%s_cycles", phases[i]);
+      fprintf(f, "%-18s: %llu\n", key, (u64)runtime_stats->cycles[i]);
+
+    }
+
+  }
+
+  if (defer_checks)
+    fprintf(f, "deferred_checks   : %llu\n"
+               "deferred_reruns   : %llu\n", deferred_checks, deferred_reruns);
+
   fclose(f);
 
 }
@@ -3862,11 +4229,22 @@ static void maybe_update_plot_file(double bitmap_cvg, double eps) {
      execs_per_sec */
 
   fprintf(plot_file,
-          "%llu, %llu, %u, %u, %u, %u, %0.02f%%, %llu, %llu, %u, %0.02f\n",
+          "%llu, %llu, %u, %u, %u, %u, %0.02f%%, %llu, %llu, %u, %0.02f",
           get_cur_time() / 1000, queue_cycle - 1, current_entry, queued_paths,
           pending_not_fuzzed, pending_favored, bitmap_cvg, unique_crashes,
           unique_hangs, max_depth, eps); /* ignore errors */
 
+  /* Then the cycles per execution of every phase of the LTL runtime */
+
+  {
+    u32 i;
+    for (i = 0; i < LTL_PHASES; i++)
+      fprintf(plot_file, ", %llu", runtime_stats && total_execs ?
+              (u64)runtime_stats->cycles[i] / total_execs : 0);
+  }
+
+  fprintf(plot_file, "\n");
+
   fflush(plot_file);
 
 }
@@ -4349,6 +4727,24 @@ static void show_stats(void) {
 
   if (total_crashes && getenv("AFL_BENCH_UNTIL_CRASH")) stop_soon = 2;
 
+  /* Honor the deadline LTL-Fuzzer pushes back while it hands us prefixes,
+     and restart the annealing schedule on every new prefix. */
+
+  if (prefix_shm != (PREFIX_SMEM*)-1) {
+
+    static u32 last_prefix_version;
+    s64 deadline = prefix_deadline(prefix_shm);
+    u32 version  = prefix_version(prefix_shm);
+
+    if (deadline && time(NULL) >= deadline) stop_soon = 2;
+
+    if (!(version & 1) && version != last_prefix_version) {
+      if (last_prefix_version) prefix_assigned_ms = cur_ms;
+      last_prefix_version = version;
+    }
+
+  }
+
   /* If we're not on TTY, bail out. */
 
   if (not_on_tty) return;
@@ -4633,9 +5029,10 @@ static void show_stats(void) {
        "  imported : " cRST "%-10s " bSTG bV "\n", tmp,
        sync_id ? DI(queued_imported) : (u8*)"n/a");
 
-  sprintf(tmp, "%s/%s, %s/%s",
+  sprintf(tmp, "%s/%s, %s/%s, %s/%s",
           DI(stage_finds[STAGE_HAVOC]), DI(stage_cycles[STAGE_HAVOC]),
-          DI(stage_finds[STAGE_SPLICE]), DI(stage_cycles[STAGE_SPLICE]));
+          DI(stage_finds[STAGE_SPLICE]), DI(stage_cycles[STAGE_SPLICE]),
+          DI(stage_finds[STAGE_EVENTS]), DI(stage_cycles[STAGE_EVENTS]));
 
   SAYF(bV bSTOP "       havoc : " cRST "%-37s " bSTG bV bSTOP, tmp);
 
@@ -4868,8 +5265,33 @@ static u8 trim_case(char** argv, struct queue_entry* q, u8* in_buf) {
   if (q->len < 5) return 0;
 
   stage_name = tmp;
+
+  /* A new prefix arrived since the entry was calibrated: its checksum no
+     longer describes what trimming runs, take it again behind the current
+     prefix first. */
+
+  if (common_subject && prefix_shm != (PREFIX_SMEM*)-1 &&
+      q->prefix_version != prefix_version(prefix_shm)) {
+
+    write_to_testcase(in_buf, q->len);
+    fault = run_target(argv, exec_tmout);
+    trim_execs++;
+
+    if (stop_soon || fault == FAULT_ERROR) goto abort_trimming;
+
+    q->exec_cksum = hash32(trace_bits, MAP_SIZE, HASH_CONST);
+    common_prefix(&q->prefix_len);
+    q->prefix_version = common_prefix_version();
+
+  }
+
   bytes_trim_in += q->len;
 
+  /* Trimming keeps what leaves the edges alone and ignores violations: the
+     runtime does not check the properties or publish paths meanwhile. */
+
+  deferred_trace->repeat = 1;
+
   /* Select initial chunk len, starting with large steps. */
 
   len_p2 = next_p2(q->len);
@@ -4965,11 +5387,47 @@ static u8 trim_case(char** argv, struct queue_entry* q, u8* in_buf) {
 
 abort_trimming:
 
+  deferred_trace->repeat = 0;
   bytes_trim_out += q->len;
   return fault;
 
 }
 
+/* AFL_LTL_DEFER: a kept input, or one sampled from the others whose trace
+   violates a property or did not reach the shm whole, runs again with the
+   checks of the runtime on, so that the runtime reports the violation and
+   stores the automaton paths as it does without deferral. Returns what
+   save_if_interesting() kept of the violation. */
+
+static u8 check_deferred(char** argv, u8* mem, u32 len, u8 kept) {
+
+  u8 fault;
+
+  if (!kept) {
+
+    if (!defer_sample || UR(defer_sample)) return 0;
+
+    deferred_checks++;
+
+    if (deferred_trace->status == DEFERRED_WRITTEN &&
+        ltl_check_trace(deferred_trace) < 0) return 0;
+
+  }
+
+  deferred_reruns++;
+
+  deferred_trace->mode = 0;
+  write_to_testcase(mem, len);
+  fault = run_target(argv, exec_tmout);
+  deferred_trace->mode = 1;
+
+  if (fault != FAULT_CRASH) return 0;
+
+  return save_if_interesting(argv, mem, len, fault);
+
+}
+
+
 /* Write a modified test case, run program, process results. Handle
    error conditions, returning 1 if it's time to bail out. This is
    a helper function for fuzz_one(). */
@@ -4977,6 +5435,7 @@ abort_trimming:
 EXP_ST u8 common_fuzz_stuff(char** argv, u8* out_buf, u32 len) {
 
   u8 fault;
+  u32 queued_before;
 
   if (post_handler) {
 
@@ -5084,8 +5543,12 @@ EXP_ST u8 common_fuzz_stuff(char** argv, u8* out_buf, u32 len) {
 
   /* This handles FAULT_ERROR for us: */
 
+  queued_before = queued_paths;
   queued_discovered += save_if_interesting(argv, out_buf, len, fault);
 
+  if (defer_checks && fault == FAULT_NONE)
+    queued_discovered += check_deferred(argv, out_buf, len, queued_paths != queued_before);
+
   if (!(stage_cur % stats_update_freq) || stage_cur + 1 == stage_max)
     show_stats();
 
@@ -5200,7 +5663,7 @@ static u32 calculate_score(struct queue_entry* q) {
   }
 
   u64 cur_ms = get_cur_time();
-  u64 t = (cur_ms - start_time) / 1000;
+  u64 t = (cur_ms - MAX(start_time, prefix_assigned_ms)) / 1000;
   double progress_to_tx = ((double) t) / ((double) t_x * 60.0);
 
   double T;
@@ -5236,19 +5699,36 @@ static u32 calculate_score(struct queue_entry* q) {
       PFATAL ("Unkown Power Schedule for Directed Fuzzing");
   }
 
-  double power_factor = 1.0;
+  /* With the LTL runtime, the CFG distance is averaged with the distance
+     of the deepest automaton state the input reached, so that energy goes
+     to inputs close to both the targets and a violation. Either one alone
+     is used when the other is not known. */
+
+  double normalized_d = -1.0;
   if (q->distance > 0) {
 
-    double normalized_d = q->distance;
+    normalized_d = q->distance;
     if (max_distance != min_distance)
       normalized_d = (q->distance - min_distance) / (max_distance - min_distance);
 
-    if (normalized_d >= 0) {
+  }
+
+  if (q->automaton_distance) {
 
-        double p = (1.0 - normalized_d) * (1.0 - T) + 0.5 * T;
-        power_factor = pow(2.0, 2.0 * (double) log2(MAX_FACTOR) * (p - 0.5));
+    double normalized_a = 0.0;
+    if (max_automaton_distance != min_automaton_distance)
+      normalized_a = (double) (q->automaton_distance - min_automaton_distance) /
+                     (double) (max_automaton_distance - min_automaton_distance);
 
-    }// else WARNF ("Normalized distance negative: %f", normalized_d);
+    normalized_d = normalized_d >= 0 ? (normalized_d + normalized_a) / 2.0 : normalized_a;
+
+  }
+
+  double power_factor = 1.0;
+  if (normalized_d >= 0) {
+
+    double p = (1.0 - normalized_d) * (1.0 - T) + 0.5 * T;
+    power_factor = pow(2.0, 2.0 * (double) log2(MAX_FACTOR) * (p - 0.5));
 
   }
 
@@ -5449,6 +5929,171 @@ static u8 could_be_interest(u32 old_val, u32 new_val, u8 blen, u8 check_le) {
 }
 
 
+/* Event stage, for RERS subjects: the runtime reports where every input
+   event of the last execution ended in the input file (EVENT_OFFSETS in
+   shmdata.h), so that whole events can be deleted, duplicated, copied to
+   another boundary, or inserted and replaced by a symbol. Symbols are the
+   -x tokens, which LTL-Fuzzer fills with the inputs of all_events.txt, or
+   events of the entry itself. Returns 1 if the entry should be abandoned. */
+
+static u8 fuzz_events(char** argv, u8* in_buf, u32 len, u32 perf_score) {
+
+  static u32 bound[EVENT_OFFSETS_MAX + 2];
+
+  EVENT_OFFSETS* offsets = (EVENT_OFFSETS*)(trace_bits + EVENT_OFFSETS_OFFSET);
+  u32 plen, events = 0, i, n;
+  u64 orig_hit_cnt, new_hit_cnt;
+  u8* out_buf;
+
+  if (queue_cur->no_events || !len) return 0;
+
+  common_prefix(&plen);
+
+  /* One execution to learn the boundaries of the entry. The offsets are
+     those of the input file, prefix included. */
+
+  write_to_testcase(in_buf, len);
+  if (run_target(argv, exec_tmout) == FAULT_ERROR)
+    FATAL("Unable to execute target application");
+
+  if (stop_soon) return 1;
+
+  n = MIN(offsets->count, EVENT_OFFSETS_MAX);
+
+  bound[events++] = 0;
+
+  for (i = 0; i < n; i++) {
+
+    u32 end = offsets->end[i];
+
+    if (end <= plen) continue;
+    end -= plen;
+    if (end > len) break;
+    if (end > bound[events - 1]) bound[events++] = end;
+
+  }
+
+  if (events == 1) {
+    queue_cur->no_events = 1;
+    return 0;
+  }
+
+  if (bound[events - 1] < len) bound[events++] = len;
+
+  events--;
+
+  stage_name  = "events";
+  stage_short = "events";
+  stage_max   = EVENT_CYCLES * perf_score / havoc_div / 100;
+  stage_cur_byte = -1;
+
+  if (stage_max < HAVOC_MIN) stage_max = HAVOC_MIN;
+
+  orig_hit_cnt = queued_paths + unique_crashes;
+
+  out_buf = ck_alloc_nozero(2 * len + MAX_DICT_FILE);
+
+#define EVENT_APPEND(_p, _l) do { \
+    memcpy(out_buf + out_len, (_p), (_l)); \
+    out_len += (_l); \
+  } while (0)
+
+  for (stage_cur = 0; stage_cur < stage_max; stage_cur++) {
+
+    u32 a     = UR(events),
+        b     = a + 1 + UR(MIN(events - a, EVENT_RUN_MAX)),
+        at    = bound[UR(events + 1)],
+        from  = bound[a],
+        to    = bound[b],
+        out_len = 0, sym_len;
+    u8* sym;
+
+    if (extras_cnt) {
+
+      u32 x = UR(extras_cnt);
+      sym     = extras[x].data;
+      sym_len = extras[x].len;
+
+    } else {
+
+      u32 x = UR(events);
+      sym     = in_buf + bound[x];
+      sym_len = bound[x + 1] - bound[x];
+
+    }
+
+    switch (UR(5)) {
+
+      case 0:
+
+        /* Delete a run of events. */
+
+        EVENT_APPEND(in_buf, from);
+        EVENT_APPEND(in_buf + to, len - to);
+        break;
+
+      case 1:
+
+        /* Duplicate a run of events in place. */
+
+        EVENT_APPEND(in_buf, to);
+        EVENT_APPEND(in_buf + from, to - from);
+        EVENT_APPEND(in_buf + to, len - to);
+        break;
+
+      case 2:
+
+        /* Copy a run of events to another boundary. */
+
+        EVENT_APPEND(in_buf, at);
+        EVENT_APPEND(in_buf + from, to - from);
+        EVENT_APPEND(in_buf + at, len - at);
+        break;
+
+      case 3:
+
+        /* Insert a symbol at a boundary. */
+
+        EVENT_APPEND(in_buf, at);
+        EVENT_APPEND(sym, sym_len);
+        EVENT_APPEND(in_buf + at, len - at);
+        break;
+
+      case 4:
+
+        /* Replace an event with a symbol. */
+
+        to = bound[a + 1];
+        EVENT_APPEND(in_buf, from);
+        EVENT_APPEND(sym, sym_len);
+        EVENT_APPEND(in_buf + to, len - to);
+        break;
+
+    }
+
+    if (!out_len || out_len > MAX_FILE) continue;
+
+    if (common_fuzz_stuff(argv, out_buf, out_len)) {
+      ck_free(out_buf);
+      return 1;
+    }
+
+  }
+
+#undef EVENT_APPEND
+
+  ck_free(out_buf);
+
+  new_hit_cnt = queued_paths + unique_crashes;
+
+  stage_finds[STAGE_EVENTS]  += new_hit_cnt - orig_hit_cnt;
+  stage_cycles[STAGE_EVENTS] += stage_max;
+
+  return 0;
+
+}
+
+
 /* Take the current entry from the queue, fuzz it for a while. This
    function is a tad too long... returns 0 if fuzzed successfully, 1 if
    skipped or bailed out. */
@@ -6643,6 +7288,12 @@ skip_extras:
 
 havoc_stage:
 
+  /* Whole events first, once per entry, not again when splicing. */
+
+  if (common_subject && !splice_cycle && !dumb_mode &&
+      fuzz_events(argv, in_buf, len, perf_score))
+    goto abandon_entry;
+
   stage_cur_byte = -1;
 
   /* The havoc stage mutation code is also invoked when splicing files; if the
@@ -7343,6 +7994,7 @@ static void sync_fuzzers(char** argv) {
       if (st.st_size && st.st_size <= MAX_FILE) {
 
         u8  fault;
+        u32 queued_before;
         u8* mem = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
 
         if (mem == MAP_FAILED) PFATAL("Unable to mmap '%s'", path);
@@ -7364,7 +8016,12 @@ static void sync_fuzzers(char** argv) {
 
 
         syncing_party = sd_ent->d_name;
+        queued_before = queued_paths;
         queued_imported += save_if_interesting(argv, mem, st.st_size, fault);
+
+        if (defer_checks && fault == FAULT_NONE)
+          queued_imported += check_deferred(argv, mem, st.st_size, queued_paths != queued_before);
+
         syncing_party = 0;
 
         /* protocol: unset this flag to disable request extractions while adding new seed to the queue */
@@ -7874,7 +8531,8 @@ EXP_ST void setup_dirs_fds(void) {
 
   fprintf(plot_file, "# unix_time, cycles_done, cur_path, paths_total, "
                      "pending_total, pending_favs, map_size, unique_crashes, "
-                     "unique_hangs, max_depth, execs_per_sec\n");
+                     "unique_hangs, max_depth, execs_per_sec, events_cyc, "
+                     "states_cyc, model_check_cyc, acceptance_cyc, paths_cyc\n");
                      /* ignore errors */
 
 }
@@ -8405,6 +9063,7 @@ void init_shm(){
   else{
     prefix_shm = bind_prefix_smem(prefix_shm_id);
   }
+  verdict_shm = bind_verdict_smem(get_verdict_smem());
 }
 
 /* Main entry point */
@@ -8432,6 +9091,11 @@ int main(int argc, char** argv) {
   gettimeofday(&tv, &tz);
   srandom(tv.tv_sec ^ tv.tv_usec ^ getpid());
 
+  if (getenv("AFL_RANDOM_SEED")) {
+    fixed_seed = 1;
+    srandom(strtoul(getenv("AFL_RANDOM_SEED"), NULL, 0));
+  }
+
 
   while ((opt = getopt(argc, argv, "+i:o:f:m:t:T:dnCB:S:M:x:QN:D:W:w:P:FKz:c:A")) > 0)
 
@@ -8803,6 +9467,7 @@ int main(int argc, char** argv) {
 
   setup_post();
   setup_shm();
+  setup_deferred_checks();
   init_count_class16();
 
   setup_dirs_fds();
@@ -8821,6 +9486,21 @@ int main(int argc, char** argv) {
 
   check_binary(argv[optind]);
 
+  if (use_net) setup_server_events();
+
+  if (getenv(TRACES_ENV_VAR) && atoi(getenv(TRACES_ENV_VAR))) {
+    trace_file = alloc_printf("%s/.cur_trace", out_dir);
+    setenv(TRACE_FILE_ENV_VAR, trace_file, 1);
+  }
+
+  snapshot_mode = common_subject && prefix_shm != (PREFIX_SMEM*)-1 &&
+                  getenv(SNAPSHOT_ENV_VAR) && !dumb_mode && !qemu_mode;
+
+  if (snapshot_mode) {
+    setenv(SNAPSHOT_ENV_VAR, "1", 1);
+    OKF("Snapshot mode: the fork server forks after the prefix.");
+  } else unsetenv(SNAPSHOT_ENV_VAR);
+
   start_time = get_cur_time();
 
   if (qemu_mode)
@@ -8830,6 +9510,8 @@ int main(int argc, char** argv) {
 
   perform_dry_run(use_argv);
 
+  if (defer_checks) deferred_trace->mode = 1;
+
   cull_queue();
 
   show_init_stats();
@@ -126,6 +126,12 @@
 
 #define SPLICE_HAVOC        32
 
+/* Nominal event stage length, and the longest run of events it deletes,
+   duplicates or copies at once (RERS subjects, see fuzz_events()): */
+
+#define EVENT_CYCLES        128
+#define EVENT_RUN_MAX       8
+
 /* Maximum offset for integer addition / subtraction stages: */
 
 #define ARITH_MAX           35
@@ -273,6 +279,11 @@
 #define PERSIST_ENV_VAR     "__AFL_PERSISTENT"
 #define DEFER_ENV_VAR       "__AFL_DEFER_FORKSRV"
 
+/* LTL-Fuzzer snapshot mode: the fork server of a RERS subject starts after
+   the prefix (see afl-llvm-rt.o.c). */
+
+#define SNAPSHOT_ENV_VAR    "LTL_SNAPSHOT"
+
 /* In-code signatures for deferred and persistent mode. */
 
 #define PERSIST_SIG         "##SIG_AFL_PERSISTENT##"
@@ -12,8 +12,12 @@
 #include <boost/algorithm/string.hpp>
 #include <boost/lexical_cast.hpp>
 
+#include <algorithm>
+#include <fstream>
+#include <functional>
 #include <iostream>
 #include <string>
+#include <thread>
 #include <unordered_map>
 
 namespace po = boost::program_options;
@@ -73,51 +77,126 @@ vertex_desc _get_ver(const graph_t &G, const std::string &name){
     return -1;
 }
 
-inline void init_distances_from(const graph_t &G, vertex_desc from, std::vector<int> &dists) {
-    auto dist_pmap = bo::make_iterator_property_map(dists.begin(), get(bo::vertex_index, G));
-    auto vis = bo::make_bfs_visitor(bo::record_distances(dist_pmap, bo::on_tree_edge()));
-    bo::breadth_first_search(G, from, bo::visitor(vis));
+/**
+ * Predecessors of every node: a BFS over them from a target gives the
+ * shortest distance from every node to that target at once, which is what
+ * a forward BFS from each node gave for one (node, target) pair.
+ */
+typedef std::vector<std::vector<vertex_desc>> preds_t;
+
+preds_t reverse_edges(const graph_t &G) {
+    preds_t preds(bo::num_vertices(G));
+    bo::graph_traits<graph_t>::edge_iterator ei, ei_end;
+    for (boost::tie(ei, ei_end) = edges(G); ei != ei_end; ++ei) {
+        preds[bo::target(*ei, G)].push_back(bo::source(*ei, G));
+    }
+    return preds;
+}
+
+/* dists[n] = shortest distance from n to t, -1 if t is not reachable; the
+   reached nodes are left in order, so callers can reset only those */
+void distances_to(const preds_t &preds, vertex_desc t, std::vector<int> &dists,
+                  std::vector<vertex_desc> &order) {
+    for (vertex_desc n : order) dists[n] = -1;
+    order.clear();
+    dists[t] = 0;
+    order.push_back(t);
+    for (size_t head = 0; head < order.size(); ++head) {
+        vertex_desc n = order[head];
+        for (vertex_desc p : preds[n]) {
+            if (dists[p] < 0) {
+                dists[p] = dists[n] + 1;
+                order.push_back(p);
+            }
+        }
+    }
+}
+
+/**
+ * One target of the harmonic distance: its nodes, and for CFGs the call
+ * graph distance of the function it calls (0 for target blocks). Call
+ * graph targets are single nodes of weight 0.
+ */
+struct Target {
+    double weight;
+    std::vector<vertex_desc> nodes;
+};
+
+/* Sums of the harmonic distance of every node, over some of the targets */
+struct Harmonic {
+    std::vector<double> d;
+    std::vector<unsigned> i;
+    explicit Harmonic(size_t n) : d(n, 0.0), i(n, 0) {}
+};
+
+/**
+ * Adds the targets [begin, end) to h. For every node n, a call graph target
+ * t adds 1 / (1 + dist(n, t)) and a CFG target averages
+ * 1 / (1 + 10 * weight + dist(n, t)) over its nodes; unreachable targets add
+ * nothing.
+ */
+void add_targets(const preds_t &preds, const std::vector<Target> &targets,
+                 size_t begin, size_t end, Harmonic &h) {
+    size_t num = preds.size();
+    std::vector<int> dists(num, -1);
+    std::vector<vertex_desc> order;
+    std::vector<double> di(num, 0.0);
+    std::vector<unsigned> ii(num, 0);
+    std::vector<vertex_desc> touched;
+    for (size_t k = begin; k < end; ++k) {
+        const Target &target = targets[k];
+        for (vertex_desc t : target.nodes) {
+            distances_to(preds, t, dists, order);
+            for (vertex_desc n : order) {
+                if (ii[n] == 0) touched.push_back(n);
+                di[n] += 1.0 / (1.0 + 10 * target.weight + static_cast<double>(dists[n]));
+                ++ii[n];
+            }
+        }
+        for (vertex_desc n : touched) {
+            h.d[n] += di[n] / static_cast<double>(ii[n]);
+            ++h.i[n];
+            di[n] = 0.0;
+            ii[n] = 0;
+        }
+        touched.clear();
+    }
+}
+
+/* The targets spread over jobs threads, each summing its share apart */
+Harmonic harmonic_distances(const graph_t &G, const std::vector<Target> &targets, unsigned jobs) {
+    preds_t preds = reverse_edges(G);
+    size_t num = preds.size();
+    jobs = std::max(1u, std::min<unsigned>(jobs, targets.size()));
+    std::vector<Harmonic> parts(jobs, Harmonic(num));
+    std::vector<std::thread> workers;
+    for (unsigned j = 0; j < jobs; ++j) {
+        size_t begin = targets.size() * j / jobs, end = targets.size() * (j + 1) / jobs;
+        workers.emplace_back(add_targets, std::cref(preds), std::cref(targets), begin, end,
+                             std::ref(parts[j]));
+    }
+    for (auto &w : workers) w.join();
+    Harmonic h(num);
+    for (auto &part : parts) {
+        for (size_t n = 0; n < num; ++n) {
+            h.d[n] += part.d[n];
+            h.i[n] += part.i[n];
+        }
+    }
+    return h;
 }
 
+/* Distance of a block or function: the smallest over its nodes */
 void distance(
     const graph_t &G,
     const std::string &name,
-    const std::vector<vertex_desc> &targets,
-    std::ofstream &out,
-    unordered_map<std::string, double> &bb_distance
+    const Harmonic &h,
+    std::ofstream &out
 ) {
     double distance = -1;
     for (vertex_desc n : find_nodes(G, name)) {
-        std::vector<int> distances(bo::num_vertices(G), 0);
-        init_distances_from(G, n, distances);
-
-        double d = 0.0;
-        unsigned i = 0;
-        if (is_cg) {
-            for (vertex_desc t : targets) {
-                auto shortest = distances[t];           // shortest distance from n to t
-                if (shortest == 0 and n != t) continue; // not reachable
-                d += 1.0 / (1.0 + static_cast<double>(shortest));
-                ++i;
-            }
-        } else {
-            for (auto &bb_d_entry : bb_distance) {
-                double di = 0.0;
-                unsigned ii = 0;
-                for (auto t : find_nodes(G, bb_d_entry.first)) {
-                    auto shortest = distances[t];           // shortest distance from n to t
-                    if (shortest == 0 and n != t) continue; // not reachable
-                    di += 1.0 / (1.0 + 10 * bb_d_entry.second + static_cast<double>(shortest));
-                    ++ii;
-                }
-                if (ii != 0) {
-                    d += di / static_cast<double>(ii);
-                    ++i;
-                }
-            }
-        }
-        double tmp = static_cast<double>(i) / d;
-        if (d != 0 and (distance == -1 or distance > tmp)) {
+        double tmp = static_cast<double>(h.i[n]) / h.d[n];
+        if (h.d[n] != 0 and (distance == -1 or distance > tmp)) {
             distance = tmp;
         }
     }
@@ -139,10 +218,6 @@ std::vector<vertex_desc> cg_calculation(
             targets.push_back(t);
         }
     }
-    if (targets.empty()) {
-        cout << "No targets available\n";
-        exit(0);
-    }
     return targets;
 }
 
@@ -209,6 +284,50 @@ std::ifstream open_file(const std::string &filename) {
     return filestream;
 }
 
+/**
+ * Distances of the nodes listed in names_path to the targets in
+ * targets_path, written to out_path; false, and nothing written, if none of
+ * the targets is in a call graph.
+ */
+bool calculate(graph_t &G, const std::string &targets_path, const std::string &out_path,
+               const std::string &names_path, const std::string &cg_distance_path,
+               const po::variables_map &vm, unsigned jobs) {
+    std::ifstream targets_stream = open_file(targets_path);
+    std::ifstream names = open_file(names_path);
+    std::vector<Target> targets;
+    unordered_map<std::string, double> cg_distance;
+    unordered_map<std::string, double> bb_distance;
+
+    if (is_cg) {
+        for (vertex_desc t : cg_calculation(G, targets_stream)) {
+            targets.push_back(Target{0.0, {t}});
+        }
+        if (targets.empty()) {
+            return false;
+        }
+    } else {
+        std::ifstream cg_distance_stream = open_file(cg_distance_path);
+        std::ifstream cg_callsites_stream = open_file(vm["cg_callsites"].as<std::string>());
+        cfg_calculation(G, targets_stream, cg_distance_stream, cg_callsites_stream,
+                        cg_distance, bb_distance);
+        for (auto &bb_d_entry : bb_distance) {
+            std::vector<vertex_desc> nodes = find_nodes(G, bb_d_entry.first);
+            if (not nodes.empty()) {
+                targets.push_back(Target{bb_d_entry.second, nodes});
+            }
+        }
+    }
+
+    cout << "Calculating distance (" << targets.size() << " targets, " << jobs << " threads)..\n";
+    Harmonic h = harmonic_distances(G, targets, jobs);
+    std::ofstream outstream(out_path);
+    for (std::string line; getline(names, line); ) {
+        bo::trim(line);
+        distance(G, line, h, outstream);
+    }
+    return true;
+}
+
 int main(int argc, char *argv[]) {
     po::variables_map vm;
     try {
@@ -217,9 +336,9 @@ int main(int argc, char *argv[]) {
                 ("help,h", "produce help message")
                 ("dot,d", po::value<std::string>()->required(), "Path to dot-file representing the "
                                                            "graph.")
-                ("targets,t", po::value<std::string>()->required(), "Path to file specifying Target"
+                ("targets,t", po::value<std::string>(), "Path to file specifying Target"
                                                                     " nodes.")
-                ("out,o", po::value<std::string>()->required(), "Path to output file containing "
+                ("out,o", po::value<std::string>(), "Path to output file containing "
                                                                 "distance for each node.")
                 ("names,n", po::value<std::string>()->required(), "Path to file containing name for"
                                                                   " each node.")
@@ -228,6 +347,12 @@ int main(int argc, char *argv[]) {
                 ("cg_callsites,s", po::value<std::string>(), "Path to file containing mapping "
                                                              "between basic blocks and called "
                                                              "functions.")
+                ("jobs,j", po::value<unsigned>()->default_value(0), "Threads the targets are "
+                                                                    "spread over, 0 for one per CPU.")
+                ("batch,b", po::value<std::string>(), "File with one \"targets out [cg_distance]\" "
+                                                      "per line, all computed on the same graph; "
+                                                      "--targets, --out and --cg_distance are "
+                                                      "then ignored.")
                 ;
 
         po::store(po::parse_command_line(argc, argv, desc), vm);
@@ -236,6 +361,13 @@ int main(int argc, char *argv[]) {
             return 0;
         }
         po::notify(vm);
+        if (not vm.count("batch")) {
+            for (const char *opt : {"targets", "out"}) {
+                if (not vm.count(opt)) {
+                    throw po::required_option(opt);
+                }
+            }
+        }
     }
     catch(exception& e) {
         cerr << "error: " << e.what() << "\n";
@@ -263,16 +395,11 @@ int main(int argc, char *argv[]) {
     is_cg = get_property(graph, bo::graph_name).find("Call graph") != std::string::npos;
     cout << "Working on " << (is_cg ? "callgraph" : "control flow graph") << "\n";
 
-    std::ifstream targets_stream = open_file(vm["targets"].as<std::string>());
-    std::ifstream names = open_file(vm["names"].as<std::string>());
-    std::vector<vertex_desc> targets;
-    unordered_map<std::string, double> cg_distance;
-    unordered_map<std::string, double> bb_distance;
+    unsigned jobs = vm["jobs"].as<unsigned>();
+    if (jobs == 0) jobs = std::max(1u, std::thread::hardware_concurrency());
 
-    if (is_cg) {
-        targets = cg_calculation(graph, targets_stream);
-    } else {
-        if (not vm.count("cg_distance")) {
+    if (not is_cg) {
+        if (not vm.count("cg_distance") and not vm.count("batch")) {
             cerr << "error: the required argument for option '--cg_distance' is missing\n";
             exit(1);
         }
@@ -280,22 +407,33 @@ int main(int argc, char *argv[]) {
             cerr << "error: the required argument for option '--cg_callsites' is missing\n";
             exit(1);
         }
-        std::ifstream cg_distance_stream = open_file(vm["cg_distance"].as<std::string>());
-        std::ifstream cg_callsites_stream = open_file(vm["cg_callsites"].as<std::string>());
-
         std::vector<std::string> splits;
         bo::algorithm::split(splits, vm["dot"].as<std::string>(), bo::is_any_of("."));;
         std::string &caller = splits.end()[-2];
         cout << "Loading cg_distance for function '" << caller << "'..\n";
-        targets = cfg_calculation(graph, targets_stream, cg_distance_stream,
-                                  cg_callsites_stream, cg_distance, bb_distance);
     }
 
-    cout << "Calculating distance..\n";
-    std::ofstream outstream(vm["out"].as<std::string>());
-    for (std::string line; getline(names, line); ) {
+    if (not vm.count("batch")) {
+        std::string cg_distance = vm.count("cg_distance") ? vm["cg_distance"].as<std::string>() : "";
+        if (not calculate(graph, vm["targets"].as<std::string>(), vm["out"].as<std::string>(),
+                          vm["names"].as<std::string>(), cg_distance, vm, jobs)) {
+            cout << "No targets available\n";
+        }
+        return 0;
+    }
+
+    // one "targets out [cg_distance]" per line, all on the graph parsed once
+    std::ifstream batch = open_file(vm["batch"].as<std::string>());
+    for (std::string line; getline(batch, line); ) {
         bo::trim(line);
-        distance(graph, line, targets, outstream, bb_distance);
+        std::vector<std::string> splits;
+        bo::algorithm::split(splits, line, bo::is_any_of(" "), bo::token_compress_on);
+        if (splits.size() < 2 or (not is_cg and splits.size() < 3)) continue;
+        cout << "Targets " << splits[0] << ":\n";
+        if (not calculate(graph, splits[0], splits[1], vm["names"].as<std::string>(),
+                          is_cg ? "" : splits[2], vm, jobs)) {
+            cout << "No targets available\n";
+        }
     }
 
     return 0;
@@ -38,6 +38,9 @@
 #include <sstream>
 #include <list>
 #include <vector>
+#include <unordered_map>
+#include <unordered_set>
+#include <set>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
@@ -80,6 +83,12 @@ cl::opt<std::string> DistanceFile(
     cl::value_desc("filename")
 );
 
+cl::opt<std::string> DistancesFile(
+    "distances",
+    cl::desc("File listing one target and its distance file per line, for a binary that serves all of them."),
+    cl::value_desc("filename")
+);
+
 cl::opt<std::string> TargetsFile(
     "targets",
     cl::desc("Input file containing the target lines of code."),
@@ -87,7 +96,7 @@ cl::opt<std::string> TargetsFile(
 
 cl::opt<std::string> OutDirectory(
     "outdir",
-    cl::desc("Output directory where Ftargets.txt, Fnames.txt, and BBnames.txt are generated."),
+    cl::desc("Output directory where Ftargets.txt, Ftargetmap.txt, Fnames.txt, and BBnames.txt are generated."),
     cl::value_desc("outdir"));
 
 cl::opt<std::string> REventsFile(
@@ -100,6 +109,11 @@ cl::opt<std::string> PEventsFile(
     cl::desc("Event file containing the locations of events and events (for protocols)."),
     cl::value_desc("pevents"));
 
+cl::opt<std::string> StateVarsFile(
+    "state-vars",
+    cl::desc("File with the names of the variables making up the program state, one per line; by default those read on the way to an event."),
+    cl::value_desc("state-vars"));
+
 namespace llvm {
 
 template<>
@@ -167,6 +181,29 @@ static bool isBlacklisted(const Function *F) {
   return false;
 }
 
+/* Reads a distance.cfg.txt: one "block,distance" per line, distances scaled
+   by 100. The blocks are added to basic_blocks. */
+static bool readDistanceFile(const std::string &path, std::unordered_map<std::string, int> &bb_to_dis,
+                             std::unordered_set<std::string> &basic_blocks) {
+  std::ifstream cf(path);
+  if (!cf.is_open())
+    return false;
+
+  std::string line;
+  while (getline(cf, line)) {
+
+    std::size_t pos = line.find(",");
+    std::string bb_name = line.substr(0, pos);
+    int bb_dis = (int) (100.0 * atof(line.substr(pos + 1, line.length()).c_str()));
+
+    bb_to_dis.emplace(bb_name, bb_dis);
+    basic_blocks.insert(bb_name);
+
+  }
+  cf.close();
+  return true;
+}
+
 
 bool AFLCoverage::runOnModule(Module &M) {
 
@@ -176,16 +213,23 @@ bool AFLCoverage::runOnModule(Module &M) {
   bool is_protocol_fuzzing = false;
   bool is_ltl_fuzzing = false;
 
-  if (!TargetsFile.empty() && !DistanceFile.empty()) {
+  if (!TargetsFile.empty() && (!DistanceFile.empty() || !DistancesFile.empty())) {
     FATAL("Cannot specify both '-targets' and '-distance'!");
     return false;
   }
 
-  std::list<std::string> targets;
-  std::map<std::string, int> bb_to_dis;
-  std::vector<std::string> basic_blocks;
-  std::map<std::string, int> loc_to_revt;          //RERS: locations mapped to events
-  std::map<std::string, std::string> loc_to_pevt;  //Protocols
+  if (!DistanceFile.empty() && !DistancesFile.empty()) {
+    FATAL("Cannot specify both '-distance' and '-distances'!");
+    return false;
+  }
+
+  /* All looked up once per instruction or block, hence hashed */
+  std::unordered_set<std::string> targets;         //"file:line", without directories
+  std::unordered_map<std::string, int> bb_to_dis;
+  std::vector<std::unordered_map<std::string, int>> target_bb_to_dis;   //-distances: one per target
+  std::unordered_set<std::string> basic_blocks;
+  std::unordered_map<std::string, int> loc_to_revt;          //RERS: locations mapped to events
+  std::unordered_map<std::string, std::string> loc_to_pevt;  //Protocols
 
   if (!TargetsFile.empty()) {
 
@@ -196,29 +240,50 @@ bool AFLCoverage::runOnModule(Module &M) {
 
     std::ifstream targetsfile(TargetsFile);
     std::string line;
-    while (std::getline(targetsfile, line)) 
-	    targets.push_back(line);
+    while (std::getline(targetsfile, line)) {
+      std::size_t found = line.find_last_of("/\\");
+      if (found != std::string::npos)
+        line = line.substr(found + 1);
+
+      std::size_t pos = line.find_last_of(":");
+      unsigned int target_line = atoi(line.substr(pos + 1).c_str());
+      targets.insert(line.substr(0, pos) + ":" + std::to_string(target_line));
+    }
     targetsfile.close();
 
     is_aflgo_preprocessing = true;
 
-  } else if (!DistanceFile.empty()) {
+  } else if (!DistanceFile.empty() || !DistancesFile.empty()) {
+
+    bool distances_read = true;
 
-    std::ifstream cf(DistanceFile);
-    if (cf.is_open()) {
+    if (!DistanceFile.empty()) {
 
+      distances_read = readDistanceFile(DistanceFile, bb_to_dis, basic_blocks);
+
+    } else {
+
+      std::ifstream lf(DistancesFile);
       std::string line;
-      while (getline(cf, line)) {
+      distances_read = lf.is_open();
 
-        std::size_t pos = line.find(",");
-        std::string bb_name = line.substr(0, pos);
-        int bb_dis = (int) (100.0 * atof(line.substr(pos + 1, line.length()).c_str()));
+      while (distances_read && getline(lf, line)) {
 
-        bb_to_dis.emplace(bb_name, bb_dis);
-        basic_blocks.push_back(bb_name);
+        std::size_t pos = line.find(" ");
+        if (pos == std::string::npos) continue;
+
+        target_bb_to_dis.emplace_back();
+        if (!readDistanceFile(line.substr(pos + 1), target_bb_to_dis.back(), basic_blocks))
+          FATAL("Unable to find %s.", line.substr(pos + 1).c_str());
 
       }
-      cf.close();
+
+      if (distances_read && target_bb_to_dis.empty())
+        FATAL("No targets in %s.", DistancesFile.c_str());
+
+    }
+
+    if (distances_read) {
 
       is_aflgo = true;
 
@@ -260,7 +325,7 @@ bool AFLCoverage::runOnModule(Module &M) {
       }
 
     } else {
-      FATAL("Unable to find %s.", DistanceFile.c_str());
+      FATAL("Unable to find %s.", DistanceFile.empty() ? DistancesFile.c_str() : DistanceFile.c_str());
       return false;
     }
 
@@ -322,6 +387,8 @@ bool AFLCoverage::runOnModule(Module &M) {
     std::ofstream bbcalls(OutDirectory + "/BBcalls.txt", std::ofstream::out | std::ofstream::app);
     std::ofstream fnames(OutDirectory + "/Fnames.txt", std::ofstream::out | std::ofstream::app);
     std::ofstream ftargets(OutDirectory + "/Ftargets.txt", std::ofstream::out | std::ofstream::app);
+    /* "file:line,function" for every target, to build the targets apart */
+    std::ofstream ftargetmap(OutDirectory + "/Ftargetmap.txt", std::ofstream::out | std::ofstream::app);
 
     /* Create dot-files directory */
     std::string dotfiles(OutDirectory + "/dot-files");
@@ -339,7 +406,7 @@ bool AFLCoverage::runOnModule(Module &M) {
         continue;
       }
 
-      bool is_target = false;
+      std::set<std::string> func_targets;
       for (auto &BB : F) {
 
         std::string bb_name("");
@@ -365,32 +432,21 @@ std::size_t found = filename.find_last_of("/\\");
             bb_name = filename + ":" + std::to_string(line);
           }
 
-          if (!is_target) {
-              for (auto &target : targets) {
-                std::size_t found = target.find_last_of("/\\");
-                if (found != std::string::npos)
-                  target = target.substr(found + 1);
-
-                std::size_t pos = target.find_last_of(":");
-                std::string target_file = target.substr(0, pos);
-                unsigned int target_line = atoi(target.substr(pos + 1).c_str());
-                if (!target_file.compare(filename) && target_line == line) {
-                  is_target = true;}
-
-              }
-            }
+          if (targets.count(filename + ":" + std::to_string(line))) {
+            func_targets.insert(filename + ":" + std::to_string(line));
+          }
 
-            if (auto *c = dyn_cast<CallInst>(&I)) {
+          if (auto *c = dyn_cast<CallInst>(&I)) {
 
-              std::size_t found = filename.find_last_of("/\\");
-              if (found != std::string::npos)
-                filename = filename.substr(found + 1);
+            std::size_t found = filename.find_last_of("/\\");
+            if (found != std::string::npos)
+              filename = filename.substr(found + 1);
 
-              if (auto *CalledF = c->getCalledFunction()) {
-                if (!isBlacklisted(CalledF))
-                  bbcalls << bb_name << "," << CalledF->getName().str() << "\n";
-              }
+            if (auto *CalledF = c->getCalledFunction()) {
+              if (!isBlacklisted(CalledF))
+                bbcalls << bb_name << "," << CalledF->getName().str() << "\n";
             }
+          }
         }
 
         if (!bb_name.empty()) {
@@ -433,8 +489,10 @@ std::size_t found = filename.find_last_of("/\\");
           WriteGraph(cfgFile, &F, true);
         }
 
-        if (is_target)
+        if (!func_targets.empty())
           ftargets << F.getName().str() << "\n";
+        for (auto &t : func_targets)
+          ftargetmap << t << "," << F.getName().str() << "\n";
         fnames << F.getName().str() << "\n";
       }
     }
@@ -468,6 +526,54 @@ std::size_t found = filename.find_last_of("/\\");
     GlobalVariable *AFLPrevLoc = new GlobalVariable(
         M, Int32Ty, false, GlobalValue::ExternalLinkage, 0, "__afl_prev_loc",
         0, GlobalVariable::GeneralDynamicTLSModel, 0, false);
+
+    /* Several targets (-distances): the distances of a block to all targets
+       are a row of __ltl_distances, and the runtime selects the column in
+       __ltl_target. The table is only known once every block is seen, so
+       blocks address a placeholder replaced at the end. */
+
+    unsigned int num_targets = target_bb_to_dis.size();
+    std::vector<uint32_t> distance_rows;
+    GlobalVariable *LTLTarget = NULL, *LTLDistances = NULL;
+
+    if (num_targets) {
+
+      LTLTarget = new GlobalVariable(M, Int32Ty, false, GlobalValue::ExternalLinkage, 0, "__ltl_target");
+      LTLDistances = new GlobalVariable(M, Int32Ty, true, GlobalValue::PrivateLinkage,
+                                        ConstantInt::get(Int32Ty, 0), "__ltl_distances.placeholder");
+
+    }
+
+    /* The state variables are the same at every event site, they are only
+       selected once: from the functions with an event location, or the ones
+       named in -state-vars */
+
+    if (is_ltl_fuzzing) {
+
+      std::set<Function*> event_funcs;
+      for (auto &F : M) {
+        for (auto &BB : F) {
+          for (auto &I : BB) {
+            std::string filename;
+            unsigned line = 0;
+            instr::InstrFunc::getDebugLoc(&I, filename, line);
+            if (filename.empty() || line == 0)
+              continue;
+            std::size_t found = filename.find_last_of("/\\");
+            if (found != std::string::npos)
+              filename = filename.substr(found + 1);
+            std::string loc_name = filename + ":" + std::to_string(line);
+            if (loc_to_revt.count(loc_name) || loc_to_pevt.count(loc_name))
+              event_funcs.insert(&F);
+          }
+        }
+      }
+
+      if (!StateVarsFile.empty())
+        instr::InstrFunc::loadStateAllowlist(StateVarsFile);
+      instr::InstrFunc::storeGlobalVariables(M, event_funcs);
+
+    }
     
     for (auto &F : M) {
 
@@ -478,6 +584,7 @@ std::size_t found = filename.find_last_of("/\\");
       for (auto &BB : F) {
 
         distance = -1;
+        int distance_row = -1;
         std::string bb_name;
 
         if (is_aflgo) {
@@ -499,7 +606,7 @@ std::size_t found = filename.find_last_of("/\\");
 
           if (!bb_name.empty()) {
 
-            if (find(basic_blocks.begin(), basic_blocks.end(), bb_name) == basic_blocks.end()) {
+            if (!basic_blocks.count(bb_name)) {
 
               if (is_selective)
                 continue;
@@ -508,12 +615,25 @@ std::size_t found = filename.find_last_of("/\\");
 
               /* Find distance for BB */
 
-              if (AFL_R(100) < dinst_ratio) {
-                std::map<std::string,int>::iterator it;
-                for (it = bb_to_dis.begin(); it != bb_to_dis.end(); ++it)
-                  if (it->first.compare(bb_name) == 0)
-                    distance = it->second;
-
+              if (AFL_R(100) < dinst_ratio && !num_targets) {
+                auto it = bb_to_dis.find(bb_name);
+                if (it != bb_to_dis.end())
+                  distance = it->second;
+
+              } else if (num_targets) {
+                std::vector<uint32_t> row(num_targets, (uint32_t) -1);
+                bool known = false;
+                for (unsigned int t = 0; t < num_targets; t++) {
+                  auto it = target_bb_to_dis[t].find(bb_name);
+                  if (it != target_bb_to_dis[t].end()) {
+                    row[t] = it->second;
+                    known = true;
+                  }
+                }
+                if (known) {
+                  distance_row = distance_rows.size() / num_targets;
+                  distance_rows.insert(distance_rows.end(), row.begin(), row.end());
+                }
               }
             }
           }
@@ -522,6 +642,37 @@ std::size_t found = filename.find_last_of("/\\");
         if(is_ltl_fuzzing){
           bool is_traversed = false;
           for(auto &I : BB){
+
+            /** 
+              Persistent mode: every __AFL_LOOP() call ends an iteration,
+              instrument the function before it: void ltl_iteration(int flag) 
+            **/
+            if(CallInst *CI = dyn_cast<CallInst>(&I)){
+              Function *callee = CI->getCalledFunction();
+              if(callee && callee->getName() == "__afl_persistent_loop"){
+                instr::InstrFunc::instrIterationBoundary(M, I, is_RERS_fuzzing ? 0 : 1);
+              }
+
+              /**
+                Snapshot mode: the runtime reopens the files the subject read
+                up to the prefix, so it needs to see them opened
+              **/
+              if(callee && is_RERS_fuzzing &&
+                 (callee->getName() == "fopen" || callee->getName() == "fopen64")){
+                CI->setCalledFunction(M.getOrInsertFunction("ltl_fopen", callee->getFunctionType()));
+              }
+
+              /**
+                Protocols: the runtime tells afl-fuzz when the server waits
+                for a client or a request, through its socket calls
+              **/
+              if(callee && !is_RERS_fuzzing){
+                StringRef name = callee->getName();
+                if(name == "accept" || name == "accept4" || name == "recv" || name == "recvfrom" || name == "read"){
+                  CI->setCalledFunction(M.getOrInsertFunction(("ltl_" + name).str(), callee->getFunctionType()));
+                }
+              }
+            }
             
             std::string filename;
             unsigned line;
@@ -539,7 +690,8 @@ std::size_t found = filename.find_last_of("/\\");
             //errs() << "loc_name: " << loc_name << "\n";
             if(is_RERS_fuzzing){
               instr::InstrFunc::storeLocalVariables(M, I);
-              if(loc_to_revt.find(loc_name) != loc_to_revt.end()){
+              auto revt = loc_to_revt.find(loc_name);
+              if(revt != loc_to_revt.end()){
 
                 if(!is_traversed){
                   /**
@@ -551,13 +703,7 @@ std::size_t found = filename.find_last_of("/\\");
                     break;
                   }
 
-                  int output_val;
-                  if(loc_to_revt.find(loc_name) != loc_to_revt.end()){
-                    output_val = loc_to_revt[loc_name];
-                  }
-                  else{
-                    output_val = 0;
-                  }
+                  int output_val = revt->second;
                   Value *output = ConstantInt::get(Type::getInt32Ty(M.getContext()), output_val);
                   instr::InstrFunc::instrAutomataHandler(M, F, I, input, output);
                   
@@ -565,7 +711,6 @@ std::size_t found = filename.find_last_of("/\\");
                     Instrument the function: void state_handler(int *global_vec, int *global_size_vec, 
                     int gsize, int *local_value_vec, int lsize) 
                   **/
-                  instr::InstrFunc::storeGlobalVariables(M);
                   //instr::InstrFunc::printGlobalVariables(loc_name);
                   //instr::InstrFunc::printLocalVariables(loc_name);
                   //Value *ret = instr::InstrFunc::instrBeginTime(M, I);
@@ -578,8 +723,9 @@ std::size_t found = filename.find_last_of("/\\");
             }
             else{
               instr::InstrFunc::storeLocalVariables(M, I);
-              if(loc_to_pevt.find(loc_name) != loc_to_pevt.end()){
-                std::string evt = loc_to_pevt[loc_name];
+              auto pevt = loc_to_pevt.find(loc_name);
+              if(pevt != loc_to_pevt.end()){
+                const std::string &evt = pevt->second;
                 if(!is_traversed){
 
                   /** 
@@ -591,7 +737,6 @@ std::size_t found = filename.find_last_of("/\\");
                     Instrument the function: void state_handler(int *global_vec, int *global_size_vec, 
                     int gsize, int *local_value_vec, int lsize) 
                   **/
-                  instr::InstrFunc::storeGlobalVariables(M);
                   instr::InstrFunc::printGlobalVariables(loc_name);
                   instr::InstrFunc::printLocalVariables(loc_name);
                   instr::InstrFunc::instrStateHandler(M, I);
@@ -658,23 +803,46 @@ std::size_t found = filename.find_last_of("/\\");
             IRB.CreateStore(ConstantInt::get(Int32Ty, cur_loc >> 1), AFLPrevLoc);
         Store->setMetadata(M.getMDKindID("nosanitize"), MDNode::get(C, None));
 
+        Value *Distance = NULL, *Count = One;
+
         if (distance >= 0) {
-          Value *bbnameVal_test = IRB.CreateGlobalStringPtr(bb_name);
-          Type *Args_test[] = {
-                 Type::getInt8PtrTy(M.getContext()) //uint8_t* bb_name
-          };
 
-          FunctionType *FTy_test = FunctionType::get(Type::getInt32Ty(M.getContext()), Args_test, false);
-          auto distance_ref = M.getOrInsertFunction("get_distance_to_target", FTy_test);
-          Value *ret = IRB.CreateCall(distance_ref, {bbnameVal_test});
+          /* The distance is known at compile time: add it as an immediate */
+
+          Distance = ConstantInt::get(LargestType, (unsigned) distance);
+
+        } else if (distance_row >= 0) {
+
+          /* Load the distance to the selected target, which may be unknown
+             (-1) for this block: then neither distance nor count change */
+
+          LoadInst *Target = IRB.CreateLoad(LTLTarget);
+          Target->setMetadata(M.getMDKindID("nosanitize"), MDNode::get(C, None));
+          Value *Column = IRB.CreateSelect(
+              IRB.CreateICmpULT(Target, ConstantInt::get(Int32Ty, num_targets)),
+              Target, ConstantInt::get(Int32Ty, 0));
+          Value *Entry = IRB.CreateGEP(LTLDistances,
+              IRB.CreateAdd(Column, ConstantInt::get(Int32Ty, distance_row * num_targets)));
+          LoadInst *TargetDist = IRB.CreateLoad(Entry);
+          TargetDist->setMetadata(M.getMDKindID("nosanitize"), MDNode::get(C, None));
+
+          Value *Known = IRB.CreateICmpSGE(TargetDist, ConstantInt::get(Int32Ty, 0));
+          Distance = IRB.CreateSelect(Known, IRB.CreateZExt(TargetDist, LargestType),
+                                      ConstantInt::get(LargestType, 0));
+          Count = IRB.CreateZExt(Known, LargestType);
+
+        }
+
+        if (Distance) {
+
+          /* Add distance to shm[MAPSIZE] */
 
           Value *MapDistPtr = IRB.CreateBitCast(
               IRB.CreateGEP(MapPtr, MapDistLoc), LargestType->getPointerTo());
           LoadInst *MapDist = IRB.CreateLoad(MapDistPtr);
           MapDist->setMetadata(M.getMDKindID("nosanitize"), MDNode::get(C, None));
 
-          Value *castInst = IRB.CreateCast(Instruction::CastOps::ZExt, ret, LargestType);
-          Value *IncrDist = IRB.CreateAdd(MapDist, castInst);
+          Value *IncrDist = IRB.CreateAdd(MapDist, Distance);
           IRB.CreateStore(IncrDist, MapDistPtr)
               ->setMetadata(M.getMDKindID("nosanitize"), MDNode::get(C, None));
 
@@ -685,7 +853,7 @@ std::size_t found = filename.find_last_of("/\\");
           LoadInst *MapCnt = IRB.CreateLoad(MapCntPtr);
           MapCnt->setMetadata(M.getMDKindID("nosanitize"), MDNode::get(C, None));
 
-          Value *IncrCnt = IRB.CreateAdd(MapCnt, One);
+          Value *IncrCnt = IRB.CreateAdd(MapCnt, Count);
           IRB.CreateStore(IncrCnt, MapCntPtr)
               ->setMetadata(M.getMDKindID("nosanitize"), MDNode::get(C, None));
 
@@ -695,6 +863,18 @@ std::size_t found = filename.find_last_of("/\\");
 
       }
     }
+
+    if (num_targets) {
+
+      if (distance_rows.empty()) distance_rows.assign(num_targets, (uint32_t) -1);
+
+      GlobalVariable *Table = new GlobalVariable(
+          M, ArrayType::get(Int32Ty, distance_rows.size()), true, GlobalValue::PrivateLinkage,
+          ConstantDataArray::get(C, distance_rows), "__ltl_distances");
+      LTLDistances->replaceAllUsesWith(ConstantExpr::getBitCast(Table, Int32Ty->getPointerTo()));
+      LTLDistances->eraseFromParent();
+
+    }
   }
 
   /* Say something nice. */
@@ -21,6 +21,7 @@
 
 #include "../config.h"
 #include "../types.h"
+#include "../../include/shmdata.h"
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -65,17 +66,39 @@ static const unsigned int prime_2 = 5009;
    is used for instrumentation output before __afl_map_shm() has a chance to run.
    It will end up as .comm, so it shouldn't be too wasteful. */
 
-u8  __afl_area_initial[MAP_SIZE + 16];
+u8  __afl_area_initial[LTL_AFL_SHM_SIZE] __attribute__((aligned(64)));
 u8* __afl_area_ptr = __afl_area_initial;
 
 __thread u32 __afl_prev_loc;
 
 
+/* Subjects instrumented with -distances for several targets report the
+   distance to __ltl_target, which every child takes from the prefix channel
+   of its afl-fuzz instance. */
+
+u32 __ltl_target;
+static PREFIX_SMEM* ltl_prefix_shm;
+
+static void __ltl_select_target(void) {
+
+  if (ltl_prefix_shm) __ltl_target = prefix_target(ltl_prefix_shm);
+
+}
+
+
 /* Running in persistent mode? */
 
 static u8 is_persistent;
 
 
+/* Snapshot mode: waiting for the subject to consume the prefix, and whether
+   the children exec the subject anew because it never stopped right after
+   the prefix. */
+
+static u8 snapshot_pending, exec_children;
+static char** saved_argv;
+
+
 /* SHM setup. */
 
 static void __afl_map_shm(void) {
@@ -103,12 +126,23 @@ static void __afl_map_shm(void) {
 
   }
 
+  id_str = getenv(PREFIX_SHM_ENV_VAR);
+
+  if (id_str) {
+
+    void* shm = shmat(atoi(id_str), NULL, SHM_RDONLY);
+    if (shm != (void *)-1) ltl_prefix_shm = shm;
+
+  }
+
+  __ltl_select_target();
+
 }
 
 
 /* Fork server logic. */
 
-static void __afl_start_forkserver(void) {
+static u8 __afl_start_forkserver(void) {
 
   static u8 tmp[4];
   s32 child_pid;
@@ -118,7 +152,7 @@ static void __afl_start_forkserver(void) {
   /* Phone home and tell the parent that we're OK. If parent isn't there,
      assume we're not running in forkserver mode and just execute program. */
 
-  if (write(FORKSRV_FD + 1, tmp, 4) != 4) return;
+  if (write(FORKSRV_FD + 1, tmp, 4) != 4) return 0;
 
   while (1) {
 
@@ -151,7 +185,16 @@ static void __afl_start_forkserver(void) {
 
         close(FORKSRV_FD);
         close(FORKSRV_FD + 1);
-        return;
+
+        __ltl_select_target();
+
+        if (exec_children) {
+          unsetenv(SNAPSHOT_ENV_VAR);
+          execv("/proc/self/exe", saved_argv);
+          _exit(1);
+        }
+
+        return 1;
   
       }
 
@@ -203,7 +246,7 @@ int __afl_persistent_loop(unsigned int max_cnt) {
 
     if (is_persistent) {
 
-      memset(__afl_area_ptr, 0, MAP_SIZE + 16);
+      memset(__afl_area_ptr, 0, MAP_SIZE + 16 + AUTOMATA_SHM_SIZE);
       __afl_area_ptr[0] = 1;
       __afl_prev_loc = 0;
     }
@@ -242,6 +285,13 @@ int __afl_persistent_loop(unsigned int max_cnt) {
 }
 
 
+/* Optional hook of the LTL-Fuzzer runtime. It reads the per-subject
+   configuration once, before the fork server starts, so that every child
+   inherits it instead of loading it again. */
+
+void __ltl_preload(void) __attribute__((weak));
+
+
 /* This one can be called from user code when deferred forkserver mode
     is enabled. */
 
@@ -252,6 +302,7 @@ void __afl_manual_init(void) {
   if (!init_done) {
 
     __afl_map_shm();
+    if (__ltl_preload) __ltl_preload();
     __afl_start_forkserver();
     init_done = 1;
 
@@ -260,11 +311,53 @@ void __afl_manual_init(void) {
 }
 
 
+/* Snapshot mode (LTL_SNAPSHOT with a PREFIX_LENGTH from afl-fuzz): the fork
+   server is not started before main, but when the LTL-Fuzzer runtime calls
+   __afl_snapshot() at the input boundary right after the prefix. Every child
+   then starts from the state the prefix left and only runs the suffix.
+   Returns 1 in the children, 0 if no fork server is listening. */
+
+int __afl_snapshot(void) {
+
+  if (!snapshot_pending) return 0;
+  snapshot_pending = 0;
+
+  return __afl_start_forkserver();
+
+}
+
+
+/* The subject read past the prefix without stopping at its end, or ended
+   before it: fall back to children that each run the whole subject. */
+
+void __afl_snapshot_missed(void) {
+
+  if (!snapshot_pending) return;
+  snapshot_pending = 0;
+
+  exec_children = 1;
+  __afl_start_forkserver();
+
+}
+
+
 /* Proper initialization routine. */
 
-__attribute__((constructor(CONST_PRIO))) void __afl_auto_init(void) {
+__attribute__((constructor(CONST_PRIO))) void __afl_auto_init(int argc, char** argv) {
+
+  u8* prefix_len = getenv("PREFIX_LENGTH");
 
   is_persistent = !!getenv(PERSIST_ENV_VAR);
+  saved_argv = argv;
+
+  if (getenv(SNAPSHOT_ENV_VAR) && prefix_len && atoi(prefix_len) > 0) {
+
+    __afl_map_shm();
+    if (__ltl_preload) __ltl_preload();
+    snapshot_pending = 1;
+    return;
+
+  }
 
   if (getenv(DEFER_ENV_VAR)) return;
 
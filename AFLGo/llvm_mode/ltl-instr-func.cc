@@ -1,11 +1,17 @@
 #include "ltl-instr-func.h"
 
+#include <fstream>
+#include <map>
+
 std::vector<Value*> instr::InstrFunc::gbptr_vec;     // store global variable pointers 
 std::vector<Value*> instr::InstrFunc::gbsize_vec;    // store global variable size
 std::vector<Value*> instr::InstrFunc::lcptr_vec;     // store local variable pointers
 std::vector<Value*> instr::InstrFunc::lcsize_vec;    // store local variable size
 std::vector<std::string> instr::InstrFunc::gbname_vec;    // store global variable names
 std::vector<std::string> instr::InstrFunc::lcname_vec;    // store local varibale names
+std::set<std::string> instr::InstrFunc::state_allowlist;
+GlobalVariable* instr::InstrFunc::gbptr_table;
+GlobalVariable* instr::InstrFunc::gbsize_table;
 
 IntegerType* instr::InstrFunc::i32;
 IntegerType* instr::InstrFunc::i64;
@@ -56,25 +62,151 @@ void instr::InstrFunc::initTypes(Module &M){
     i8_ptr  = llvm::IntegerType::getInt8PtrTy(M.getContext());
 }
 
-void instr::InstrFunc::storeGlobalVariables(Module &M){
+void instr::InstrFunc::loadStateAllowlist(const std::string &path){
+    /**
+        One variable name per line: only those are part of the state
+    **/
+    std::ifstream names(path);
+    std::string name;
+    while(std::getline(names, name)){
+        if(!name.empty()){
+            state_allowlist.insert(name);
+        }
+    }
+}
+
+void instr::InstrFunc::accessesOf(Value *V, const std::set<Function*> &readers, bool &read, bool &written){
+    /**
+        Whether the memory at V is loaded in one of readers, and stored to
+        anywhere; an address that escapes counts as both
+    **/
+    for(User *U : V->users()){
+        if(LoadInst *LI = dyn_cast<LoadInst>(U)){
+            if(readers.count(LI->getFunction())){
+                read = true;
+            }
+        }
+        else if(StoreInst *SI = dyn_cast<StoreInst>(U)){
+            if(SI->getPointerOperand() == V){
+                written = true;
+            }
+            else{
+                read = written = true;
+            }
+        }
+        else if(isa<GEPOperator>(U) || isa<BitCastOperator>(U)){
+            accessesOf(U, readers, read, written);
+        }
+        else{
+            read = written = true;
+        }
+        if(read && written){
+            return;
+        }
+    }
+}
+
+void instr::InstrFunc::storeGlobalVariables(Module &M, const std::set<Function*> &event_funcs){
     /** 
-        Get global variables 
+        Get global variables: those read on the way to an event, in the
+        event functions, their callers and everything they call, and written
+        somewhere; the others cannot tell two states at an event apart
     **/
     gbptr_vec.clear();
     gbsize_vec.clear();
+    gbname_vec.clear();
+
+    std::map<Function*, std::set<Function*>> callers, callees;
+    bool indirect = false;
+    for(auto &F : M){
+        for(auto &BB : F){
+            for(auto &I : BB){
+                if(CallInst *CI = dyn_cast<CallInst>(&I)){
+                    Function *callee = CI->getCalledFunction();
+                    if(callee == nullptr && !CI->isInlineAsm()){
+                        indirect = true;
+                    }
+                    else if(callee != nullptr){
+                        callers[callee].insert(&F);
+                        callees[&F].insert(callee);
+                    }
+                }
+            }
+        }
+    }
+
+    std::set<Function*> readers;
+    if(indirect){
+        for(auto &F : M){
+            readers.insert(&F);
+        }
+    }
+    else{
+        std::vector<Function*> work(event_funcs.begin(), event_funcs.end());
+        std::set<Function*> up(event_funcs.begin(), event_funcs.end());
+        while(!work.empty()){
+            Function *F = work.back();
+            work.pop_back();
+            for(Function *caller : callers[F]){
+                if(up.insert(caller).second){
+                    work.push_back(caller);
+                }
+            }
+        }
+        work.assign(up.begin(), up.end());
+        readers = up;
+        while(!work.empty()){
+            Function *F = work.back();
+            work.pop_back();
+            for(Function *callee : callees[F]){
+                if(readers.insert(callee).second){
+                    work.push_back(callee);
+                }
+            }
+        }
+    }
 
+    const DataLayout &DL = M.getDataLayout();
+    std::vector<Constant*> ptrs, sizes;
     for(auto gv_iter = M.global_begin();gv_iter != M.global_end(); gv_iter++){
         GlobalVariable *gv = &*gv_iter;
         std::string gName = (gv->getName()).str();
         //errs() << "gbname: " << gName << "\n";
-        if(!gName.empty() && gName != "__afl_area_ptr" && gName != "__afl_prev_loc" && gName.find(".str") == std::string::npos &&  gName.find("std") == std::string::npos){
-            int gsize = gv->getAlignment();
-            Value *ssize = ConstantInt::get(Type::getInt32Ty(M.getContext()), gsize);
-            gbptr_vec.push_back(&*gv_iter);
-            gbsize_vec.push_back(ssize);
-            gbname_vec.push_back(gName);
+        if(gName.empty() || gv->isDeclaration() || gv->isConstant() ||
+           gName.compare(0, 6, "__afl_") == 0 || gName.compare(0, 6, "__ltl_") == 0 ||
+           gName.find(".str") != std::string::npos || gName.find("std") != std::string::npos){
+            continue;
+        }
+        if(!state_allowlist.empty()){
+            if(!state_allowlist.count(gName)){
+                continue;
+            }
+        }
+        else{
+            bool read = false, written = false;
+            accessesOf(gv, readers, read, written);
+            if(!read || !written){
+                continue;
+            }
         }
+        int gsize = DL.getTypeAllocSize(gv->getValueType());
+        Constant *ssize = ConstantInt::get(i32, gsize);
+        gbptr_vec.push_back(gv);
+        gbsize_vec.push_back(ssize);
+        gbname_vec.push_back(gName);
+        ptrs.push_back(ConstantExpr::getPtrToInt(gv, i64));
+        sizes.push_back(ssize);
     }
+
+    /**
+        Sites without local variables pass these directly
+    **/
+    ArrayType *ptrsType = ArrayType::get(i64, ptrs.size());
+    ArrayType *sizesType = ArrayType::get(i32, sizes.size());
+    gbptr_table = new GlobalVariable(M, ptrsType, true, GlobalValue::PrivateLinkage,
+                                     ConstantArray::get(ptrsType, ptrs), "__ltl_state_ptrs");
+    gbsize_table = new GlobalVariable(M, sizesType, true, GlobalValue::PrivateLinkage,
+                                      ConstantArray::get(sizesType, sizes), "__ltl_state_sizes");
 }
 
 void instr::InstrFunc::storeLocalVariables(Module &M, Instruction &I){
@@ -82,12 +214,24 @@ void instr::InstrFunc::storeLocalVariables(Module &M, Instruction &I){
         Get local variables 
     **/
     if ( DbgDeclareInst *dbg = dyn_cast<DbgDeclareInst>(&I)){
-        if (AllocaInst *sinst = dyn_cast<AllocaInst>(dbg->getAddress())){  // find alloca instructions
+        if (AllocaInst *sinst = dyn_cast_or_null<AllocaInst>(dbg->getAddress())){  // find alloca instructions
             
             DILocalVariable *DILocVar = dbg->getVariable();
-            int lsize = sinst->getAlignment();
-            Value *ssize = ConstantInt::get(Type::getInt32Ty(M.getContext()), lsize);
             std::string lcname = (DILocVar->getName()).str();
+            if(!state_allowlist.empty()){
+                if(!state_allowlist.count(lcname)){
+                    return;
+                }
+            }
+            else{
+                bool read = false, written = false;
+                accessesOf(sinst, {sinst->getFunction()}, read, written);
+                if(!read || !written){
+                    return;
+                }
+            }
+            int lsize = M.getDataLayout().getTypeAllocSize(sinst->getAllocatedType());
+            Value *ssize = ConstantInt::get(Type::getInt32Ty(M.getContext()), lsize);
             
             lcptr_vec.push_back(&*sinst); 
             lcsize_vec.push_back(ssize);  
@@ -113,19 +257,30 @@ void instr::InstrFunc::instrStateHandler(Module &M, Instruction &I){
     size_t lc_size = lcsize_vec.size();
     size_t size = gb_size + lc_size;
 
-    Type* arrayType64 = ArrayType::get(i64, size); 
-    Type* arrayType32 = ArrayType::get(i32, size); 
-    Value* ptr_arr = IRB.CreateAlloca(arrayType64);
-    Value* size_arr = IRB.CreateAlloca(arrayType32);
-
-    for(size_t i = 0; i < gb_size; i++){
-        IRB.CreateStore(gbptr_vec[i], IRB.CreateConstGEP2_64(ptr_arr, 0, i));
-        IRB.CreateStore(gbsize_vec[i], IRB.CreateConstGEP2_32(arrayType32, size_arr, 0, i));
+    Value* ptr_arr;
+    Value* size_arr;
+    if(lc_size == 0){
+        ptr_arr = IRB.CreateConstGEP2_64(gbptr_table->getValueType(), gbptr_table, 0, 0);
+        size_arr = IRB.CreateConstGEP2_32(gbsize_table->getValueType(), gbsize_table, 0, 0);
     }
+    else{
+        Type* arrayType64 = ArrayType::get(i64, size); 
+        Type* arrayType32 = ArrayType::get(i32, size); 
+        Value* ptr_alloca = IRB.CreateAlloca(arrayType64);
+        Value* size_alloca = IRB.CreateAlloca(arrayType32);
+
+        for(size_t i = 0; i < gb_size; i++){
+            IRB.CreateStore(IRB.CreatePtrToInt(gbptr_vec[i], i64), IRB.CreateConstGEP2_64(arrayType64, ptr_alloca, 0, i));
+            IRB.CreateStore(gbsize_vec[i], IRB.CreateConstGEP2_32(arrayType32, size_alloca, 0, i));
+        }
 
-    for(size_t i = 0; i < lc_size; i++){
-        IRB.CreateStore(lcptr_vec[i], IRB.CreateConstGEP2_64(ptr_arr, 0, i + gb_size));
-        IRB.CreateStore(lcsize_vec[i], IRB.CreateConstGEP2_32(arrayType32, size_arr, 0, i + gb_size));
+        for(size_t i = 0; i < lc_size; i++){
+            IRB.CreateStore(IRB.CreatePtrToInt(lcptr_vec[i], i64), IRB.CreateConstGEP2_64(arrayType64, ptr_alloca, 0, i + gb_size));
+            IRB.CreateStore(lcsize_vec[i], IRB.CreateConstGEP2_32(arrayType32, size_alloca, 0, i + gb_size));
+        }
+
+        ptr_arr = IRB.CreateConstGEP2_64(arrayType64, ptr_alloca, 0, 0);
+        size_arr = IRB.CreateConstGEP2_32(arrayType32, size_alloca, 0, 0);
     }
 
     Value *ssize = ConstantInt::get(Type::getInt32Ty(M.getContext()), size);
@@ -173,6 +328,23 @@ void instr::InstrFunc::instrEvaluateTrace(Module &M, Instruction &I,  int flag){
     IRB.CreateCall(func_eva, func_args_eva);
 }
 
+void instr::InstrFunc::instrIterationBoundary(Module &M, Instruction &I,  int flag){
+    /** 
+        Instrument the function: void ltl_iteration(int flag) 
+    **/
+    IRBuilder<> IRB(&(I)); 
+
+    std::vector<Type*> args_itr;
+    args_itr.push_back(i32);
+    FunctionType *type_itr = FunctionType::get(Type::getVoidTy(M.getContext()), args_itr, false);
+    auto func_itr = (M.getOrInsertFunction("ltl_iteration", type_itr));
+
+    Value *fval = ConstantInt::get(Type::getInt32Ty(M.getContext()), flag);
+    std::vector<Value*> func_args_itr;
+    func_args_itr.push_back(fval);
+    IRB.CreateCall(func_itr, func_args_itr);
+}
+
 void instr::InstrFunc::clearLocalVariables(){
     /** 
         Clear local containers when switching to differnet functions 
@@ -4,6 +4,7 @@
 #include <string.h>
 #include <sstream>
 #include <list>
+#include <set>
 #include <vector>
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -34,7 +35,8 @@ using namespace llvm;
 namespace instr{
     class InstrFunc{
         public:
-            static void storeGlobalVariables(Module &M);
+            static void loadStateAllowlist(const std::string &path);
+            static void storeGlobalVariables(Module &M, const std::set<Function*> &event_funcs);
             static void storeLocalVariables(Module &M, Instruction &I);
             static void clearLocalVariables();
             static void printLocalVariables(std::string loc_name);
@@ -43,6 +45,7 @@ namespace instr{
             static void initTypes(Module &M);
             static void instrStateHandler(Module &M, Instruction &I);
             static void instrEvaluateTrace(Module &M, Instruction &I, int flag); 
+            static void instrIterationBoundary(Module &M, Instruction &I, int flag);
 
             static void instrAutomataHandler(Module &M, Function &F, Instruction &I, Value* input, Value* output);
 
@@ -54,6 +57,7 @@ namespace instr{
             static void instrEndTime(Module &M, Instruction &I, Value* bval);
 
         private:
+            static void accessesOf(Value *V, const std::set<Function*> &readers, bool &read, bool &written);
 
             static IntegerType* i32;
             static IntegerType* i64;
@@ -67,6 +71,9 @@ namespace instr{
             static std::vector<Value*> lcsize_vec;    // store local variable size
             static std::vector<std::string> gbname_vec; // store global variable names
             static std::vector<std::string> lcname_vec; // store local varibale names
+            static std::set<std::string> state_allowlist; // -state-vars, empty for all relevant ones
+            static GlobalVariable* gbptr_table;       // constant tables of the global variables
+            static GlobalVariable* gbsize_table;
             
     };
 }
@@ -1,3 +1,5 @@
+#define _GNU_SOURCE /* sendmmsg() */
+
 #include <ctype.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -11,78 +13,166 @@
 #include "alloc-inl.h"
 #include "protocol.h"
 
-// Protocol-specific functions for extracting requests and responses
+// Delimiter scanning shared by the extractors: the SIMD kernels find the
+// "\r\n" pairs of a buffer a vector at a time, with a scalar fallback
 
-region_t* extract_requests_smtp(unsigned char* buf, unsigned int buf_size, unsigned int* region_count_ref)
-{
-   char *mem;
-  unsigned int byte_count = 0;
-  unsigned int mem_count = 0;
-  unsigned int mem_size = 1024;
-  unsigned int region_count = 0;
-  region_t *regions = NULL;
-  char terminator[2] = {0x0D, 0x0A};
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define SCAN_WIDTH 32
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define SCAN_WIDTH 16
+#endif
 
-  mem=(char *)ck_alloc(mem_size);
+#ifdef SCAN_WIDTH
+// Bit i is set if p[i - 1] and p[i] are "\r\n"
+static inline u32 crlf_mask(const unsigned char* p)
+{
+#if defined(__AVX2__)
+  __m256i cur = _mm256_loadu_si256((const __m256i *)p);
+  __m256i prev = _mm256_loadu_si256((const __m256i *)(p - 1));
+  return (u32)_mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(prev, _mm256_set1_epi8(0x0D)),
+                                                    _mm256_cmpeq_epi8(cur, _mm256_set1_epi8(0x0A))));
+#else
+  __m128i cur = _mm_loadu_si128((const __m128i *)p);
+  __m128i prev = _mm_loadu_si128((const __m128i *)(p - 1));
+  return (u32)_mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(prev, _mm_set1_epi8(0x0D)),
+                                              _mm_cmpeq_epi8(cur, _mm_set1_epi8(0x0A))));
+#endif
+}
+#endif
 
-  unsigned int cur_start = 0;
-  unsigned int cur_end = 0;
-  while (byte_count < buf_size) {
+// The first p >= from (from > 0) with buf[p - 1], buf[p] = "\r\n", buf_size if none
+static unsigned int next_crlf(const unsigned char* buf, unsigned int from, unsigned int buf_size)
+{
+  unsigned int p = from;
+#ifdef SCAN_WIDTH
+  while (p + SCAN_WIDTH <= buf_size) {
+    u32 mask = crlf_mask(buf + p);
+    if (mask) return p + __builtin_ctz(mask);
+    p += SCAN_WIDTH;
+  }
+#endif
+  for (; p < buf_size; p++)
+    if (buf[p - 1] == 0x0D && buf[p] == 0x0A) return p;
+  return buf_size;
+}
 
-    memcpy(&mem[mem_count], buf + byte_count++, 1);
+static unsigned int count_crlf(const unsigned char* buf, unsigned int buf_size)
+{
+  unsigned int p = 1, count = 0;
+#ifdef SCAN_WIDTH
+  while (p + SCAN_WIDTH <= buf_size) {
+    count += __builtin_popcount(crlf_mask(buf + p));
+    p += SCAN_WIDTH;
+  }
+#endif
+  for (; p < buf_size; p++)
+    if (buf[p - 1] == 0x0D && buf[p] == 0x0A) count++;
+  return count;
+}
 
-    //Check if the last two bytes are 0x0D0A
-    if ((mem_count > 1) && (memcmp(&mem[mem_count - 1], terminator, 2) == 0)) {
-      region_count++;
-      regions = (region_t *)ck_realloc(regions, region_count * sizeof(region_t));
-      regions[region_count - 1].start_byte = cur_start;
-      regions[region_count - 1].end_byte = cur_end;
-      regions[region_count - 1].state_sequence = NULL;
-      regions[region_count - 1].state_count = 0;
+// Appending to region and state arrays, which grow geometrically
+static region_t* add_region(region_t* regions, unsigned int* region_count, unsigned int* region_cap,
+                            unsigned int start, unsigned int end)
+{
+  if (*region_count == *region_cap) {
+    *region_cap = *region_cap ? *region_cap * 2 : 16;
+    regions = (region_t *)ck_realloc(regions, *region_cap * sizeof(region_t));
+  }
+  regions[*region_count].start_byte = start;
+  regions[*region_count].end_byte = end;
+  regions[*region_count].modifiable = 0;
+  regions[*region_count].state_sequence = NULL;
+  regions[*region_count].state_count = 0;
+  (*region_count)++;
+  return regions;
+}
 
-      mem_count = 0;
-      cur_start = cur_end + 1;
-      cur_end = cur_start;
-    } else {
-      mem_count++;
-      cur_end++;
+static unsigned int* add_state(unsigned int* state_sequence, unsigned int* state_count, unsigned int* state_cap,
+                               unsigned int state)
+{
+  if (*state_count == *state_cap) {
+    *state_cap = *state_cap ? *state_cap * 2 : 16;
+    state_sequence = (unsigned int *)ck_realloc(state_sequence, *state_cap * sizeof(unsigned int));
+  }
+  state_sequence[(*state_count)++] = state;
+  return state_sequence;
+}
 
-      //Check if the last byte has been reached
-      if (cur_end == buf_size - 1) {
-        region_count++;
-        regions = (region_t *)ck_realloc(regions, region_count * sizeof(region_t));
-        regions[region_count - 1].start_byte = cur_start;
-        regions[region_count - 1].end_byte = cur_end;
-        regions[region_count - 1].state_sequence = NULL;
-        regions[region_count - 1].state_count = 0;
-        break;
-      }
+// Requests ending with one ("\r\n") or two ("\r\n\r\n") line ends. A region
+// ends at a terminator once it has more bytes than the terminator; the last
+// region ends with the buffer, unless only its last byte is left.
+static region_t* extract_requests_crlf(unsigned char* buf, unsigned int buf_size, unsigned int crlfs,
+                                       unsigned int* region_count_ref)
+{
+  unsigned int terminator_size = 2 * crlfs;
+  unsigned int region_count = 0;
+  unsigned int region_cap = buf_size ? count_crlf(buf, buf_size) + 1 : 0;
+  region_t *regions = (region_t *)ck_alloc(region_cap * sizeof(region_t));
 
-      if (mem_count == mem_size) {
-        //enlarge the mem buffer
-        mem_size = mem_size * 2;
-        mem=(char *)ck_realloc(mem, mem_size);
-      }
+  unsigned int cur_start = 0;
+  unsigned int p = 1;
+  while (buf_size >= 2 && (p = next_crlf(buf, p, buf_size - 1)) < buf_size - 1) {
+    if (p - cur_start >= terminator_size &&
+        (crlfs == 1 || (buf[p - 3] == 0x0D && buf[p - 2] == 0x0A))) {
+      regions = add_region(regions, &region_count, &region_cap, cur_start, p);
+      cur_start = p + 1;
     }
+    p++;
   }
-  if (mem) ck_free(mem);
+  if (buf_size >= 2 && cur_start <= buf_size - 2)
+    regions = add_region(regions, &region_count, &region_cap, cur_start, buf_size - 1);
 
   //in case region_count equals zero, it means that the structure of the buffer is broken
   //hence we create one region for the whole buffer
-  if ((region_count == 0) && (buf_size > 0)) {
-    regions = (region_t *)ck_realloc(regions, sizeof(region_t));
-    regions[0].start_byte = 0;
-    regions[0].end_byte = buf_size - 1;
-    regions[0].state_sequence = NULL;
-    regions[0].state_count = 0;
-
-    region_count = 1;
-  }
+  if ((region_count == 0) && (buf_size > 0))
+    regions = add_region(regions, &region_count, &region_cap, 0, buf_size - 1);
 
   *region_count_ref = region_count;
   return regions;
 }
 
+// Response codes of "\r\n"-terminated lines: the number in the 3 bytes at
+// code_offset of every line, or of the lines starting with prefix; the
+// first 0 ends the sequence, which always starts with state 0
+static unsigned int* extract_response_codes_crlf(unsigned char* buf, unsigned int buf_size, const char* prefix,
+                                                 unsigned int code_offset, unsigned int* state_count_ref)
+{
+  unsigned int prefix_size = prefix ? strlen(prefix) : 0;
+  unsigned int state_count = 0;
+  unsigned int state_cap = count_crlf(buf, buf_size) + 1;
+  unsigned int *state_sequence = (unsigned int *)ck_alloc(state_cap * sizeof(unsigned int));
+
+  state_sequence = add_state(state_sequence, &state_count, &state_cap, 0);
+
+  unsigned int line_start = 0;
+  unsigned int p;
+  while ((p = next_crlf(buf, line_start + 1, buf_size)) < buf_size) {
+    unsigned int line_size = p - line_start + 1;
+    if (prefix_size == 0 || (line_size > prefix_size && memcmp(buf + line_start, prefix, prefix_size) == 0)) {
+      char temp[4] = {0};
+      for (unsigned int k = 0; k < 3 && code_offset + k < line_size; k++)
+        temp[k] = buf[line_start + code_offset + k];
+      unsigned int message_code = (unsigned int) atoi(temp);
+
+      if (message_code == 0) break;
+
+      state_sequence = add_state(state_sequence, &state_count, &state_cap, message_code);
+    }
+    line_start = p + 1;
+  }
+  *state_count_ref = state_count;
+  return state_sequence;
+}
+
+// Protocol-specific functions for extracting requests and responses
+
+region_t* extract_requests_smtp(unsigned char* buf, unsigned int buf_size, unsigned int* region_count_ref)
+{
+  return extract_requests_crlf(buf, buf_size, 1, region_count_ref);
+}
+
 region_t* extract_requests_ssh(unsigned char* buf, unsigned int buf_size, unsigned int* region_count_ref)
 {
   char *mem;
@@ -90,6 +180,7 @@ region_t* extract_requests_ssh(unsigned char* buf, unsigned int buf_size, unsign
   unsigned int mem_count = 0;
   unsigned int mem_size = 1024;
   unsigned int region_count = 0;
+  unsigned int region_cap = 0;
   region_t *regions = NULL;
   char terminator[2] = {0x0D, 0x0A};
 
@@ -119,12 +210,7 @@ region_t* extract_requests_ssh(unsigned char* buf, unsigned int buf_size, unsign
         }
 
         //Create one region
-        region_count++;
-        regions = (region_t *)ck_realloc(regions, region_count * sizeof(region_t));
-        regions[region_count - 1].start_byte = cur_start;
-        regions[region_count - 1].end_byte = cur_end;
-        regions[region_count - 1].state_sequence = NULL;
-        regions[region_count - 1].state_count = 0;
+        regions = add_region(regions, &region_count, &region_cap, cur_start, cur_end);
 
         //Check if the last byte has been reached
         if (cur_end < buf_size - 1) {
@@ -159,12 +245,7 @@ region_t* extract_requests_ssh(unsigned char* buf, unsigned int buf_size, unsign
         }
 
         //Create one region
-        region_count++;
-        regions = (region_t *)ck_realloc(regions, region_count * sizeof(region_t));
-        regions[region_count - 1].start_byte = cur_start;
-        regions[region_count - 1].end_byte = cur_end;
-        regions[region_count - 1].state_sequence = NULL;
-        regions[region_count - 1].state_count = 0;
+        regions = add_region(regions, &region_count, &region_cap, cur_start, cur_end);
 
         //Check if the last byte has been reached
         if (cur_end < buf_size - 1) {
@@ -179,12 +260,7 @@ region_t* extract_requests_ssh(unsigned char* buf, unsigned int buf_size, unsign
 
       //Check if the last byte has been reached
       if (cur_end == buf_size - 1) {
-        region_count++;
-        regions = (region_t *)ck_realloc(regions, region_count * sizeof(region_t));
-        regions[region_count - 1].start_byte = cur_start;
-        regions[region_count - 1].end_byte = cur_end;
-        regions[region_count - 1].state_sequence = NULL;
-        regions[region_count - 1].state_count = 0;
+        regions = add_region(regions, &region_count, &region_cap, cur_start, cur_end);
         break;
       }
 
@@ -199,15 +275,8 @@ region_t* extract_requests_ssh(unsigned char* buf, unsigned int buf_size, unsign
 
   //in case region_count equals zero, it means that the structure of the buffer is broken
   //hence we create one region for the whole buffer
-  if ((region_count == 0) && (buf_size > 0)) {
-    regions = (region_t *)ck_realloc(regions, sizeof(region_t));
-    regions[0].start_byte = 0;
-    regions[0].end_byte = buf_size - 1;
-    regions[0].state_sequence = NULL;
-    regions[0].state_count = 0;
-
-    region_count = 1;
-  }
+  if ((region_count == 0) && (buf_size > 0))
+    regions = add_region(regions, &region_count, &region_cap, 0, buf_size - 1);
 
   *region_count_ref = region_count;
   return regions;
@@ -220,6 +289,7 @@ region_t* extract_requests_tls(unsigned char* buf, unsigned int buf_size, unsign
   unsigned int mem_count = 0;
   unsigned int mem_size = 1024;
   unsigned int region_count = 0;
+  unsigned int region_cap = 0;
   region_t *regions = NULL;
 
   mem=(char *)ck_alloc(mem_size);
@@ -254,12 +324,7 @@ region_t* extract_requests_tls(unsigned char* buf, unsigned int buf_size, unsign
       }
 
       //Create one region
-      region_count++;
-      regions = (region_t *)ck_realloc(regions, region_count * sizeof(region_t));
-      regions[region_count - 1].start_byte = cur_start;
-      regions[region_count - 1].end_byte = cur_end;
-      regions[region_count - 1].state_sequence = NULL;
-      regions[region_count - 1].state_count = 0;
+      regions = add_region(regions, &region_count, &region_cap, cur_start, cur_end);
 
       //Check if the last byte has been reached
       if (cur_end < buf_size - 1) {
@@ -273,12 +338,7 @@ region_t* extract_requests_tls(unsigned char* buf, unsigned int buf_size, unsign
 
       //Check if the last byte has been reached
       if (cur_end == buf_size - 1) {
-        region_count++;
-        regions = (region_t *)ck_realloc(regions, region_count * sizeof(region_t));
-        regions[region_count - 1].start_byte = cur_start;
-        regions[region_count - 1].end_byte = cur_end;
-        regions[region_count - 1].state_sequence = NULL;
-        regions[region_count - 1].state_count = 0;
+        regions = add_region(regions, &region_count, &region_cap, cur_start, cur_end);
         break;
       }
 
@@ -293,15 +353,8 @@ region_t* extract_requests_tls(unsigned char* buf, unsigned int buf_size, unsign
 
   //in case region_count equals zero, it means that the structure of the buffer is broken
   //hence we create one region for the whole buffer
-  if ((region_count == 0) && (buf_size > 0)) {
-    regions = (region_t *)ck_realloc(regions, sizeof(region_t));
-    regions[0].start_byte = 0;
-    regions[0].end_byte = buf_size - 1;
-    regions[0].state_sequence = NULL;
-    regions[0].state_count = 0;
-
-    region_count = 1;
-  }
+  if ((region_count == 0) && (buf_size > 0))
+    regions = add_region(regions, &region_count, &region_cap, 0, buf_size - 1);
 
   *region_count_ref = region_count;
   return regions;
@@ -313,6 +366,7 @@ region_t* extract_requests_dicom(unsigned char* buf, unsigned int buf_size, unsi
   unsigned int pdu_length = 0;
   unsigned int packet_length = 0;
   unsigned int region_count = 0;
+  unsigned int region_cap = 0;
   unsigned int end = 0;
   unsigned int start = 0;
 
@@ -339,12 +393,7 @@ region_t* extract_requests_dicom(unsigned char* buf, unsigned int buf_size, unsi
     if (end < start) break; // it means that int overflow has happened -_0_0_-
     if (end >= buf_size) break; // checking boundaries
 
-    region_count++;
-    regions = (region_t *)ck_realloc(regions, region_count * sizeof(region_t));
-    regions[region_count - 1].start_byte = start;
-    regions[region_count - 1].end_byte = end;
-    regions[region_count - 1].state_sequence = NULL;
-    regions[region_count - 1].state_count = 0;
+    regions = add_region(regions, &region_count, &region_cap, start, end);
 
     if ( (byte_count + packet_length) < byte_count ) break; // checking int overflow
     if ( (byte_count + packet_length) < packet_length ) break; // checking int overflow
@@ -353,12 +402,7 @@ region_t* extract_requests_dicom(unsigned char* buf, unsigned int buf_size, unsi
 
   // if bytes is left
   if ((byte_count < buf_size) && (buf_size > 0)) {
-    region_count++;
-    regions = (region_t *)ck_realloc(regions, region_count * sizeof(region_t));
-    regions[region_count - 1].start_byte = byte_count;
-    regions[region_count - 1].end_byte = buf_size - 1;
-    regions[region_count - 1].state_sequence = NULL;
-    regions[region_count - 1].state_count = 0;
+    regions = add_region(regions, &region_count, &region_cap, byte_count, buf_size - 1);
   }
 
   *region_count_ref = region_count;
@@ -371,6 +415,7 @@ region_t* extract_requests_dns(unsigned char* buf, unsigned int buf_size, unsign
   unsigned int mem_count = 0;
   unsigned int mem_size = 1024;
   unsigned int region_count = 0;
+  unsigned int region_cap = 0;
   region_t *regions = NULL;
 
   mem = (char *)ck_alloc(mem_size);
@@ -385,12 +430,7 @@ region_t* extract_requests_dns(unsigned char* buf, unsigned int buf_size, unsign
       // 4 bytes left of the tail.
       cur_end += 4;
       byte_count += 4;
-      region_count++;
-      regions = (region_t *)ck_realloc(regions, region_count * sizeof(region_t));
-      regions[region_count - 1].start_byte = cur_start;
-      regions[region_count - 1].end_byte = cur_end;
-      regions[region_count - 1].state_sequence = NULL;
-      regions[region_count - 1].state_count = 0;
+      regions = add_region(regions, &region_count, &region_cap, cur_start, cur_end);
 
       if (cur_end == buf_size - 1) break;
 
@@ -403,12 +443,7 @@ region_t* extract_requests_dns(unsigned char* buf, unsigned int buf_size, unsign
 
       // Check if the last byte has been reached
       if (cur_end == buf_size - 1) {
-        region_count++;
-        regions = (region_t *)ck_realloc(regions, region_count * sizeof(region_t));
-        regions[region_count - 1].start_byte = cur_start;
-        regions[region_count - 1].end_byte = cur_end;
-        regions[region_count - 1].state_sequence = NULL;
-        regions[region_count - 1].state_count = 0;
+        regions = add_region(regions, &region_count, &region_cap, cur_start, cur_end);
         break;
       }
 
@@ -423,15 +458,8 @@ region_t* extract_requests_dns(unsigned char* buf, unsigned int buf_size, unsign
 
   // In case region_count equals zero, it means that the structure of the buffer is broken
   // hence we create one region for the whole buffer
-  if ((region_count == 0) && (buf_size > 0)) {
-    regions = (region_t *)ck_realloc(regions, sizeof(region_t));
-    regions[0].start_byte = 0;
-    regions[0].end_byte = buf_size - 1;
-    regions[0].state_sequence = NULL;
-    regions[0].state_count = 0;
-
-    region_count = 1;
-  }
+  if ((region_count == 0) && (buf_size > 0))
+    regions = add_region(regions, &region_count, &region_cap, 0, buf_size - 1);
 
   *region_count_ref = region_count;
   return regions;
@@ -439,304 +467,29 @@ region_t* extract_requests_dns(unsigned char* buf, unsigned int buf_size, unsign
 
 region_t* extract_requests_rtsp(unsigned char* buf, unsigned int buf_size, unsigned int* region_count_ref)
 {
-  char *mem;
-  unsigned int byte_count = 0;
-  unsigned int mem_count = 0;
-  unsigned int mem_size = 1024;
-  unsigned int region_count = 0;
-  region_t *regions = NULL;
-  char terminator[4] = {0x0D, 0x0A, 0x0D, 0x0A};
-
-  mem=(char *)ck_alloc(mem_size);
-
-  unsigned int cur_start = 0;
-  unsigned int cur_end = 0;
-  while (byte_count < buf_size) {
-
-    memcpy(&mem[mem_count], buf + byte_count++, 1);
-
-    //Check if the last four bytes are 0x0D0A0D0A
-    if ((mem_count > 3) && (memcmp(&mem[mem_count - 3], terminator, 4) == 0)) {
-      region_count++;
-      regions = (region_t *)ck_realloc(regions, region_count * sizeof(region_t));
-      regions[region_count - 1].start_byte = cur_start;
-      regions[region_count - 1].end_byte = cur_end;
-      regions[region_count - 1].state_sequence = NULL;
-      regions[region_count - 1].state_count = 0;
-
-      mem_count = 0;
-      cur_start = cur_end + 1;
-      cur_end = cur_start;
-    } else {
-      mem_count++;
-      cur_end++;
-
-      //Check if the last byte has been reached
-      if (cur_end == buf_size - 1) {
-        region_count++;
-        regions = (region_t *)ck_realloc(regions, region_count * sizeof(region_t));
-        regions[region_count - 1].start_byte = cur_start;
-        regions[region_count - 1].end_byte = cur_end;
-        regions[region_count - 1].state_sequence = NULL;
-        regions[region_count - 1].state_count = 0;
-        break;
-      }
-
-      if (mem_count == mem_size) {
-        //enlarge the mem buffer
-        mem_size = mem_size * 2;
-        mem=(char *)ck_realloc(mem, mem_size);
-      }
-    }
-  }
-  if (mem) ck_free(mem);
-
-  //in case region_count equals zero, it means that the structure of the buffer is broken
-  //hence we create one region for the whole buffer
-  if ((region_count == 0) && (buf_size > 0)) {
-    regions = (region_t *)ck_realloc(regions, sizeof(region_t));
-    regions[0].start_byte = 0;
-    regions[0].end_byte = buf_size - 1;
-    regions[0].state_sequence = NULL;
-    regions[0].state_count = 0;
-
-    region_count = 1;
-  }
-
-  *region_count_ref = region_count;
-  return regions;
+  return extract_requests_crlf(buf, buf_size, 2, region_count_ref);
 }
 
 region_t* extract_requests_ftp(unsigned char* buf, unsigned int buf_size, unsigned int* region_count_ref)
 {
-  char *mem;
-  unsigned int byte_count = 0;
-  unsigned int mem_count = 0;
-  unsigned int mem_size = 1024;
-  unsigned int region_count = 0;
-  region_t *regions = NULL;
-  char terminator[2] = {0x0D, 0x0A};
-
-  mem=(char *)ck_alloc(mem_size);
-
-  unsigned int cur_start = 0;
-  unsigned int cur_end = 0;
-  while (byte_count < buf_size) {
-
-    memcpy(&mem[mem_count], buf + byte_count++, 1);
-
-    //Check if the last two bytes are 0x0D0A
-    if ((mem_count > 1) && (memcmp(&mem[mem_count - 1], terminator, 2) == 0)) {
-      region_count++;
-      regions = (region_t *)ck_realloc(regions, region_count * sizeof(region_t));
-      regions[region_count - 1].start_byte = cur_start;
-      regions[region_count - 1].end_byte = cur_end;
-      regions[region_count - 1].state_sequence = NULL;
-      regions[region_count - 1].state_count = 0;
-
-      mem_count = 0;
-      cur_start = cur_end + 1;
-      cur_end = cur_start;
-    } else {
-      mem_count++;
-      cur_end++;
-
-      //Check if the last byte has been reached
-      if (cur_end == buf_size - 1) {
-        region_count++;
-        regions = (region_t *)ck_realloc(regions, region_count * sizeof(region_t));
-        regions[region_count - 1].start_byte = cur_start;
-        regions[region_count - 1].end_byte = cur_end;
-        regions[region_count - 1].state_sequence = NULL;
-        regions[region_count - 1].state_count = 0;
-        break;
-      }
-
-      if (mem_count == mem_size) {
-        //enlarge the mem buffer
-        mem_size = mem_size * 2;
-        mem=(char *)ck_realloc(mem, mem_size);
-      }
-    }
-  }
-  if (mem) ck_free(mem);
-
-  //in case region_count equals zero, it means that the structure of the buffer is broken
-  //hence we create one region for the whole buffer
-  if ((region_count == 0) && (buf_size > 0)) {
-    regions = (region_t *)ck_realloc(regions, sizeof(region_t));
-    regions[0].start_byte = 0;
-    regions[0].end_byte = buf_size - 1;
-    regions[0].state_sequence = NULL;
-    regions[0].state_count = 0;
-
-    region_count = 1;
-  }
-
-  *region_count_ref = region_count;
-  return regions;
+  return extract_requests_crlf(buf, buf_size, 1, region_count_ref);
 }
 
 unsigned int* extract_response_codes_smtp(unsigned char* buf, unsigned int buf_size, unsigned int* state_count_ref)
 {
-  char *mem;
-  unsigned int byte_count = 0;
-  unsigned int mem_count = 0;
-  unsigned int mem_size = 1024;
-  unsigned int *state_sequence = NULL;
-  unsigned int state_count = 0;
-  char terminator[2] = {0x0D, 0x0A};
-
-  mem=(char *)ck_alloc(mem_size);
-
-  state_count++;
-  state_sequence = (unsigned int *)ck_realloc(state_sequence, state_count * sizeof(unsigned int));
-  state_sequence[state_count - 1] = 0;
-
-  while (byte_count < buf_size) {
-    memcpy(&mem[mem_count], buf + byte_count++, 1);
-
-    if ((mem_count > 0) && (memcmp(&mem[mem_count - 1], terminator, 2) == 0)) {
-      //Extract the response code which is the first 3 bytes
-      char temp[4];
-      memcpy(temp, mem, 4);
-      temp[3] = 0x0;
-      unsigned int message_code = (unsigned int) atoi(temp);
-
-      if (message_code == 0) break;
-
-      state_count++;
-      state_sequence = (unsigned int *)ck_realloc(state_sequence, state_count * sizeof(unsigned int));
-      state_sequence[state_count - 1] = message_code;
-      mem_count = 0;
-    } else {
-      mem_count++;
-      if (mem_count == mem_size) {
-        //enlarge the mem buffer
-        mem_size = mem_size * 2;
-        mem=(char *)ck_realloc(mem, mem_size);
-      }
-    }
-  }
-  if (mem) ck_free(mem);
-  *state_count_ref = state_count;
-  return state_sequence;
+  //the code is the first 3 bytes
+  return extract_response_codes_crlf(buf, buf_size, NULL, 0, state_count_ref);
 }
 
 region_t* extract_requests_telnet(unsigned char* buf, unsigned int buf_size, unsigned int* region_count_ref)
 {
-   char *mem;
-  unsigned int byte_count = 0;
-  unsigned int mem_count = 0;
-  unsigned int mem_size = 1024;
-  unsigned int region_count = 0;
-  region_t *regions = NULL;
-  char terminator[2] = {0x0D, 0x0A};
-
-  mem=(char *)ck_alloc(mem_size);
-
-  unsigned int cur_start = 0;
-  unsigned int cur_end = 0;
-  while (byte_count < buf_size) {
-
-    memcpy(&mem[mem_count], buf + byte_count++, 1);
-
-    //Check if the last two bytes are 0x0D0A
-    if ((mem_count > 1) && (memcmp(&mem[mem_count - 1], terminator, 2) == 0)) {
-      region_count++;
-      regions = (region_t *)ck_realloc(regions, region_count * sizeof(region_t));
-      regions[region_count - 1].start_byte = cur_start;
-      regions[region_count - 1].end_byte = cur_end;
-      regions[region_count - 1].state_sequence = NULL;
-      regions[region_count - 1].state_count = 0;
-
-      mem_count = 0;
-      cur_start = cur_end + 1;
-      cur_end = cur_start;
-    } else {
-      mem_count++;
-      cur_end++;
-
-      //Check if the last byte has been reached
-      if (cur_end == buf_size - 1) {
-        region_count++;
-        regions = (region_t *)ck_realloc(regions, region_count * sizeof(region_t));
-        regions[region_count - 1].start_byte = cur_start;
-        regions[region_count - 1].end_byte = cur_end;
-        regions[region_count - 1].state_sequence = NULL;
-        regions[region_count - 1].state_count = 0;
-        break;
-      }
-
-      if (mem_count == mem_size) {
-        //enlarge the mem buffer
-        mem_size = mem_size * 2;
-        mem=(char *)ck_realloc(mem, mem_size);
-      }
-    }
-  }
-  if (mem) ck_free(mem);
-
-  //in case region_count equals zero, it means that the structure of the buffer is broken
-  //hence we create one region for the whole buffer
-  if ((region_count == 0) && (buf_size > 0)) {
-    regions = (region_t *)ck_realloc(regions, sizeof(region_t));
-    regions[0].start_byte = 0;
-    regions[0].end_byte = buf_size - 1;
-    regions[0].state_sequence = NULL;
-    regions[0].state_count = 0;
-
-    region_count = 1;
-  }
-
-  *region_count_ref = region_count;
-  return regions;
+  return extract_requests_crlf(buf, buf_size, 1, region_count_ref);
 }
 
 unsigned int* extract_response_codes_telnet(unsigned char* buf, unsigned int buf_size, unsigned int* state_count_ref)
 {
-  char *mem;
-  unsigned int byte_count = 0;
-  unsigned int mem_count = 0;
-  unsigned int mem_size = 1024;
-  unsigned int *state_sequence = NULL;
-  unsigned int state_count = 0;
-  char terminator[2] = {0x0D, 0x0A};
-
-  mem=(char *)ck_alloc(mem_size);
-
-  state_count++;
-  state_sequence = (unsigned int *)ck_realloc(state_sequence, state_count * sizeof(unsigned int));
-  state_sequence[state_count - 1] = 0;
-
-  while (byte_count < buf_size) {
-    memcpy(&mem[mem_count], buf + byte_count++, 1);
-
-    if ((mem_count > 0) && (memcmp(&mem[mem_count - 1], terminator, 2) == 0)) {
-      //Extract the response code which is the first 3 bytes
-      char temp[4];
-      memcpy(temp, mem, 4);
-      temp[3] = 0x0;
-      unsigned int message_code = (unsigned int) atoi(temp);
-
-      if (message_code == 0) break;
-
-      state_count++;
-      state_sequence = (unsigned int *)ck_realloc(state_sequence, state_count * sizeof(unsigned int));
-      state_sequence[state_count - 1] = message_code;
-      mem_count = 0;
-    } else {
-      mem_count++;
-      if (mem_count == mem_size) {
-        //enlarge the mem buffer
-        mem_size = mem_size * 2;
-        mem=(char *)ck_realloc(mem, mem_size);
-      }
-    }
-  }
-  if (mem) ck_free(mem);
-  *state_count_ref = state_count;
-  return state_sequence;
+  //the code is the first 3 bytes
+  return extract_response_codes_crlf(buf, buf_size, NULL, 0, state_count_ref);
 }
 
 
@@ -746,12 +499,10 @@ unsigned int* extract_response_codes_ssh(unsigned char* buf, unsigned int buf_si
    unsigned int byte_count = 0;
    unsigned int *state_sequence = NULL;
    unsigned int state_count = 0;
+   unsigned int state_cap = 0;
 
    //Initial state
-   state_count++;
-   state_sequence = (unsigned int *)ck_realloc(state_sequence, state_count * sizeof(unsigned int));
-   if (state_sequence == NULL) PFATAL("Unable realloc a memory region to store state sequence");
-   state_sequence[state_count - 1] = 0;
+   state_sequence = add_state(state_sequence, &state_count, &state_cap, 0);
 
    while (byte_count < buf_size) {
       memcpy(mem, buf + byte_count, 6);
@@ -765,10 +516,7 @@ unsigned int* extract_response_codes_ssh(unsigned char* buf, unsigned int buf_si
           memcpy(&tmp, buf + byte_count, 1);
           byte_count += 1;
         }
-        state_count++;
-        state_sequence = (unsigned int *)ck_realloc(state_sequence, state_count * sizeof(unsigned int));
-        if (state_sequence == NULL) PFATAL("Unable realloc a memory region to store state sequence");
-        state_sequence[state_count - 1] = 256; //Identification
+        state_sequence = add_state(state_sequence, &state_count, &state_cap, 256); //Identification
       } else {
         //Extract the message type and skip the payload and the MAC
         unsigned int* size_buf = (unsigned int*)&mem[0];
@@ -779,10 +527,7 @@ unsigned int* extract_response_codes_ssh(unsigned char* buf, unsigned int buf_si
         if (message_size - 2 > buf_size - byte_count) break;
 
         unsigned char message_code = (unsigned char)mem[5];
-        state_count++;
-        state_sequence = (unsigned int *)ck_realloc(state_sequence, state_count * sizeof(unsigned int));
-        if (state_sequence == NULL) PFATAL("Unable realloc a memory region to store state sequence");
-        state_sequence[state_count - 1] = message_code;
+        state_sequence = add_state(state_sequence, &state_count, &state_cap, message_code);
         /* If this is a KEY exchange related message */
         if ((message_code >= 20) && (message_code <= 49)) {
           //Do nothing
@@ -805,13 +550,12 @@ unsigned int* extract_response_codes_tls(unsigned char* buf, unsigned int buf_si
   unsigned char content_type, message_type;
   unsigned int *state_sequence = NULL;
   unsigned int state_count = 0;
+  unsigned int state_cap = 0;
 
   mem=(char *)ck_alloc(mem_size);
 
   //Add initial state
-  state_count++;
-  state_sequence = (unsigned int *)ck_realloc(state_sequence, state_count * sizeof(unsigned int));
-  state_sequence[state_count - 1] = 0;
+  state_sequence = add_state(state_sequence, &state_count, &state_cap, 0);
 
   while (byte_count < buf_size) {
 
@@ -849,9 +593,7 @@ unsigned int* extract_response_codes_tls(unsigned char* buf, unsigned int buf_si
 
       //add a new response code
       unsigned int message_code = (content_type << 8) + message_type;
-      state_count++;
-      state_sequence = (unsigned int *)ck_realloc(state_sequence, state_count * sizeof(unsigned int));
-      state_sequence[state_count - 1] = message_code;
+      state_sequence = add_state(state_sequence, &state_count, &state_cap, message_code);
       mem_count = 0;
     } else {
       mem_count++;
@@ -899,12 +641,11 @@ unsigned int* extract_response_codes_dns(unsigned char* buf, unsigned int buf_si
   unsigned int mem_size = 1024;
   unsigned int *state_sequence = NULL;
   unsigned int state_count = 0;
+  unsigned int state_cap = 0;
 
   mem=(char *)ck_alloc(mem_size);
 
-  state_count++;
-  state_sequence = (unsigned int *)ck_realloc(state_sequence, state_count * sizeof(unsigned int));
-  state_sequence[state_count - 1] = 0;
+  state_sequence = add_state(state_sequence, &state_count, &state_cap, 0);
 
   for (unsigned int byte_count = 0; byte_count < buf_size; byte_count++) {
     memcpy(&mem[mem_count], buf + byte_count, 1);
@@ -918,9 +659,7 @@ unsigned int* extract_response_codes_dns(unsigned char* buf, unsigned int buf_si
       // Save the 3rd & 4th bytes as the response code
       unsigned int message_code = (unsigned int) ((mem[2] << 8) + mem[3]);
 
-      state_count++;
-      state_sequence = (unsigned int *)ck_realloc(state_sequence, state_count * sizeof(unsigned int));
-      state_sequence[state_count - 1] = message_code;
+      state_sequence = add_state(state_sequence, &state_count, &state_cap, message_code);
       mem_count = 0;
     } else {
       mem_count++;
@@ -957,6 +696,7 @@ static unsigned char dtls12_version[2] = {0xFE, 0xFD};
 region_t *extract_requests_dtls12(unsigned char* buf, unsigned int buf_size, unsigned int* region_count_ref) {
   unsigned int byte_count = 0;
   unsigned int region_count = 0;
+  unsigned int region_cap = 0;
   region_t *regions = NULL;
 
   unsigned int cur_start = 0;
@@ -967,23 +707,13 @@ region_t *extract_requests_dtls12(unsigned char* buf, unsigned int buf_size, uns
      if ((byte_count > 3 && buf_size - byte_count > 1) &&
      (buf[byte_count] >= CCS_CONTENT_TYPE && buf[byte_count] <= HEARTBEAT_CONTENT_TYPE)  &&
      (memcmp(&buf[byte_count+1], dtls12_version, 2) == 0)) {
-       region_count++;
-       regions = (region_t *)ck_realloc(regions, region_count * sizeof(region_t));
-       regions[region_count - 1].start_byte = cur_start;
-       regions[region_count - 1].end_byte = byte_count-1;
-       regions[region_count - 1].state_sequence = NULL;
-       regions[region_count - 1].state_count = 0;
+       regions = add_region(regions, &region_count, &region_cap, cur_start, byte_count-1);
        cur_start = byte_count;
      } else {
 
       //Check if the last byte has been reached
       if (byte_count == buf_size - 1) {
-        region_count++;
-        regions = (region_t *)ck_realloc(regions, region_count * sizeof(region_t));
-        regions[region_count - 1].start_byte = cur_start;
-        regions[region_count - 1].end_byte = byte_count;
-        regions[region_count - 1].state_sequence = NULL;
-        regions[region_count - 1].state_count = 0;
+        regions = add_region(regions, &region_count, &region_cap, cur_start, byte_count);
         break;
       }
      }
@@ -993,15 +723,8 @@ region_t *extract_requests_dtls12(unsigned char* buf, unsigned int buf_size, uns
 
   //in case region_count equals zero, it means that the structure of the buffer is broken
   //hence we create one region for the whole buffer
-  if ((region_count == 0) && (buf_size > 0)) {
-    regions = (region_t *)ck_realloc(regions, sizeof(region_t));
-    regions[0].start_byte = 0;
-    regions[0].end_byte = buf_size - 1;
-    regions[0].state_sequence = NULL;
-    regions[0].state_count = 0;
-
-    region_count = 1;
-  }
+  if ((region_count == 0) && (buf_size > 0))
+    regions = add_region(regions, &region_count, &region_cap, 0, buf_size - 1);
 
   *region_count_ref = region_count;
   return regions;
@@ -1015,11 +738,10 @@ unsigned int* extract_response_codes_dtls12(unsigned char* buf, unsigned int buf
   unsigned int byte_count = 0;
   unsigned int *state_sequence = NULL;
   unsigned int state_count = 0;
+  unsigned int state_cap = 0;
   unsigned int status_code = 0;
 
-  state_count++;
-  state_sequence = (unsigned int *)ck_realloc(state_sequence, state_count * sizeof(unsigned int));
-  state_sequence[state_count - 1] = 0; // initial status code is 0
+  state_sequence = add_state(state_sequence, &state_count, &state_cap, 0); // initial status code is 0
 
   while (byte_count < buf_size) {
     // a DTLS 1.2 record has a 13 bytes header, followed by the contained message
@@ -1114,9 +836,7 @@ unsigned int* extract_response_codes_dtls12(unsigned char* buf, unsigned int buf
       }
 
       status_code = (content_type << 8) + message_type;
-      state_count++;
-      state_sequence = (unsigned int *)ck_realloc(state_sequence, state_count * sizeof(unsigned int));
-      state_sequence[state_count - 1] = status_code;
+      state_sequence = add_state(state_sequence, &state_count, &state_cap, status_code);
       byte_count += record_length;
     } else {
       // we shouldn't really be reaching this code
@@ -1130,100 +850,14 @@ unsigned int* extract_response_codes_dtls12(unsigned char* buf, unsigned int buf
 
 unsigned int* extract_response_codes_rtsp(unsigned char* buf, unsigned int buf_size, unsigned int* state_count_ref)
 {
-  char *mem;
-  unsigned int byte_count = 0;
-  unsigned int mem_count = 0;
-  unsigned int mem_size = 1024;
-  unsigned int *state_sequence = NULL;
-  unsigned int state_count = 0;
-  char terminator[2] = {0x0D, 0x0A};
-  char rtsp[5] = {0x52, 0x54, 0x53, 0x50, 0x2f};
-
-  mem=(char *)ck_alloc(mem_size);
-
-  state_count++;
-  state_sequence = (unsigned int *)ck_realloc(state_sequence, state_count * sizeof(unsigned int));
-  state_sequence[state_count - 1] = 0;
-
-  while (byte_count < buf_size) {
-    memcpy(&mem[mem_count], buf + byte_count++, 1);
-
-    //Check if the last two bytes are 0x0D0A
-    if ((mem_count > 0) && (memcmp(&mem[mem_count - 1], terminator, 2) == 0)) {
-      if ((mem_count >= 5) && (memcmp(mem, rtsp, 5) == 0)) {
-        //Extract the response code which is the first 3 bytes
-        char temp[4];
-        memcpy(temp, &mem[9], 4);
-        temp[3] = 0x0;
-        unsigned int message_code = (unsigned int) atoi(temp);
-
-        if (message_code == 0) break;
-
-        state_count++;
-        state_sequence = (unsigned int *)ck_realloc(state_sequence, state_count * sizeof(unsigned int));
-        state_sequence[state_count - 1] = message_code;
-        mem_count = 0;
-      } else {
-        mem_count = 0;
-      }
-    } else {
-      mem_count++;
-      if (mem_count == mem_size) {
-        //enlarge the mem buffer
-        mem_size = mem_size * 2;
-        mem=(char *)ck_realloc(mem, mem_size);
-      }
-    }
-  }
-  if (mem) ck_free(mem);
-  *state_count_ref = state_count;
-  return state_sequence;
+  //the code follows "RTSP/1.0 "
+  return extract_response_codes_crlf(buf, buf_size, "RTSP/", 9, state_count_ref);
 }
 
 unsigned int* extract_response_codes_ftp(unsigned char* buf, unsigned int buf_size, unsigned int* state_count_ref)
 {
-  char *mem;
-  unsigned int byte_count = 0;
-  unsigned int mem_count = 0;
-  unsigned int mem_size = 1024;
-  unsigned int *state_sequence = NULL;
-  unsigned int state_count = 0;
-  char terminator[2] = {0x0D, 0x0A};
-
-  mem=(char *)ck_alloc(mem_size);
-
-  state_count++;
-  state_sequence = (unsigned int *)ck_realloc(state_sequence, state_count * sizeof(unsigned int));
-  state_sequence[state_count - 1] = 0;
-
-  while (byte_count < buf_size) {
-    memcpy(&mem[mem_count], buf + byte_count++, 1);
-
-    if ((mem_count > 0) && (memcmp(&mem[mem_count - 1], terminator, 2) == 0)) {
-      //Extract the response code which is the first 3 bytes
-      char temp[4];
-      memcpy(temp, mem, 4);
-      temp[3] = 0x0;
-      unsigned int message_code = (unsigned int) atoi(temp);
-
-      if (message_code == 0) break;
-
-      state_count++;
-      state_sequence = (unsigned int *)ck_realloc(state_sequence, state_count * sizeof(unsigned int));
-      state_sequence[state_count - 1] = message_code;
-      mem_count = 0;
-    } else {
-      mem_count++;
-      if (mem_count == mem_size) {
-        //enlarge the mem buffer
-        mem_size = mem_size * 2;
-        mem=(char *)ck_realloc(mem, mem_size);
-      }
-    }
-  }
-  if (mem) ck_free(mem);
-  *state_count_ref = state_count;
-  return state_sequence;
+  //the code is the first 3 bytes
+  return extract_response_codes_crlf(buf, buf_size, NULL, 0, state_count_ref);
 }
 
 // kl_messages manipulating functions
@@ -1380,6 +1014,65 @@ int net_send(int sockfd, struct timeval timeout, char *mem, unsigned int len) {
   return byte_count;
 }
 
+/* Send count messages with as few syscalls as possible: sendmsg() over a
+   stream, where message boundaries do not matter, and sendmmsg() for
+   datagrams, which keeps one datagram per message. Returns the number of
+   messages sent whole. */
+int net_send_batch(int sockfd, struct timeval timeout, const struct iovec *iov, unsigned int count, int datagram) {
+  const unsigned int batch = 64;
+  unsigned int sent = 0, i;
+  size_t skip = 0;  /* bytes of iov[sent] already out */
+  struct pollfd pfd[1];
+  pfd[0].fd = sockfd;
+  pfd[0].events = POLLOUT;
+
+  if (count == 0) return 0;
+
+  setsockopt(sockfd, SOL_SOCKET, SO_SNDTIMEO, (char *)&timeout, sizeof(timeout));
+  if (poll(pfd, 1, 1) <= 0 || !(pfd[0].revents & POLLOUT)) return 0;
+
+  while (sent < count) {
+    unsigned int n = count - sent < batch ? count - sent : batch;
+
+    if (datagram) {
+      struct mmsghdr msgs[batch];
+      memset(msgs, 0, sizeof(msgs[0]) * n);
+      for (i = 0; i < n; i++) {
+        msgs[i].msg_hdr.msg_iov = (struct iovec *)&iov[sent + i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+      }
+      int r = sendmmsg(sockfd, msgs, n, MSG_NOSIGNAL);
+      if (r <= 0) break;
+      sent += r;
+      continue;
+    }
+
+    struct iovec part[batch];
+    struct msghdr msg;
+    memcpy(part, &iov[sent], sizeof(part[0]) * n);
+    part[0].iov_base = (char *)part[0].iov_base + skip;
+    part[0].iov_len -= skip;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = part;
+    msg.msg_iovlen = n;
+
+    ssize_t r = sendmsg(sockfd, &msg, MSG_NOSIGNAL);
+    if (r <= 0) break;
+
+    while (r > 0) {
+      size_t left = iov[sent].iov_len - skip;
+      if ((size_t)r < left) {
+        skip += r;
+        break;
+      }
+      r -= left;
+      skip = 0;
+      sent++;
+    }
+  }
+  return sent;
+}
+
 int net_recv(int sockfd, struct timeval timeout, int poll_w, char **response_buf, unsigned int *len) {
   char temp_buf[1000];
   int n;
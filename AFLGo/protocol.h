@@ -5,6 +5,7 @@
 #include "khash.h"
 #include <arpa/inet.h>
 #include <poll.h>
+#include <sys/uio.h>
 
 typedef struct {
   int start_byte;                 /* The start byte, negative if unknown. */
@@ -84,6 +85,7 @@ extern region_t* (*extract_requests)(unsigned char* buf, unsigned int buf_size,
 
 // Two wrappers for sending and receiving data over socket
 int net_send(int sockfd, struct timeval timeout, char *mem, unsigned int len);
+int net_send_batch(int sockfd, struct timeval timeout, const struct iovec *iov, unsigned int count, int datagram);
 int net_recv(int sockfd, struct timeval timeout, int poll_w, char **response_buf, unsigned int *len);
 
 // kl_messages manipulating functions
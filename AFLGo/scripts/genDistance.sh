@@ -37,6 +37,36 @@ STEP=1
 
 RESUME=$(if [ -f $TMPDIR/state ]; then cat $TMPDIR/state; else echo 0; fi)
 
+# Content-addressed cache of the call graphs and distances, shared by all
+# builds: an entry is reused whenever everything it was computed from is
+# unchanged, so a rebuild only recomputes the functions that changed.
+CACHE=${AFLGO_DISTANCE_CACHE:-$HOME/.cache/aflgo-distance}
+mkdir -p $CACHE/cg $CACHE/cg-distance $CACHE/cfg-distance
+DISTANCE_SUM=$(sha256sum < $AFLGO/distance.py | cut -d' ' -f1)
+
+function cache_get {
+  [ -f $CACHE/$1 ] && cp $CACHE/$1 $2
+}
+
+function cache_put {
+  [ -f $2 ] && cp $2 $CACHE/$1.$$ && mv $CACHE/$1.$$ $CACHE/$1
+}
+
+# The key of a CFG's distances: the CFG and only the lines of the target,
+# name and callsite files and the callee distances that can match its blocks
+function cfg_key {
+  sed -n 's/.*label="{\([^:"]*:[0-9]*\):.*/\1/p' $1 | sort -u > $TMPDIR/cache.blocks
+  grep -F -f $TMPDIR/cache.blocks $TMPDIR/BBcalls.txt > $TMPDIR/cache.calls
+  {
+    echo $DISTANCE_SUM
+    cat $1
+    echo; grep -F -f $TMPDIR/cache.blocks $TMPDIR/BBtargets.txt
+    echo; grep -F -f $TMPDIR/cache.blocks $TMPDIR/BBnames.txt
+    echo; cat $TMPDIR/cache.calls
+    echo; awk -F, 'NR==FNR{c[$2];next} $1 in c' $TMPDIR/cache.calls $TMPDIR/distance.callgraph.txt
+  } | sha256sum | cut -d' ' -f1
+}
+
 function next_step {
   echo $STEP > $TMPDIR/state
   if [ $FAIL -ne 0 ]; then
@@ -60,6 +90,12 @@ if [ $RESUME -le $STEP ]; then
   if [ -z "$fuzzer" ]; then
     for binary in $(echo "$binaries"); do
 
+      key=cg/$( (opt --version; cat $binary.0.0.*.bc) | sha256sum | cut -d' ' -f1)
+      if cache_get $key callgraph.$(basename $binary).dot; then
+        echo "($STEP) Reusing CG for $binary.."
+        continue
+      fi
+
       echo "($STEP) Constructing CG for $binary.."
       while ! opt -dot-callgraph $binary.0.0.*.bc >/dev/null 2> $TMPDIR/step${STEP}.log ; do
         echo -e "\e[93;1m[!]\e[0m Could not generate call graph. Repeating.."
@@ -68,6 +104,7 @@ if [ $RESUME -le $STEP ]; then
       #Remove repeated lines and rename
       awk '!a[$0]++' callgraph.dot > callgraph.$(basename $binary).dot
       rm callgraph.dot
+      cache_put $key callgraph.$(basename $binary).dot
     done
 
     #Integrate several call graphs into one
@@ -76,14 +113,20 @@ if [ $RESUME -le $STEP ]; then
 
   else
 
-    echo "($STEP) Constructing CG for $fuzzer.."
-    while ! opt -dot-callgraph $fuzzer.0.0.*.bc >/dev/null 2> $TMPDIR/step${STEP}.log ; do
-      echo -e "\e[93;1m[!]\e[0m Could not generate call graph. Repeating.."
-    done
+    key=cg/$( (opt --version; cat $fuzzer.0.0.*.bc) | sha256sum | cut -d' ' -f1)
+    if cache_get $key callgraph.dot; then
+      echo "($STEP) Reusing CG for $fuzzer.."
+    else
+      echo "($STEP) Constructing CG for $fuzzer.."
+      while ! opt -dot-callgraph $fuzzer.0.0.*.bc >/dev/null 2> $TMPDIR/step${STEP}.log ; do
+        echo -e "\e[93;1m[!]\e[0m Could not generate call graph. Repeating.."
+      done
 
-    #Remove repeated lines and rename
-    awk '!a[$0]++' callgraph.dot > callgraph.1.dot
-    mv callgraph.1.dot callgraph.dot
+      #Remove repeated lines and rename
+      awk '!a[$0]++' callgraph.dot > callgraph.1.dot
+      mv callgraph.1.dot callgraph.dot
+      cache_put $key callgraph.dot
+    fi
 
   fi
 fi
@@ -93,9 +136,15 @@ next_step
 # Generate config file keeping distance information for code instrumentation
 #-------------------------------------------------------------------------------
 if [ $RESUME -le $STEP ]; then
-  echo "($STEP) Computing distance for call graph .."
+  key=cg-distance/$( (echo $DISTANCE_SUM; cat $TMPDIR/dot-files/callgraph.dot $TMPDIR/Ftargets.txt $TMPDIR/Fnames.txt) | sha256sum | cut -d' ' -f1)
+  if cache_get $key $TMPDIR/distance.callgraph.txt; then
+    echo "($STEP) Reusing distance for call graph .."
+  else
+    echo "($STEP) Computing distance for call graph .."
 
-  $AFLGO/distance.py -d $TMPDIR/dot-files/callgraph.dot -t $TMPDIR/Ftargets.txt -n $TMPDIR/Fnames.txt -o $TMPDIR/distance.callgraph.txt > $TMPDIR/step${STEP}.log 2>&1 || FAIL=1
+    $AFLGO/distance.py -d $TMPDIR/dot-files/callgraph.dot -t $TMPDIR/Ftargets.txt -n $TMPDIR/Fnames.txt -o $TMPDIR/distance.callgraph.txt > $TMPDIR/step${STEP}.log 2>&1 || FAIL=1
+    [ $FAIL -eq 0 ] && cache_put $key $TMPDIR/distance.callgraph.txt
+  fi
 
   if [ $(cat $TMPDIR/distance.callgraph.txt | wc -l) -eq 0 ]; then
     FAIL=1
@@ -119,11 +168,21 @@ if [ $RESUME -le $STEP ]; then
     sed -i 's/\[.\"]//g' $f
     sed -i 's/\(^\s*[0-9a-zA-Z_]*\):[a-zA-Z0-9]*\( -> \)/\1\2/g' $f
 
+    key=cfg-distance/$(cfg_key $f)
+    if cache_get $key ${f}.distances.txt; then
+      printf "\nReusing distance for $f..\n"
+      continue
+    fi
+
     #Compute distance
     printf "\nComputing distance for $f..\n"
     $AFLGO/distance.py -d $f -t $TMPDIR/BBtargets.txt -n $TMPDIR/BBnames.txt -s $TMPDIR/BBcalls.txt -c $TMPDIR/distance.callgraph.txt -o ${f}.distances.txt >> $TMPDIR/step${STEP}.log 2>&1 #|| FAIL=1
     if [ $? -ne 0 ]; then
       echo -e "\e[93;1m[!]\e[0m Could not calculate distance for $f."
+    else
+      #Also a CFG without any distance, distance.py may exit before writing it
+      touch ${f}.distances.txt
+      cache_put $key ${f}.distances.txt
     fi
     #if [ $FAIL -eq 1 ]; then
     #  next_step #Fail asap.
@@ -5,7 +5,11 @@ The distance is parallelized and uses the compiled distance calculation
 version by default.
 """
 import argparse
+import hashlib
 import multiprocessing as mp
+import os
+import re
+import shutil
 import sys
 import subprocess
 from argparse import ArgumentTypeError as ArgTypeErr
@@ -20,6 +24,11 @@ CALLGRAPH_NAME = "callgraph.dot"
 PROJ_ROOT = Path(__file__).resolve().parent.parent
 DIST_BIN = PROJ_ROOT / "distance_calculator/distance_calculator"
 DIST_PY = PROJ_ROOT / "scripts/distance.py"
+# Content-addressed cache of the call graphs and distances shared by all
+# builds, see genDistance.sh
+CACHE = Path(os.environ.get("AFLGO_DISTANCE_CACHE",
+                            Path.home() / ".cache/aflgo-distance"))
+BLOCK_RE = re.compile(r'label="\{([^:"]*:[0-9]*):')
 
 
 def next_step(args):
@@ -57,6 +66,51 @@ def remove_repeated_lines(in_path, out_path):
                 lines_seen.add(line)
 
 
+def digest(*parts):
+    """Hex sha256 of the bytes or files in parts"""
+    h = hashlib.sha256()
+    for part in parts:
+        h.update(part.read_bytes() if isinstance(part, Path) else part)
+        h.update(b"\0")
+    return h.hexdigest()
+
+
+def cache_get(key, path):
+    entry = CACHE / key
+    if not entry.is_file():
+        return False
+    shutil.copyfile(entry, path)
+    return True
+
+
+def cache_put(key, path):
+    if not path.is_file():
+        return
+    entry = CACHE / key
+    entry.parent.mkdir(parents=True, exist_ok=True)
+    temp = entry.with_name(f"{entry.name}.{os.getpid()}")
+    shutil.copyfile(path, temp)
+    temp.replace(entry)
+
+
+def cfg_key(cfg, prog, bbtargets, bbnames, bbcalls, callgraph_distance):
+    """Key of the distances of a CFG: the CFG itself and only the lines of
+    the other inputs that can match one of its blocks"""
+    blocks = set(BLOCK_RE.findall(cfg.read_text()))
+    targets = [l for l in bbtargets if l.rsplit("/", 1)[-1] in blocks]
+    names = [l for l in bbnames if l in blocks]
+    calls = [l for l in bbcalls if l.split(",")[0] in blocks]
+    callees = {l.split(",")[-1] for l in calls}
+    cg_dist = [l for l in callgraph_distance if l.split(",")[0] in callees]
+    return digest(prog, cfg, *("\n".join(sorted(ls)).encode()
+                               for ls in (targets, names, calls, cg_dist)))
+
+
+def read_lines(path):
+    with path.open("r") as f:
+        return [l.strip() for l in f]
+
+
 def merge_callgraphs(dots, outfilepath):
     import networkx as nx
     print(f"({STEP}) Integrating several call-graphs into one.")
@@ -91,13 +145,19 @@ def construct_callgraph(args, binaries):
         tmp = next(args.binaries_directory.glob(f"{fuzzer.name}.0.0.*.bc"))
         binaries = [tmp]
 
+    opt_version = subprocess.run(["opt", "--version"], stdout=subprocess.PIPE).stdout
     for binary in binaries:
+        callgraph = dot_files / f"{binary.name}.callgraph.dot"
+        key = "cg/" + digest(opt_version, binary)
+        if cache_get(key, callgraph):
+            print(f"({STEP}) Reusing CG for {binary}..")
+            continue
         opt_callgraph(args, binary)
         temp = dot_files / f"{binary.name}.callgraph.temp.dot"
-        callgraph = dot_files / f"{binary.name}.callgraph.dot"
         callgraph.replace(temp)     # return only works with py >= 3.8 :(
         remove_repeated_lines(temp, callgraph)
         temp.unlink()
+        cache_put(key, callgraph)
 
     # The goal is to have one file called "callgraph.dot"
     if fuzzer:
@@ -110,7 +170,7 @@ def construct_callgraph(args, binaries):
 
 
 def exec_distance_prog(dot, targets, out, names, cg_distance=None,
-                       cg_callsites=None, py_version=False):
+                       cg_callsites=None, py_version=False, jobs=None):
     """
     Args:
         dot: Path to dot-file representing the graph.
@@ -121,6 +181,7 @@ def exec_distance_prog(dot, targets, out, names, cg_distance=None,
         cg_callsites: Path to file containing mapping between basic blocks and
             called functions.
         py_version: If true, the python version is used.
+        jobs: Threads of the C++ version, all CPUs if None.
     """
     prog = DIST_BIN if not py_version else DIST_PY
     cmd = [prog,
@@ -131,6 +192,8 @@ def exec_distance_prog(dot, targets, out, names, cg_distance=None,
     if cg_distance is not None and cg_callsites is not None:
         cmd.extend(["-c", cg_distance,
                     "-s", cg_callsites])
+    if jobs is not None and not py_version:
+        cmd.extend(["-j", str(jobs)])
     pipe = subprocess.PIPE
     r = subprocess.run(cmd, stdout=pipe, stderr=pipe, check=True)
     return r
@@ -163,7 +226,13 @@ def calculating_distances(args):
     ftargets = args.temporary_directory / "Ftargets.txt"
     callgraph = dot_files / CALLGRAPH_NAME
     callgraph_distance = args.temporary_directory / "callgraph.distance.txt"
+    prog = DIST_BIN if not args.python_only else DIST_PY
 
+    if STEP == 1:
+        key = "cg-distance/" + digest(prog, callgraph, ftargets, fnames)
+        if cache_get(key, callgraph_distance):
+            print(f"({STEP}) Reusing distance for callgraph")
+            next_step(args)
     if STEP == 1:
         print(f"({STEP}) Computing distance for callgraph")
         log_p = args.temporary_directory / f"step{STEP}.log"
@@ -183,10 +252,13 @@ def calculating_distances(args):
                 f.write(r.stdout.decode())
                 f.write(r.stderr.decode())
             abort(args)
+        cache_put(key, callgraph_distance)
         next_step(args)
 
     with callgraph.open("r") as f:
         callgraph_dot = f.read()
+    inputs = (prog, read_lines(bbtargets), read_lines(bbnames),
+              read_lines(bbcalls), read_lines(callgraph_distance))
 
     # Helper
     def calculate_cfg_distance_from_file(cfg: Path):
@@ -196,6 +268,8 @@ def calculating_distances(args):
         if name not in callgraph_dot: return
         outname = name + ".distances.txt"
         outpath = cfg.parent / outname
+        key = "cfg-distance/" + cfg_key(cfg, *inputs)
+        if cache_get(key, outpath): return
         exec_distance_prog(
                 cfg,
                 bbtargets,
@@ -203,10 +277,13 @@ def calculating_distances(args):
                 bbnames,
                 callgraph_distance,
                 bbcalls,
-                py_version=args.python_only)
+                py_version=args.python_only,
+                jobs=1)     # the CFGs already run in parallel
+        outpath.touch()
+        cache_put(key, outpath)
     print(f"({STEP}) Computing distance for control-flow graphs (this might "
           "take a while)")
-    with ThreadPoolExecutor(max_workers=mp.cpu_count()) as executor:
+    with ThreadPoolExecutor(max_workers=args.jobs) as executor:
         results = executor.map(calculate_cfg_distance_from_file,
                                dot_files.glob("cfg.*.dot"))
 
@@ -271,6 +348,11 @@ def main():
                         action="store_true",
                         default=False,
                         help="Use the python version for distance calculation")
+    parser.add_argument("-j", "--jobs",
+                        type=int,
+                        default=mp.cpu_count(),
+                        help="Control-flow graphs computed at once (default: "
+                             "all CPUs)")
     args = parser.parse_args()
 
     # Additional sanity checks
@@ -1,20 +1,40 @@
 #include <stdint.h>
-#include <shmdata.h>
+#include "shmdata.h"
 
 #ifndef AFLGO_EXT_H
 #define AFLGO_EXT_H
 /*
- * This funciton replaces the prefix of generated inputs. The prefix is obtained 
- * from shared memory.
- * 
- * parameters: 
- * void* mem: the memory block containing the generated input by aflgo 
- *
- * uint32_t len: the size of the generated input
- *
+ * Points mem at the prefix of shm followed by the len bytes of mem, and adds
+ * the prefix length to len. The buffer belongs to add_prefix_common and stays
+ * valid until its next call; nothing is allocated unless the input grows.
  */
-
-void replace_with_prefix(void* mem, uint32_t len, PREFIX_SMEM* shm);
 void add_prefix_common(void** mem, uint32_t* len, PREFIX_SMEM* shm);
 
+/*
+ * The prefix add_prefix_common put in front of the last test case and the
+ * channel version it came from. AFLGo never mutates it: queue entries only
+ * hold what comes after it.
+ */
+const void* common_prefix(uint32_t* len);
+uint32_t common_prefix_version(void);
+
+/*
+ * Deferred model checking, see DEFERRED_TRACE in shmdata.h: the automata
+ * of the properties are loaded from the images in ltl_dir once, and a trace
+ * the runtime left in the shm is checked against each of them in-process,
+ * as ltl-trace checks counterexample traces.
+ */
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* the number of properties loaded, 0 if ltl_dir holds no image */
+int ltl_check_init(const char* ltl_dir);
+/* the first property trace violates, -1 if none */
+int ltl_check_trace(const DEFERRED_TRACE* trace);
+
+#ifdef __cplusplus
+}
+#endif
+
 #endif
@@ -0,0 +1,77 @@
+#include <stdint.h>
+#include <map>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#ifndef ASSIGNMENT_STATS_H
+#define ASSIGNMENT_STATS_H
+
+namespace ltlfuzz{
+
+const char assignmentsFile[] = "ltl_targets";   //next to ltl_stats
+const long int assignmentsInterval = 60;        //seconds between rewrites of the file
+const size_t assignmentsRows = 4096;            //triples kept apart, see AssignmentStats
+const char otherPaths[] = "*";
+
+/*
+ * What each assignment of the campaign got and gave: an (automaton path,
+ * event, target) triple is assigned when a worker starts on it, or takes
+ * it over by a prefix hand-off, and for every INPUT step. Per triple the
+ * file counts the assignments, the wall time the workers spent on it, the
+ * executions, the automaton paths found meanwhile (the share of each
+ * worker, as the rewards of the targets) and the counterexamples. A
+ * worker's executions and counterexamples are the execs_done and
+ * unique_crashes of its fuzzer_stats, which AFL updates every minute: an
+ * assignment ended by a hand-off may miss the last minute of them.
+ * Assignments still running are counted as far as they got. Past
+ * assignmentsRows triples, those of new automaton paths are added up
+ * under the path otherPaths of their (target, event).
+ */
+class AssignmentStats{
+    public:
+        AssignmentStats(const std::string& file, size_t slots);
+
+        /* slot starts on (path, event, target); execs, crashes, paths: the counters of its run so far */
+        void open(size_t slot, const std::string& path, const std::string& event, const std::string& target,
+                  long int now, uint64_t execs, uint64_t crashes, double paths);
+        /* the counters of the run in slot at now */
+        void update(size_t slot, long int now, uint64_t execs, uint64_t crashes, double paths);
+        /* ends the assignment of slot, if any, with its counters at now */
+        void close(size_t slot, long int now, uint64_t execs, uint64_t crashes, double paths);
+        /* an INPUT step of ns nanoseconds */
+        void input(const std::string& path, const std::string& event, const std::string& target,
+                   uint64_t ns, bool violated);
+        /* one row per triple, most wall time first; replaced by rename */
+        void write() const;
+
+    private:
+        typedef std::tuple<std::string, std::string, std::string> Key;  //target, event, path
+        struct Totals{
+            uint64_t assignments = 0;
+            double wall = 0;            //seconds
+            uint64_t execs = 0;
+            double paths = 0;
+            uint64_t counterexamples = 0;
+        };
+        struct Running{
+            bool active = false;
+            Key key;
+            long int started = 0;       //counters when it was assigned
+            uint64_t execs = 0;
+            uint64_t crashes = 0;
+            double paths = 0;
+            Totals now;                 //what it got since
+        };
+
+        void add(Totals& into, const Totals& from) const;
+        Totals& row(const Key& key);
+
+        std::string file;
+        std::map<Key, Totals> totals;   //ended assignments
+        std::vector<Running> slots;
+};
+
+}//namespace
+
+#endif
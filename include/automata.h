@@ -6,27 +6,20 @@
 #include <set>
 #include <vector>
 #include <stack>
+#include <mutex>
 #include <spot/twa/twagraph.hh>
 
-#include <exception.h>
+#include <automata_types.h>
+#include <automata_image.h>
+#include <event_dictionary.h>
 
 namespace lfz {
 namespace automata {
 
 typedef unsigned state_num_t;
 
-class AutomataException : public Exception {
-public:
-    AutomataException(const std::string &msg) noexcept;
-    AutomataException(const AutomataException &e) noexcept;
-    AutomataException &operator= (const AutomataException &e) noexcept;
-    ~AutomataException();
-
-    virtual const char *what() const noexcept override;
-
-private:
-    std::string msg_;
-};
+/* Satisfying assignments of a condition: [(BDD variable, polarity), ...] */
+typedef std::vector<std::vector<std::pair<int, bool>>> cubes_t;
 
 class State {
 public:
@@ -43,6 +36,11 @@ private:
     state_num_t state_num_;
 };
 
+/*
+ * Iterators wrap spot successor iterators and evaluate conditions through
+ * BuDDy, neither of which is thread-safe: an Iterator must stay on the
+ * thread that created it. Condition evaluation itself is reentrant.
+ */
 class Iterator {
 public:
     Iterator(spot::twa_succ_iterator *iter,
@@ -69,20 +67,13 @@ private:
     const std::unordered_map<int, std::string> *reverse_bdd_map_;
 };
 
-struct MCState {
-    MCState(int state, int distance, bool acceptance);
-
-    int state;
-    int distance;
-    bool acceptance;
-};
-
-
-typedef std::vector<std::pair<std::vector<std::set<std::string>>, int>> transitions_t;
-typedef std::vector<std::set<std::string>> events_t;
-typedef std::set<int> stateSet_t;
-typedef std::vector<std::stack<int>> paths_t;
-
+/*
+ * Once set_formula() returns, an Automata is immutable: model checking and
+ * the state transition/path queries read precomputed tables only, so a
+ * single instance may be queried from many threads without locking.
+ * set_formula(), get_init_state() and get_iterator() still go through spot
+ * and must not run concurrently with anything else.
+ */
 class Automata {
 public:
     Automata();
@@ -102,8 +93,35 @@ public:
     State get_init_state() const;
     Iterator get_iterator(const State &state) const;
 
+    /*
+     * Return the interned id of an event. Ids are dense in
+     * [0, other_event_id()]; events outside the automaton alphabet all map
+     * to other_event_id().
+     */
+    int event_id(const std::string &event) const;
+    int other_event_id() const;
+
+    /*
+     * Extend ids so that ids[d] is the event id of dictionary event d. Only
+     * the entries of events interned since the last call are computed.
+     */
+    void bind_events(const EventDictionary &dict, std::vector<int> &ids) const;
+
+    /*
+     * Model check a trace against the lowered transition table: one lookup
+     * per event.
+     */
     void model_check_events(const std::vector<std::string> &events,
                             std::vector<MCState> &states) const;
+    void model_check_events(const std::vector<int> &events,
+                            std::vector<MCState> &states) const;
+
+    /*
+     * Reference implementation walking spot iterators and BDD conditions.
+     * Only meant for debugging the lowered transition table.
+     */
+    void model_check_events_reference(const std::vector<std::string> &events,
+                                      std::vector<MCState> &states) const;
     /*
      * Return all transitions (with transition conditions) for an automata
      * state.
@@ -114,8 +132,25 @@ public:
      */
     void get_state_transitions(int state, transitions_t &transitions) const;
 
+    /*
+     * Memoized variants of get_state_transitions(). Each state is filled on
+     * first use (safely from any thread) and the returned references stay
+     * valid until the next set_formula().
+     */
+    const transitions_t &state_transitions(int state) const;
+    const id_transitions_t &state_transition_ids(int state) const;
+    const std::string &event_name(int id) const;
+
+    /*
+     * Shortest number of transitions from a state to an accepting cycle,
+     * NO_ACCEPTANCE if no accepting cycle is reachable. Precomputed by
+     * set_formula().
+     */
+    int distance_to_acceptance(int state) const;
+
     /*
      * Return all paths from the current state to the accepting states.
+     * Materializes every path; prefer PathEnumerator on large automata.
      */
     void get_state_paths(int curState, paths_t &paths, std::vector<int> aPath) const;
     
@@ -124,12 +159,94 @@ public:
      */
     void get_state_events(int curState, int nextState, events_t &events) const;
 
+    /*
+     * Write the lowered automaton to an image file that CompiledAutomata can
+     * map without spot (see automata_image.h).
+     *
+     * @throws AutomataException
+     */
+    void save(const std::string &path) const;
+
 private:
     spot::twa_graph_ptr automata_;
     std::unordered_map<std::string, int> bdd_map_;
     std::unordered_map<int, std::string> reverse_bdd_map_;
+
+    /*
+     * Lowered automaton: next_state_[state * (other_event_id() + 1) + event]
+     * is the successor state, or -1 if no transition is enabled.
+     */
+    std::vector<std::string> events_;
+    std::unordered_map<std::string, int> event_ids_;
+    std::vector<int> next_state_;
+    std::vector<bool> accepting_;
+    std::vector<int> distance_;
+
+    /* Outgoing edges of every state with their conditions as cubes */
+    struct Edge {
+        int dst;
+        cubes_t cond;
+    };
+    std::vector<std::vector<Edge>> edges_;
+
+    struct TransitionCache {
+        id_transitions_t ids;
+        transitions_t names;
+    };
+    mutable std::vector<TransitionCache> transition_cache_;
+    std::unique_ptr<std::once_flag[]> transition_cache_once_;
+
+    void build_transition_table();
+    void compute_distances();
+    void reset_transition_cache();
+    void fill_transition_cache(int state) const;
     void get_state_set(int curState, stateSet_t &stateSet) const;
-    void find_paths(std::stack<int> &sstack, paths_t &paths, std::vector<int> &isVisited, std::stack<int> &path) const;
+
+    friend class PathEnumerator;
+};
+
+/*
+ * Lazily enumerates the paths of get_state_paths() one at a time, shortest
+ * first. A path starts at curState, skips self loops, ends at the first
+ * accepting state it reaches and never goes through a state of aPath or
+ * twice through the same state.
+ *
+ * The search is an iterative deepening DFS with an explicit stack, so
+ * memory stays proportional to the current path length. max_length bounds
+ * the number of transitions of a path and max_count the number of paths
+ * returned; 0 means unbounded.
+ */
+class PathEnumerator {
+public:
+    PathEnumerator(const Automata &atm, int curState,
+                   const std::vector<int> &aPath = std::vector<int>(),
+                   size_t max_length = 0, size_t max_count = 0);
+
+    /*
+     * Store the next path (states from curState to the accepting state) in
+     * path and return true, or return false once the paths are exhausted.
+     */
+    bool next(std::vector<int> &path);
+
+private:
+    struct Frame {
+        int state;
+        std::vector<int> succ;
+        size_t next;
+    };
+
+    const Automata &atm_;
+    int start_;
+    size_t max_length_;
+    size_t max_count_;
+    size_t count_;
+    /* Current length bound and whether a longer path was cut by it */
+    size_t depth_;
+    bool truncated_;
+    std::vector<char> visited_;
+    std::vector<Frame> stack_;
+
+    void push(int state);
 };
 
 } // namespace automata
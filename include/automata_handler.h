@@ -1,9 +1,11 @@
 #include <iostream>
 #include <automata.h>
+#include <event_dictionary.h>
 #include <automata_transition.h>
 #include <event.h>
-#include <random_strategy.h>
+#include <select_strategy.h>
 #include <proposition.h>
+#include <state_path.h>
 #include <string>
 #include <sstream>
 #include <fstream>
@@ -14,19 +16,26 @@
 
 namespace ltlfuzz{
     extern std::set<std::string> ALL_EVENTS; //all exclusive events
+    extern lfz::automata::EventDictionary EVENT_DICT; //ids of all events the orchestrator deals with
+    extern std::vector<int> ALL_EVENT_IDS;  //EVENT_DICT ids of ALL_EVENTS
 	extern void load_ALL_EVENTS(std::string fileName); 
     class AutomataHandler{
         public:
             AutomataHandler(lfz::automata::Automata* atm);
-            std::string select_event(std::string curState, std::string aPath);
+            std::string select_event(int curState, const lfz::automata::StatePath& aPath);
             
         private:
             lfz::automata::Automata* atm;
+            std::vector<int> event_ids;  //automaton event id -> EVENT_DICT id
+            EventBits all_events;        //ALL_EVENT_IDS
+            //by state, transition and proposition: the events that satisfy it, compiled on the first visit
+            std::vector<std::vector<std::vector<EventBits>>> prop_events;
+            strategy::Candidates<const lfz::automata::Transition*> tran_candidates;
             
-            AutomataTransition select_tran(std::string curState, std::string aPath);
-            Proposition select_proposition(AutomataTransition tran);
-            EventSet extract_proposition_events(Proposition prop);
-            std::string select_event(EventSet eSet);
+            const lfz::automata::Transition& select_tran(int state, const lfz::automata::StatePath& aPath);
+            double transition_fitness(const lfz::automata::Transition& tran);
+            const std::vector<std::vector<EventBits>>& state_events(int state);
+            EventBits proposition_events(const std::vector<int>& prop);
 
     };
 }
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <stdint.h>
+#include <string>
+
+/*
+ * On-disk image of a lowered automaton, written by ltl-fuzz next to ltl.txt
+ * and mapped read-only by the instrumented targets.
+ *
+ * The header is followed by these sections, all 4-byte aligned:
+ *
+ *   int32_t  next_state[num_states * (num_events + 1)]
+ *   uint32_t accepting[num_states]
+ *   int32_t  distance[num_states]          hops to an accepting cycle
+ *   uint32_t state_edges[num_states + 1]   edge range of each state
+ *   int32_t  edge_dst[num_edges]
+ *   uint32_t edge_cubes[num_edges + 1]     cube range of each edge
+ *   uint32_t cube_literals[num_cubes + 1]  literal range of each cube
+ *   int32_t  literals[num_literals]        event id + 1, negated if < 0
+ *   char     names[names_size]             event names, NUL-terminated
+ *
+ * Column num_events of next_state is the event outside the alphabet.
+ */
+
+namespace lfz {
+namespace automata {
+
+const uint32_t AUTOMATA_IMAGE_MAGIC = 0x415a464c;   // "LFZA"
+const uint32_t AUTOMATA_IMAGE_VERSION = 2;
+const char AUTOMATA_IMAGE_FILE[] = "ltl.atm";
+
+/*
+ * Image of the property-th formula of a multi-property run: ltl.atm for the
+ * first one, ltl.<property>.atm for the others. Readers stop at the first
+ * missing index.
+ */
+inline std::string automata_image_file(unsigned property)
+{
+    if (property == 0) {
+        return AUTOMATA_IMAGE_FILE;
+    }
+    return "ltl." + std::to_string(property) + ".atm";
+}
+
+struct AutomataImageHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t num_states;
+    uint32_t num_events;
+    uint32_t init_state;
+    uint32_t num_edges;
+    uint32_t num_cubes;
+    uint32_t num_literals;
+    uint32_t names_size;
+};
+
+} // namespace automata
+} // namespace lfz
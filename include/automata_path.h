@@ -1,5 +1,6 @@
 #include <string>
 #include <iostream>
+#include <state_path.h>
 
 #ifndef AUTOMATA_PATH_H
 #define AUTOMATA_PATH_H
@@ -7,15 +8,21 @@
 namespace ltlfuzz{
     class AutomataPath{
         public:
-            std::string path;
+            int property;
+            lfz::automata::StatePath states;
             
-            AutomataPath(std::string path){
-                this->path = path;
+            AutomataPath(int property, const lfz::automata::StatePath& states){
+                this->property = property;
+                this->states = states;
             }
             ~AutomataPath(){}
 
+            std::string str() const{
+                return std::to_string(this->property) + "#" + this->states.str();
+            }
+
             void dump(){
-                std::cout << "path: " << this->path << std::endl;
+                std::cout << "path: " << str() << std::endl;
             }
     };
 }
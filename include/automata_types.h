@@ -0,0 +1,62 @@
+#pragma once
+
+#include <string>
+#include <set>
+#include <vector>
+#include <stack>
+
+#include <exception.h>
+
+/*
+ * Types shared by the spot-backed Automata and the spot-free
+ * CompiledAutomata used by the instrumentation runtime.
+ */
+
+namespace lfz {
+namespace automata {
+
+const int NO_ACCEPTANCE = -1;
+
+class AutomataException : public Exception {
+public:
+    AutomataException(const std::string &msg) noexcept;
+    AutomataException(const AutomataException &e) noexcept;
+    AutomataException &operator= (const AutomataException &e) noexcept;
+    ~AutomataException();
+
+    virtual const char *what() const noexcept override;
+
+private:
+    std::string msg_;
+};
+
+/*
+ * distance is the number of transitions from state to the closest accepting
+ * cycle, NO_ACCEPTANCE if none is reachable.
+ */
+struct MCState {
+    MCState(int state, int distance, bool acceptance);
+
+    int state;
+    int distance;
+    bool acceptance;
+};
+
+
+/*
+ * A transition whose condition is kept as interned event ids. Every cube
+ * lists literals as event id + 1, negated when the event must not occur.
+ */
+struct Transition {
+    std::vector<std::vector<int>> cond;
+    int dst;
+};
+
+typedef std::vector<Transition> id_transitions_t;
+typedef std::vector<std::pair<std::vector<std::set<std::string>>, int>> transitions_t;
+typedef std::vector<std::set<std::string>> events_t;
+typedef std::set<int> stateSet_t;
+typedef std::vector<std::stack<int>> paths_t;
+
+} // namespace automata
+} // namespace lfz
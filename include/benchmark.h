@@ -0,0 +1,49 @@
+#include <stdint.h>
+#include <string>
+#include <table_stats.h>
+
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+namespace ltlfuzz{
+
+const char benchDir[] = "bench_output/";    //under the subject, replaced by every benchmark
+const char benchResultsFile[] = "ltl_bench";
+const char benchPlotFile[] = "ltl_bench_plot";
+const long int benchSampleSecs = 10;        //between two rows of the plot
+
+/*
+ * ltl-fuzz bench: what a campaign of fixed budget and seeds achieved, to
+ * compare builds on the same subject. dir is the output folder of the
+ * campaign; ltl_bench_plot gets a row every benchSampleSecs, as AFL's
+ * plot_data does, and ltl_bench the results once it ended, in the format
+ * of fuzzer_stats. Executions are those of the orchestrator's INPUT steps
+ * and the execs_done of every AFLGo run, which AFL updates every minute
+ * and when the run ends. A counterexample was found when its file was
+ * written, under crashes/ or a run's replayable-crashes/.
+ */
+class Benchmark{
+    public:
+        Benchmark(const std::string& dir, long int start, long int budget, uint64_t seed, unsigned workers);
+
+        /* a row of the plot if benchSampleSecs passed since the last one */
+        void sample(const path::table_stats& stats, uint64_t input_execs);
+        void finish(const path::table_stats& stats, uint64_t input_execs, long int iterations, uint64_t busy_ns);
+
+    private:
+        uint64_t execs(uint64_t input_execs);
+        /* how many counterexamples there are, first: when the earliest was written */
+        size_t counterexamples(long int& first);
+
+        std::string dir;
+        long int start;
+        long int budget;
+        uint64_t seed;
+        unsigned workers;
+        long int last_sample;
+        uint64_t last_execs = 0;
+};
+
+}//namespace
+
+#endif
@@ -0,0 +1,106 @@
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#ifndef CLUSTER_H
+#define CLUSTER_H
+
+/*
+ * Distributed campaigns: every node runs its own ltl-fuzz and AFLGo workers
+ * on the same property, and they exchange what they find through ltl-coord.
+ * A node pushes the prefixes stored in its table since its last push and
+ * pulls the records the other nodes pushed since its last pull; both go in
+ * batches over a short TCP connection. The coordinator keeps one copy of
+ * each record, by path key and content, so the same prefix is only sent
+ * around once. Each node selects only the automata paths whose table hash
+ * falls in its partition (hash % nodes == node), so that the cluster spreads
+ * over the frontier instead of all nodes chasing the same paths.
+ *
+ * Messages: a cluster_header, then count records, each a kind, a node and
+ * three length-prefixed strings (all integers little endian, as on the
+ * nodes themselves). On a new connection the coordinator first sends a
+ * random 64-bit challenge; the request answers it in auth with
+ * cluster_auth() of the secret both sides have in LTL_CLUSTER_SECRET.
+ * Replies carry the epoch of the coordinator, drawn at its start: positions
+ * of an earlier epoch mean nothing to a restarted coordinator.
+ */
+
+namespace ltlfuzz{
+
+const uint32_t clusterMagic = 0x4c544c43;      //"LTLC"
+const uint32_t clusterBatch = 4096;            //records per message at most
+const uint32_t clusterMaxField = 4 << 20;      //bytes of one string of a record at most
+const uint32_t clusterMaxMessage = 32 << 20;   //bytes of the records of a message at most
+const char clusterEnv[] = "LTL_CLUSTER";       //host:port of ltl-coord
+const char nodeEnv[] = "LTL_NODE";             //id of this node, from 0
+const char nodesEnv[] = "LTL_NODES";           //nodes in the cluster
+const char syncEnv[] = "LTL_SYNC_SECS";        //seconds between two syncs
+const char secretEnv[] = "LTL_CLUSTER_SECRET"; //shared by the nodes and ltl-coord
+
+enum ClusterMessage : uint32_t{
+    CLUSTER_PUSH = 1,       //records from a node
+    CLUSTER_PULL = 2,       //records of the other nodes after since
+    CLUSTER_BATCH = 3       //reply to both, since is the next position; a pull is done at count 0
+};
+
+enum ClusterKind : uint32_t{
+    CLUSTER_PREFIX = 0,             //key: path key, data: prefix, extra: metric
+    CLUSTER_COUNTEREXAMPLE = 1      //key: file name, data: the input, extra: automata path
+};
+
+struct ClusterRecord{
+    uint32_t kind;
+    uint32_t node;
+    std::string key;
+    std::string data;
+    std::string extra;
+};
+
+struct cluster_header{
+    uint32_t magic;
+    uint32_t type;
+    uint32_t node;
+    uint32_t count;
+    uint64_t since;
+    uint64_t epoch;         //replies: of the coordinator
+    uint64_t auth;          //requests: answer to the challenge
+};
+
+/* bytes a record takes in a message */
+size_t record_size(const ClusterRecord& r);
+/* one message on a socket; false if the peer went away or sent garbage */
+bool send_message(int fd, const cluster_header& header, const std::vector<ClusterRecord>& records);
+bool receive_message(int fd, cluster_header& header, std::vector<ClusterRecord>& records);
+/* keyed hash (SipHash-2-4) of a challenge; 0 without a secret */
+uint64_t cluster_auth(const std::string& secret, uint64_t challenge);
+
+class ClusterClient{
+    public:
+        /* address is host:port */
+        ClusterClient(const std::string& address, unsigned node);
+
+        unsigned node() const;
+        /* false if the coordinator could not be reached, the records are kept for the next push */
+        bool push(const std::vector<ClusterRecord>& records);
+        /* appends what the other nodes pushed since the last pull */
+        bool pull(std::vector<ClusterRecord>& records);
+
+    private:
+        int connect_coordinator();
+        bool exchange(cluster_header& request, const std::vector<ClusterRecord>& records,
+                      cluster_header& reply, std::vector<ClusterRecord>& received);
+        /* true if the coordinator restarted, since is reset then */
+        bool new_epoch(const cluster_header& reply);
+
+        std::string host;
+        std::string port;
+        std::string secret;
+        unsigned node_id;
+        uint64_t since;
+        uint64_t epoch;         //of the coordinator, 0 before the first reply
+        std::vector<ClusterRecord> pending;     //not pushed yet
+};
+
+}//namespace
+
+#endif
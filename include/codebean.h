@@ -1,7 +1,13 @@
 #include <stdint.h>
 #include <string>
+#include <string_view>
 #include <vector>
-#include <automata.h>
+#include <compiled_automata.h>
+#include <state_path.h>
+#include <event_dictionary.h>
+#include <trace_arena.h>
+#include <runtime_stats.h>
+#include <counterexample_trace.h>
 #include <shmdata.h>
 #include <iostream>
 #include <fstream>
@@ -10,12 +16,16 @@
 #include <cstring>
 #include <sys/shm.h>
 #include <sys/types.h>
+#include <unistd.h>
 #include <pathwriter.h>
+#include <prefix_log.h>
 #include <utility> 
 #include <map>
 #include <fstream>
 #include <sstream>
-#include <boost/functional/hash.hpp>
+#include <unordered_set>
+#include <unordered_map>
+#include <memory>
 
 #ifndef CODEBEAN_H
 #define CODEBEAN_H
@@ -28,39 +38,184 @@ namespace inst{
             static int MAP_SIZE; 
             
             static std::vector<int> trace_common;
-            static std::vector<std::string> trace_protocol;
-            static std::vector<std::string> input_protocol;
-            static std::map<std::string, int32_t> distance_map;
+            static std::vector<std::string_view> input_protocol;   //views into trace_arena
+            static TraceArena trace_arena;   //constant-initialized, see preload()
             static std::vector<size_t> state_vector; 
             static int offset;
-            static std::string distance_file_path; 
             static std::string delimiter;
             static std::string delimiter_prefix;
             static std::string delimiter_ltl;
             static std::string ltl_formula_path;
             static std::string DRY_RUN_ENV;
-            static void init_distance_map();
-            static void collect_proposition(std::string prop);
-            static void collect_input(std::string input);
+            static std::string VERBOSE_ENV;
+            static std::string STATE_HASH_ENV;
+            static size_t TRACE_RESERVE;
+            static void collect_proposition(const char* prop);
+            static void collect_input(const char* input);
             static void collect_trace(int input, int output);
             static void collect_state(long *ptr, int *size, int num);
             static void evaluate_trace(int flag);
-            static int32_t get_distance_to_target(char* block_id);
+            static void end_iteration(int flag);
+            static void reset_trace();
+            static void preload();
             static void init_shared_memory();
+            static void input_opened(FILE* file, const char* path, const char* mode);
         
         private:
             CodeBean(){}
-            static std::map<int, std::string> event_reverse_map; 
-            static std::map<std::string, int> prop_to_loc;
-            static std::vector< std::pair<std::string, int> > prop_loc_vec;
-            static std::vector<std::string> trace_string;
-            static void saved_prefix_path(std::string aPath, std::string prefix);
-            static void load_event_reverse_map();
-            static void normalize_trace();
-            static int get_last_state(std::string aPath);
-            static void check_conditions(std::vector<std::set<std::string>> events, unsigned int begin_loc, unsigned int end_loc, int flag);
-            static void check_acceptance(std::vector<lfz::automata::MCState> states, std::string aPath, int flag);
-            static void extract_prefix_automata_path(std::vector<lfz::automata::MCState> states, std::string& aPath, std::string& prefix, int flag);
+            static VERDICT_SMEM* verdict;         //(VERDICT_SMEM*)-1 outside a campaign, see preload()
+            [[noreturn]] static void report_counterexample(int property, const lfz::automata::StatePath& aPath, TraceViolation violation);
+            //a violating trace goes to TRACE_FILE_ENV_VAR too, see counterexample_trace.h
+            static int trace_mode;     //-1 until tracing() read the environment
+            static bool tracing();
+            static std::vector<int> state_events;   //trace events before every program state, when tracing() or deferred()
+            static void save_counterexample_trace(int property, TraceViolation violation);
+            static int verbose_mode;   //-1 until verbose() read the environment
+            static bool verbose();
+
+            //snapshot mode (RERS): the fork server starts once the prefix is
+            //consumed, and each child reopens the files read so far, see afl-llvm-rt
+            struct InputFile{
+                FILE* file;
+                std::string path;
+                std::string mode;
+                long offset;      //position at the snapshot
+            };
+            static std::string SNAPSHOT_ENV;
+            static long snapshot_prefix;   //-1 unread, 0 off or taken, else prefix bytes
+            static std::vector<InputFile> input_files;
+            static bool snapshot_pending();
+            static void snapshot_point();
+
+            //incremental state hashing: per-variable hashes and a copy of
+            //the variables of the last collect_state call
+            struct StateVar{
+                long ptr;
+                int size;
+                size_t offset;      //in state_snapshot
+                uint64_t hash;
+            };
+            static int state_hash_mode;   //-1 unread, 0 full, 1 incremental
+            static std::vector<StateVar> state_vars;
+            static std::vector<unsigned char> state_snapshot;
+            static bool state_snapshot_valid;
+            static size_t hash_state(long *ptr, int *size, int num);
+            //events of the trace as EventDictionary ids: "i"/"o"-prefixed
+            //inputs and outputs (RERS) or propositions (protocols)
+            static lfz::automata::EventDictionary events;
+            static std::map<int, int> input_events;
+            static std::map<int, int> output_events;
+            static std::vector<int> trace_events;
+            static size_t protocol_inputs;          //inputs of the session, some not kept when streaming()
+            //event id of each proposition string of the pass, by address
+            static std::unordered_map<const char*, int> prop_events;
+            static void proposition_event(const char* prop, int event);
+
+            static std::vector<int> state_prev;     //previous position of every program state, -1 if new
+            static std::unordered_map<size_t, int> state_last_pos;
+
+            //streaming acceptance (protocols, STREAMING_ENV_VAR): the trace and
+            //program state histories are not kept, the lassos are checked as
+            //the program states arrive against a bounded summary per
+            //accepting state, see stream_lasso()
+            static int stream_mode;    //-1 until streaming() read the environment
+            static bool streaming();
+            static bool keep_history();     //of the trace, states and automaton states
+            static uint64_t stream_events;  //propositions of the session
+            static size_t STREAM_INPUTS_MAX;
+            static size_t STREAM_STATES_MAX;
+            struct StreamWindow{
+                const std::vector<std::vector<int>>* self_loop = nullptr;
+                std::vector<int64_t> last_fail;     //per cube of self_loop: last event it did not hold on
+                std::unordered_map<size_t, uint64_t> first_seen;  //program state -> events before it
+                size_t prune_at = 64;
+            };
+
+            //prefix counts over trace_events of the events of a condition, so
+            //that the events of any window are summarized in constant time
+            struct EventCounts{
+                std::vector<int> columns;       //automaton event id -> column, -1 if not counted
+                size_t width = 0;
+                size_t rows = 0;                //trace events counted so far
+                std::vector<unsigned> counts;   //counts[pos * width + column]: occurrences before pos
+                void build(int num_events, const std::vector<std::vector<int>>& cond);
+                void extend(const std::vector<int>& event_ids);
+                unsigned count(int event, unsigned int begin_loc, unsigned int end_loc) const;
+            };
+
+            //one automaton per property, all stepped online as events arrive
+            struct PropertyRun{
+                lfz::automata::CompiledAutomata automata;
+                std::vector<lfz::automata::MCState> mc_states;
+                int mc_state = -2;                      //-1 once the trace left the automaton
+                int mc_path_loc = 0;                    //trace position of the last automaton state change
+                size_t mc_path_input = 0;               //protocols: inputs before the last automaton state change
+                lfz::automata::StatePath mc_path;       //running automaton path
+                std::string mc_prefix;                  //running prefix (RERS)
+                std::unordered_set<size_t> lasso_states; //program states seen since entering mc_state
+                std::vector<int> event_ids;             //dictionary id -> automaton event id
+                bool seen_accepting = false;            //some state of mc_states is accepting
+                //evaluation state, so that repeated evaluate_trace calls only
+                //look at what the trace gained since the previous one
+                int checked_state = -1;                 //last path state the lassos were checked against
+                size_t checked_states = 0;              //program states whose lasso has been checked
+                const std::vector<std::vector<int>>* self_loop = nullptr;
+                EventCounts summary;                    //over the self-loop condition of checked_state
+                size_t written_path_len = 0;            //states of mc_path when last evaluated
+                //streaming(): one window per accepting state the trace was in
+                std::unordered_map<int, StreamWindow> stream_windows;
+                int stream_state = -2;                  //mc_state after the last streamed event
+                uint64_t stream_entered = 0;            //events streamed when it was entered
+            };
+            static std::vector<std::unique_ptr<PropertyRun>> properties;
+            static int live_properties;  //properties whose automaton still follows the trace
+
+            //configuration read by preload() in the fork server parent, so
+            //that the children inherit it instead of reading files per exec;
+            //held on the heap because the statics above are not constructed
+            //yet at that point, and moved into them by adopt_preloaded()
+            struct Preloaded{
+                lfz::automata::EventDictionary events;
+                std::map<int, int> input_events;
+                std::map<int, int> output_events;
+                std::vector<std::unique_ptr<PropertyRun>> properties;
+                //trace storage reserved up front, so children do not allocate it
+                std::vector<int> trace_common;
+                std::vector<int> trace_events;
+                std::vector<int> state_prev;
+                std::vector<size_t> state_vector;
+                std::vector<std::string_view> input_protocol;
+            };
+            static Preloaded* preloaded;
+            static bool config_tried;
+            static void adopt_preloaded();
+            static bool read_event_map(const char* subject, lfz::automata::EventDictionary& dict, std::map<int, int>& inputs, std::map<int, int>& outputs);
+            static void read_automata(const char* subject, std::vector<std::unique_ptr<PropertyRun>>& runs);
+
+            static int prefix_log_fd;   //protocols: opened by preload() or on the first prefix
+            static void saved_prefix_path(const std::string& aPath, const std::string& prefix);
+            static void load_event_map();
+            static int trace_event(std::map<int, int>& code_events, int code, const std::string& kind);
+            static bool load_automata();
+            static void step_automata(PropertyRun& run, int event, int flag);
+            static void step_properties(int event, int flag);
+            static int automata_map_mode;   //-1 until LTL_AUTOMATA_MAP is read
+            static bool automata_map();
+            static void record_transition(size_t property, int state, int event, int next, int distance);
+            static void record_event_offset();
+            /* the telemetry block of afl-fuzz, nullptr outside it */
+            static RUNTIME_STATS* runtime_stats();
+            /* afl-fuzz checks the lassos and the acceptance of the trace, see DEFERRED_TRACE */
+            static bool deferred();
+            static void write_deferred_trace();
+            /* afl-fuzz runs again an input whose checks and paths are done, see DEFERRED_TRACE */
+            static bool repeated();
+            static void check_conditions(int property, const lfz::automata::StatePath& aPath, const EventCounts& summary, const std::vector<std::vector<int>>& cond, unsigned int begin_loc, unsigned int end_loc);
+            static void check_acceptance(int property, PropertyRun& run, int flag);
+            static void stream_event(PropertyRun& run, int event);
+            static void stream_lasso(int property, PropertyRun& run, size_t hash);
+            static bool extract_prefix_automata_path(const PropertyRun& run, std::string& prefix, int flag);
+            static std::string prefix_metric(const PropertyRun& run);
 
     };
 }
@@ -0,0 +1,94 @@
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <automata_types.h>
+#include <automata_image.h>
+#include <event_dictionary.h>
+
+namespace lfz {
+namespace automata {
+
+/*
+ * Read-only view of an automaton image written by Automata::save(). It does
+ * not depend on spot, so the instrumented targets can model check traces
+ * without translating the formula in every execution.
+ */
+class CompiledAutomata {
+public:
+    CompiledAutomata();
+    CompiledAutomata(const CompiledAutomata &c) = delete;
+    CompiledAutomata &operator= (const CompiledAutomata &c) = delete;
+    ~CompiledAutomata();
+
+    /**
+     * @throws AutomataException
+     */
+    void load(const std::string &path);
+    bool valid() const;
+
+    int event_id(const std::string &event) const;
+    int other_event_id() const;
+    int init_state() const;
+
+    /* as Automata::bind_events */
+    void bind_events(const EventDictionary &dict, std::vector<int> &ids) const;
+
+    /*
+     * Single step of the lowered automaton: the successor of state on event,
+     * or -1 if no transition is enabled.
+     */
+    int next_state(int state, int event) const;
+    bool accepting(int state) const;
+    int distance_to_acceptance(int state) const;
+
+    void model_check_events(const std::vector<std::string> &events,
+                            std::vector<MCState> &states) const;
+    void model_check_events(const std::vector<int> &events,
+                            std::vector<MCState> &states) const;
+
+    /*
+     * Same format as Automata::get_state_transitions().
+     */
+    void get_state_transitions(int state, transitions_t &transitions) const;
+
+    /*
+     * Memoized transitions, decoded from the image on first use of a state.
+     * Not synchronized: the runtime collects traces on a single thread.
+     */
+    const transitions_t &state_transitions(int state) const;
+    const id_transitions_t &state_transition_ids(int state) const;
+
+private:
+    void *image_;
+    size_t image_size_;
+
+    const AutomataImageHeader *header_;
+    const int32_t *next_state_;
+    const uint32_t *accepting_;
+    const int32_t *distance_;
+    const uint32_t *state_edges_;
+    const int32_t *edge_dst_;
+    const uint32_t *edge_cubes_;
+    const uint32_t *cube_literals_;
+    const int32_t *literals_;
+
+    std::vector<std::string> events_;
+    std::unordered_map<std::string, int> event_ids_;
+
+    struct TransitionCache {
+        bool filled = false;
+        id_transitions_t ids;
+        transitions_t names;
+    };
+    mutable std::vector<TransitionCache> transition_cache_;
+
+    void unload();
+    const TransitionCache &transition_cache(int state) const;
+};
+
+} // namespace automata
+} // namespace lfz
@@ -0,0 +1,45 @@
+#include <stdint.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#ifndef CORPUS_H
+#define CORPUS_H
+
+namespace ltlfuzz{
+
+/*
+ * Inputs kept across AFLGo runs. When a worker's slot is reused, the queue
+ * its previous instance left in output_folder/fuzzing-* is harvested into
+ * output_folder/corpus/, one file per distinct content. Every new instance
+ * then starts from the original seeds plus the entries most relevant to its
+ * target: those found while fuzzing that target, then those AFL tagged as
+ * adding coverage or automaton transitions, newest first.
+ */
+class Corpus{
+    public:
+        Corpus(const std::string& dir, const std::string& initial_seeds, size_t seeds);
+
+        /* adds the queue of the AFLGo output directory fuzzing_dir, run on target */
+        void harvest(const std::string& fuzzing_dir, const std::string& target);
+        /* refills seed_dir for a run on target and returns it */
+        std::string seed(const std::string& target, const std::string& seed_dir);
+        size_t size() const;
+
+    private:
+        struct Entry{
+            std::string file;
+            std::string target;
+            bool coverage;      //AFL's +cov or +ltl tag
+            long int found;
+        };
+
+        std::string dir;
+        std::string initial_seeds;
+        size_t seeds;
+        std::unordered_map<uint64_t, Entry> entries;    //by content hash
+};
+
+}//namespace
+
+#endif
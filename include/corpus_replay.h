@@ -0,0 +1,49 @@
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <pathstore.h>
+#include <compiled_automata.h>
+#include <counterexample_trace.h>
+
+#ifndef CORPUS_REPLAY_H
+#define CORPUS_REPLAY_H
+
+namespace ltlfuzz{
+
+/*
+ * ltl-fuzz replay: seeds the path table of a RERS campaign with what earlier
+ * campaigns on the same subject found, before directed fuzzing starts.
+ * Inputs run through the instrumented subject, one fork server per thread,
+ * and the runtime stores the automaton paths and prefixes of the current
+ * properties they reach, as in any execution. Counterexample traces (see
+ * counterexample_trace.h) are model checked against the automata of the
+ * current properties without running anything.
+ */
+class CorpusReplay{
+    public:
+        CorpusReplay(path::PathsStore* path_store, const std::string& ltl_dir, const std::string& events_mapping_file);
+
+        /* the files of dir, traces told apart by their suffix */
+        void add_dir(const std::string& dir);
+        size_t inputs() const;
+        size_t traces() const;
+        /* runs the inputs through binary from workdir on threads threads,
+           each writing its input under input_dir, then stores the paths of the traces */
+        void run(const std::string& workdir, const std::string& binary, const std::string& input_dir,
+                 unsigned threads, unsigned timeout_ms);
+
+    private:
+        void run_inputs(const std::string& workdir, const std::string& binary, const std::string& input_dir,
+                        unsigned threads, unsigned timeout_ms);
+        bool replay_trace(const inst::CounterexampleTrace& trace, int property, const lfz::automata::CompiledAutomata& automata);
+
+        path::PathsStore* path_store;
+        std::string ltl_dir;
+        std::unordered_map<std::string, int> event_codes;   //"i"/"o"-prefixed event name -> input or output code
+        std::vector<std::string> input_files;
+        std::vector<std::string> trace_files;
+};
+
+}//namespace
+
+#endif
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <compiled_automata.h>
+#include <state_path.h>
+
+/*
+ * Compact binary record of a violating execution, written by the runtime
+ * to the file in TRACE_FILE_ENV_VAR (see shmdata.h) when it reports a
+ * counterexample, and decoded by ltl-trace, which checks it again against
+ * the automaton image without running the subject:
+ *
+ *   CounterexampleTraceHeader
+ *   char     names[names_size]          dictionary event names, NUL-terminated
+ *   varint   events[num_events]         dictionary id of every trace event
+ *   varint   state_events[num_states]   trace events before each program state, delta-coded
+ *   uint64_t hashes[num_hashes]         distinct program state hashes
+ *   varint   states[num_states]         index in hashes of each program state
+ *   varint   mc_states[num_mc_states]   automaton state after each event, zigzag-coded
+ *
+ * Varints are LEB128. The automaton states are those of the violated
+ * property, -1 once the trace left the automaton.
+ */
+
+namespace inst {
+
+const uint32_t COUNTEREXAMPLE_TRACE_MAGIC = 0x5254464c;   // "LFTR"
+const uint32_t COUNTEREXAMPLE_TRACE_VERSION = 1;
+
+/* how the runtime found the violation */
+enum TraceViolation : uint32_t {
+    TRACE_LASSO = 0,        // a program state repeated in an accepting automaton state
+    TRACE_NO_SELF_LOOP = 1, // the path ends in an accepting state without a self loop
+    TRACE_SELF_LOOP = 2     // the self loop of the last state holds over a lasso
+};
+
+struct CounterexampleTraceHeader {
+    uint32_t magic;
+    uint32_t version;
+    int32_t property;
+    uint32_t violation;
+    uint32_t protocol;      // 1 for propositions, 0 for RERS input/output pairs
+    uint32_t num_names;
+    uint32_t names_size;
+    uint32_t num_events;
+    uint32_t num_states;
+    uint32_t num_hashes;
+    uint32_t num_mc_states;
+    uint32_t reserved;
+};
+
+struct CounterexampleTrace {
+    int property = 0;
+    uint32_t violation = TRACE_LASSO;
+    bool protocol = false;
+    std::vector<std::string> names;
+    std::vector<int> events;
+    std::vector<int> state_events;      // absolute, not delta-coded
+    std::vector<uint64_t> state_hashes;
+    std::vector<int> mc_states;
+
+    void encode(std::string &out) const;
+    /* false if data is not a whole trace of this version */
+    bool decode(const std::string &data);
+};
+
+/* write trace to file at once, replacing it */
+bool write_counterexample_trace(const char *file, const CounterexampleTrace &trace);
+bool read_counterexample_trace(const std::string &file, CounterexampleTrace &trace);
+
+/* what stepping a trace through the automaton of its property found */
+struct TraceReplay {
+    std::vector<int> mc_states;     // automaton state after each event
+    std::vector<bool> accepting;
+    lfz::automata::StatePath path;
+    int mismatch = -1;              // first event whose automaton state differs from the recorded one
+    int violation = -1;             // a TraceViolation, -1 if none was found
+};
+
+/*
+ * Steps automata through trace as the runtime does, checks the lassos at
+ * every program state and then the end of the trace, so that ltl-trace and
+ * afl-fuzz find the violations the runtime would have found. ids:
+ * automata.bind_events() of a dictionary holding trace.names.
+ */
+void replay_counterexample_trace(const lfz::automata::CompiledAutomata &automata, const CounterexampleTrace &trace,
+                                 const std::vector<int> &ids, TraceReplay &r);
+
+} // namespace inst
@@ -1,31 +1,56 @@
-#include <iostream>
-#include <string>
-#include <set>
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
 
 #ifndef EVENT_H
 #define EVENT_H
 
 namespace ltlfuzz{
 
-enum EventType {ACCEPT,REJECT};
-
-class EventSet{
-    
+/* a set of EVENT_DICT ids, one bit each; picking its k-th event costs a
+   popcount per word and never allocates */
+class EventBits{
     public:
-        std::set<std::string> events;
-        ltlfuzz::EventType eventType;
-        EventSet(std::set<std::string>  events, const ltlfuzz::EventType eventType){
-            this->events = events;
-            this->eventType = eventType;
+        void set(int id){
+            if((size_t)id / 64 >= this->words.size()){
+                this->words.resize(id / 64 + 1, 0);
+            }
+            uint64_t bit = 1ULL << (id % 64);
+            this->total += !(this->words[id / 64] & bit);
+            this->words[id / 64] |= bit;
         }
-        ~EventSet(){}
-
-        void dump(){
-            std::cout << "event name: " << "event Type" << this->eventType <<std::endl;
+        void reset(int id){
+            if((size_t)id / 64 < this->words.size() && (this->words[id / 64] & (1ULL << (id % 64)))){
+                this->words[id / 64] &= ~(1ULL << (id % 64));
+                this->total--;
+            }
+        }
+        size_t count() const{
+            return this->total;
         }
+        /* the id of the k-th event of the set, k < count() */
+        int nth(size_t k) const{
+            for(size_t w = 0; w < this->words.size(); w++){
+                size_t n = __builtin_popcountll(this->words[w]);
+                if(k >= n){
+                    k -= n;
+                    continue;
+                }
+                uint64_t word = this->words[w];
+                while(k--){
+                    word &= word - 1;   //drops the lowest bit
+                }
+                return w * 64 + __builtin_ctzll(word);
+            }
+            return -1;
+        }
+
+    private:
+        std::vector<uint64_t> words;
+        size_t total = 0;
 };
 }//namespace
- 
+
 
 
 #endif
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace lfz {
+namespace automata {
+
+/*
+ * Dense integer ids for event names. The orchestrator fills it from
+ * all_events.txt and the instrumented runtime from event_mapping.txt; the
+ * automata translate dictionary ids to their own event ids once (see
+ * bind_events()), so traces are stepped and compared as integers.
+ */
+class EventDictionary {
+public:
+    /* Id of name, assigning the next free id if it is new */
+    int intern(const std::string &name);
+    /* Id of name, -1 if it was never interned */
+    int id(const std::string &name) const;
+    const std::string &name(int id) const;
+    size_t size() const;
+
+private:
+    std::vector<std::string> names_;
+    std::unordered_map<std::string, int> ids_;
+};
+
+} // namespace automata
+} // namespace lfz
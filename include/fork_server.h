@@ -0,0 +1,41 @@
+#include <string>
+#include <utility>
+#include <vector>
+#include <sys/types.h>
+
+#ifndef FORK_SERVER_H
+#define FORK_SERVER_H
+
+namespace ltlfuzz{
+
+/*
+ * The AFL fork server of an instrumented subject, driven by the
+ * orchestrator itself to run INPUT steps: the binary is executed once and
+ * every run is a fork() of it, reported back over the control pipes of
+ * afl-llvm-rt (FORKSRV_FD and FORKSRV_FD + 1). Verdicts come through the
+ * verdict shm, the output of the subject is discarded.
+ */
+class ForkServer{
+    public:
+        ForkServer();
+        ~ForkServer();
+
+        /* false if binary did not answer as a fork server; env is added to its environment */
+        bool start(const std::string& workdir, const std::string& binary, const std::vector<std::string>& args,
+                   const std::vector<std::pair<std::string, std::string>>& env = {});
+        bool running() const;
+        /* one execution, its wait status; -1 if the server died */
+        int run(unsigned timeout_ms);
+        void stop();
+
+    private:
+        bool read_word(int fd, int& value, int timeout_ms);
+
+        pid_t pid;
+        int ctl_fd;     //we write: run once
+        int st_fd;      //we read: child pid, then its status
+};
+
+}//namespace
+
+#endif
@@ -1,4 +1,6 @@
 #include <stdint.h>
+#include <stdio.h>
+#include <sys/socket.h>
 #include <sys/time.h>
 
 #ifndef INSTRUMENT_H
@@ -10,22 +12,32 @@ extern "C" {
 
 //For RERS
 void automata_handler(int input, int output);
+FILE* ltl_fopen(const char* path, const char* mode);  //replaces the subject's fopen
 
 //For protocols
 void proposition_handler(const char* prop);
 void input_handler(const char* input);
+//replace the server's socket calls, see server_events.h
+int ltl_accept(int fd, struct sockaddr* addr, socklen_t* len);
+int ltl_accept4(int fd, struct sockaddr* addr, socklen_t* len, int flags);
+ssize_t ltl_recv(int fd, void* buf, size_t len, int flags);
+ssize_t ltl_recvfrom(int fd, void* buf, size_t len, int flags, struct sockaddr* addr, socklen_t* addr_len);
+ssize_t ltl_read(int fd, void* buf, size_t len);
 
 void state_handler(long *ptr, int *size, int num);
 void evaluate_trace(int flag); //0: RESR; 1: protocols
 
+//For persistent mode: evaluate (RERS) and drop the trace of one iteration
+void ltl_iteration(int flag);
+void ltl_reset_trace();
+
 /**
     Record beginning time and ending time
 **/
 long begin_time();
 void end_time(long btime);
 
-int32_t get_distance_to_target(char* block_id);
-void init_distance_map();
+void __ltl_preload();
 void init_shared_memory();
 
 #if defined(__cplusplus)
@@ -11,10 +11,63 @@
 #include <automata_handler.h>
 #include <target_location.h>
 #include <boost/process.hpp>
+#include <worker_pool.h>
+#include <corpus.h>
+#include <fork_server.h>
+#include <cluster.h>
+#include <benchmark.h>
+#include <assignment_stats.h>
+#include <memory>
 
 namespace ltlfuzz{
 
-    
+    //parallel campaigns, see Config-Options.md
+    const char workersEnv[] = "LTL_WORKERS";                    //AFLGo instances at once
+    const char targetInstancesEnv[] = "LTL_TARGET_INSTANCES";   //of them on the same target
+    const char cpuBaseEnv[] = "LTL_CPU_BASE";                   //first CPU to pin to, -1 to leave it to AFL
+    const char prefixCapacityEnv[] = "LTL_PREFIX_KB";           //size of the prefix channel of each worker
+    const char seedsEnv[] = "LTL_SEEDS";                        //corpus inputs added to the seeds of a run
+    const char plateauEnv[] = "LTL_PLATEAU";                    //seconds without progress before a run is stopped
+    const char resumeEnv[] = "LTL_RESUME";                      //1 to continue from the last snapshot
+    const char snapshotEnv[] = "LTL_SNAPSHOT_SECS";             //seconds between snapshots of the table
+    const char replayThreadsEnv[] = "LTL_REPLAY_THREADS";       //threads of ltl-fuzz replay
+    const char seedEnv[] = "LTL_SEED";                          //selections and AFLGo runs, reproducible
+    const unsigned inputTimeoutMs = 1000;  //for one INPUT step run through the fork server
+    const long int handoffMargin = 30;     //seconds before its deadline a worker may take a new prefix
+
+
+/* time the orchestrator spends on its own work, paused while it waits for
+   workers or runs INPUT steps */
+struct BusyClock{
+    uint64_t ns = 0;
+    bool running = false;
+    std::chrono::steady_clock::time_point since;
+
+    void resume(){
+        if(!running){
+            since = std::chrono::steady_clock::now();
+            running = true;
+        }
+    }
+    void pause(){
+        if(running){
+            ns += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - since).count();
+            running = false;
+        }
+    }
+};
+
+/* what the orchestrator follows of the run in a worker slot */
+struct WorkerRun{
+    std::string out_dir;        //empty once retired
+    std::string target;
+    long int started = 0;
+    long int progress = 0;      //last new automaton path, or prefix hand-off
+    double paths = 0;           //its share of the automaton paths found while it ran
+    uint64_t execs = 0;         //execs_done and unique_crashes of its fuzzer_stats, when last supervised
+    uint64_t crashes = 0;
+};
+
 class LTLFuzzer{
     public:
         std::string aflgo_paras;
@@ -37,11 +90,14 @@ class LTLFuzzer{
         std::string output_folder;
         std::string events_mapping_file;
         std::string all_events_file;
-        std::string prefixDir;
+        std::string prefixLog;    //protocols: prefix log under the subject directory
+        std::string statsFile;    //campaign counters, rewritten every iteration
+        std::string targetsFile;  //per (automata path, event, target) assignment, see assignment_stats.h
+        std::string snapshotFile; //RERS: the shared table, rewritten every LTL_SNAPSHOT_SECS
         int size=0;
 
         path::PathsStore* path_store;
-        AutomataHandler* automata_handler;
+        std::vector<AutomataHandler*> automata_handlers;  //one per property
         TargetsStore* targets_store;
         
         
@@ -49,16 +105,57 @@ class LTLFuzzer{
         ~LTLFuzzer();
 
         void init(int flag);
+        /* seeds the table from inputs and traces in dirs, those of earlier runs if empty */
+        void replay(int flag, std::vector<std::string> dirs);
+        /* a fresh campaign of seconds under bench_output/, see benchmark.h */
+        void benchmark(int flag, int seconds);
         void fuzz(int flag);
 
     private:
         void save_input(std::string input_file, std::string folder);
         bool is_counterexample(std::string output);
 
-        void replace_prefix_run_program(std::string prefix);
-        std::string assemble_cmd(std::string target, int flag);
+        /* an INPUT step, true if it violated a property */
+        bool replace_prefix_run_program(std::string prefix);
+        Command assemble_cmd(std::string target, int flag, int slot, std::string seeds, std::string out_dir);
+        int expiring_worker(const WorkerPool& pool, const std::string& target);
+        void supervise(const WorkerPool& pool, int flag);
+        void retire(size_t slot, Corpus& corpus);
+        void read_run_stats(WorkerRun& run);
+        void write_stats(int flag, long int start, long int iterations);
+        void sync_cluster();
+        size_t write_input_dictionary(const std::string& file);
+        std::string binary_dir(const std::string& target) const;
+        std::string input_workdir();
+        void wait_for_build();
+
+        std::vector<int> prefix_channels;   //one per worker slot, see shmdata.h
+        std::vector<int> verdict_channels;  //one per worker slot: AFLGo resets its verdict before every execution
+        std::vector<PREFIX_SMEM*> prefix_maps;  //mapped once for the whole campaign
+        long int campaign_end;
+        long int plateau_time;
+        std::vector<WorkerRun> runs;        //one per worker slot
+        uint64_t table_paths;               //automaton paths stored when last supervised
+        uint64_t runs_started = 0;          //numbers the AFLGo seeds under LTL_SEED
+        uint64_t input_execs = 0;           //INPUT steps run
+        BusyClock busy;
+        std::unique_ptr<Benchmark> bench;   //ltl-fuzz bench only
+        std::unique_ptr<AssignmentStats> assignments;
+
+        //distributed campaigns, see cluster.h
+        ClusterClient* cluster = NULL;
+        std::vector<ClusterRecord> cluster_outbox;   //counterexamples found since the last sync
+
+        //INPUT steps: the program of the first target, forked from its fork server
+        std::string input_program;
+        ForkServer input_server;
+        bool input_server_tried = false;
+        int input_fd = -1;                  //the input file, rewritten in place
+        int verdict_shmid;
+        VERDICT_SMEM* verdict;
 
-        int prefix_shmid;
+        //RERS: target -> index of a subject instrumented for all targets, see DISTANCE_TARGETS_FILE
+        std::map<std::string, uint32_t> distance_targets;
         
     };
 }
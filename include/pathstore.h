@@ -1,14 +1,17 @@
 #include <shared_table.h>
+#include <prefix_log.h>
+#include <table_snapshot.h>
+#include <cluster.h>
 #include <string>
 #include <vector>
+#include <set>
+#include <unordered_map>
 #include <automata_path.h>
 #include <automata_transition.h>
 #include <prefix.h>
 #include <target_location.h>
 #include "targetstore.h"
-#include <any>
-#include "strategy.h"
-#include "random_strategy.h"
+#include "select_strategy.h"
 #include "utils.h"
 #include "automata.h"
 
@@ -26,31 +29,65 @@ class PathsStore{
         PathsStore();
         ~PathsStore();
         
-        void insert_init_automata_path(std::string automata_path, std::string prefix, std::string metric);
+        void insert_init_automata_path(int property, std::string prefix, std::string metric);
+        /* RERS: a path found outside the executions, see corpus_replay.h */
+        void insert_automata_path(int property, const lfz::automata::StatePath& states, const std::string& prefix, const std::string& metric);
         std::pair<ltlfuzz::Prefix, ltlfuzz::AutomataPath> select_prefix_aPath();
-        std::pair<std::string, std::string> select_automataPath_and_prefix(std::string prefixDir);
+        std::pair<ltlfuzz::AutomataPath, std::string> select_automataPath_and_prefix(std::string prefixLog);
 
         
         //data checking
         int getSize();
+        /* counters kept on insertion, cheap to call every iteration */
+        table_stats stats(int flag);
+        /* the whole table, on demand only: ltl-fuzz dump */
         void dump();
         static void clean_up();
+        /* write the table to file (atomically replaced), false if it failed */
+        bool save_snapshot(const std::string& file);
+        /* insert the paths of a snapshot, how many were restored */
+        size_t load_snapshot(const std::string& file);
+
+        /* distributed campaigns: only the paths with hash % nodes == node are selected */
+        void set_partition(unsigned node, unsigned nodes);
+        /* the prefixes stored since the previous call */
+        void export_records(std::vector<ltlfuzz::ClusterRecord>& records);
+        /* stores the prefixes pulled from the other nodes, how many were new */
+        size_t import_records(const std::vector<ltlfuzz::ClusterRecord>& records);
 
 
     private:
         static int init_run;
         managed_shared_memory* segment;
-        string_string_string_map*                  table;        //For RERS
+        table_shard*                               shards;       //For RERS, tableShards of them
+        PrefixLog                                  prefix_log;   //For protocols
+
+        //slots never move, but every access goes through the lock of their shard
+        unsigned                                   selected_shard;
+        path_entry*                                selected_item;
 
-        string_string_string_map::iterator         selected_item;
+        //For RERS: the automata paths ordered by priority, highest last, and
+        //kept up to date from the change lists of the shards. Paths are
+        //identified by shard << 32 | slot
+        struct FrontierItem{
+            double key;
+            unsigned selected;      //times the path was picked
+        };
+        std::set<std::pair<double, uint64_t>>      frontier;
+        std::unordered_map<uint64_t, FrontierItem> frontier_items;
+        size_t                                     frontier_seen[tableShards];   //changes indexed per shard
+        uint64_t                                   frontier_resets[tableShards]; //table_shard::resets they were indexed at
+        uint64_t                                   exported_seq[tableShards];    //prefixes of higher seq not pushed yet
+        unsigned                                   partition_node = 0;
+        unsigned                                   partition_nodes = 1;
+        void                                       refresh_frontier();
 
-        string_string_string_map::iterator         select_automata_path();
+        path_entry*                                select_automata_path();
         ltlfuzz::AutomataPath                      get_selected_automata_path();
         ltlfuzz::Prefix                            select_prefix();
         ltlfuzz::AutomataTransition                select_transition(const lfz::automata::Automata &atm);
-        double                                     compute_prefix_fitness(ltlfuzz::Prefix prefix);
-        std::string                                get_automataPath(std::vector<std::string> &fileList);
-        std::string                                get_prefix(std::string aPath, std::string prefixDir);
+        double                                     compute_path_priority(const path_entry& path, unsigned selected);
+        double                                     compute_prefix_fitness(const prefix_entry& prefix);
 
 };
 }//namespace
@@ -1,5 +1,7 @@
 #include "shared_table.h"
 #include <string.h>
+#include <stdint.h>
+#include <unordered_set>
 
 #ifndef PATHWRITER_H
 #define PATHWRITER_H
@@ -12,8 +14,13 @@ class PathWriter{
         PathWriter();
         ~PathWriter();
         
-        static void write_to_shared_table(std::string automata_path, std::string prefix, std::string metric);
-        
+        static void write_to_shared_table(int property, const lfz::automata::StatePath& automata_path, const std::string& prefix, const std::string& metric);
+
+    private:
+        static bool attach();
+        static uint64_t entry_hash(uint64_t path_hash, const std::string& prefix);
+        static std::unordered_set<uint64_t> written;
+
 };
 } //namespace
 #endif
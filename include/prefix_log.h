@@ -0,0 +1,91 @@
+#include <fcntl.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <unordered_set>
+#include <table_stats.h>
+#include <state_path.h>
+
+#ifndef PREFIX_LOG_H
+#define PREFIX_LOG_H
+
+/*
+ * Append-only log of the prefixes found in protocol mode, one record per
+ * productive execution:
+ *
+ *   PrefixLogRecord   key[key_size]   prefix[prefix_size]
+ *
+ * The key is the encode_path_key() of the property and automata path.
+ * Children append a record with a single write() to the log opened with
+ * O_APPEND, so concurrent writers need no lock; ltl-fuzz indexes the
+ * records appended since its previous look and samples from the index.
+ */
+
+namespace path{
+
+const uint32_t PREFIX_LOG_MAGIC = 0x474c5250;   // "PRLG"
+const char PREFIX_LOG_FILE[] = "prefix.log";
+
+struct PrefixLogRecord{
+    uint32_t magic;
+    uint32_t key_size;
+    uint32_t prefix_size;
+};
+
+/* open the log for prefix_log_append(), -1 on failure */
+inline int prefix_log_open(const char* file){
+    return open(file, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+}
+
+inline bool prefix_log_append(int fd, const std::string& key, const std::string& prefix){
+    PrefixLogRecord record = {PREFIX_LOG_MAGIC, (uint32_t)key.size(), (uint32_t)prefix.size()};
+    std::string buffer;
+    buffer.reserve(sizeof(record) + key.size() + prefix.size());
+    buffer.append((const char*)&record, sizeof(record));
+    buffer.append(key);
+    buffer.append(prefix);
+    return write(fd, buffer.data(), buffer.size()) == (ssize_t)buffer.size();
+}
+
+/* read side, used by ltl-fuzz */
+class PrefixLog{
+    public:
+        PrefixLog();
+        ~PrefixLog();
+
+        bool open(const std::string& file);
+        bool is_open() const;
+        /* index the records appended since the previous call */
+        void refresh();
+        size_t paths() const;
+        size_t prefixes() const;
+        /* add the counters kept while indexing to stats */
+        void add_stats(table_stats& stats) const;
+        /* a uniformly chosen path and one of its prefixes, in O(1) */
+        bool sample(std::string& key, std::string& prefix);
+
+    private:
+        struct Entry{
+            off_t offset;       //of the prefix bytes
+            uint32_t size;
+        };
+        int fd;
+        std::string file;
+        off_t scanned;          //records before this offset are indexed
+        size_t total;
+        std::vector<std::string> keys;
+        std::vector<std::vector<Entry>> entries;    //per key
+        std::unordered_map<std::string, size_t> key_ids;
+        std::unordered_set<uint64_t> seen;          //hashes of key and prefix
+        uint64_t offered;                           //records indexed, including duplicates
+        uint64_t depth_paths[tableDepths];
+        uint64_t pool_paths[tablePoolBuckets];
+        std::vector<std::pair<time_t, size_t>> recent;  //newest keys, oldest first
+};
+
+}//namespace
+
+#endif
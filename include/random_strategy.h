@@ -5,9 +5,10 @@
 #define RANDOM_STRATEGY_H
 namespace strategy{
 
-class RandomStrategy: public Strategy {
+/* uniform choice, the fitness is ignored */
+class RandomStrategy: public Strategy<RandomStrategy> {
     public:
-        std::any select(std::vector<std::pair<std::any, double>> v);
+        size_t select_index(const double* fitness, size_t n, const void* set, uint64_t version);
         static RandomStrategy* instance();
 
     private:
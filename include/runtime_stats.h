@@ -0,0 +1,69 @@
+#pragma once
+
+#include <stdint.h>
+#include <time.h>
+#include <shmdata.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+/*
+ * Cycle counters of the runtime phases, see RUNTIME_STATS in shmdata.h.
+ * A PhaseTimer adds the cycles from its construction to its destruction to
+ * its phase, less those of the timers constructed meanwhile, so that the
+ * phases of one call never count the same cycle twice. Without a stats
+ * block (a run outside afl-fuzz) it does nothing.
+ */
+
+namespace inst {
+
+inline uint64_t cycles_now()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+#endif
+}
+
+class PhaseTimer {
+public:
+    PhaseTimer(RUNTIME_STATS *stats, int phase)
+        : stats_(stats), phase_(phase), nested_(0), parent_(current_)
+    {
+        if (stats_ != nullptr) {
+            current_ = this;
+            start_ = cycles_now();
+        }
+    }
+    ~PhaseTimer()
+    {
+        if (stats_ == nullptr) {
+            return;
+        }
+        uint64_t spent = cycles_now() - start_;
+        // A protocol server may fork per session: its processes share the block
+        __atomic_fetch_add(&stats_->count[phase_], 1, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&stats_->cycles[phase_], spent - nested_, __ATOMIC_RELAXED);
+        if (parent_ != nullptr) {
+            parent_->nested_ += spent;
+        }
+        current_ = parent_;
+    }
+
+    PhaseTimer(const PhaseTimer &) = delete;
+    PhaseTimer &operator=(const PhaseTimer &) = delete;
+
+private:
+    RUNTIME_STATS *stats_;
+    int phase_;
+    uint64_t start_;
+    uint64_t nested_;       // cycles of the timers inside this one
+    PhaseTimer *parent_;
+
+    static inline PhaseTimer *current_ = nullptr;
+};
+
+} // namespace inst
@@ -0,0 +1,21 @@
+#include <random_strategy.h>
+#include <weighted_strategy.h>
+
+#ifndef SELECT_STRATEGY_H
+#define SELECT_STRATEGY_H
+namespace strategy{
+
+/* the strategy of the selections that carry a fitness (paths, transitions,
+   targets); -DLTL_UNIFORM_SELECTION builds the uniform baseline */
+#ifdef LTL_UNIFORM_SELECTION
+typedef RandomStrategy SelectStrategy;
+#else
+typedef WeightedStrategy SelectStrategy;
+#endif
+
+inline SelectStrategy& selector(){
+    return *SelectStrategy::instance();
+}
+}//namespace
+
+#endif
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <stddef.h>
+#include <sys/types.h>
+
+/*
+ * Readiness of a protocol server, reported to AFLGo through the pipe of
+ * LTL_SERVER_FD (see SERVER_EVENT in shmdata.h). The LTL pass redirects
+ * the socket calls of the server to the ltl_* wrappers of Instrument.cc,
+ * which call these before and after the real call. Sockets returned by
+ * accept() and those recv() is called on are session sockets; read() on
+ * them counts as a request as well.
+ *
+ * All state is plain data: it is inherited from the fork server and
+ * starts from zero in every execution.
+ */
+
+namespace inst {
+namespace server_events {
+
+/* about to block in accept() on fd */
+void accepting(int fd);
+/* accept() returned fd */
+void accepted(int fd);
+/* about to read from fd; datagram: recv()/recvfrom(), always a socket */
+void receiving(int fd, bool datagram);
+/* the read of fd returned n */
+void received(int fd, ssize_t n);
+
+} // namespace server_events
+} // namespace inst
@@ -1,14 +1,24 @@
 /*
- * define a map<string, map<string,string>> data structure on the shared memory to
- * store automata paths and corresponding prefixes
+ * define a table on the shared memory to store automata paths and their
+ * prefixes: open addressing on a 64-bit path hash, split into locked shards,
+ * with a bounded pool of prefixes per path
  */
 
 #include <boost/interprocess/managed_shared_memory.hpp>
 #include <boost/interprocess/allocators/allocator.hpp>
-#include <boost/interprocess/containers/map.hpp>
+#include <boost/interprocess/containers/vector.hpp>
 #include <boost/interprocess/containers/string.hpp>
+#include <boost/interprocess/sync/scoped_lock.hpp>
+#include <algorithm>
 #include <iostream>
+#include <string>
 #include <stdint.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <pthread.h>
+#include <time.h>
+#include <table_stats.h>
+#include <state_path.h>
 
 #ifndef SHARED_TABLE_H
 #define SHARED_TABLE_H
@@ -18,24 +28,517 @@ using namespace boost::interprocess;
 
 typedef managed_shared_memory::segment_manager                       segment_manager_t;
 typedef allocator<void, segment_manager_t>                           void_allocator;
- 
+
 /*-- define string type --*/
 typedef allocator<char, segment_manager_t>                           char_allocator;
 typedef basic_string<char, std::char_traits<char>, char_allocator>   char_string;
 
-/*-- define map<string, string> type --*/
-typedef std::pair<const char_string, char_string> string_string_value_type;
-typedef allocator<string_string_value_type, segment_manager_t> string_string_map_allocator;
-typedef map<char_string, char_string, std::less<char_string>, string_string_map_allocator>  string_string_map;
- 
-/*-- define map<string, map<string, string>> --*/
-typedef std::pair<const char_string, string_string_map> string_string_string_value_type;
-typedef allocator<string_string_string_value_type, segment_manager_t> string_string_string_map_allocator;
-typedef map<char_string, string_string_map, std::less<char_string>, string_string_string_map_allocator>  string_string_string_map;
-
 
 const string shmId = "PathsTable";
 const string tableName = "table_map";
 const uint32_t size = 4096*1000*100;
 
+/*-- limits of the table, read by the orchestrator when it creates it
+     (utils::env_option) --*/
+const char tableSizeEnv[] = "LTL_TABLE_MB";          //segment size in MB
+const char tablePathsEnv[] = "LTL_TABLE_PATHS";      //automata paths kept
+const char tablePrefixesEnv[] = "LTL_TABLE_PREFIXES"; //prefixes kept per path
+const uint32_t defaultTablePaths = 65536;
+const uint32_t defaultTablePrefixes = 64;
+
+/*-- process-shared mutex that stays usable when its owner dies: writers are
+     fuzzed children, which AFL may SIGKILL at any point. It only notes the
+     death (owner_died); what the owner was in the middle of is for the
+     holder to repair, see shard_lock. Only the shard locks are robust: the
+     segment_manager of Boost allocates under an interprocess_mutex of its
+     own, and a writer killed inside an allocation leaves it locked, which
+     blocks every later allocation in the segment --*/
+class table_mutex{
+    public:
+        table_mutex(){
+            pthread_mutexattr_t attr;
+            pthread_mutexattr_init(&attr);
+            pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+            pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+            pthread_mutex_init(&mutex, &attr);
+            pthread_mutexattr_destroy(&attr);
+        }
+        ~table_mutex(){ pthread_mutex_destroy(&mutex); }
+        table_mutex(const table_mutex&) = delete;
+        table_mutex& operator=(const table_mutex&) = delete;
+
+        void lock(){
+            if(pthread_mutex_lock(&mutex) == EOWNERDEAD){
+                pthread_mutex_consistent(&mutex);
+                owner_died = true;
+            }
+        }
+        bool try_lock(){
+            int r = pthread_mutex_trylock(&mutex);
+            if(r == EOWNERDEAD){
+                pthread_mutex_consistent(&mutex);
+                owner_died = true;
+                return true;
+            }
+            return r == 0;
+        }
+        void unlock(){ pthread_mutex_unlock(&mutex); }
+
+        bool owner_died = false;    //a holder died since the last repair
+
+    private:
+        pthread_mutex_t mutex;
+};
+
+/*-- hash of the key of path under property, from the hash the path rolls
+     forward as it grows, finalized so that both the shard (high bits) and
+     the slot (low bits) depend on all of it; never 0 (0 marks an empty slot) --*/
+inline uint64_t table_hash(int property, const lfz::automata::StatePath& path){
+    uint64_t h = path.hash() ^ ((uint64_t)(property + 1) * 0x9e3779b97f4a7c15ULL);
+    h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    h = (h ^ (h >> 27)) * 0x94d049bb133111ebULL;
+    h ^= h >> 31;
+    return h ? h : 1;
+}
+
+/*-- prefixes are sequences of input tokens ("<input>,") and the prefix
+     of a deeper automata path nearly always extends one of a shallower
+     path, so the prefixes of a shard share one tree of tokens: a prefix is
+     the id of its last node, and extending it by a token is a single child
+     lookup. A node counts its children and the pool entries that hold it,
+     and is freed, its id reused, when the last of them goes: the trie never
+     outgrows the prefixes the pools keep. It lives in its shard, under the
+     shard lock --*/
+const char prefixTokenDelimiter = ',';
+
+struct trie_node{
+    uint32_t parent;        //0 for the children of the root
+    uint32_t length;        //length of the whole prefix up to this node
+    uint32_t refs;          //children and pool entries; an empty token marks a free node
+    uint64_t key;           //trie_key(parent, token)
+    char_string token;
+    trie_node(const void_allocator& alloc) : parent(0), length(0), refs(0), key(0), token(alloc){}
+};
+typedef allocator<trie_node, segment_manager_t>                      trie_node_allocator;
+typedef vector<trie_node, trie_node_allocator>                       trie_nodes;
+typedef allocator<uint32_t, segment_manager_t>                       uint32_allocator;
+typedef vector<uint32_t, uint32_allocator>                           uint32_vector;
+
+inline uint64_t trie_key(uint32_t parent, const char* token, size_t len);
+
+struct prefix_trie{
+    trie_nodes nodes;         //node 0 is the root, the empty prefix
+    uint32_vector index;      //open addressing over node ids by key, 0 if free
+    uint32_vector free_ids;   //freed nodes, reused before nodes grows
+
+    prefix_trie(const void_allocator& alloc) : nodes(alloc), index(alloc), free_ids(alloc){
+        nodes.push_back(trie_node(alloc));
+        index.resize(1024, 0);
+    }
+
+    /* child of parent for token, created if create is set; 0 if absent */
+    uint32_t child(uint32_t parent, const char* token, size_t len, bool create){
+        uint64_t key = trie_key(parent, token, len);
+        size_t mask = index.size() - 1;
+        size_t i = key & mask;
+        for(; index[i] != 0; i = (i + 1) & mask){
+            trie_node& n = nodes[index[i]];
+            if(n.key == key && n.parent == parent && n.token.size() == len && n.token.compare(0, len, token, len) == 0){
+                return index[i];
+            }
+        }
+        if(!create){
+            return 0;
+        }
+        if(free_ids.empty() && 2 * (nodes.size() + 1) > index.size()){
+            grow();
+            mask = index.size() - 1;
+            for(i = key & mask; index[i] != 0; i = (i + 1) & mask){}
+        }
+        bool reused = !free_ids.empty();
+        if(!reused){
+            nodes.push_back(trie_node(nodes.get_allocator()));
+        }
+        uint32_t id = reused ? free_ids.back() : nodes.size() - 1;
+        trie_node& n = nodes[id];
+        try{
+            n.token.assign(token, len);
+        }catch(const bad_alloc&){
+            //a reused node stays free, its token empty
+            if(!reused){
+                nodes.pop_back();
+            }
+            throw;
+        }
+        if(reused){
+            free_ids.pop_back();
+        }
+        n.parent = parent;
+        n.length = nodes[parent].length + len;
+        n.refs = 0;
+        n.key = key;
+        nodes[parent].refs++;
+        index[i] = id;
+        return id;
+    }
+
+    /* node of prefix, adding the tokens that are missing; the caller takes
+       a reference with acquire(), or gives the new nodes back with trim() */
+    uint32_t insert(const std::string& prefix){
+        uint32_t node = 0;
+        size_t begin = 0;
+        try{
+            while(begin < prefix.size()){
+                size_t end = prefix.find(prefixTokenDelimiter, begin);
+                end = end == std::string::npos ? prefix.size() : end + 1;
+                node = child(node, prefix.c_str() + begin, end - begin, true);
+                begin = end;
+            }
+        }catch(const bad_alloc&){
+            trim(node);
+            throw;
+        }
+        return node;
+    }
+
+    void acquire(uint32_t node){
+        nodes[node].refs++;
+    }
+
+    /* a pool entry gives up node */
+    void release(uint32_t node){
+        nodes[node].refs--;
+        trim(node);
+    }
+
+    /* frees node and the ancestors only it held, if nothing refers to it */
+    void trim(uint32_t node){
+        while(node != 0 && nodes[node].refs == 0){
+            uint32_t parent = nodes[node].parent;
+            unlink(node);
+            trie_node& n = nodes[node];
+            n.token.clear();
+            n.token.shrink_to_fit();
+            n.key = 0;
+            try{
+                free_ids.push_back(node);
+            }catch(const bad_alloc&){
+                //the node stays allocated but unreachable
+            }
+            nodes[parent].refs--;
+            node = parent;
+        }
+    }
+
+    std::string get(uint32_t node){
+        std::string prefix(nodes[node].length, '\0');
+        for(; node != 0; node = nodes[node].parent){
+            trie_node& n = nodes[node];
+            prefix.replace(n.length - n.token.size(), n.token.size(), n.token.c_str(), n.token.size());
+        }
+        return prefix;
+    }
+
+    private:
+        void grow(){
+            uint32_vector bigger(2 * index.size(), 0, index.get_allocator());
+            size_t mask = bigger.size() - 1;
+            for(uint32_t id = 1; id < nodes.size(); id++){
+                if(nodes[id].token.empty()){
+                    continue;
+                }
+                size_t i = nodes[id].key & mask;
+                while(bigger[i] != 0){
+                    i = (i + 1) & mask;
+                }
+                bigger[i] = id;
+            }
+            index.swap(bigger);
+        }
+
+        /* removes node from the index, moving back the entries probed past it */
+        void unlink(uint32_t node){
+            size_t mask = index.size() - 1;
+            size_t i = nodes[node].key & mask;
+            while(index[i] != node){
+                i = (i + 1) & mask;
+            }
+            for(size_t j = (i + 1) & mask; index[j] != 0; j = (j + 1) & mask){
+                size_t home = nodes[index[j]].key & mask;
+                //index[j] may move to i unless its home lies cyclically in (i, j]
+                if(i < j ? (home <= i || home > j) : (home <= i && home > j)){
+                    index[i] = index[j];
+                    i = j;
+                }
+            }
+            index[i] = 0;
+        }
+};
+
+inline uint64_t trie_key(uint32_t parent, const char* token, size_t len){
+    uint64_t h = 14695981039346656037ULL ^ parent;
+    for(size_t i = 0; i < len; i++){
+        h = (h ^ (unsigned char)token[i]) * 1099511628211ULL;
+    }
+    return h;
+}
+
+/*-- one prefix of a path with its metric --*/
+struct prefix_entry{
+    uint32_t node;          //prefix_trie node of the prefix
+    char_string metric;
+    double score;           //metric as a number, higher is better
+    uint64_t seq;           //insertion order, higher is newer
+    prefix_entry(const void_allocator& alloc) : node(0), metric(alloc), score(0), seq(0){}
+};
+typedef allocator<prefix_entry, segment_manager_t>                   prefix_entry_allocator;
+typedef vector<prefix_entry, prefix_entry_allocator>                 prefix_pool;
+
+/*-- one slot of a shard: an automata path and its prefix pool --*/
+struct path_entry{
+    uint64_t hash;          //table_hash of the path, 0 if the slot is free
+    char_string path;       //encode_path_key() of the property and path
+    prefix_pool prefixes;
+    uint64_t offered;       //prefixes ever offered to this path
+    int64_t found;          //time the path was stored
+    double best;            //highest score in prefixes
+    path_entry(const void_allocator& alloc) : hash(0), path(alloc), prefixes(alloc), offered(0), found(0), best(0){}
+};
+typedef allocator<path_entry, segment_manager_t>                     path_entry_allocator;
+typedef vector<path_entry, path_entry_allocator>                     path_slots;
+
+/*-- the table is split into shards by path hash, each behind its own mutex, so
+     that concurrent writers (children of several fuzzer instances) and the
+     orchestrator only wait for each other on the same shard. Slots are
+     allocated once; every access goes through the shard lock --*/
+const unsigned tableShards = 16;
+
+struct table_shard{
+    table_mutex mutex;
+    path_slots slots;         //power-of-two open-addressing table
+    uint32_t count;           //used slots, at most half of them
+    uint32_t pool_capacity;   //prefixes kept per path
+    uint64_t seq;
+    uint64_t dropped_paths;   //paths not stored because the shard was full
+    uint64_t evicted;         //prefixes replaced in full pools
+
+    /* campaign counters, see table_stats.h */
+    uint64_t prefixes;
+    uint64_t offered;
+    uint64_t depth_paths[path::tableDepths];
+    uint64_t pool_paths[path::tablePoolBuckets];
+    uint32_t recent[path::tableRecent];     //slots of the newest paths
+    uint32_t recent_next;
+    uint32_vector changes;    //slots in the order they were added or their best score rose
+    prefix_trie trie;         //tokens of the prefixes of the shard
+    uint32_t writing;         //set while table_insert() changes the shard
+    uint64_t resets;          //times the shard was lost to a writer that died in it
+
+    table_shard(const void_allocator& alloc, uint32_t capacity, uint32_t pool_capacity)
+        : slots(alloc), count(0), pool_capacity(pool_capacity), seq(0), dropped_paths(0), evicted(0),
+          prefixes(0), offered(0), depth_paths(), pool_paths(), recent(), recent_next(0), changes(alloc), trie(alloc),
+          writing(0), resets(0){
+        uint32_t n = 2;
+        while(n < 2 * capacity){
+            n <<= 1;
+        }
+        slots.resize(n, path_entry(alloc));
+    }
+
+    /* slot of path, or of the free slot it should go to; nullptr if full */
+    path_entry* probe(uint64_t hash, const char* path, size_t len){
+        size_t mask = slots.size() - 1;
+        for(size_t i = hash & mask, n = 0; n < slots.size(); i = (i + 1) & mask, n++){
+            path_entry& e = slots[i];
+            if(e.hash == 0){
+                return &e;
+            }
+            if(e.hash == hash && e.path.size() == len && e.path.compare(0, len, path, len) == 0){
+                return &e;
+            }
+        }
+        return nullptr;
+    }
+
+    path_entry* find(uint64_t hash, const std::string& key){
+        path_entry* e = probe(hash, key.c_str(), key.size());
+        return e != nullptr && e->hash != 0 ? e : nullptr;
+    }
+
+    /* after a holder died: a writer may have left anything half done, down to
+       a vector between two buffers, so the contents are dropped (and leaked in
+       the segment, as they cannot be freed safely) and the shard starts over
+       empty; seq goes on so that readers of the changes see new ones. The
+       caller holds the lock */
+    void repair(){
+        mutex.owner_died = false;
+        if(!__atomic_load_n(&writing, __ATOMIC_SEQ_CST)){
+            return;
+        }
+        void_allocator alloc(changes.get_allocator());
+        for(auto& e : slots){
+            new (&e) path_entry(alloc);
+        }
+        new (&changes) uint32_vector(alloc);
+        new (&trie) prefix_trie(alloc);
+        count = 0;
+        prefixes = 0;
+        std::fill(depth_paths, depth_paths + path::tableDepths, 0);
+        std::fill(pool_paths, pool_paths + path::tablePoolBuckets, 0);
+        recent_next = 0;
+        resets++;
+        __atomic_store_n(&writing, 0, __ATOMIC_SEQ_CST);
+        std::cout << "table shard lost to a writer that died updating it, cleared" << std::endl;
+    }
+
+    /* add the counters of this shard to stats; the caller holds the lock */
+    void add_stats(path::table_stats& stats) const{
+        stats.paths += count;
+        stats.prefixes += prefixes;
+        stats.offered += offered;
+        stats.dropped_paths += dropped_paths;
+        stats.evicted += evicted;
+        stats.lost_shards += resets;
+        for(unsigned i = 0; i < path::tableDepths; i++){
+            stats.depth_paths[i] += depth_paths[i];
+        }
+        for(unsigned i = 0; i < path::tablePoolBuckets; i++){
+            stats.pool_paths[i] += pool_paths[i];
+        }
+        for(unsigned i = 0; i < path::tableRecent && i < count; i++){
+            const path_entry& e = slots[recent[i]];
+            stats.add_newest(e.found, lfz::automata::path_key_str(e.path.c_str(), e.path.size()));
+        }
+    }
+};
+
+/*-- the lock of a shard, repaired first if its last holder died --*/
+class shard_lock{
+    public:
+        shard_lock(table_shard& shard) : lock(shard.mutex){
+            if(shard.mutex.owner_died){
+                shard.repair();
+            }
+        }
+
+    private:
+        scoped_lock<table_mutex> lock;
+};
+
+/*-- marks the shard as being written for as long as it lives, so that a
+     writer killed in between leaves the mark for repair() --*/
+struct shard_write{
+    table_shard& shard;
+    shard_write(table_shard& shard) : shard(shard){
+        __atomic_store_n(&shard.writing, 1, __ATOMIC_SEQ_CST);
+    }
+    ~shard_write(){
+        __atomic_store_n(&shard.writing, 0, __ATOMIC_SEQ_CST);
+    }
+};
+
+inline table_shard& table_shard_of(table_shard* shards, uint64_t hash){
+    return shards[(hash >> 32) % tableShards];
+}
+
+/*-- insert prefix with metric under the path key of the given table_hash;
+     the caller holds the shard lock. A full pool replaces its worst prefix
+     (lowest score, then oldest) unless the new one scores lower, and the
+     trie nodes only the replaced prefix held are freed. Returns false if
+     nothing was stored --*/
+inline bool table_insert(table_shard& shard, const void_allocator& alloc, uint64_t hash, const std::string& automata_path, const std::string& prefix, const std::string& metric){
+    shard_write writing(shard);
+    path_entry* e = shard.probe(hash, automata_path.c_str(), automata_path.size());
+    if(e == nullptr || (e->hash == 0 && 2 * (shard.count + 1) > shard.slots.size())){
+        shard.dropped_paths++;
+        return false;
+    }
+    bool added = false;
+    bool changed = false;
+    try{
+        if(e->hash == 0){
+            e->path.assign(automata_path.c_str(), automata_path.size());
+            e->hash = hash;
+            e->found = time(NULL);
+            shard.count++;
+            shard.depth_paths[path::depth_bucket(lfz::automata::path_key_depth(automata_path.c_str(), automata_path.size()))]++;
+            shard.recent[shard.recent_next] = e - &shard.slots[0];
+            shard.recent_next = (shard.recent_next + 1) % path::tableRecent;
+        }
+        e->offered++;
+        shard.offered++;
+
+        prefix_trie& trie = shard.trie;
+        uint32_t node = trie.insert(prefix);
+        for(auto& p : e->prefixes){
+            if(p.node == node){
+                return true;
+            }
+        }
+        double score = atof(metric.c_str());
+        prefix_entry* slot = nullptr;
+        if(e->prefixes.size() < shard.pool_capacity){
+            try{
+                e->prefixes.push_back(prefix_entry(alloc));
+            }catch(const bad_alloc&){
+                trie.trim(node);
+                throw;
+            }
+            added = true;
+            slot = &e->prefixes.back();
+        }
+        else{
+            for(auto& p : e->prefixes){
+                if(slot == nullptr || p.score < slot->score || (p.score == slot->score && p.seq < slot->seq)){
+                    slot = &p;
+                }
+            }
+            if(slot == nullptr || score < slot->score){
+                trie.trim(node);
+                return false;
+            }
+            shard.evicted++;
+        }
+        try{
+            slot->metric.assign(metric.c_str(), metric.size());
+        }catch(const bad_alloc&){
+            if(added){
+                e->prefixes.pop_back();
+                added = false;
+            }
+            trie.trim(node);
+            throw;
+        }
+        trie.acquire(node);
+        if(!added){
+            trie.release(slot->node);
+        }
+        slot->node = node;
+        slot->score = score;
+        slot->seq = ++shard.seq;
+        if(e->prefixes.size() == 1 || score > e->best){
+            e->best = score;
+            changed = true;
+        }
+        if(added){
+            shard.prefixes++;
+            path::pool_grown(shard.pool_paths, e->prefixes.size());
+        }
+    }catch(const bad_alloc&){
+        //the segment is full: keep what is there
+        if(added){
+            e->prefixes.pop_back();
+        }
+        return false;
+    }
+    if(changed){
+        try{
+            shard.changes.push_back(e - &shard.slots[0]);
+        }catch(const bad_alloc&){
+            //the orchestrator misses the change, the path stays stored
+        }
+    }
+    return true;
+}
+
 #endif
@@ -11,41 +11,300 @@
 
 typedef char INPUT_TYPE;
 
+#define PREFIX_SHM_ENV_VAR "LTL_PREFIX_SHM"     // id of the prefix channel of an AFLGo instance
+#define PREFIX_DEFAULT_CAPACITY (1u << 20)
+
+/*
+ * One channel per AFLGo instance, created by LTL-Fuzzer for the worker slot
+ * and handed over in PREFIX_SHM_ENV_VAR. The header is followed by
+ * arr_size + 1 offsets and then the payload: message i is the bytes
+ * [offsets[i], offsets[i + 1]) of the payload. Protocol prefixes hold one
+ * message per request, RERS prefixes a single message with the inputs.
+ *
+ * LTL-Fuzzer maps its channels once and publishes every prefix between
+ * prefix_publish_begin() and prefix_publish_end(), which bump version: it
+ * is odd while a prefix is being written, and a reader that saw the same
+ * even version before and after its copy got a whole prefix. AFLGo keeps
+ * what it built from a prefix until the version changes.
+ *
+ * A worker lives until deadline: LTL-Fuzzer pushes it back whenever it
+ * hands a running instance a new prefix, instead of starting another one.
+ *
+ * A subject instrumented for several targets at once (-distances, see
+ * DISTANCE_TARGETS_FILE) reports the CFG distance to the target at index
+ * target; the runtime reads it in every child it forks.
+ */
 typedef struct Prefix_SMEM{
-	INPUT_TYPE array[32][32768];
-	uint32_t arr_size;  
+	uint32_t capacity;    // bytes after the header, offsets included
+	uint32_t version;     // prefixes published so far, times 2
+	int64_t deadline;     // Unix time the instance stops at, 0 for none
+	uint32_t arr_size;    // number of messages
+	uint32_t data_size;   // payload bytes in use
+	uint32_t target;      // selected target of a multi-target subject
+	uint32_t reserved;
 } PREFIX_SMEM;     // From LTL-Fuzzer to AFLGo
 
-static int set_prefix_smem(){
+/* in the build directory of a multi-target subject: one line per target,
+   "<target> <distance.cfg.txt>"; the line number is the target's index */
+#define DISTANCE_TARGETS_FILE "distance_targets.txt"
+
+#define VERDICT_PATH_SIZE 1024
+
+typedef struct Verdict_SMEM{
+	uint32_t violated;                 // 1 once the current execution violated a property
+	int32_t property;                  // id of the violated property
+	uint32_t trace_len;                // number of events collected until the violation
+	char path[VERDICT_PATH_SIZE];      // violating automaton path, NUL-terminated
+} VERDICT_SMEM;    // From the instrumented runtime to AFLGo and LTL-Fuzzer
+
+/* id of the verdict shm of a process running the subject: LTL-Fuzzer creates
+   one for its INPUT steps, one per worker slot and one per triage thread */
+#define VERDICT_SHM_ENV_VAR "LTL_VERDICT_SHM"
+
+/*
+ * The runtime also writes a binary trace of a violating execution (see
+ * counterexample_trace.h) to the file named in TRACE_FILE_ENV_VAR. With
+ * TRACES_ENV_VAR=1, LTL-Fuzzer and AFLGo each point it at a file of their
+ * own and keep the trace next to every counterexample they save, as the
+ * input's name followed by TRACE_FILE_SUFFIX.
+ */
+#define TRACES_ENV_VAR "LTL_TRACES"
+#define TRACE_FILE_ENV_VAR "LTL_TRACE_FILE"
+#define TRACE_FILE_SUFFIX ".trace"
+
+/* STREAMING_ENV_VAR=1: the runtime of a protocol server checks the accepting
+   lassos as the session goes instead of keeping its whole history, so that
+   its memory stays bounded however long the session runs */
+#define STREAMING_ENV_VAR "LTL_STREAMING"
+
+/*
+ * Automaton transitions: AFLGo's coverage map holds, after AFL's MAP_SIZE
+ * edge bytes and the 16 bytes of the CFG distance, AUTOMATA_MAP_SIZE bytes
+ * that the runtime sets to 1 for every (property, state, event, next state)
+ * an execution walks. afl-fuzz keeps inputs that hit a transition no earlier
+ * input hit. Other AFL tools map the edge bytes alone, so the runtime only
+ * writes there when afl-fuzz sets AUTOMATA_MAP_ENV_VAR.
+ */
+#define AUTOMATA_MAP_OFFSET ((1 << 16) + 16)    // MAP_SIZE + 16 of AFLGo's config.h
+#define AUTOMATA_MAP_SIZE (1 << 12)
+#define AUTOMATA_MAP_ENV_VAR "LTL_AUTOMATA_MAP"
+
+/*
+ * After the transitions, a uint32_t holding 1 + the smallest distance to an
+ * accepting cycle of the automaton states the execution reached, 0 if it
+ * reached none from which a violation is still possible. afl-fuzz weighs it
+ * with the CFG distance in its power schedule.
+ */
+#define AUTOMATA_DISTANCE_OFFSET (AUTOMATA_MAP_OFFSET + AUTOMATA_MAP_SIZE)
+
+/*
+ * Then, for RERS subjects, where the input events of the execution ended
+ * in the input file: end[i] is the file offset right after the bytes the
+ * subject read up to input event i. The first EVENT_OFFSETS_MAX events are
+ * kept, count is the number of events seen. afl-fuzz mutates whole events
+ * between these boundaries. AUTOMATA_SHM_SIZE is all the runtime writes
+ * after the distance slots.
+ */
+#define EVENT_OFFSETS_OFFSET (AUTOMATA_DISTANCE_OFFSET + 8)
+#define EVENT_OFFSETS_MAX 1024
+
+typedef struct Event_Offsets{
+	uint32_t count;
+	uint32_t end[EVENT_OFFSETS_MAX];
+} EVENT_OFFSETS;   // From the instrumented runtime to AFLGo
+
+#define AUTOMATA_SHM_SIZE (AUTOMATA_MAP_SIZE + 8 + sizeof(EVENT_OFFSETS))
+
+/*
+ * Runtime telemetry, after all of the above: how often each phase of the
+ * runtime ran and the cycles (TSC, or nanoseconds without one) it took,
+ * nested phases excluded. afl-fuzz clears the block once, not before every
+ * execution, so the runtimes of all its executions add up there; it appends
+ * the totals to fuzzer_stats and the cycles per execution to plot_data.
+ */
+#define RUNTIME_STATS_OFFSET ((AUTOMATA_MAP_OFFSET + AUTOMATA_SHM_SIZE + 63) & ~63)   // atomic adds never split a cache line
+
+enum { LTL_PHASE_EVENTS, LTL_PHASE_STATES, LTL_PHASE_MODEL_CHECK, LTL_PHASE_ACCEPTANCE,
+       LTL_PHASE_PATHS, LTL_PHASES };
+#define LTL_PHASE_NAMES { "events", "states", "model_check", "acceptance", "paths" }
+
+typedef struct Runtime_Stats{
+	uint64_t count[LTL_PHASES];
+	uint64_t cycles[LTL_PHASES];
+} RUNTIME_STATS;   // From the instrumented runtime to AFLGo
+
+/*
+ * Deferred model checking (RERS): when afl-fuzz sets mode, the runtime
+ * only steps the automata during the execution, for the transition map and
+ * the distance, and leaves the lassos and the acceptance to afl-fuzz. At
+ * the end of the execution it writes the trace here instead: the event
+ * names of its dictionary (NUL-terminated), the dictionary id of every
+ * event, and for every program state its hash and the number of events
+ * before it, as in a counterexample trace. afl-fuzz resets status before
+ * every execution; a trace that does not fit is left DEFERRED_OVERFLOW.
+ *
+ * afl-fuzz sets repeat, with or without deferral, while it calibrates an
+ * input the runtime already evaluated and while it trims one: the runtime
+ * still steps the automata but neither checks the properties nor publishes
+ * automaton paths, which the first execution of the input did.
+ */
+#define DEFERRED_TRACE_OFFSET ((RUNTIME_STATS_OFFSET + sizeof(RUNTIME_STATS) + 63) & ~63)
+#define DEFERRED_NAMES_SIZE (1 << 13)
+#define DEFERRED_EVENTS_MAX (1 << 16)
+#define DEFERRED_STATES_MAX (1 << 15)
+
+enum { DEFERRED_NONE, DEFERRED_WRITTEN, DEFERRED_OVERFLOW };
+
+typedef struct Deferred_Trace{
+	uint32_t mode;                  // afl-fuzz: 1 to defer the checks of the next executions
+	uint32_t status;                // the runtime: DEFERRED_WRITTEN once the trace is complete
+	uint32_t num_names;
+	uint32_t num_events;
+	uint32_t num_states;
+	uint32_t repeat;                // afl-fuzz: 1 while the executions repeat an evaluated input
+	char names[DEFERRED_NAMES_SIZE];
+	uint32_t events[DEFERRED_EVENTS_MAX];
+	uint32_t state_events[DEFERRED_STATES_MAX];
+	uint64_t hashes[DEFERRED_STATES_MAX];
+} DEFERRED_TRACE;
+
+/* the whole shm of afl-fuzz, coverage map included */
+#define LTL_AFL_SHM_SIZE (DEFERRED_TRACE_OFFSET + sizeof(DEFERRED_TRACE))
+
+/*
+ * Protocol servers: the runtime writes a SERVER_EVENT to the pipe whose
+ * write end AFLGo passes in LTL_SERVER_FD each time the server is about to
+ * block waiting for a client (accept) or for a request on a session socket,
+ * so that AFLGo waits on the pipe instead of sleeping or polling coverage.
+ * An event is smaller than PIPE_BUF, so concurrent writers never interleave.
+ */
+#define SERVER_EVENT_ENV_VAR "LTL_SERVER_FD"
+#define SERVER_READY 1      // waiting for a connection
+#define SERVER_IDLE  2      // waiting for a request, received bytes read so far
+
+typedef struct Server_Event{
+	uint32_t pid;         // the server process
+	uint32_t kind;        // SERVER_READY or SERVER_IDLE
+	uint64_t received;    // bytes read from session sockets by this process
+} SERVER_EVENT;    // From the instrumented runtime to AFLGo
+
+static inline uint32_t* prefix_offsets(PREFIX_SMEM* shm){
+	return (uint32_t*)(shm + 1);
+}
+
+static inline char* prefix_payload(PREFIX_SMEM* shm){
+	return (char*)(prefix_offsets(shm) + shm->arr_size + 1);
+}
+
+static inline uint32_t prefix_version(PREFIX_SMEM* shm){
+	return __atomic_load_n(&shm->version, __ATOMIC_ACQUIRE);
+}
+
+static inline int64_t prefix_deadline(PREFIX_SMEM* shm){
+	return __atomic_load_n(&shm->deadline, __ATOMIC_ACQUIRE);
+}
+
+static inline void prefix_set_deadline(PREFIX_SMEM* shm, int64_t deadline){
+	__atomic_store_n(&shm->deadline, deadline, __ATOMIC_RELEASE);
+}
+
+static inline uint32_t prefix_target(PREFIX_SMEM* shm){
+	return __atomic_load_n(&shm->target, __ATOMIC_ACQUIRE);
+}
+
+static inline void prefix_set_target(PREFIX_SMEM* shm, uint32_t target){
+	__atomic_store_n(&shm->target, target, __ATOMIC_RELEASE);
+}
+
+static inline void prefix_publish_begin(PREFIX_SMEM* shm){
+	__atomic_store_n(&shm->version, shm->version + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static inline void prefix_publish_end(PREFIX_SMEM* shm){
+	__atomic_store_n(&shm->version, shm->version + 1, __ATOMIC_RELEASE);
+}
+
+/* message i of the prefix, its length in *len; NULL if a concurrent
+   publication left offsets outside the channel */
+static inline const char* prefix_message(PREFIX_SMEM* shm, uint32_t i, uint32_t* len){
+	uint64_t table = ((uint64_t)shm->arr_size + 1) * sizeof(uint32_t);
+	uint32_t* offsets = prefix_offsets(shm);
+	*len = 0;
+	if(i >= shm->arr_size || table > shm->capacity){
+		return NULL;
+	}
+	uint32_t begin = offsets[i], end = offsets[i + 1];
+	if(begin > end || table + end > shm->capacity){
+		return NULL;
+	}
+	*len = end - begin;
+	return prefix_payload(shm) + begin;
+}
+
+/* starts a prefix of n messages, -1 if their offsets alone do not fit */
+static inline int prefix_reset(PREFIX_SMEM* shm, uint32_t n){
+	if((uint64_t)(n + 1) * sizeof(uint32_t) > shm->capacity){
+		return -1;
+	}
+	shm->arr_size = n;
+	shm->data_size = 0;
+	prefix_offsets(shm)[0] = 0;
+	return 0;
+}
+
+/* writes message i after the previous ones, -1 if the channel is full */
+static inline int prefix_append(PREFIX_SMEM* shm, uint32_t i, const void* data, uint32_t len){
+	uint64_t used = (uint64_t)(shm->arr_size + 1) * sizeof(uint32_t) + shm->data_size;
+	if(i >= shm->arr_size || used + len > shm->capacity){
+		return -1;
+	}
+	memcpy(prefix_payload(shm) + shm->data_size, data, len);
+	shm->data_size += len;
+	prefix_offsets(shm)[i + 1] = shm->data_size;
+	return 0;
+}
+
+static inline int create_prefix_smem(uint32_t capacity){
 	/**
-		From LTL-Fuzzer to AFLGo
+		From LTL-Fuzzer to one AFLGo instance
 	**/
-	key_t key = 2222;
-	int shmid = shmget(key, sizeof(PREFIX_SMEM), 0666|IPC_CREAT);
+	if(capacity < sizeof(uint32_t)){
+		capacity = sizeof(uint32_t);
+	}
+	int shmid = shmget(IPC_PRIVATE, sizeof(PREFIX_SMEM) + capacity, 0600|IPC_CREAT);
 	if(shmid == -1){
 		printf(">>> failed to set prefix_shm.\n");
 		return -1;
 	}
-	else{
-		printf(">>> succeeded to set prefix_shm.\n");
-		return shmid;
+	PREFIX_SMEM* shm = (PREFIX_SMEM*)shmat(shmid, NULL, 0);
+	if(shm == (PREFIX_SMEM*)-1){
+		printf(">>> failed to set prefix_shm.\n");
+		shmctl(shmid, IPC_RMID, NULL);
+		return -1;
 	}
+	shm->capacity = capacity;
+	shm->version = 0;
+	shm->deadline = 0;
+	shm->arr_size = 0;
+	shm->data_size = 0;
+	shm->target = 0;
+	prefix_offsets(shm)[0] = 0;
+	shmdt(shm);
+	return shmid;
 }
 
-static int get_prefix_smem(){
-	key_t key = 2222;
-	int shmid = shmget(key, 0, 0);
-	if(shmid == -1){
-		printf(">>> sigmget prefix_shm failed.\n");
+/* the channel of this AFLGo instance, -1 when it runs outside LTL-Fuzzer */
+static inline int get_prefix_smem(){
+	const char* id = getenv(PREFIX_SHM_ENV_VAR);
+	if(id == NULL || *id == '\0'){
+		printf(">>> no prefix_shm given in %s.\n", PREFIX_SHM_ENV_VAR);
 		return -1;
 	}
-	else{
-		//printf("sigmget succeeded.\n");
-		return shmid;
-	}
+	return atoi(id);
 }
 
-static PREFIX_SMEM* bind_prefix_smem(int shmid){
+static inline PREFIX_SMEM* bind_prefix_smem(int shmid){
 	void *shm = NULL;
 	shm = shmat(shmid, NULL, 0);
 	if(shm == (void*)-1){
@@ -58,14 +317,54 @@ static PREFIX_SMEM* bind_prefix_smem(int shmid){
 	}
 }
 
-static void detach_prefix_shmem(PREFIX_SMEM* shm){
+static inline void detach_prefix_shmem(PREFIX_SMEM* shm){
 	int status = shmdt(shm);
 	if(status){
 		printf(">>> prefix_shm detach failed. \n"); 
 	}
 }
 
-static void release_prefix_shmem(int shmid){
+/* a verdict shm of its own for each process that runs the subject: an AFLGo
+   instance resets its verdict before every execution, which would erase the
+   violation of another one sharing it */
+static inline int create_verdict_smem(){
+	/**
+		From the instrumented runtime to AFLGo and LTL-Fuzzer
+	**/
+	int shmid = shmget(IPC_PRIVATE, sizeof(VERDICT_SMEM), 0600|IPC_CREAT);
+	if(shmid == -1){
+		printf(">>> failed to set verdict_shm.\n");
+	}
+	return shmid;
+}
+
+/* Silent: outside a campaign there is no verdict shm and executions fall back to aborting */
+static inline int get_verdict_smem(){
+	char* id = getenv(VERDICT_SHM_ENV_VAR);
+	if(id != NULL && *id != '\0'){
+		return atoi(id);
+	}
+	return -1;
+}
+
+static inline VERDICT_SMEM* bind_verdict_smem(int shmid){
+	if(shmid == -1){
+		return (VERDICT_SMEM*)-1;
+	}
+	void *shm = shmat(shmid, NULL, 0);
+	if(shm == (void*)-1){
+		return (VERDICT_SMEM*)-1;
+	}
+	return (VERDICT_SMEM*)shm;
+}
+
+static inline void reset_verdict(VERDICT_SMEM* shm){
+	if(shm != (VERDICT_SMEM*)-1){
+		shm->violated = 0;
+	}
+}
+
+static inline void release_prefix_shmem(int shmid){
 	if(shmid == -1){
 		return;
 	}
@@ -75,5 +374,14 @@ static void release_prefix_shmem(int shmid){
 	}
 }
 
+static inline void release_verdict_smem(int shmid){
+	if(shmid == -1){
+		return;
+	}
+	if(shmctl(shmid, IPC_RMID, NULL) == -1){
+		printf(">>> verdict_shm release failed. \n");
+	}
+}
+
 #endif
 
@@ -0,0 +1,173 @@
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+/*
+ * An automaton path: the automaton states a trace moved through, each one
+ * different from the previous. It is kept as state ids with a 64-bit hash
+ * rolled forward as states are appended, and stored in the shared table and
+ * the prefix log as a compact key (see encode_path_key()). The text form
+ * "0,3,5," is only for display.
+ */
+
+namespace lfz {
+namespace automata {
+
+class StatePath {
+public:
+    StatePath() : hash_(HASH_BASIS)
+    {
+    }
+
+    void push(int state)
+    {
+        this->states_.push_back(state);
+        this->hash_ = (this->hash_ ^ (uint32_t)state) * HASH_PRIME;
+    }
+
+    void clear()
+    {
+        this->states_.clear();
+        this->hash_ = HASH_BASIS;
+    }
+
+    size_t size() const
+    {
+        return this->states_.size();
+    }
+
+    bool empty() const
+    {
+        return this->states_.empty();
+    }
+
+    int operator[](size_t i) const
+    {
+        return this->states_[i];
+    }
+
+    /* the state the path ends in, -1 for the empty path */
+    int last() const
+    {
+        return this->states_.empty() ? -1 : this->states_.back();
+    }
+
+    bool contains(int state) const
+    {
+        for (int s : this->states_) {
+            if (s == state) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    uint64_t hash() const
+    {
+        return this->hash_;
+    }
+
+    bool operator==(const StatePath &other) const
+    {
+        return this->hash_ == other.hash_ && this->states_ == other.states_;
+    }
+
+    std::string str() const
+    {
+        std::string s;
+        for (int state : this->states_) {
+            s += std::to_string(state);
+            s += ',';
+        }
+        return s;
+    }
+
+private:
+    static constexpr uint64_t HASH_BASIS = 14695981039346656037ULL;
+    static constexpr uint64_t HASH_PRIME = 1099511628211ULL;
+
+    std::vector<int> states_;
+    uint64_t hash_;
+};
+
+/*
+ * Key of a path of a property: the property id, then the states, each as an
+ * unsigned LEB128 varint, so that states below 128 take one byte.
+ */
+inline void append_varint(std::string &key, uint32_t value)
+{
+    while (value >= 0x80) {
+        key += (char)(value | 0x80);
+        value >>= 7;
+    }
+    key += (char)value;
+}
+
+inline std::string encode_path_key(int property, const StatePath &path)
+{
+    std::string key;
+    key.reserve(path.size() + 1);
+    append_varint(key, property);
+    for (size_t i = 0; i < path.size(); i++) {
+        append_varint(key, path[i]);
+    }
+    return key;
+}
+
+/* false if the key is truncated */
+inline bool decode_path_key(const char *key, size_t len, int &property, StatePath &path)
+{
+    path.clear();
+    bool first = true;
+    size_t i = 0;
+    while (i < len) {
+        uint32_t value = 0;
+        unsigned shift = 0;
+        for (;;) {
+            if (i == len || shift > 28) {
+                return false;
+            }
+            unsigned char b = key[i++];
+            value |= (uint32_t)(b & 0x7f) << shift;
+            shift += 7;
+            if (!(b & 0x80)) {
+                break;
+            }
+        }
+        if (first) {
+            property = value;
+            first = false;
+        } else {
+            path.push(value);
+        }
+    }
+    return !first;
+}
+
+/* number of states in a key, without decoding it */
+inline size_t path_key_depth(const char *key, size_t len)
+{
+    size_t values = 0;
+    for (size_t i = 0; i < len; i++) {
+        if (!((unsigned char)key[i] & 0x80)) {
+            values++;
+        }
+    }
+    return values ? values - 1 : 0;
+}
+
+/* display form of a key, "<property id>#0,3,5," */
+inline std::string path_key_str(const char *key, size_t len)
+{
+    int property = 0;
+    StatePath path;
+    if (!decode_path_key(key, len, property, path)) {
+        return "<corrupted path>";
+    }
+    return std::to_string(property) + "#" + path.str();
+}
+
+} // namespace automata
+} // namespace lfz
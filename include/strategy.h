@@ -3,17 +3,118 @@
  * (double type) and returns an object according to implemented strategies
  */
 #include <vector>
-#include <any>
+#include <stdint.h>
+#include <stddef.h>
 
 #ifndef STRATEGY_H
 #define STRATEGY_H
 namespace strategy{
 
+/* splitmix64: one seeded generator for every selection of the orchestrator */
+class Rng{
+    public:
+        Rng(uint64_t seed) : state(seed){}
+        uint64_t next(){
+            uint64_t z = (state += 0x9e3779b97f4a7c15ULL);
+            z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+            z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+            return z ^ (z >> 31);
+        }
+        /* uniform in [0, n) */
+        uint64_t below(uint64_t n){
+            return n ? next() % n : 0;
+        }
+        /* uniform in [0, 1) */
+        double uniform(){
+            return (next() >> 11) * (1.0 / 9007199254740992.0);
+        }
+
+    private:
+        uint64_t state;
+};
+
+/* seeded once from LTL_SEED, or from the time and pid */
+Rng& rng();
+
+/* a version no Candidates had before */
+inline uint64_t next_candidates_version(){
+    static uint64_t last = 0;
+    return ++last;
+}
+
+/* the objects of one selection and their fitness. Items are usually
+   pointers into the container selected from, so nothing is copied, and a
+   Candidates kept by its caller is refilled without allocating. A refill
+   is compared with what it replaces: the version only changes when the
+   items or their fitness do, so strategies keep what they derived from
+   them until then */
+template<typename T>
+class Candidates{
+    public:
+        void clear(){
+            count = 0;
+        }
+        void add(const T& item, double f){
+            if(count == items.size()){
+                items.push_back(item);
+                fitness.push_back(f);
+                changed = true;
+            }
+            else if(!(items[count] == item) || fitness[count] != f){
+                items[count] = item;
+                fitness[count] = f;
+                changed = true;
+            }
+            count++;
+        }
+        size_t size() const{
+            return count;
+        }
+        bool empty() const{
+            return count == 0;
+        }
+        /* the same for the same items and fitness, unique otherwise */
+        uint64_t version(){
+            if(count != items.size()){
+                items.erase(items.begin() + count, items.end());
+                fitness.erase(fitness.begin() + count, fitness.end());
+                changed = true;
+            }
+            if(changed){
+                current = next_candidates_version();
+                changed = false;
+            }
+            return current;
+        }
+        const T& operator[](size_t i) const{
+            return items[i];
+        }
+        const double* weights() const{
+            return fitness.data();
+        }
+
+    private:
+        std::vector<T> items;
+        std::vector<double> fitness;
+        size_t count = 0;           //items of the current fill, the rest are of the previous one
+        bool changed = false;
+        uint64_t current = 0;
+};
+
+/* an implementation provides size_t select_index(const double* fitness,
+   size_t n, const void* set, uint64_t version) over n > 0 candidates, where
+   set is the Candidates and version its version(); the implementation is
+   chosen at compile time (see select_strategy.h), without virtual calls or
+   type erasure */
+template<typename Impl>
 class Strategy{
     public:
-        Strategy(){};
-        ~Strategy(){};
-        virtual std::any select(std::vector<std::pair<std::any, double>> m) = 0;
+        template<typename T>
+        const T& select(Candidates<T>& candidates){
+            uint64_t version = candidates.version();
+            return candidates[static_cast<Impl*>(this)->select_index(candidates.weights(), candidates.size(),
+                                                                     &candidates, version)];
+        }
 };
 } //namepsace
 #endif
@@ -0,0 +1,41 @@
+#include <stdint.h>
+
+#ifndef TABLE_SNAPSHOT_H
+#define TABLE_SNAPSHOT_H
+
+/*
+ * Snapshot of the shared table, written by ltl-fuzz now and then so that a
+ * campaign can be resumed (LTL_RESUME) after a crash or a reboot. The file
+ * is flat so that it is read back through a single mmap: the header, then
+ * for every path a snapshot_path and its key, followed by its prefixes
+ * (oldest first), each a snapshot_prefix, the prefix and the metric.
+ * Records are packed: read them with memcpy.
+ */
+
+namespace path{
+
+const uint32_t snapshotMagic = 0x4c544c53;      //"LTLS"
+const uint32_t snapshotVersion = 1;
+const char SNAPSHOT_FILE[] = "ltl_snapshot";
+
+struct snapshot_header{
+    uint32_t magic;
+    uint32_t version;
+    uint64_t paths;
+    int64_t saved;          //Unix time of the snapshot
+};
+
+struct snapshot_path{
+    uint32_t key_len;
+    uint32_t prefixes;
+    int64_t found;
+};
+
+struct snapshot_prefix{
+    uint32_t prefix_len;
+    uint32_t metric_len;
+};
+
+}//namespace
+
+#endif
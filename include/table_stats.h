@@ -0,0 +1,77 @@
+#include <stdint.h>
+#include <time.h>
+#include <string>
+#include <vector>
+
+#ifndef TABLE_STATS_H
+#define TABLE_STATS_H
+
+/*
+ * Campaign counters kept next to the stored paths: the shared table (RERS)
+ * and the prefix log index (protocols) update them on every insertion, so
+ * ltl-fuzz can report them without walking what is stored.
+ */
+
+namespace path{
+
+const unsigned tableDepths = 16;        //paths by number of automata states, the last bucket holds deeper ones
+const unsigned tablePoolBuckets = 8;    //paths by prefixes held: 1, 2-3, 4-7, ..., 128 and more
+const unsigned tableRecent = 4;         //newest paths remembered
+
+/* bucket of a path with depth automata states, see path_key_depth() */
+inline unsigned depth_bucket(unsigned depth){
+    if(depth == 0){
+        return 0;
+    }
+    return (depth < tableDepths ? depth : tableDepths) - 1;
+}
+
+/* bucket of a pool holding n > 0 prefixes */
+inline unsigned pool_bucket(size_t n){
+    unsigned b = 0;
+    while(n > 1 && b + 1 < tablePoolBuckets){
+        n >>= 1;
+        b++;
+    }
+    return b;
+}
+
+/* moves a path from the bucket of n - 1 prefixes to the one of n */
+inline void pool_grown(uint64_t* pool_paths, size_t n){
+    if(n > 1){
+        pool_paths[pool_bucket(n - 1)]--;
+    }
+    pool_paths[pool_bucket(n)]++;
+}
+
+/* the counters of a whole store, summed by its reader */
+struct table_stats{
+    uint64_t paths = 0;
+    uint64_t prefixes = 0;
+    uint64_t offered = 0;         //prefixes reported, including duplicates
+    uint64_t dropped_paths = 0;
+    uint64_t evicted = 0;
+    uint64_t lost_shards = 0;     //shards cleared after a writer died in them
+    uint64_t depth_paths[tableDepths] = {};
+    uint64_t pool_paths[tablePoolBuckets] = {};
+    time_t last_found = 0;
+    std::vector<std::pair<time_t, std::string>> newest;    //newest first
+
+    void add_newest(time_t found, const std::string& key){
+        auto it = newest.begin();
+        while(it != newest.end() && it->first >= found){
+            it++;
+        }
+        newest.insert(it, std::make_pair(found, key));
+        if(newest.size() > tableRecent){
+            newest.pop_back();
+        }
+        if(found > last_found){
+            last_found = found;
+        }
+    }
+};
+
+}//namespace
+
+#endif
@@ -1,12 +1,14 @@
 #include <string>
 #include <strategy.h>
 #include <map>
+#include <unordered_map>
+#include <vector>
 #include <automata_transition.h>
 #include <iostream>
 #include <target_location.h>
 #include <event.h>
 #include <set>
-#include <random_strategy.h>
+#include <select_strategy.h>
 #include <algorithm>
 #include <fstream>
 #include <sstream>
@@ -16,6 +18,11 @@
 
 namespace ltlfuzz{
 
+//a staged build of the subject (scripts/build-subject.sh), in its build directory
+const char buildPendingFile[] = "build_pending";        //there until every target is built
+const char buildFailedFile[] = "build_failed";          //there once the build stopped short of that
+const char builtTargetsFile[] = "built_targets.txt";    //one line per target whose binary is done
+
 class TargetsStore{
         public:
             
@@ -23,18 +30,42 @@ class TargetsStore{
             void load_events(std::string fileName);
             static TargetsStore* instance();
             TargetLocation getTarget(std::string event, int flag);
+            /* event: its EVENT_DICT id */
+            TargetLocation getTarget(int event, int flag);
             void dump_event_target();
+            /* the code the subject reads for the input event input ("i" + name), empty if unknown */
             std::string decode(std::string input);
-            std::map<std::string, std::string> event_map;
+            /* credit a finished run on target with reward (new automaton paths per minute) */
+            void reward(const std::string& target, double reward);
+            /* while a staged build runs in build_dir, targets are only selected once
+               built; an event none of whose targets is built gets an empty target */
+            void watch_build(const std::string& build_dir);
+            bool built(const std::string& target);
+            /* the build ended without building every target: what is not built yet never will be */
+            bool build_failed();
+            std::unordered_map<std::string, std::string> event_map;    //event name -> code, of event_mapping.txt
 
         private:
             static TargetsStore *s_instance;
-            std::map<std::string, std::set<std::string>> event_target_map;
+            std::unordered_map<std::string, std::string> code_map;     //code -> event name
+            std::vector<std::set<std::string>> event_targets;           //by EVENT_DICT id of the output event
+            std::map<std::string, unsigned> target_runs;    //times each target was selected
+            std::map<std::string, unsigned> target_rewarded; //finished runs of each target, see reward()
+            std::map<std::string, double> target_rewards;   //summed rewards of its finished runs
+            unsigned total_runs = 0;
+            double best_mean_reward = 0;
+            strategy::Candidates<const std::string*> target_candidates;
+            std::string build_dir;
+            bool building = false;
+            bool failed_build = false;
+            std::set<std::string> built_targets;
+            std::streamoff built_read = 0;                  //of builtTargetsFile
 
             TargetsStore();
-            TargetLocation get_target_from_event(std::string e, int flag);
+            TargetLocation get_target_from_event(int event, int flag);
             TargetType get_target_type(std::string target, int flag);
             std::string coding(std::string value);
+            void refresh_build();
 
     };
 }
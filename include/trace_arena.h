@@ -0,0 +1,53 @@
+#pragma once
+
+#include <stddef.h>
+#include <string_view>
+
+/*
+ * Bump-pointer storage for the data the runtime collects during one
+ * execution (protocol inputs). Strings are copied into large chunks and
+ * handed out as views; reset() rewinds to the first chunk in one step and
+ * keeps every chunk for the next execution, so a warmed-up arena does not
+ * allocate at all.
+ *
+ * It is constant-initialized, so the preload hook can reserve() the first
+ * chunk in the fork server parent and every child inherits it.
+ */
+
+namespace inst {
+
+class TraceArena {
+public:
+    static const size_t CHUNK_SIZE = 1 << 16;
+
+    constexpr TraceArena()
+        : head_(nullptr), current_(nullptr), used_(0)
+    {
+    }
+    ~TraceArena();
+
+    TraceArena(const TraceArena &) = delete;
+    TraceArena &operator=(const TraceArena &) = delete;
+
+    /* Make sure size bytes fit without allocating */
+    void reserve(size_t size);
+    /* Copy of data[0, size) that stays valid until reset() */
+    std::string_view copy(const char *data, size_t size);
+    /* Forget every copy, keeping the chunks */
+    void reset();
+
+private:
+    struct Chunk {
+        Chunk *next;
+        size_t size;
+        char *data() { return (char *)(this + 1); }
+    };
+
+    char *allocate(size_t size);
+
+    Chunk *head_;
+    Chunk *current_;
+    size_t used_;   // bytes used in current_
+};
+
+} // namespace inst
@@ -0,0 +1,90 @@
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+#include <shmdata.h>
+#include <fork_server.h>
+
+#ifndef TRIAGE_H
+#define TRIAGE_H
+
+namespace ltlfuzz{
+
+const char triageEnv[] = "LTL_TRIAGE";              //triage threads, 0 for none
+const char triageExecsEnv[] = "LTL_TRIAGE_EXECS";   //executions to minimize one input
+const long int triageScanSecs = 10;                 //between two looks for new counterexamples
+
+/*
+ * Counterexample triage of a RERS campaign, in the background of the
+ * orchestrator. The counterexamples saved by ltl-fuzz and by its AFLGo
+ * workers are run again, one fork server and verdict shm per thread, and
+ * grouped by their violation: the property and the violating automaton
+ * path the runtime reports. The first input of every violation, and any
+ * later one shorter than its witness, is minimized as afl-tmin does, by
+ * deleting blocks of events for as long as the same violation remains.
+ * out_dir gets one witness per violation and violations.txt, which lists
+ * them with the number of counterexamples that showed each one.
+ */
+class Triage{
+    public:
+        Triage(const std::string& out_dir, const std::string& workdir, const std::string& binary,
+               unsigned threads, unsigned timeout_ms, unsigned max_execs);
+        ~Triage();
+
+        /* counterexamples in the directories matching pattern (glob) are triaged as they appear */
+        void watch(const std::string& pattern);
+        void start();
+        /* waits for the input being minimized by every thread */
+        void stop();
+
+    private:
+        struct Violation{
+            std::string witness;        //file under out_dir, empty until the first is minimized
+            size_t size = 0;            //events of the witness, or of the input being minimized first
+            size_t counterexamples = 0;
+        };
+        struct Slot{
+            std::string input_file;
+            int verdict_shmid = -1;
+            VERDICT_SMEM* verdict = (VERDICT_SMEM*)-1;
+        };
+
+        void work(unsigned t);
+        /* queues the files of the watched directories not seen yet */
+        void scan();
+        /* runs data in slot t, false if it did not violate a property;
+           key is then the property and automaton path it violated */
+        bool execute(unsigned t, const std::string& data, std::string& key);
+        std::string minimize(unsigned t, std::string data, const std::string& key);
+        void save(const std::string& key, const std::string& witness);
+        void write_summary();
+
+        std::string out_dir;
+        std::string workdir;
+        std::string binary;
+        unsigned timeout_ms;
+        unsigned max_execs;         //per minimized input
+        std::vector<Slot> slots;
+        std::vector<std::unique_ptr<ForkServer>> servers;   //one per slot
+        std::vector<std::thread> threads;
+        std::vector<std::string> patterns;
+
+        std::atomic<bool> stopping;
+        std::mutex lock;            //guards everything below
+        std::condition_variable wake;
+        long int last_scan = 0;
+        std::set<std::string> seen;
+        std::deque<std::string> queue;
+        std::map<std::string, Violation> violations;   //by property and automaton path
+        size_t not_reproduced = 0;
+};
+
+}//namespace
+
+#endif
@@ -22,6 +22,7 @@ using std::endl;
 #define UTILS_H
 namespace utils{
     extern std::string aDelimiter;
+    extern std::string ltlDelimiter;
 
     std::string get_last_state(std::string aPath);
 
@@ -36,14 +37,34 @@ namespace utils{
     std::vector<std::string> string2vector(std::string s);
     void string_to_vector(std::string p, std::vector<std::string>& results); 
 
+    //split the LTL variable into its properties
+    std::vector<std::string> split_formulas(std::string s);
+    //positive integer from the environment, default_value if unset or invalid
+    size_t env_option(const char* env, size_t default_value);
+    /* numeric field of an AFL fuzzer_stats file, 0 if missing */
+    long int read_afl_stat(const std::string& file, const std::string& key);
+
     void gen_ltl_files(std::string script, std::string build_dir, std::string formula);
 
+    /* runs argv[0] (looked up in PATH) in workdir, without a shell, and waits for it.
+       Its exit status, -1 if it could not run; output, if given, collects its
+       stdout and stderr, which are discarded when quiet */
+    int run_process(const std::vector<std::string>& argv, const std::string& workdir = "",
+                    std::string* output = NULL, bool quiet = false);
+    /* in-process rm -rf and mkdir -p */
+    void remove_all(const std::string& path);
+    bool make_dirs(const std::string& path);
+    /* the regular files of dir, not hidden, sorted */
+    std::vector<std::string> list_files(const std::string& dir);
+    /* rename, or copy and unlink across file systems */
+    bool move_file(const std::string& from, const std::string& to);
+
     INPUT_TYPE* read_input(int* size, std::string input_file);
 
     void write_input(INPUT_TYPE* input, int size,  std::string output_file);
     
-    void write_to_shmem_protocol(std::vector<std::string> arr, uint32_t arr_size);  //For protocols
-    void write_to_shmem_common(INPUT_TYPE arr[], uint32_t arr_size);  //For RERS
+    void write_to_shmem_protocol(PREFIX_SMEM* shm, const std::vector<std::string>& arr);  //For protocols
+    void write_to_shmem_common(PREFIX_SMEM* shm, const INPUT_TYPE arr[], uint32_t arr_size);  //For RERS
     void add_path_and_loc_pair(std::string path);
     //std::string decode(std::string input);
             
@@ -0,0 +1,42 @@
+#include <strategy.h>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#ifndef WEIGHTED_STRATEGY_H
+#define WEIGHTED_STRATEGY_H
+namespace strategy{
+
+/*
+ * Walker's alias table: built in O(n) over the weights, then every sample
+ * costs one random number and one comparison. Non-positive weights are
+ * never chosen; if no weight is positive the choice is uniform.
+ */
+class AliasTable{
+    public:
+        void build(const double* weights, size_t n);
+        size_t size() const;
+        size_t sample(Rng& rng) const;
+
+    private:
+        std::vector<double> prob;
+        std::vector<size_t> alias;
+};
+
+/* selects an object with probability proportional to its fitness; the
+   alias table of a set of candidates is only built again once its version
+   changed */
+class WeightedStrategy: public Strategy<WeightedStrategy> {
+    public:
+        size_t select_index(const double* fitness, size_t n, const void* set, uint64_t version);
+        static WeightedStrategy* instance();
+
+    private:
+        static WeightedStrategy* s_instance;
+        WeightedStrategy();
+        //by Candidates: the version the table was built for
+        std::unordered_map<const void*, std::pair<uint64_t, AliasTable>> tables;
+};
+}//namespace
+
+#endif
@@ -0,0 +1,71 @@
+#include <string>
+#include <utility>
+#include <vector>
+#include <sys/types.h>
+
+#ifndef WORKER_POOL_H
+#define WORKER_POOL_H
+
+namespace ltlfuzz{
+
+/* a program run without a shell */
+struct Command{
+    std::string workdir;
+    std::vector<std::string> argv;
+    long int kill_at = 0;       //Unix time it is stopped at if still running, 0 for never
+
+    std::string str() const;
+};
+
+/*
+ * AFLGo instances run by the orchestrator at the same time, each one on
+ * its own (automata path, target) pair, all of them reporting to the
+ * shared path table. Every worker occupies a slot; slot i is pinned to
+ * CPU cpu_base + i (modulo the online CPUs) and AFL's own core binding is
+ * turned off for it. The pool reaps its children without blocking the
+ * orchestrator for longer than it asks, and stops the ones that outlive
+ * their kill_at (SIGTERM, then SIGKILL after a grace period).
+ */
+class WorkerPool{
+    public:
+        struct Worker{
+            pid_t pid;          //0 if the slot is free
+            std::string target;
+            long int started;
+            long int kill_at;
+            bool terminated;    //SIGTERM sent
+        };
+
+        WorkerPool(size_t workers, size_t per_target, int cpu_base);
+        ~WorkerPool();
+
+        size_t size() const;
+        bool full() const;
+        bool empty() const;
+        /* a new instance of target would not exceed the per-target cap */
+        bool accepts(const std::string& target) const;
+        /* index of the slot the next spawn() takes, -1 if full */
+        int free_slot() const;
+        const Worker& worker(size_t slot) const;
+        /* run cmd in a free slot with env added to its environment, false if it failed */
+        bool spawn(const std::string& target, const Command& cmd,
+                   const std::vector<std::pair<std::string, std::string>>& env = {});
+        /* block until a worker ends */
+        void wait_one();
+        /* same, for at most seconds; false if none ended */
+        bool wait_one_for(unsigned seconds);
+        void wait_all();
+
+    private:
+        /* reaps ended workers and stops overdue ones, true if one ended */
+        bool poll();
+
+        std::vector<Worker> slots;
+        size_t per_target;
+        int cpu_base;
+        size_t busy;
+};
+
+}//namespace
+
+#endif
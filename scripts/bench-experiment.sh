@@ -0,0 +1,39 @@
+#!/bin/bash
+
+if [ "$#" -lt 2 ]; then
+    echo "Usage: ./bench-experiment.sh Experiment Seconds [Seed]" >&2
+    echo "-----------------------------help information----------------------------"
+    echo "  Experiment is: Problem1 or testTelnet, instrumented as in README.md"
+    echo "     Seconds is: the fuzzing budget"
+    echo "        Seed is: the seed of every random choice (default 1)"
+    echo "  Results go to experiment/<Experiment>/bench_output/ltl_bench and ltl_bench_plot"
+    exit
+fi
+
+Experiment=$1
+Seconds=$2
+Seed=${3:-1}
+
+export LTLFuzzer=${LTLFuzzer:-$(cd "$(dirname "$0")/.." && pwd)/}
+export SUBJECT=$LTLFuzzer/experiment/$Experiment/
+
+# the subjects and properties of README.md
+case $Experiment in
+    Problem1)
+        export EXECName=Problem1
+        export LTL="!(! (true U oU) | (! oU U ((oZ & ! oU) & X (! oU U oP))))"
+        Flag=0
+        ;;
+    testTelnet)
+        export EXECName=telnet-server.minimal-net
+        export LTL='!(G((WILLDISABLED)->(X(G((DO)|(DONT))))))'
+        Flag=1
+        ;;
+    *)
+        echo "Unknown experiment: $Experiment" >&2
+        exit 1
+        ;;
+esac
+
+cd $LTLFuzzer/build/src
+./ltl-fuzz bench $Flag $Seconds $Seed
@@ -0,0 +1,179 @@
+#!/bin/bash
+
+usage(){
+    echo "Usage: ./build-subject [-j Jobs] problem1|telnet Targets_file Prj_dir Build_dir" >&2
+    echo "-----------------------------help information----------------------------"
+    echo "          Jobs is: targets whose distances and binaries are made at once (default: all CPUs)"
+    echo "  Targets_file is: the file that contains all instrumentation locations"
+    echo "       Prj_dir is: the directory where source code lies"
+    echo "     Build_dir is: the directory that stores instrumented code"
+    echo "  Compiles the bitcode once, then builds the targets in parallel, each in"
+    echo "  Build_dir/<target> as instrument-problem1.sh and instrument-telnet.sh do."
+    echo "  ltl-fuzz may start meanwhile: it fuzzes a target once its binary is there,"
+    echo "  and only the built ones if the build fails"
+    exit
+}
+
+Jobs=$(nproc)
+if [ "$1" == "-j" ]; then
+    Jobs=$2
+    shift 2
+    if ! [[ "$Jobs" =~ ^[1-9][0-9]*$ ]]; then
+        echo "Jobs must be a positive number" >&2
+        usage
+    fi
+fi
+if [ "$#" -ne 4 ] || [ "$1" != "problem1" -a "$1" != "telnet" ]; then
+    usage
+fi
+
+Subject=$1
+Targets_file=$(realpath $2)
+Prj_dir=$(realpath $3)
+Build_dir=$(realpath $4)
+
+export AFLGO=$LTLFuzzer/AFLGo
+
+INC=$LTLFuzzer/include
+INST_LIB=$LTLFuzzer/build/src/instrumentation/libinstrumentation.a
+ATM_LIB=$LTLFuzzer/build/src/automata/libautomata.a
+
+if [ "$Subject" == "telnet" ]; then
+    BIN_SUBDIR=examples/telnet-server
+    BIN_NAME=telnet-server.minimal-net
+    FINAL_FLAGS="-I $INC -Wl,--whole-archive $INST_LIB -Wl,--no-whole-archive $ATM_LIB -lrt -lpthread -lstdc++"
+else
+    BIN_SUBDIR=.
+    BIN_NAME=Problem1
+    FINAL_FLAGS="-revents=$Targets_file"
+fi
+
+# The files ltl-fuzz follows the build with, see TargetsStore::watch_build()
+PENDING=$Build_dir/build_pending
+FAILED=$Build_dir/build_failed
+BUILT=$Build_dir/built_targets.txt
+
+PRE_DIR=$Build_dir/preprocess
+TMP_DIR=$Build_dir/distances
+
+# compile Dir Flags: builds the copy of the subject in Dir
+compile(){
+    if [ "$Subject" == "telnet" ]; then
+        cd $1/$BIN_SUBDIR || return 1
+        export CC="$AFLGO/afl-clang-fast $2"
+        export CXX="$AFLGO/afl-clang-fast++ $2"
+        make clean
+        make
+    else
+        cd $1 || return 1
+        $AFLGO/afl-clang-fast++ $2 -o Problem1 Problem1.c -I $INC $INST_LIB $ATM_LIB -lrt -lpthread
+    fi
+}
+
+# build_target Target Threads: the distances to Target, then its binary, built
+# aside and moved to Build_dir/Target once complete
+build_target(){
+    local target=$1
+    local dist=$TMP_DIR/$target
+    local out=$Build_dir/$target.partial
+
+    rm -rf $dist && mkdir $dist
+    cp -r $TMP_DIR/dot-files $TMP_DIR/BBnames.txt $TMP_DIR/BBcalls.txt $TMP_DIR/Fnames.txt $dist/
+    echo $target > $dist/BBtargets.txt
+    # the functions with the target, from the map of the preprocessing pass
+    awk -F, -v t="${target##*/}" '$1 == t { print $2 }' $TMP_DIR/Ftargetmap.txt | sort -u > $dist/Ftargets.txt
+    if [ ! -s $dist/Ftargets.txt ]; then
+        echo "$target is in no function of the subject" >&2
+        return 1
+    fi
+    $AFLGO/scripts/gen_distance_fast.py -j $2 $PRE_DIR/$BIN_SUBDIR $dist $BIN_NAME || return 1
+
+    rm -rf $out && mkdir $out
+    cp -r $Prj_dir/* $out/
+    (compile $out "-distance=$dist/distance.cfg.txt $FINAL_FLAGS") || return 1
+    if [ "$Subject" == "problem1" ]; then
+        cp $dist/distance.cfg.txt $out/
+    fi
+
+    rm -rf $Build_dir/$target
+    mv $out $Build_dir/$target
+    echo $target >> $BUILT
+}
+
+# start Target Threads: build_target in the background, logged next to its distances
+start(){
+    local log=$TMP_DIR/$1.log
+    (
+        if build_target $1 $2 > $log 2>&1; then
+            echo "built $1"
+        else
+            echo "failed to build $1, see $log" >&2
+            exit 1
+        fi
+    ) &
+}
+
+# However the build ends, ltl-fuzz must not wait for it: unless it completed,
+# the failure marker goes in before the pending one goes away
+finish(){
+    if [ -e $PENDING ]; then
+        touch $FAILED
+        rm -f $PENDING
+    fi
+}
+trap finish EXIT
+trap 'exit 1' INT TERM HUP
+
+cd $Build_dir || exit 1
+touch $PENDING
+rm -rf $FAILED $PRE_DIR $TMP_DIR $BUILT
+mkdir $PRE_DIR $TMP_DIR
+cp -r $Prj_dir/* $PRE_DIR/
+
+# One preprocessing build, as in instrument-problem1-single.sh
+cut -d: -f1,2 $Targets_file | awk '!seen[$0]++' > $TMP_DIR/BBtargets.txt
+(compile $PRE_DIR "-flto -targets=$TMP_DIR/BBtargets.txt -outdir=$TMP_DIR -fuse-ld=gold -Wl,-plugin-opt=save-temps")
+if [ $? -ne 0 ]; then
+    echo "preprocessing failed" >&2
+    exit 1
+fi
+echo "-------------------------Preprocessing Done--------------------------"
+
+cat $TMP_DIR/BBnames.txt | rev | cut -d: -f2- | rev | sort | uniq > $TMP_DIR/BBnames2.txt && mv $TMP_DIR/BBnames2.txt $TMP_DIR/BBnames.txt
+cat $TMP_DIR/BBcalls.txt | sort | uniq > $TMP_DIR/BBcalls2.txt && mv $TMP_DIR/BBcalls2.txt $TMP_DIR/BBcalls.txt
+
+# The first target alone and with all CPUs: ltl-fuzz waits for it, and its call
+# graph lands in the distance cache for the others. Without it there is no
+# campaign, so the build stops there
+Threads=$(( ($(nproc) + Jobs - 1) / Jobs ))
+failed=0
+running=0
+first=1
+while read -r -u 3 target
+do
+    if [ $first -eq 1 ]; then
+        start $target $(nproc)
+        wait -n || exit 1
+        first=0
+        continue
+    fi
+    if [ $running -ge $Jobs ]; then
+        wait -n || failed=1
+        running=$((running - 1))
+    fi
+    start $target $Threads
+    running=$((running + 1))
+done 3< $TMP_DIR/BBtargets.txt
+
+while [ $running -gt 0 ]; do
+    wait -n || failed=1
+    running=$((running - 1))
+done
+
+# A target that failed leaves the build failed: ltl-fuzz keeps to the built ones
+if [ $failed -ne 0 ]; then
+    echo "some targets failed, see $TMP_DIR/*.log" >&2
+    exit 1
+fi
+rm -f $PENDING
+echo "-------------------------All Targets Built--------------------------"
@@ -0,0 +1,58 @@
+#!/bin/bash
+
+if [ "$#" -ne 3 ]; then
+    echo "Usage: ./instrument-problem1-single Targets_file Prj_dir Build_dir" >&2
+    echo "-----------------------------help information----------------------------"
+    echo "  Targets_file is: the file that contains all instrumentation locations"
+    echo "       Prj_dir is: the directory where source code lies"
+    echo "     Build_dir is: the directory that stores instrumented code"
+    echo "  Builds one binary that serves every target, see distance_targets.txt"
+    exit
+fi
+
+Targets_file=$(realpath $1)
+Prj_dir=$2
+Build_dir=$(realpath $3)
+
+export AFLGO=$LTLFuzzer/AFLGo
+export CC=$AFLGO/afl-clang-fast
+export CXX=$AFLGO/afl-clang-fast++
+
+INC=$LTLFuzzer/include
+INST_LIB=$LTLFuzzer/build/src/instrumentation/libinstrumentation.a
+ATM_LIB=$LTLFuzzer/build/src/automata/libautomata.a
+
+
+cd $Build_dir
+rm -rf TMP distance_targets.txt
+mkdir TMP
+TMP_DIR=$(realpath TMP)
+cp $Prj_dir/* .
+
+# One preprocessing build: the CFGs, block names and calls do not depend on the target
+cut -d: -f1,2 $Targets_file > $TMP_DIR/BBtargets.txt
+
+export ADDITIONAL="-targets=$TMP_DIR/BBtargets.txt -outdir=$TMP_DIR -flto  -fuse-ld=gold -Wl,-plugin-opt=save-temps"
+
+$CXX $ADDITIONAL -o Problem1 Problem1.c -I $INC $INST_LIB $ATM_LIB -lrt -lpthread
+
+cat $TMP_DIR/BBnames.txt | rev | cut -d: -f2- | rev | sort | uniq > $TMP_DIR/BBnames2.txt && mv $TMP_DIR/BBnames2.txt $TMP_DIR/BBnames.txt
+cat $TMP_DIR/BBcalls.txt | sort | uniq > $TMP_DIR/BBcalls2.txt && mv $TMP_DIR/BBcalls2.txt $TMP_DIR/BBcalls.txt
+
+# The distances to each target, in the order of distance_targets.txt
+index=0
+while IFS=":" read -r fileName lineNum event
+do
+    Target_DIR=$TMP_DIR/$fileName":"$lineNum
+    mkdir $Target_DIR
+    cp -r $TMP_DIR/dot-files $TMP_DIR/BBnames.txt $TMP_DIR/BBcalls.txt $TMP_DIR/Fnames.txt $Target_DIR/
+    echo $fileName":"$lineNum > $Target_DIR/BBtargets.txt
+    grep -l "$fileName:$lineNum:" $TMP_DIR/dot-files/cfg.*.dot | sed 's/.*cfg\.\(.*\)\.dot$/\1/' > $Target_DIR/Ftargets.txt
+
+    $AFLGO/scripts/gen_distance_fast.py $Build_dir $Target_DIR Problem1
+
+    echo $fileName":"$lineNum $Target_DIR/distance.cfg.txt >> distance_targets.txt
+    index=$((index + 1))
+done < "$Targets_file"
+
+$CXX -distances=$Build_dir/distance_targets.txt -revents=$Targets_file -o Problem1  Problem1.c -I $INC $INST_LIB $ATM_LIB -lrt -lpthread
@@ -38,12 +38,12 @@ do
 
     export ADDITIONAL="-targets=$TMP_DIR/BBtargets.txt -outdir=$TMP_DIR -flto  -fuse-ld=gold -Wl,-plugin-opt=save-temps"
 
-    $CXX $ADDITIONAL -o Problem1 Problem1.c -I $INC $INST_LIB $ATM_LIB -lrt -lspot -lpthread -lbddx
+    $CXX $ADDITIONAL -o Problem1 Problem1.c -I $INC $INST_LIB $ATM_LIB -lrt -lpthread
 
     cat $TMP_DIR/BBnames.txt | rev | cut -d: -f2- | rev | sort | uniq > $TMP_DIR/BBnames2.txt && mv $TMP_DIR/BBnames2.txt $TMP_DIR/BBnames.txt
     cat $TMP_DIR/BBcalls.txt | sort | uniq > $TMP_DIR/BBcalls2.txt && mv $TMP_DIR/BBcalls2.txt $TMP_DIR/BBcalls.txt
     $AFLGO/scripts/gen_distance_fast.py $Binary_DIR $TMP_DIR Problem1
-    $CXX -distance=$TMP_DIR/distance.cfg.txt -revents=$Targets_file -o Problem1  Problem1.c -I $INC $INST_LIB $ATM_LIB -lrt -lspot -lpthread -lbddx
+    $CXX -distance=$TMP_DIR/distance.cfg.txt -revents=$Targets_file -o Problem1  Problem1.c -I $INC $INST_LIB $ATM_LIB -lrt -lpthread
 
     cp $TMP_DIR/distance.cfg.txt .
 
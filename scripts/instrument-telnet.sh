@@ -48,8 +48,8 @@ do
     cat $TMP_DIR/BBcalls.txt | sort | uniq > $TMP_DIR/BBcalls2.txt && mv $TMP_DIR/BBcalls2.txt $TMP_DIR/BBcalls.txt
 	
     $AFLGO/scripts/gen_distance_fast.py $Binary_DIR/examples/telnet-server/ $TMP_DIR telnet-server.minimal-net
-	export COMPILE_ADDITIONAL="-distance=$TMP_DIR/distance.cfg.txt -I $INC -Wl,--whole-archive $INST_LIB $ATM_LIB -Wl,--no-whole-archive -lrt -lspot -lpthread -lbddx -lstdc++"
-	export LINK_ADDITIONAL="-distance=$TMP_DIR/distance.cfg.txt -I $INC -Wl,--whole-archive $INST_LIB $ATM_LIB -Wl,--no-whole-archive -lrt -lspot -lpthread -lbddx -lstdc++"
+	export COMPILE_ADDITIONAL="-distance=$TMP_DIR/distance.cfg.txt -I $INC -Wl,--whole-archive $INST_LIB -Wl,--no-whole-archive $ATM_LIB -lrt -lpthread -lstdc++"
+	export LINK_ADDITIONAL="-distance=$TMP_DIR/distance.cfg.txt -I $INC -Wl,--whole-archive $INST_LIB -Wl,--no-whole-archive $ATM_LIB -lrt -lpthread -lstdc++"
 	export CC="$AFLGO/afl-clang-fast $COMPILE_ADDITIONAL"
 	export CXX="$AFLGO/afl-clang-fast++ $LINK_ADDITIONAL"
 	make clean
@@ -0,0 +1,104 @@
+#include <assignment_stats.h>
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <stdio.h>
+
+ltlfuzz::AssignmentStats::AssignmentStats(const std::string& file, size_t slots){
+    this->file = file;
+    this->slots.resize(slots);
+}
+
+void ltlfuzz::AssignmentStats::open(size_t slot, const std::string& path, const std::string& event, const std::string& target,
+                                    long int now, uint64_t execs, uint64_t crashes, double paths){
+    close(slot, now, execs, crashes, paths);
+    Running& run = this->slots[slot];
+    run.active = true;
+    run.key = Key(target, event, path);
+    run.started = now;
+    run.execs = execs;
+    run.crashes = crashes;
+    run.paths = paths;
+    run.now = Totals();
+    run.now.assignments = 1;
+}
+
+void ltlfuzz::AssignmentStats::update(size_t slot, long int now, uint64_t execs, uint64_t crashes, double paths){
+    Running& run = this->slots[slot];
+    if(!run.active){
+        return;
+    }
+    run.now.wall = now - run.started;
+    //execs_done of a run that did not write its stats yet reads as 0
+    run.now.execs = execs > run.execs ? execs - run.execs : 0;
+    run.now.counterexamples = crashes > run.crashes ? crashes - run.crashes : 0;
+    run.now.paths = paths - run.paths;
+}
+
+void ltlfuzz::AssignmentStats::close(size_t slot, long int now, uint64_t execs, uint64_t crashes, double paths){
+    Running& run = this->slots[slot];
+    if(!run.active){
+        return;
+    }
+    update(slot, now, execs, crashes, paths);
+    add(row(run.key), run.now);
+    run.active = false;
+}
+
+void ltlfuzz::AssignmentStats::input(const std::string& path, const std::string& event, const std::string& target,
+                                     uint64_t ns, bool violated){
+    Totals& t = row(Key(target, event, path));
+    t.assignments++;
+    t.wall += ns / 1e9;
+    t.execs++;
+    t.counterexamples += violated;
+}
+
+void ltlfuzz::AssignmentStats::add(Totals& into, const Totals& from) const{
+    into.assignments += from.assignments;
+    into.wall += from.wall;
+    into.execs += from.execs;
+    into.paths += from.paths;
+    into.counterexamples += from.counterexamples;
+}
+
+ltlfuzz::AssignmentStats::Totals& ltlfuzz::AssignmentStats::row(const Key& key){
+    auto it = this->totals.find(key);
+    if(it != this->totals.end()){
+        return it->second;
+    }
+    if(this->totals.size() < assignmentsRows){
+        return this->totals[key];
+    }
+    return this->totals[Key(std::get<0>(key), std::get<1>(key), otherPaths)];
+}
+
+void ltlfuzz::AssignmentStats::write() const{
+    std::map<Key, Totals> rows = this->totals;
+    for(auto& run : this->slots){
+        if(run.active){
+            add(rows[run.key], run.now);
+        }
+    }
+    std::vector<std::pair<Key, Totals>> sorted(rows.begin(), rows.end());
+    std::stable_sort(sorted.begin(), sorted.end(), [](const std::pair<Key, Totals>& a, const std::pair<Key, Totals>& b){
+        return a.second.wall > b.second.wall;
+    });
+
+    std::string tmp = this->file + ".tmp";
+    std::ofstream out(tmp, std::ios::trunc);
+    if(!out){
+        return;
+    }
+    //the automata path last: it is the only column that may hold spaces
+    out << "# target, event, assignments, wall_s, execs, execs_per_sec, new_paths, counterexamples, automata_path\n";
+    out << std::fixed << std::setprecision(1);
+    for(auto& row : sorted){
+        const Totals& t = row.second;
+        out << std::get<0>(row.first) << ", " << std::get<1>(row.first) << ", " << t.assignments << ", "
+            << t.wall << ", " << t.execs << ", " << (t.wall > 0 ? t.execs / t.wall : 0) << ", "
+            << t.paths << ", " << t.counterexamples << ", " << std::get<2>(row.first) << "\n";
+    }
+    out.close();
+    rename(tmp.c_str(), this->file.c_str());
+}
@@ -1,10 +1,18 @@
 #include <automata_handler.h>
  
 std::set<std::string> ltlfuzz::ALL_EVENTS;
+lfz::automata::EventDictionary ltlfuzz::EVENT_DICT;
+std::vector<int> ltlfuzz::ALL_EVENT_IDS;
 
 
 ltlfuzz::AutomataHandler::AutomataHandler(lfz::automata::Automata* atm){
     this->atm = atm;
+    for(int e = 0; e < atm->other_event_id(); e++){
+        this->event_ids.push_back(ltlfuzz::EVENT_DICT.intern(atm->event_name(e)));
+    }
+    for(int e : ltlfuzz::ALL_EVENT_IDS){
+        this->all_events.set(e);
+    }
 }
 
 void ltlfuzz::load_ALL_EVENTS(std::string fileName){
@@ -18,124 +26,102 @@ void ltlfuzz::load_ALL_EVENTS(std::string fileName){
         std::string result;
         input >> result;
         std::cout << "event: " << result << std::endl;
-        ltlfuzz::ALL_EVENTS.insert(result);
+        if(ltlfuzz::ALL_EVENTS.insert(result).second){
+            ltlfuzz::ALL_EVENT_IDS.push_back(ltlfuzz::EVENT_DICT.intern(result));
+        }
     }
     std::cout << "-----------------loading Done: " << ALL_EVENTS.size() << "--------------" << std::endl;
     fileReader.close();
 }
 
-std::string ltlfuzz::AutomataHandler::select_event(std::string curState, std::string aPath){
-    ltlfuzz::AutomataTransition tran = select_tran(curState, aPath);
-    ltlfuzz::Proposition prop = select_proposition(tran);
-    ltlfuzz::EventSet eSet = extract_proposition_events(prop);
-    return select_event(eSet);
-}
-
-ltlfuzz::AutomataTransition ltlfuzz::AutomataHandler::select_tran(std::string curState, std::string aPath){
-    std::set<int> sPath;
-    std::vector<std::string> vPath;
-    aPath = aPath.substr(0, aPath.size()-1);
-    boost::split(vPath, aPath, [](char c){return c == ',';});
-    for(auto& e : vPath){
-        sPath.insert(std::stoi(e));
+//a transition by fitness, then one of its propositions and one of the events
+//that satisfy it, both uniformly
+std::string ltlfuzz::AutomataHandler::select_event(int curState, const lfz::automata::StatePath& aPath){
+    const lfz::automata::Transition& tran = select_tran(curState, aPath);
+    const std::vector<EventBits>& props = state_events(curState)[&tran - this->atm->state_transition_ids(curState).data()];
+    const EventBits* events = &this->all_events;
+    if(!props.empty()){
+        const EventBits& prop = props[strategy::rng().below(props.size())];
+        if(prop.count()){
+            events = &prop;
+        }
     }
+    return ltlfuzz::EVENT_DICT.name(events->nth(strategy::rng().below(events->count())));
+}
 
-    for(auto&e : sPath){
-        std::cout << ">>> test existing path: " << e << std::endl;
-    }
-    
-    int state = std::stoi(curState);
-    lfz::automata::transitions_t trans;
+const lfz::automata::Transition& ltlfuzz::AutomataHandler::select_tran(int state, const lfz::automata::StatePath& aPath){
+    std::cout << ">>> test existing path: " << aPath.str() << std::endl;
 
-    this->atm->get_state_transitions(state, trans);
+    const lfz::automata::id_transitions_t &trans = this->atm->state_transition_ids(state);
 
 
-    std::cout << "debug: " << curState << std::endl;
-    std::vector<std::pair<std::any, double>> vector_;
+    std::cout << "debug: " << state << std::endl;
+    this->tran_candidates.clear();
 
     for(auto& e : trans){
-        std::set<int>::iterator it;
-        it = sPath.find(e.second);
-        std::cout << "next state: " << e.second << std::endl;
-        if(it == sPath.end()){
-            ltlfuzz::AutomataTransition tran(e.first, std::to_string(e.second));
-            vector_.push_back(std::make_pair(tran,1.0));
+        std::cout << "next state: " << e.dst << std::endl;
+        if(!aPath.contains(e.dst)){
+            this->tran_candidates.add(&e, transition_fitness(e));
         }
     }
 
-    if(vector_.size() == 0){
+    if(this->tran_candidates.empty()){
         for(auto& e : trans){
-            ltlfuzz::AutomataTransition tran(e.first, std::to_string(e.second));
-            vector_.push_back(std::make_pair(tran,1.0));
+            this->tran_candidates.add(&e, transition_fitness(e));
         }
     }
 
-    std::any selected = strategy::RandomStrategy::instance()->select(vector_);
-    ltlfuzz::AutomataTransition trans_selected = std::any_cast<ltlfuzz::AutomataTransition> (selected);
+    const lfz::automata::Transition* trans_selected = strategy::selector().select(this->tran_candidates);
 
 
-    std::cout << "Selected transition: "<< std::endl;
-    trans_selected.dump();
+    std::cout << "Selected transition: next state " << trans_selected->dst << std::endl;
 
-    return trans_selected;
+    return *trans_selected;
 
 
 }
 
-ltlfuzz::Proposition ltlfuzz::AutomataHandler::select_proposition(ltlfuzz::AutomataTransition tran){
-    std::vector<std::pair<std::any, double>> vector_;
-
-    for(auto& e : tran.propositions){
-        ltlfuzz::Proposition prop(e);
-        vector_.push_back(std::make_pair(prop,1.0));
+//transitions into states closer to an accepting cycle (a violation) first
+double ltlfuzz::AutomataHandler::transition_fitness(const lfz::automata::Transition& tran){
+    int distance = this->atm->distance_to_acceptance(tran.dst);
+    if(distance < 0){
+        return 0.01;
     }
-
-    std::any selected = strategy::RandomStrategy::instance()->select(vector_);
-    ltlfuzz::Proposition prop = std::any_cast<ltlfuzz::Proposition> (selected);
-
-    return prop;
+    return 1.0 / (1 + distance);
 }
 
-ltlfuzz::EventSet ltlfuzz::AutomataHandler::extract_proposition_events(ltlfuzz::Proposition prop){
-    std::set<std::string> eSet;
-    for(auto e : prop.events){
-
-        if(e.front() == '!'){
-            eSet.insert(e.erase(0));
-        }
-        else{
-            eSet.clear();
-            eSet.insert(e);
-            return ltlfuzz::EventSet(eSet, ltlfuzz::EventType::ACCEPT);
+const std::vector<std::vector<ltlfuzz::EventBits>>& ltlfuzz::AutomataHandler::state_events(int state){
+    if((size_t)state >= this->prop_events.size()){
+        this->prop_events.resize(state + 1);
+    }
+    std::vector<std::vector<EventBits>>& compiled = this->prop_events[state];
+    const lfz::automata::id_transitions_t& trans = this->atm->state_transition_ids(state);
+    if(compiled.size() != trans.size()){
+        compiled.clear();
+        for(auto& tran : trans){
+            compiled.emplace_back();
+            for(auto& prop : tran.cond){
+                compiled.back().push_back(proposition_events(prop));
+            }
         }
-
     }
-    return ltlfuzz::EventSet(eSet, ltlfuzz::EventType::REJECT);
+    return compiled;
 }
 
-std::string ltlfuzz::AutomataHandler::select_event(ltlfuzz::EventSet eSet){
-
-     std::vector<std::pair<std::any, double>> vector_;
-
-     switch (eSet.eventType){
-         case ltlfuzz::EventType::ACCEPT :
-             for( auto& e : eSet.events ){
-                 vector_.push_back(std::make_pair(e, 1.0));
-             }
-             break;
-
-         case ltlfuzz::EventType::REJECT :
-             std::set<std::string> accept_events;
-             std::set_difference(ltlfuzz::ALL_EVENTS.begin(), ltlfuzz::ALL_EVENTS.end(), eSet.events.begin(), eSet.events.end(), std::inserter(accept_events, accept_events.end()));
-
-             for(auto& e : accept_events){
-                 vector_.push_back(std::make_pair(e, 1.0));
-             }
-             break;
-     }
-
-     std::any selected = strategy::RandomStrategy::instance()->select(vector_);
-     std::string event = std::any_cast<std::string> (selected);
-
-     return event;
+//literals of a proposition are automaton event id + 1, negative when negated.
+//Events are exclusive: a positive literal is the only event that satisfies it,
+//otherwise every event of all_events.txt but the negated ones does
+ltlfuzz::EventBits ltlfuzz::AutomataHandler::proposition_events(const std::vector<int>& prop){
+    for(int lit : prop){
+        if(lit > 0){
+            EventBits accepted;
+            accepted.set(this->event_ids[lit - 1]);
+            return accepted;
+        }
+    }
+    EventBits events = this->all_events;
+    for(int lit : prop){
+        events.reset(this->event_ids[-lit - 1]);
+    }
+    return events;
 }
@@ -0,0 +1,104 @@
+#include <benchmark.h>
+#include <shmdata.h>
+#include <utils.h>
+#include <fstream>
+#include <iostream>
+#include <glob.h>
+#include <stdio.h>
+#include <sys/stat.h>
+#include <time.h>
+
+ltlfuzz::Benchmark::Benchmark(const std::string& dir, long int start, long int budget, uint64_t seed, unsigned workers){
+    this->dir = dir;
+    this->start = start;
+    this->budget = budget;
+    this->seed = seed;
+    this->workers = workers;
+    this->last_sample = start;
+    std::ofstream plot(dir + benchPlotFile, std::ios::trunc);
+    plot << "# elapsed_s, paths, prefixes, execs, execs_per_sec, counterexamples" << std::endl;
+}
+
+void ltlfuzz::Benchmark::sample(const path::table_stats& stats, uint64_t input_execs){
+    long int now = static_cast<long int> (time(NULL));
+    if(now - this->last_sample < benchSampleSecs){
+        return;
+    }
+    uint64_t total = execs(input_execs);
+    long int first;
+    size_t found = counterexamples(first);
+    //AFL counts executions in bursts: the rate between two rows is uneven, their sum is not
+    double rate = total > this->last_execs ? (double)(total - this->last_execs) / (now - this->last_sample) : 0;
+    std::ofstream plot(this->dir + benchPlotFile, std::ios::app);
+    plot << now - this->start << ", " << stats.paths << ", " << stats.prefixes << ", " << total << ", "
+         << static_cast<uint64_t> (rate) << ", " << found << std::endl;
+    this->last_sample = now;
+    this->last_execs = std::max(total, this->last_execs);
+}
+
+void ltlfuzz::Benchmark::finish(const path::table_stats& stats, uint64_t input_execs, long int iterations, uint64_t busy_ns){
+    long int now = static_cast<long int> (time(NULL));
+    uint64_t total = execs(input_execs);
+    long int first;
+    size_t found = counterexamples(first);
+    std::string file = this->dir + benchResultsFile;
+    std::ofstream out(file + ".tmp", std::ios::trunc);
+    out << "budget            : " << this->budget << "\n";
+    out << "elapsed           : " << now - this->start << "\n";
+    out << "seed              : " << this->seed << "\n";
+    out << "workers           : " << this->workers << "\n";
+    //-1 without a counterexample
+    out << "first_violation_s : " << (found ? first - this->start : -1) << "\n";
+    out << "counterexamples   : " << found << "\n";
+    out << "paths             : " << stats.paths << "\n";
+    out << "prefixes          : " << stats.prefixes << "\n";
+    out << "last_path_s       : " << (stats.paths ? static_cast<long int> (stats.last_found) - this->start : -1) << "\n";
+    out << "execs             : " << total << "\n";
+    out << "input_execs       : " << input_execs << "\n";
+    out << "execs_per_sec     : " << static_cast<uint64_t> ((double)total / std::max(now - this->start, 1L)) << "\n";
+    out << "iterations        : " << iterations << "\n";
+    out << "overhead_us_iter  : " << (iterations ? busy_ns / 1000 / iterations : 0) << "\n";
+    out.close();
+    rename((file + ".tmp").c_str(), file.c_str());
+    std::cout << "benchmark: results in " << file << ", " << stats.paths << " automata paths, "
+              << found << " counterexamples" << std::endl;
+}
+
+uint64_t ltlfuzz::Benchmark::execs(uint64_t input_execs){
+    uint64_t total = input_execs;
+    glob_t runs;
+    if(glob((this->dir + "fuzzing-*").c_str(), GLOB_ONLYDIR, NULL, &runs) == 0){
+        for(size_t i = 0; i < runs.gl_pathc; i++){
+            total += utils::read_afl_stat(std::string(runs.gl_pathv[i]) + "/fuzzer_stats", "execs_done");
+        }
+    }
+    globfree(&runs);
+    return total;
+}
+
+size_t ltlfuzz::Benchmark::counterexamples(long int& first){
+    const std::string suffix = TRACE_FILE_SUFFIX;
+    size_t found = 0;
+    first = 0;
+    std::vector<std::string> dirs = {this->dir + "crashes"};
+    glob_t runs;
+    if(glob((this->dir + "fuzzing-*/replayable-crashes").c_str(), GLOB_ONLYDIR, NULL, &runs) == 0){
+        dirs.insert(dirs.end(), runs.gl_pathv, runs.gl_pathv + runs.gl_pathc);
+    }
+    globfree(&runs);
+    for(auto& d : dirs){
+        for(auto& file : utils::list_files(d)){
+            bool trace = file.size() > suffix.size() && file.compare(file.size() - suffix.size(), suffix.size(), suffix) == 0;
+            bool readme = file.size() >= 11 && file.compare(file.size() - 11, 11, "/README.txt") == 0;
+            struct stat st;
+            if(trace || readme || stat(file.c_str(), &st) != 0){
+                continue;
+            }
+            found++;
+            if(first == 0 || st.st_mtime < first){
+                first = st.st_mtime;
+            }
+        }
+    }
+    return found;
+}
@@ -0,0 +1,267 @@
+#include <cluster.h>
+#include <algorithm>
+#include <errno.h>
+#include <iostream>
+#include <netdb.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+namespace{
+
+const unsigned clusterTimeoutSecs = 10;
+
+bool write_all(int fd, const char* data, size_t len){
+    while(len > 0){
+        ssize_t n = send(fd, data, len, MSG_NOSIGNAL);
+        if(n < 0 && errno == EINTR){
+            continue;
+        }
+        if(n <= 0){
+            return false;
+        }
+        data += n;
+        len -= n;
+    }
+    return true;
+}
+
+bool read_all(int fd, char* data, size_t len){
+    while(len > 0){
+        ssize_t n = read(fd, data, len);
+        if(n < 0 && errno == EINTR){
+            continue;
+        }
+        if(n <= 0){
+            return false;
+        }
+        data += n;
+        len -= n;
+    }
+    return true;
+}
+
+void append_field(std::string& out, const std::string& field){
+    uint32_t len = field.size();
+    out.append((const char*)&len, sizeof(len));
+    out += field;
+}
+
+//budget: bytes the rest of the message may still take
+bool read_field(int fd, std::string& field, size_t& budget){
+    uint32_t len;
+    if(!read_all(fd, (char*)&len, sizeof(len)) || len > ltlfuzz::clusterMaxField || len > budget){
+        return false;
+    }
+    budget -= len;
+    field.resize(len);
+    return len == 0 || read_all(fd, &field[0], len);
+}
+
+uint64_t rotl(uint64_t x, int b){
+    return (x << b) | (x >> (64 - b));
+}
+
+//SipHash-2-4 of data under the key k0, k1
+uint64_t siphash(uint64_t k0, uint64_t k1, const unsigned char* data, size_t len){
+    uint64_t v0 = 0x736f6d6570736575ULL ^ k0, v1 = 0x646f72616e646f6dULL ^ k1;
+    uint64_t v2 = 0x6c7967656e657261ULL ^ k0, v3 = 0x7465646279746573ULL ^ k1;
+    auto round = [&](){
+        v0 += v1; v1 = rotl(v1, 13); v1 ^= v0; v0 = rotl(v0, 32);
+        v2 += v3; v3 = rotl(v3, 16); v3 ^= v2;
+        v0 += v3; v3 = rotl(v3, 21); v3 ^= v0;
+        v2 += v1; v1 = rotl(v1, 17); v1 ^= v2; v2 = rotl(v2, 32);
+    };
+    auto compress = [&](uint64_t m){
+        v3 ^= m;
+        round();
+        round();
+        v0 ^= m;
+    };
+    size_t i = 0;
+    for(; i + 8 <= len; i += 8){
+        uint64_t m;
+        memcpy(&m, data + i, 8);
+        compress(m);
+    }
+    uint64_t last = (uint64_t)len << 56;
+    for(size_t j = 0; i + j < len; j++){
+        last |= (uint64_t)data[i + j] << (8 * j);
+    }
+    compress(last);
+    v2 ^= 0xff;
+    for(int r = 0; r < 4; r++){
+        round();
+    }
+    return v0 ^ v1 ^ v2 ^ v3;
+}
+
+}//namespace
+
+size_t ltlfuzz::record_size(const ClusterRecord& r){
+    return 5 * sizeof(uint32_t) + r.key.size() + r.data.size() + r.extra.size();
+}
+
+uint64_t ltlfuzz::cluster_auth(const std::string& secret, uint64_t challenge){
+    if(secret.empty()){
+        return 0;
+    }
+    const unsigned char* key = (const unsigned char*)secret.data();
+    uint64_t k0 = siphash(0, 0, key, secret.size());
+    uint64_t k1 = siphash(k0, 1, key, secret.size());
+    return siphash(k0, k1, (const unsigned char*)&challenge, sizeof(challenge));
+}
+
+bool ltlfuzz::send_message(int fd, const cluster_header& header, const std::vector<ClusterRecord>& records){
+    std::string out((const char*)&header, sizeof(header));
+    for(auto& r : records){
+        out.append((const char*)&r.kind, sizeof(r.kind));
+        out.append((const char*)&r.node, sizeof(r.node));
+        append_field(out, r.key);
+        append_field(out, r.data);
+        append_field(out, r.extra);
+    }
+    return write_all(fd, out.data(), out.size());
+}
+
+bool ltlfuzz::receive_message(int fd, cluster_header& header, std::vector<ClusterRecord>& records){
+    if(!read_all(fd, (char*)&header, sizeof(header)) || header.magic != clusterMagic || header.count > clusterBatch){
+        return false;
+    }
+    size_t budget = clusterMaxMessage;
+    for(uint32_t i = 0; i < header.count; i++){
+        ClusterRecord r;
+        if(!read_all(fd, (char*)&r.kind, sizeof(r.kind)) || !read_all(fd, (char*)&r.node, sizeof(r.node)) ||
+           !read_field(fd, r.key, budget) || !read_field(fd, r.data, budget) || !read_field(fd, r.extra, budget)){
+            return false;
+        }
+        records.push_back(r);
+    }
+    return true;
+}
+
+ltlfuzz::ClusterClient::ClusterClient(const std::string& address, unsigned node){
+    size_t colon = address.find_last_of(':');
+    this->host = address.substr(0, colon);
+    this->port = colon == std::string::npos ? "" : address.substr(colon + 1);
+    const char* secret = getenv(secretEnv);
+    this->secret = secret ? secret : "";
+    this->node_id = node;
+    this->since = 0;
+    this->epoch = 0;
+}
+
+unsigned ltlfuzz::ClusterClient::node() const{
+    return this->node_id;
+}
+
+int ltlfuzz::ClusterClient::connect_coordinator(){
+    struct addrinfo hints, *res;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if(getaddrinfo(this->host.c_str(), this->port.c_str(), &hints, &res) != 0){
+        return -1;
+    }
+    int fd = -1;
+    for(struct addrinfo* a = res; a != NULL && fd < 0; a = a->ai_next){
+        fd = socket(a->ai_family, a->ai_socktype | SOCK_CLOEXEC, a->ai_protocol);
+        if(fd < 0){
+            continue;
+        }
+        struct timeval tv = {clusterTimeoutSecs, 0};
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+        if(connect(fd, a->ai_addr, a->ai_addrlen) != 0){
+            close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(res);
+    return fd;
+}
+
+bool ltlfuzz::ClusterClient::exchange(cluster_header& request, const std::vector<ClusterRecord>& records,
+                                      cluster_header& reply, std::vector<ClusterRecord>& received){
+    int fd = connect_coordinator();
+    if(fd < 0){
+        std::cout << "cannot reach the coordinator " << this->host << ":" << this->port << std::endl;
+        return false;
+    }
+    uint64_t challenge;
+    bool ok = read_all(fd, (char*)&challenge, sizeof(challenge));
+    request.epoch = 0;
+    request.auth = cluster_auth(this->secret, challenge);
+    ok = ok && send_message(fd, request, records) && receive_message(fd, reply, received) &&
+         reply.type == CLUSTER_BATCH;
+    close(fd);
+    if(!ok){
+        std::cout << "no reply from the coordinator " << this->host << ":" << this->port
+                  << ", is " << secretEnv << " the same on both sides?" << std::endl;
+    }
+    return ok;
+}
+
+bool ltlfuzz::ClusterClient::new_epoch(const cluster_header& reply){
+    if(reply.epoch == this->epoch){
+        return false;
+    }
+    bool restarted = this->epoch != 0;
+    if(restarted){
+        std::cout << "the coordinator restarted, pulling from its start" << std::endl;
+    }
+    this->epoch = reply.epoch;
+    this->since = 0;
+    return restarted;
+}
+
+bool ltlfuzz::ClusterClient::push(const std::vector<ClusterRecord>& records){
+    for(auto& r : records){
+        if(record_size(r) > clusterMaxMessage || r.key.size() > clusterMaxField ||
+           r.data.size() > clusterMaxField || r.extra.size() > clusterMaxField){
+            std::cout << "cluster: record " << r.key << " is too large to be sent, dropped" << std::endl;
+            continue;
+        }
+        this->pending.push_back(r);
+    }
+    while(!this->pending.empty()){
+        size_t n = 0, bytes = 0;
+        while(n < this->pending.size() && n < clusterBatch && bytes + record_size(this->pending[n]) <= clusterMaxMessage){
+            bytes += record_size(this->pending[n]);
+            n++;
+        }
+        std::vector<ClusterRecord> batch(this->pending.begin(), this->pending.begin() + n);
+        cluster_header request = {clusterMagic, CLUSTER_PUSH, this->node_id, (uint32_t)n, 0, 0, 0};
+        cluster_header reply;
+        std::vector<ClusterRecord> none;
+        if(!exchange(request, batch, reply, none)){
+            return false;
+        }
+        new_epoch(reply);
+        this->pending.erase(this->pending.begin(), this->pending.begin() + n);
+    }
+    return true;
+}
+
+bool ltlfuzz::ClusterClient::pull(std::vector<ClusterRecord>& records){
+    for(;;){
+        cluster_header request = {clusterMagic, CLUSTER_PULL, this->node_id, 0, this->since, 0, 0};
+        cluster_header reply;
+        size_t before = records.size();
+        if(!exchange(request, std::vector<ClusterRecord>(), reply, records)){
+            records.resize(before);
+            return false;
+        }
+        if(new_epoch(reply)){
+            //read from a position of the old epoch
+            records.resize(before);
+            continue;
+        }
+        this->since = reply.since;
+        if(reply.count == 0){
+            return true;
+        }
+    }
+}
@@ -0,0 +1,104 @@
+#include <corpus.h>
+#include <utils.h>
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <sys/stat.h>
+#include <time.h>
+#include <tuple>
+
+namespace{
+
+bool read_file(const std::string& file, std::string& content){
+    std::ifstream ifs(file, std::ios::binary);
+    if(!ifs){
+        return false;
+    }
+    std::stringstream ss;
+    ss << ifs.rdbuf();
+    content = ss.str();
+    return true;
+}
+
+void copy_file(const std::string& from, const std::string& to){
+    std::ifstream ifs(from, std::ios::binary);
+    std::ofstream ofs(to, std::ios::binary);
+    ofs << ifs.rdbuf();
+}
+
+uint64_t content_hash(const std::string& content){
+    uint64_t h = 14695981039346656037ULL;
+    for(unsigned char c : content){
+        h = (h ^ c) * 1099511628211ULL;
+    }
+    return h ^ content.size();
+}
+
+}//namespace
+
+ltlfuzz::Corpus::Corpus(const std::string& dir, const std::string& initial_seeds, size_t seeds){
+    this->dir = dir;
+    this->initial_seeds = initial_seeds;
+    this->seeds = seeds;
+    mkdir(dir.c_str(), 0755);
+}
+
+void ltlfuzz::Corpus::harvest(const std::string& fuzzing_dir, const std::string& target){
+    size_t added = 0;
+    long int now = static_cast<long int> (time(NULL));
+    for(auto& file : utils::list_files(fuzzing_dir + "/queue")){
+        std::string content;
+        if(!read_file(file, content) || content.empty()){
+            continue;
+        }
+        uint64_t h = content_hash(content);
+        if(this->entries.count(h)){
+            continue;
+        }
+        char name[32];
+        snprintf(name, sizeof(name), "%016llx", (unsigned long long)h);
+        std::string entry_file = this->dir + "/" + name;
+        std::ofstream ofs(entry_file, std::ios::binary);
+        ofs.write(content.data(), content.size());
+        bool coverage = file.find("+cov") != std::string::npos || file.find("+ltl") != std::string::npos;
+        this->entries[h] = Entry{entry_file, target, coverage, now};
+        added++;
+    }
+    if(added){
+        std::cout << "corpus: " << added << " new inputs from " << fuzzing_dir
+                  << ", " << this->entries.size() << " in total" << std::endl;
+    }
+}
+
+std::string ltlfuzz::Corpus::seed(const std::string& target, const std::string& seed_dir){
+    if(this->entries.empty() || this->seeds == 0){
+        return this->initial_seeds;
+    }
+    std::vector<const Entry*> ranked;
+    ranked.reserve(this->entries.size());
+    for(auto& e : this->entries){
+        ranked.push_back(&e.second);
+    }
+    auto rank = [&target](const Entry* e){
+        return std::make_tuple(e->target == target, e->coverage, e->found);
+    };
+    size_t n = std::min(this->seeds, ranked.size());
+    std::partial_sort(ranked.begin(), ranked.begin() + n, ranked.end(),
+                      [&rank](const Entry* a, const Entry* b){ return rank(a) > rank(b); });
+
+    utils::remove_all(seed_dir);
+    utils::make_dirs(seed_dir);
+    for(auto& file : utils::list_files(this->initial_seeds)){
+        copy_file(file, seed_dir + "/" + file.substr(file.find_last_of('/') + 1));
+    }
+    for(size_t i = 0; i < n; i++){
+        const std::string& file = ranked[i]->file;
+        copy_file(file, seed_dir + "/corpus-" + file.substr(file.find_last_of('/') + 1));
+    }
+    return seed_dir;
+}
+
+size_t ltlfuzz::Corpus::size() const{
+    return this->entries.size();
+}
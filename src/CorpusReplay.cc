@@ -0,0 +1,185 @@
+#include <corpus_replay.h>
+#include <fork_server.h>
+#include <utils.h>
+#include <atomic>
+#include <fcntl.h>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <thread>
+#include <unistd.h>
+
+ltlfuzz::CorpusReplay::CorpusReplay(path::PathsStore* path_store, const std::string& ltl_dir, const std::string& events_mapping_file){
+    this->path_store = path_store;
+    this->ltl_dir = ltl_dir;
+    //the names the runtime gives the codes of event_mapping.txt, see CodeBean::read_event_map()
+    std::ifstream ifs(events_mapping_file);
+    std::string line;
+    while(std::getline(ifs, line)){
+        std::stringstream ss(line);
+        std::string name;
+        int code;
+        if(ss >> name >> code){
+            this->event_codes["i" + name] = code;
+            this->event_codes["o" + name] = code;
+        }
+    }
+}
+
+void ltlfuzz::CorpusReplay::add_dir(const std::string& dir){
+    const std::string suffix = TRACE_FILE_SUFFIX;
+    for(auto& file : utils::list_files(dir)){
+        if(file.size() > suffix.size() && file.compare(file.size() - suffix.size(), suffix.size(), suffix) == 0){
+            this->trace_files.push_back(file);
+        }
+        else{
+            this->input_files.push_back(file);
+        }
+    }
+}
+
+size_t ltlfuzz::CorpusReplay::inputs() const{
+    return this->input_files.size();
+}
+
+size_t ltlfuzz::CorpusReplay::traces() const{
+    return this->trace_files.size();
+}
+
+void ltlfuzz::CorpusReplay::run(const std::string& workdir, const std::string& binary, const std::string& input_dir,
+                                unsigned threads, unsigned timeout_ms){
+    if(!this->input_files.empty()){
+        run_inputs(workdir, binary, input_dir, threads, timeout_ms);
+    }
+    if(this->trace_files.empty()){
+        return;
+    }
+    std::vector<std::unique_ptr<lfz::automata::CompiledAutomata>> automata;
+    for(unsigned k = 0; ; k++){
+        std::string image = this->ltl_dir + lfz::automata::automata_image_file(k);
+        if(access(image.c_str(), R_OK) != 0){
+            break;
+        }
+        automata.emplace_back(new lfz::automata::CompiledAutomata());
+        try{
+            automata.back()->load(image);
+        }catch(lfz::automata::AutomataException& e){
+            std::cout << "replay: cannot load the automaton of property " << k << ": " << e.what() << std::endl;
+        }
+    }
+    size_t stored = 0;
+    for(auto& file : this->trace_files){
+        inst::CounterexampleTrace trace;
+        if(!inst::read_counterexample_trace(file, trace) || trace.protocol){
+            continue;
+        }
+        for(size_t k = 0; k < automata.size(); k++){
+            stored += automata[k]->valid() && replay_trace(trace, k, *automata[k]);
+        }
+    }
+    std::cout << "replay: " << stored << " automata paths from " << this->trace_files.size() << " traces" << std::endl;
+}
+
+//Every thread forks its own server of the subject and feeds it the next
+//input not taken yet; the children store what they reach in the table.
+void ltlfuzz::CorpusReplay::run_inputs(const std::string& workdir, const std::string& binary, const std::string& input_dir,
+                                       unsigned threads, unsigned timeout_ms){
+    threads = std::max(1u, std::min(threads, (unsigned)this->input_files.size()));
+    std::vector<std::unique_ptr<ForkServer>> servers;
+    std::vector<std::string> files;
+    for(unsigned t = 0; t < threads; t++){
+        files.push_back(input_dir + "/replay-" + std::to_string(t));
+        close(open(files.back().c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0600));
+        servers.emplace_back(new ForkServer());
+        servers.back()->start(workdir, binary, {files.back()});
+    }
+
+    std::atomic<size_t> next(0);
+    std::atomic<size_t> failed(0);
+    std::vector<std::thread> pool;
+    for(unsigned t = 0; t < threads; t++){
+        pool.emplace_back([&, t](){
+            ForkServer& server = *servers[t];
+            for(size_t i = next++; i < this->input_files.size(); i = next++){
+                std::ifstream ifs(this->input_files[i], std::ios::binary);
+                std::ofstream ofs(files[t], std::ios::binary | std::ios::trunc);
+                ofs << ifs.rdbuf();
+                ofs.close();
+                if(!server.running() || server.run(timeout_ms) == -1){
+                    //not instrumented with a fork server, or it died
+                    if(utils::run_process({binary, files[t]}, workdir, NULL, true) != 0){
+                        failed++;
+                    }
+                }
+            }
+        });
+    }
+    for(auto& th : pool){
+        th.join();
+    }
+    servers.clear();
+    for(auto& f : files){
+        remove(f.c_str());
+    }
+    std::cout << "replay: " << this->input_files.size() << " inputs on " << threads << " threads";
+    if(failed){
+        std::cout << ", " << failed << " did not run";
+    }
+    std::cout << std::endl;
+}
+
+//The path and prefix the runtime would have stored for property, had the
+//input of trace been run with it: see CodeBean::step_automata()
+bool ltlfuzz::CorpusReplay::replay_trace(const inst::CounterexampleTrace& trace, int property,
+                                         const lfz::automata::CompiledAutomata& automata){
+    lfz::automata::EventDictionary dict;
+    for(auto& name : trace.names){
+        dict.intern(name);
+    }
+    std::vector<int> ids;
+    automata.bind_events(dict, ids);
+    std::vector<int> codes(trace.names.size(), -1);
+    for(size_t d = 0; d < trace.names.size(); d++){
+        auto it = this->event_codes.find(trace.names[d]);
+        if(it != this->event_codes.end()){
+            codes[d] = it->second;
+        }
+    }
+
+    lfz::automata::StatePath states;
+    std::string prefix;
+    int state = automata.init_state();
+    size_t path_loc = 0;
+    const std::vector<int>& events = trace.events;
+    for(size_t i = 0; i < events.size(); i++){
+        int next = automata.next_state(state, ids[events[i]]);
+        if(next < 0){
+            break;
+        }
+        if(i == 0 || next != state){
+            //the inputs since the previous change that got an output, and this one
+            for(size_t j = i == 0 ? 0 : path_loc + 1; j <= i; j++){
+                if(j%2 != 0 || (j < i && codes[events[j+1]] <= 0)){
+                    continue;
+                }
+                if(codes[events[j]] < 0){
+                    //an input the event map does not know, no prefix to replay it with
+                    return false;
+                }
+                prefix += std::to_string(codes[events[j]]) + ",";
+            }
+            path_loc = i;
+            states.push(next);
+        }
+        state = next;
+    }
+    if(states.empty()){
+        return false;
+    }
+    int distance = automata.distance_to_acceptance(states.last());
+    char metric[32];
+    snprintf(metric, sizeof(metric), "%g", distance < 0 ? 0.0 : 1.0 / (1 + distance));
+    this->path_store->insert_automata_path(property, states, prefix, metric);
+    return true;
+}
@@ -0,0 +1,142 @@
+#include <fork_server.h>
+#include <fcntl.h>
+#include <iostream>
+#include <poll.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+//as in AFLGo/config.h
+#define FORKSRV_FD 198
+
+namespace{
+
+const int forkServerStartMs = 10000;
+
+}//namespace
+
+ltlfuzz::ForkServer::ForkServer(){
+    this->pid = -1;
+    this->ctl_fd = -1;
+    this->st_fd = -1;
+}
+
+ltlfuzz::ForkServer::~ForkServer(){
+    stop();
+}
+
+bool ltlfuzz::ForkServer::start(const std::string& workdir, const std::string& binary, const std::vector<std::string>& args,
+                                const std::vector<std::pair<std::string, std::string>>& env){
+    stop();
+    //a server that died makes run() write to a closed pipe: that is to fail
+    //with EPIPE, not to kill ltl-fuzz
+    signal(SIGPIPE, SIG_IGN);
+    //close-on-exec from the start: other threads fork too (worker slots,
+    //triage restarts), and a process that inherits a write end keeps the
+    //server from ever seeing EOF
+    int ctl[2], st[2];
+    if(pipe2(ctl, O_CLOEXEC) != 0){
+        return false;
+    }
+    if(pipe2(st, O_CLOEXEC) != 0){
+        close(ctl[0]);
+        close(ctl[1]);
+        return false;
+    }
+    pid_t pid = fork();
+    if(pid < 0){
+        close(ctl[0]); close(ctl[1]); close(st[0]); close(st[1]);
+        return false;
+    }
+    if(pid == 0){
+        if(chdir(workdir.c_str()) != 0 ||
+           dup2(ctl[0], FORKSRV_FD) < 0 || dup2(st[1], FORKSRV_FD + 1) < 0){
+            _exit(127);
+        }
+        //the dup2 copies come without the flag: only they survive execv
+        close(ctl[0]); close(ctl[1]); close(st[0]); close(st[1]);
+        signal(SIGPIPE, SIG_DFL);
+        for(auto& var : env){
+            setenv(var.first.c_str(), var.second.c_str(), 1);
+        }
+        int null_fd = open("/dev/null", O_RDWR);
+        if(null_fd >= 0){
+            dup2(null_fd, 0);
+            dup2(null_fd, 1);
+            dup2(null_fd, 2);
+            close(null_fd);
+        }
+        std::vector<char*> argv;
+        argv.push_back(const_cast<char*>(binary.c_str()));
+        for(auto& a : args){
+            argv.push_back(const_cast<char*>(a.c_str()));
+        }
+        argv.push_back(NULL);
+        execv(binary.c_str(), argv.data());
+        _exit(127);
+    }
+    close(ctl[0]);
+    close(st[1]);
+    this->pid = pid;
+    this->ctl_fd = ctl[1];
+    this->st_fd = st[0];
+
+    int hello;
+    if(!read_word(this->st_fd, hello, forkServerStartMs)){
+        std::cout << "no fork server in " << binary << std::endl;
+        stop();
+        return false;
+    }
+    return true;
+}
+
+bool ltlfuzz::ForkServer::running() const{
+    return this->pid > 0;
+}
+
+int ltlfuzz::ForkServer::run(unsigned timeout_ms){
+    if(!running()){
+        return -1;
+    }
+    int was_killed = 0, child = -1, status = 0;
+    if(write(this->ctl_fd, &was_killed, 4) != 4 || !read_word(this->st_fd, child, forkServerStartMs)){
+        stop();
+        return -1;
+    }
+    if(!read_word(this->st_fd, status, timeout_ms)){
+        //hung: kill the run, the server reports it as signaled
+        if(child > 0){
+            kill(child, SIGKILL);
+        }
+        if(!read_word(this->st_fd, status, forkServerStartMs)){
+            stop();
+            return -1;
+        }
+    }
+    return status;
+}
+
+void ltlfuzz::ForkServer::stop(){
+    if(this->ctl_fd >= 0){
+        close(this->ctl_fd);
+    }
+    if(this->st_fd >= 0){
+        close(this->st_fd);
+    }
+    if(this->pid > 0){
+        kill(this->pid, SIGKILL);
+        waitpid(this->pid, NULL, 0);
+    }
+    this->pid = -1;
+    this->ctl_fd = -1;
+    this->st_fd = -1;
+}
+
+bool ltlfuzz::ForkServer::read_word(int fd, int& value, int timeout_ms){
+    struct pollfd p = {fd, POLLIN, 0};
+    if(poll(&p, 1, timeout_ms) <= 0){
+        return false;
+    }
+    return read(fd, &value, 4) == 4;
+}
@@ -1,15 +1,48 @@
 #include <ltlfuzzer.h>
+#include <corpus_replay.h>
+#include <triage.h>
+#include <glob.h>
+#include <thread>
+#include <memory>
 #include <stdio.h>
+#include <fstream>
+#include <fcntl.h>
+#include <unistd.h>
 
 ltlfuzz::LTLFuzzer::LTLFuzzer(path::PathsStore* path_store){
     this->path_store = path_store;
-    this->prefix_shmid = set_prefix_smem();
+    //the INPUT steps, through the fork server or a process of their own
+    this->verdict_shmid = create_verdict_smem();
+    this->verdict = bind_verdict_smem(this->verdict_shmid);
+    if(this->verdict_shmid != -1){
+        setenv(VERDICT_SHM_ENV_VAR, std::to_string(this->verdict_shmid).c_str(), 1);
+    }
 }
 
 ltlfuzz::LTLFuzzer::~LTLFuzzer(){
-    delete this->automata_handler;
+    for(auto handler : this->automata_handlers){
+        delete handler;
+    }
     delete this->targets_store;
-    release_prefix_shmem(this->prefix_shmid);
+    delete this->cluster;
+    if(this->input_fd >= 0){
+        close(this->input_fd);
+    }
+    for(PREFIX_SMEM* shm : this->prefix_maps){
+        if(shm != (PREFIX_SMEM*)-1){
+            detach_prefix_shmem(shm);
+        }
+    }
+    for(int shmid : this->prefix_channels){
+        release_prefix_shmem(shmid);
+    }
+    for(int shmid : this->verdict_channels){
+        release_verdict_smem(shmid);
+    }
+    if(this->verdict != (VERDICT_SMEM*)-1){
+        shmdt(this->verdict);
+    }
+    release_verdict_smem(this->verdict_shmid);
 }
 
 //flag: 0 for common programs; 1 for protocols
@@ -30,6 +63,10 @@ void ltlfuzz::LTLFuzzer::init(int flag){
     }
     std::string SUBJ(subjDir);
     std::cout << "Subject directory under test: " << SUBJ << std::endl;
+    this->statsFile = SUBJ + "ltl_stats";
+    this->targetsFile = SUBJ + assignmentsFile;
+    this->snapshotFile = SUBJ + path::SNAPSHOT_FILE;
+    bool resume = utils::env_option(resumeEnv, 0) != 0;
 
     char* enChar = getenv("EXECName");
     if(enChar == NULL){
@@ -47,6 +84,12 @@ void ltlfuzz::LTLFuzzer::init(int flag){
     }
     std::string formula(ltlProp);
     std::cout << "LTL property under test: " << formula << std::endl;
+    //several properties separated by ';' are checked in the same campaign
+    std::vector<std::string> formulas = utils::split_formulas(formula);
+    if(formulas.empty()){
+        std::cout << "Please specify the LTL property under test" << std::endl;
+        return;
+    }
 
 
     if(!flag){
@@ -74,7 +117,24 @@ void ltlfuzz::LTLFuzzer::init(int flag){
         this->events_mapping_file = SUBJ + "event_map_dir/event_mapping.txt";
         this->targets_store->load_events(this->events_mapping_file);
         this->targets_store->load_targets(this->targets_file, 0); 
-        this->path_store->insert_init_automata_path("0,", "", "1");
+        this->targets_store->watch_build(this->build_dir);
+        std::ifstream distance_targets(this->build_dir + DISTANCE_TARGETS_FILE);
+        std::string line;
+        for(uint32_t index = 0; std::getline(distance_targets, line); index++){
+            this->distance_targets.emplace(line.substr(0, line.find(' ')), index);
+        }
+        utils::make_dirs(this->output_folder);
+        this->dictionary = this->output_folder + "input_events.dict";
+        if(write_input_dictionary(this->dictionary) == 0){
+            //afl-fuzz refuses an empty dictionary
+            this->dictionary.clear();
+        }
+        if(resume){
+            this->path_store->load_snapshot(this->snapshotFile);
+        }
+        for(size_t k = 0; k < formulas.size(); k++){
+            this->path_store->insert_init_automata_path(k, "", "1");
+        }
     }
     else{
         //specific parameters for protocols
@@ -99,106 +159,450 @@ void ltlfuzz::LTLFuzzer::init(int flag){
         this->targets_store = ltlfuzz::TargetsStore::instance();
 
         this->dictionary = SUBJ + "telnet.dict";
-        this->prefixDir = SUBJ + "prefix";
-        std::string rm_prefix = std::string ("sudo rm -r ") + this->prefixDir;
-        system(rm_prefix.c_str());
-        std::string mk_prefix = std::string ("mkdir ") + this->prefixDir;
-        system(mk_prefix.c_str());
+        if(!std::ifstream(this->dictionary).good()){
+            this->dictionary.clear();
+        }
+        //every campaign starts from an empty prefix log, unless it resumes the
+        //previous one: the log is on disk already
+        this->prefixLog = SUBJ + path::PREFIX_LOG_FILE;
+        if(!resume){
+            remove(this->prefixLog.c_str());
+        }
         this->targets_store->load_targets(this->targets_file, 1); 
+        this->targets_store->watch_build(this->build_dir);
     }
     
     std::string exclusive_events = utils::set_to_string(ltlfuzz::ALL_EVENTS); 
     std::cout << "exclusive events: " << exclusive_events << std::endl;
 
-    lfz::automata::Automata* atm=new lfz::automata::Automata();
-    atm->set_formula(formula, exclusive_events);
-
-    this->automata_handler=new ltlfuzz::AutomataHandler(atm);
-    
     utils::gen_ltl_files(std::string(PRJ_HOME) + "scripts/write_ltl_file.sh", this->ltl_dir, formula + ":" + exclusive_events);
 
+    for(size_t k = 0; k < formulas.size(); k++){
+        std::cout << "property " << k << ": " << formulas[k] << std::endl;
+        lfz::automata::Automata* atm=new lfz::automata::Automata();
+        atm->set_formula(formulas[k], exclusive_events);
+        this->automata_handlers.push_back(new ltlfuzz::AutomataHandler(atm));
+
+        //instrumented targets map these images instead of translating the formulas
+        atm->save(this->ltl_dir + lfz::automata::automata_image_file(k));
+    }
+    //a leftover image of an earlier run would add a property
+    std::string stale = this->ltl_dir + lfz::automata::automata_image_file(formulas.size());
+    remove(stale.c_str());
+
     setenv("DRY_RUN", "0", 1);
     setenv("LTL", "1", 1);
+    if(!flag && getenv(STREAMING_ENV_VAR)){
+        std::cout << STREAMING_ENV_VAR << " only applies to protocols, ignored" << std::endl;
+        unsetenv(STREAMING_ENV_VAR);
+    }
+    //the traces of the runs of replace_prefix_run_program(), see save_input()
+    if(utils::env_option(TRACES_ENV_VAR, 0)){
+        setenv(TRACE_FILE_ENV_VAR, (this->input_folder + "input" + TRACE_FILE_SUFFIX).c_str(), 1);
+    }
 }
 
 
+//ltl-fuzz replay: what the inputs and traces of earlier campaigns reach
+//with the current properties goes to the table before fuzzing starts
+void ltlfuzz::LTLFuzzer::replay(int flag, std::vector<std::string> dirs){
+    if(flag){
+        std::cout << "replay: protocol inputs need the network harness of AFLGo, nothing replayed" << std::endl;
+        return;
+    }
+    if(dirs.empty()){
+        dirs = {this->output_folder + "corpus", this->output_folder + "crashes"};
+        glob_t runs;
+        if(glob((this->output_folder + "fuzzing-*").c_str(), GLOB_ONLYDIR, NULL, &runs) == 0){
+            for(size_t i = 0; i < runs.gl_pathc; i++){
+                dirs.push_back(std::string(runs.gl_pathv[i]) + "/queue");
+                dirs.push_back(std::string(runs.gl_pathv[i]) + "/replayable-crashes");
+            }
+        }
+        globfree(&runs);
+    }
+    ltlfuzz::CorpusReplay replay(this->path_store, this->ltl_dir, this->events_mapping_file);
+    for(auto& dir : dirs){
+        replay.add_dir(dir);
+    }
+    std::cout << "replay: " << replay.inputs() << " inputs and " << replay.traces() << " traces" << std::endl;
+    uint64_t paths = this->path_store->stats(flag).paths;
+    wait_for_build();
+    std::string workdir = input_workdir();
+    replay.run(workdir, workdir + this->exec_name, this->input_folder,
+               utils::env_option(replayThreadsEnv, std::max(1u, std::thread::hardware_concurrency())), inputTimeoutMs);
+    std::cout << "replay: " << this->path_store->stats(flag).paths - paths << " new automata paths" << std::endl;
+}
+
+//ltl-fuzz bench: main() already fixed LTL_SEED and turned resuming and
+//clusters off; the campaign writes to a directory of its own
+void ltlfuzz::LTLFuzzer::benchmark(int flag, int seconds){
+    char* subjDir = getenv("SUBJECT");
+    if(subjDir == NULL || seconds <= 0){
+        return;
+    }
+    this->output_folder = std::string(subjDir) + benchDir;
+    utils::remove_all(this->output_folder);
+    utils::make_dirs(this->output_folder);
+    this->statsFile = this->output_folder + "ltl_stats";
+    this->targetsFile = this->output_folder + assignmentsFile;
+    this->snapshotFile = this->output_folder + path::SNAPSHOT_FILE;
+    //a budget shorter than a run shortens the runs in proportion
+    if(this->time_budget_one_target > seconds){
+        this->time_to_exploitation = (long int)this->time_to_exploitation * seconds / this->time_budget_one_target;
+        this->time_budget_one_target = seconds;
+    }
+    this->total_time_budget = seconds;
+    uint64_t seed = strtoull(getenv(seedEnv), NULL, 0);
+    std::cout << "benchmark: " << seconds << "s, seed " << seed << ", output in " << this->output_folder << std::endl;
+    this->bench.reset(new Benchmark(this->output_folder, static_cast<long int> (time(NULL)), seconds, seed,
+                                    utils::env_option(workersEnv, 1)));
+    fuzz(flag);
+}
+
 //Flag: 0 for common fuzzed programs; 1 for protocols
 void ltlfuzz::LTLFuzzer::fuzz(int flag){
 
+    wait_for_build();
     long int start = static_cast<long int> (time(NULL));
+    long int iterations = 0;
+    this->campaign_end = start + this->total_time_budget;
+    long int snapshot_interval = utils::env_option(snapshotEnv, 300);
+    long int last_snapshot = start;
+    //RERS: with a coordinator, the nodes share the table and split the frontier
+    long int sync_interval = utils::env_option(syncEnv, 30);
+    long int last_sync = start;
+    long int last_assignments = start;
+    if(!flag && getenv(clusterEnv)){
+        unsigned node = getenv(nodeEnv) ? atoi(getenv(nodeEnv)) : 0;
+        this->cluster = new ClusterClient(getenv(clusterEnv), node);
+        this->path_store->set_partition(node, utils::env_option(nodesEnv, 1));
+        std::cout << "cluster node " << node << " of " << utils::env_option(nodesEnv, 1)
+                  << ", coordinator " << getenv(clusterEnv) << std::endl;
+    }
+
+    //N AFLGo instances at once on different (automata path, target) pairs
+    ltlfuzz::WorkerPool pool(utils::env_option(workersEnv, 1), utils::env_option(targetInstancesEnv, 1),
+                             getenv(cpuBaseEnv) ? atoi(getenv(cpuBaseEnv)) : 0);
+    std::cout << "workers: " << pool.size() << std::endl;
+    //the queues of finished runs seed the next ones
+    ltlfuzz::Corpus corpus(this->output_folder + "corpus", this->input_folder, utils::env_option(seedsEnv, 16));
+    //runs that stopped finding automaton paths end early and leave their time to others
+    this->plateau_time = utils::env_option(plateauEnv, std::max(this->time_budget_one_target / 4, 1));
+    this->runs.assign(pool.size(), WorkerRun());
+    this->assignments.reset(new AssignmentStats(this->targetsFile, pool.size()));
+    this->table_paths = this->path_store->stats(flag).paths;
+    //each slot has its own prefix channel, so that instances never read each other's prefix
+    uint32_t capacity = utils::env_option(prefixCapacityEnv, PREFIX_DEFAULT_CAPACITY >> 10) << 10;
+    while(this->prefix_channels.size() < pool.size()){
+        int shmid = create_prefix_smem(capacity);
+        if(shmid == -1){
+            return;
+        }
+        this->prefix_channels.push_back(shmid);
+        this->prefix_maps.push_back(bind_prefix_smem(shmid));
+    }
+    while(this->verdict_channels.size() < pool.size()){
+        this->verdict_channels.push_back(create_verdict_smem());
+    }
+
+    //RERS: the counterexamples are grouped and minimized in the background
+    std::unique_ptr<ltlfuzz::Triage> triage;
+    if(!flag && utils::env_option(triageEnv, 0) > 0){
+        std::string workdir = input_workdir();
+        triage.reset(new ltlfuzz::Triage(this->output_folder + "violations/", workdir, workdir + this->exec_name,
+                                         utils::env_option(triageEnv, 0), inputTimeoutMs, utils::env_option(triageExecsEnv, 5000)));
+        triage->watch(this->output_folder + "crashes");
+        triage->watch(this->output_folder + "fuzzing-*/replayable-crashes");
+        triage->start();
+    }
 
     while((start+this->total_time_budget) > static_cast<long int> (time(NULL))){
 
-        std::string spath = "";
+        this->busy.resume();
+        supervise(pool, flag);
+        //a full pool only takes a new selection once a worker is about to end
+        if(pool.full() && expiring_worker(pool, "") < 0){
+            this->busy.pause();
+            pool.wait_one_for(1);
+            continue;
+        }
+
+        ltlfuzz::AutomataPath aPath(0, lfz::automata::StatePath());
         std::string prefix = "";
         if(flag){
-            std::pair<std::string, std::string> ppair=this->path_store->select_automataPath_and_prefix(this->prefixDir);
-            spath = ppair.first;
+            std::pair<ltlfuzz::AutomataPath, std::string> ppair=this->path_store->select_automataPath_and_prefix(this->prefixLog);
+            aPath = ppair.first;
             prefix = ppair.second;
         }
         else{
             std::pair<ltlfuzz::Prefix, ltlfuzz::AutomataPath> pair=this->path_store->select_prefix_aPath();
-            ltlfuzz::Prefix prefix_o = pair.first;
-            ltlfuzz::AutomataPath aPath = pair.second;
-            spath = aPath.path;
-            prefix = prefix_o.prefix;
+            aPath = pair.second;
+            prefix = pair.first.prefix;
         }
 
-        std::cout<< "selected aPath: "<< spath<< " prefix: " << prefix <<std::endl;
+        std::cout<< "selected aPath: "<< aPath.str() << " prefix: " << prefix <<std::endl;
 
-        std::string lastState = utils::get_last_state(spath);
-        std::cout<< "last state: " << lastState <<std::endl;
+        size_t property = aPath.property;
+        if(property >= this->automata_handlers.size() || aPath.states.empty()){
+            std::cout << "unknown property of the automata path: " << property << std::endl;
+            continue;
+        }
+        int lastState = aPath.states.last();
+        std::cout<< "property: " << property << " last state: " << lastState <<std::endl;
 
-        std::string selected_event = this->automata_handler->select_event(lastState, spath);
+        std::string selected_event = this->automata_handlers[property]->select_event(lastState, aPath.states);
         std::cout<< "selected event: " << selected_event <<std::endl<< std::flush;
 
         ltlfuzz::TargetLocation target = this->targets_store->getTarget(selected_event, flag);
 
         switch(target.targetType){
             case ltlfuzz::TargetType::INPUT:
-
-                replace_prefix_run_program(prefix + this->targets_store->decode(target.targetName));
-
+            {
+                this->busy.pause();
+                auto step_start = std::chrono::steady_clock::now();
+                bool violated = replace_prefix_run_program(prefix + this->targets_store->decode(target.targetName));
+                this->assignments->input(aPath.str(), selected_event, target.targetName,
+                                         std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - step_start).count(),
+                                         violated);
+                this->busy.resume();
+            }
                 break;
 
             case ltlfuzz::TargetType::OUTPUT:
+            {
+                if(target.targetName.empty()){
+                    //none of the targets of the event is built yet
+                    this->busy.pause();
+                    pool.wait_one_for(1);
+                    break;
+                }
+                //an instance on this target near its deadline gets the prefix while it runs
+                int slot = expiring_worker(pool, target.targetName);
+                bool handoff = slot >= 0;
+                if(!handoff){
+                    this->busy.pause();
+                    if(!pool.accepts(target.targetName)){
+                        //as many instances on this target as allowed: let one end
+                        pool.wait_one();
+                        break;
+                    }
+                    if(pool.full()){
+                        pool.wait_one();
+                    }
+                    this->busy.resume();
+                    slot = pool.free_slot();
+                }
+                long int now = static_cast<long int> (time(NULL));
+                PREFIX_SMEM* channel_map = this->prefix_maps[slot];
+                auto distance_target = this->distance_targets.find(target.targetName);
+                if(distance_target != this->distance_targets.end()){
+                    prefix_set_target(channel_map, distance_target->second);
+                }
                 if(flag){ //For protocols
                     std::vector<std::string> pre_;
                     if(!prefix.empty()){   
                         utils::string_to_vector(prefix, pre_);
-                        utils::write_to_shmem_protocol(pre_, pre_.size()); //AFLGo will fetch the prefix 
-                    }
-                    else{
-                        utils::write_to_shmem_protocol(pre_, 0); //AFLGo will fetch the prefix 
                     }
+                    utils::write_to_shmem_protocol(channel_map, pre_); //AFLGo will fetch the prefix 
                 }
                 else{
                     std::vector<INPUT_TYPE> pre_;
                     if(!prefix.empty()){
                         utils::string_to_input_type(prefix, pre_);
-                        utils::write_to_shmem_common(&pre_[0], pre_.size()); //AFLGo will fetch the prefix 
-                    }
-                    else{
-                        pre_.push_back(0);
-                        utils::write_to_shmem_common(&pre_[0], 0);
                     }
+                    utils::write_to_shmem_common(channel_map, pre_.data(), pre_.size()); //AFLGo will fetch the prefix 
                 }
+                prefix_set_deadline(channel_map, std::min(now + this->time_budget_one_target, this->campaign_end));
                 
-                std::string cmd=assemble_cmd(target.targetName, flag);
-                system(cmd.c_str());
-
+                if(handoff){
+                    std::cout << "prefix handed to the worker on " << target.targetName << std::endl;
+                    WorkerRun& run = this->runs[slot];
+                    run.progress = now;
+                    this->assignments->open(slot, aPath.str(), selected_event, target.targetName,
+                                            now, run.execs, run.crashes, run.paths);
+                }
+                else{
+                    retire(slot, corpus);
+                    std::string instance = slot > 0 ? "-w" + std::to_string(slot) : "";
+                    std::string out_dir = this->output_folder + "fuzzing-" + utils::get_current_time() + instance;
+                    std::string seeds = corpus.seed(target.targetName, this->output_folder + "seeds-w" + std::to_string(slot));
+                    WorkerRun& run = this->runs[slot];
+                    run.out_dir = out_dir;
+                    run.target = target.targetName;
+                    run.started = run.progress = now;
+                    run.paths = 0;
+                    run.execs = run.crashes = 0;
+                    this->assignments->open(slot, aPath.str(), selected_event, target.targetName, now, 0, 0, 0);
+                    ltlfuzz::Command cmd=assemble_cmd(target.targetName, flag, slot, seeds, out_dir);
+                    std::vector<std::pair<std::string, std::string>> env = {{PREFIX_SHM_ENV_VAR, std::to_string(this->prefix_channels[slot])},
+                                                                            {VERDICT_SHM_ENV_VAR, std::to_string(this->verdict_channels[slot])}};
+                    if(getenv(seedEnv)){
+                        //the n-th run of a campaign mutates alike in every campaign of the same seed
+                        env.push_back({"AFL_RANDOM_SEED", std::to_string(strtoull(getenv(seedEnv), NULL, 0) + this->runs_started)});
+                    }
+                    this->runs_started++;
+                    pool.spawn(target.targetName, cmd, env);
+                }
+            }
                 break;
         }
-        if(!flag){
-            this->path_store->dump();
+        write_stats(flag, start, ++iterations);
+        if(static_cast<long int> (time(NULL)) - last_assignments >= assignmentsInterval){
+            this->assignments->write();
+            last_assignments = static_cast<long int> (time(NULL));
+        }
+        if(this->bench){
+            this->bench->sample(this->path_store->stats(flag), this->input_execs);
+        }
+        if(!flag && static_cast<long int> (time(NULL)) - last_snapshot >= snapshot_interval){
+            if(!this->path_store->save_snapshot(this->snapshotFile)){
+                std::cout << "failed to write the snapshot " << this->snapshotFile << std::endl;
+            }
+            last_snapshot = static_cast<long int> (time(NULL));
+        }
+        if(this->cluster && static_cast<long int> (time(NULL)) - last_sync >= sync_interval){
+            sync_cluster();
+            last_sync = static_cast<long int> (time(NULL));
         }
+        this->busy.pause();
+    }
+    //each worker stops at the deadline of its prefix channel
+    pool.wait_all();
+    if(triage){
+        triage->stop();
+    }
+    for(size_t slot = 0; slot < this->runs.size(); slot++){
+        retire(slot, corpus);
+    }
+    write_stats(flag, start, iterations);
+    this->assignments->write();
+    if(this->bench){
+        this->bench->finish(this->path_store->stats(flag), this->input_execs, iterations, this->busy.ns);
+    }
+    if(this->cluster){
+        sync_cluster();
     }
     if(!flag){
+        this->path_store->save_snapshot(this->snapshotFile);
         this->path_store->clean_up();
     }
 }
 
-void ltlfuzz::LTLFuzzer::replace_prefix_run_program(std::string prefix){
+/* credits the automaton paths found since the last call to the running workers and
+   stops the ones that found neither automaton paths nor AFL paths for plateau_time */
+void ltlfuzz::LTLFuzzer::supervise(const WorkerPool& pool, int flag){
+    long int now = static_cast<long int> (time(NULL));
+    uint64_t paths = this->path_store->stats(flag).paths;
+    size_t busy = 0;
+    for(size_t slot = 0; slot < pool.size(); slot++){
+        busy += pool.worker(slot).pid != 0;
+    }
+    for(size_t slot = 0; slot < pool.size(); slot++){
+        if(pool.worker(slot).pid == 0){
+            continue;
+        }
+        WorkerRun& run = this->runs[slot];
+        if(paths > this->table_paths){
+            run.paths += (double)(paths - this->table_paths) / busy;
+            run.progress = now;
+        }
+        long int progress = std::max(run.progress, utils::read_afl_stat(run.out_dir + "/fuzzer_stats", "last_path"));
+        read_run_stats(run);
+        this->assignments->update(slot, now, run.execs, run.crashes, run.paths);
+        PREFIX_SMEM* channel_map = this->prefix_maps[slot];
+        if(prefix_deadline(channel_map) > now && now - progress > this->plateau_time){
+            std::cout << "worker on " << run.target << " made no progress for "
+                      << now - progress << "s, stopping it" << std::endl;
+            prefix_set_deadline(channel_map, now);
+        }
+    }
+    this->table_paths = paths;
+}
+
+/* collects the queue of the run that last used slot and rewards its target */
+void ltlfuzz::LTLFuzzer::retire(size_t slot, Corpus& corpus){
+    WorkerRun& run = this->runs[slot];
+    if(run.out_dir.empty()){
+        return;
+    }
+    corpus.harvest(run.out_dir, run.target);
+    long int ended = std::min(static_cast<long int> (time(NULL)), (long int)prefix_deadline(this->prefix_maps[slot]));
+    double minutes = std::max(ended - run.started, 60L) / 60.0;
+    this->targets_store->reward(run.target, run.paths / minutes);
+    //AFL wrote its stats a last time when it ended
+    read_run_stats(run);
+    this->assignments->close(slot, ended, run.execs, run.crashes, run.paths);
+    run.out_dir.clear();
+}
+
+void ltlfuzz::LTLFuzzer::read_run_stats(WorkerRun& run){
+    std::string stats = run.out_dir + "/fuzzer_stats";
+    run.execs = std::max<uint64_t>(run.execs, utils::read_afl_stat(stats, "execs_done"));
+    run.crashes = std::max<uint64_t>(run.crashes, utils::read_afl_stat(stats, "unique_crashes"));
+}
+
+/* a worker on target (any target if empty) whose deadline is close enough for a
+   hand-off but not so close that it could stop before seeing it, -1 if none */
+int ltlfuzz::LTLFuzzer::expiring_worker(const WorkerPool& pool, const std::string& target){
+    long int now = static_cast<long int> (time(NULL));
+    for(size_t slot = 0; slot < pool.size(); slot++){
+        const WorkerPool::Worker& w = pool.worker(slot);
+        if(w.pid == 0 || (!target.empty() && w.target != target)){
+            continue;
+        }
+        long int deadline = prefix_deadline(this->prefix_maps[slot]);
+        if(deadline > now + 2 && deadline <= now + handoffMargin){
+            return slot;
+        }
+    }
+    return -1;
+}
+
+/* key: value lines like AFL's fuzzer_stats; replaced by rename so readers
+   never see a partial file. The full table is printed by "ltl-fuzz dump" */
+void ltlfuzz::LTLFuzzer::write_stats(int flag, long int start, long int iterations){
+    path::table_stats stats = this->path_store->stats(flag);
+    long int now = static_cast<long int> (time(NULL));
+    std::string tmp = this->statsFile + ".tmp";
+    std::ofstream out(tmp, std::ios::trunc);
+    if(!out){
+        return;
+    }
+    out << "start_time        : " << start << "\n";
+    out << "last_update       : " << now << "\n";
+    out << "iterations        : " << iterations << "\n";
+    out << "overhead_us_iter  : " << (iterations ? this->busy.ns / 1000 / iterations : 0) << "\n";
+    out << "input_execs       : " << this->input_execs << "\n";
+    out << "paths             : " << stats.paths << "\n";
+    out << "prefixes          : " << stats.prefixes << "\n";
+    out << "prefixes_offered  : " << stats.offered << "\n";
+    out << "dropped_paths     : " << stats.dropped_paths << "\n";
+    out << "evicted_prefixes  : " << stats.evicted << "\n";
+    out << "lost_shards       : " << stats.lost_shards << "\n";
+    out << "last_path_found   : " << static_cast<long int> (stats.last_found) << "\n";
+    out << "paths_by_depth    :";
+    for(unsigned i = 0; i < path::tableDepths; i++){
+        if(stats.depth_paths[i]){
+            out << " " << i + 1 << (i + 1 == path::tableDepths ? "+" : "") << ":" << stats.depth_paths[i];
+        }
+    }
+    out << "\n";
+    out << "paths_by_prefixes :";
+    for(unsigned i = 0; i < path::tablePoolBuckets; i++){
+        if(stats.pool_paths[i]){
+            out << " " << (1u << i) << (i + 1 == path::tablePoolBuckets ? "+" : "") << ":" << stats.pool_paths[i];
+        }
+    }
+    out << "\n";
+    for(auto& n : stats.newest){
+        out << "newest_path       : " << static_cast<long int> (n.first) << " " << n.second << "\n";
+    }
+    out.close();
+    rename(tmp.c_str(), this->statsFile.c_str());
+}
+
+bool ltlfuzz::LTLFuzzer::replace_prefix_run_program(std::string prefix){
 
     if(!prefix.empty()){ 
         std::vector<INPUT_TYPE> pre_;
@@ -206,46 +610,107 @@ void ltlfuzz::LTLFuzzer::replace_prefix_run_program(std::string prefix){
         memcpy(this->input, &pre_[0], sizeof(INPUT_TYPE)*pre_.size()); 
     }
     std::string input_file = this->input_folder+"input";
-    utils::write_input(this->input, this->size, input_file);
-
-    std::ifstream ifs(this->targets_file);
-    std::string fline;
-    getline(ifs, fline);
-    ifs.close();
 
-    size_t loc = fline.find_last_of(":");
-    std::string program = fline.substr(0, loc);
+    std::string workdir=input_workdir();
+    std::string binary=workdir + this->exec_name;
 
-    std::string workdir=this->build_dir + program;
-    std::string exec=this->build_dir + program +"/" + this->exec_name + " " + input_file;
-
-    std::string CMD=std::string("cd ")+ workdir + " && " + exec + " 2>&1"; 
-    FILE* output=popen(CMD.c_str(), "r");
-
-    std::ostringstream stm;
-    char line[1024];
-    if(output){
-        while(!feof(output)){
-            if(fgets(line, 100, output)!=NULL){
-                stm << line;
-            }
+    bool violated = false;
+    this->input_execs++;
+    if(this->verdict != (VERDICT_SMEM*)-1){
+        //the runtime fills in the verdict shm, no need to read its output
+        if(this->input_fd < 0){
+            this->input_fd = open(input_file.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+        }
+        if(this->input_fd < 0 || pwrite(this->input_fd, this->input, this->size, 0) != this->size ||
+           ftruncate(this->input_fd, this->size) != 0){
+            std::cout << "failed to write " << input_file << std::endl;
+            return false;
+        }
+        if(!this->input_server_tried){
+            this->input_server_tried = true;
+            this->input_server.start(workdir, binary, {input_file});
         }
-        pclose(output);
+        reset_verdict(this->verdict);
+        if(this->input_server.run(inputTimeoutMs) == -1){
+            //not instrumented with a fork server, or it died: one process per step
+            utils::run_process({binary, input_file}, workdir, NULL, true);
+        }
+        violated = this->verdict->violated;
+        if(violated){
+            std::cout << "property " << this->verdict->property << " violated, automata path: "
+                      << this->verdict->path << std::endl;
+        }
+    }
+    else{
+        utils::write_input(this->input, this->size, input_file);
+        std::string output;
+        utils::run_process({binary, input_file}, workdir, &output);
+        violated = is_counterexample(output);
     }
     
-    if(is_counterexample(stm.str())){
+    if(violated){
         std::cout << "there is a conterexample!" << std::endl;
+        //the file is moved away: the next step writes a new one
+        if(this->input_fd >= 0){
+            close(this->input_fd);
+            this->input_fd = -1;
+        }
         save_input(input_file, this->output_folder + "crashes/");
     }
+    return violated;
 }
 
 void ltlfuzz::LTLFuzzer::save_input(std::string input_file, std::string folder){
 
-    std::string mk_crashes = folder;
-    system(mk_crashes.c_str());
+    utils::make_dirs(folder);
     std::string saved_file=folder+"input-" +utils::get_current_time();
-    std::string CMD="mv " + input_file + " " + saved_file;
-    system(CMD.c_str());
+    if(!utils::move_file(input_file, saved_file)){
+        std::cout << "failed to save " << input_file << " to " << saved_file << std::endl;
+        return;
+    }
+    std::string trace_file = input_file + TRACE_FILE_SUFFIX;
+    if(access(trace_file.c_str(), F_OK) == 0){
+        utils::move_file(trace_file, saved_file + TRACE_FILE_SUFFIX);
+    }
+    if(this->cluster){
+        std::ifstream ifs(saved_file, std::ios::binary);
+        std::stringstream content;
+        content << ifs.rdbuf();
+        this->cluster_outbox.push_back(ClusterRecord{CLUSTER_COUNTEREXAMPLE, this->cluster->node(),
+                                       saved_file.substr(folder.size()), content.str(), this->verdict != (VERDICT_SMEM*)-1 ? this->verdict->path : ""});
+    }
+}
+
+/* pushes the prefixes and counterexamples found here since the last sync, then
+   stores those of the other nodes; what cannot be pushed is kept for the next sync */
+void ltlfuzz::LTLFuzzer::sync_cluster(){
+    std::vector<ClusterRecord> records;
+    records.swap(this->cluster_outbox);
+    this->path_store->export_records(records);
+    for(auto& r : records){
+        r.node = this->cluster->node();
+    }
+    bool pushed = this->cluster->push(records);
+
+    std::vector<ClusterRecord> pulled;
+    if(!this->cluster->pull(pulled)){
+        std::cout << "cluster: pull failed, " << (pushed ? "" : "push failed, ") << "retrying at the next sync" << std::endl;
+        return;
+    }
+    size_t stored = this->path_store->import_records(pulled);
+    size_t counterexamples = 0;
+    std::string folder = this->output_folder + "crashes/";
+    for(auto& r : pulled){
+        if(r.kind != CLUSTER_COUNTEREXAMPLE || r.key.find('/') != std::string::npos){
+            continue;
+        }
+        utils::make_dirs(folder);
+        std::ofstream ofs(folder + "node" + std::to_string(r.node) + "-" + r.key, std::ios::binary);
+        ofs.write(r.data.data(), r.data.size());
+        counterexamples++;
+    }
+    std::cout << "cluster: pushed " << records.size() << (pushed ? "" : " (pending)") << ", pulled " << pulled.size()
+              << ": " << stored << " new prefixes, " << counterexamples << " counterexamples" << std::endl;
 }
 
 bool ltlfuzz::LTLFuzzer::is_counterexample(std::string output){
@@ -257,30 +722,114 @@ bool ltlfuzz::LTLFuzzer::is_counterexample(std::string output){
         return false;
 }
 
-std::string ltlfuzz::LTLFuzzer::assemble_cmd(std::string target, int flag){
-    std::string full_CMD = "";
+//RERS: an AFL dictionary with the byte the subject reads for every input
+//event of all_events.txt, which afl-fuzz inserts between whole events;
+//returns the number of tokens written
+size_t ltlfuzz::LTLFuzzer::write_input_dictionary(const std::string& file){
+    std::ofstream ofs(file);
+    size_t tokens = 0;
+    for(auto& e : ltlfuzz::ALL_EVENTS){
+        auto it = e.size() > 1 && e[0] == 'i' ? this->targets_store->event_map.find(e.substr(1)) : this->targets_store->event_map.end();
+        if(it == this->targets_store->event_map.end()){
+            continue;
+        }
+        char token[8];
+        snprintf(token, sizeof(token), "\\x%02x", (unsigned char)atoi(it->second.c_str()));
+        ofs << e << "=\"" << token << "\"" << std::endl;
+        tokens++;
+    }
+    return tokens;
+}
+
+//RERS: where the binary run by INPUT steps is, that of the first target
+std::string ltlfuzz::LTLFuzzer::input_workdir(){
+    if(this->input_program.empty()){
+        std::ifstream ifs(this->targets_file);
+        std::string fline;
+        getline(ifs, fline);
+        ifs.close();
+        this->input_program = fline.substr(0, fline.find_last_of(":"));
+    }
+    return binary_dir(this->input_program);
+}
+
+//a staged build still running (see TargetsStore::watch_build()): the first
+//target of the targets file, which the build makes first and whose binary
+//runs the INPUT steps, has to be there; the others join as they are built
+void ltlfuzz::LTLFuzzer::wait_for_build(){
+    input_workdir();
+    if(this->targets_store->built(this->input_program)){
+        return;
+    }
+    std::cout << "waiting for the build of " << this->input_program << std::endl;
+    while(!this->targets_store->built(this->input_program)){
+        if(this->targets_store->build_failed()){
+            std::cout << "the build of " << this->input_program << " failed, see the logs in "
+                      << this->build_dir << "distances/" << std::endl;
+            exit(EXIT_FAILURE);
+        }
+        sleep(5);
+    }
+}
+
+//RERS: where the binary instrumented for target is, a single one for all
+//targets when the build directory has a DISTANCE_TARGETS_FILE
+std::string ltlfuzz::LTLFuzzer::binary_dir(const std::string& target) const{
+    return this->distance_targets.empty() ? this->build_dir + target + "/" : this->build_dir;
+}
+
+//the words of a space-separated option string, as separate arguments
+static void append_words(std::vector<std::string>& argv, const std::string& options){
+    std::vector<std::string> words;
+    boost::split(words, options, boost::is_any_of(" "), boost::token_compress_on);
+    for(auto& w : words){
+        if(!w.empty()){
+            argv.push_back(w);
+        }
+    }
+}
+
+//slot: the worker pool slot the command runs in, which keeps the output and
+//test directories of concurrent instances apart
+ltlfuzz::Command ltlfuzz::LTLFuzzer::assemble_cmd(std::string target, int flag, int slot, std::string seeds, std::string out_dir){
+    ltlfuzz::Command cmd;
+    std::string instance = slot > 0 ? "-w" + std::to_string(slot) : "";
+    //AFLGo stops at the deadline of its prefix channel, which hand-offs push back;
+    //kill_at only guards against an instance that misses it
+    cmd.kill_at = this->campaign_end + handoffMargin;
+    append_words(cmd.argv, this->aflgo_fuzz_path);
+    append_words(cmd.argv, this->aflgo_paras);
+    for(std::string a : {std::string("-c"), std::to_string(this->time_to_exploitation), std::string("-i"), seeds, std::string("-o"), out_dir}){
+        cmd.argv.push_back(a);
+    }
     if(flag){
         /** For protocols **/
-        std::string CMD = std::string("timeout ") + std::to_string(this->time_budget_one_target) + " "+ this->aflgo_fuzz_path + this->aflgo_paras  + " -c " + std::to_string(this->time_to_exploitation) + " -i " + this->input_folder + "  -o " + this->output_folder + "fuzzing-" + utils::get_current_time() + " " + this->network_link +  " -x " + this->dictionary + " " + this->protocol_name + " " + this->build_dir + target + "/examples/telnet-server/" + this->exec_name;
+        append_words(cmd.argv, this->network_link);
+        append_words(cmd.argv, this->protocol_name);
+        if(!this->dictionary.empty()){
+            cmd.argv.push_back("-x");
+            cmd.argv.push_back(this->dictionary);
+        }
+        cmd.argv.push_back(this->build_dir + target + "/examples/telnet-server/" + this->exec_name);
         
         std::string work_dir = this->build_dir + target + "/examples/telnet-server";
-        std::string cl_testDir = std::string("rm -r ") + work_dir + std::string("/test_dir");
-        std::string mk_testDir = std::string("mkdir ") + work_dir + std::string("/test_dir");
-        system(cl_testDir.c_str());
-        system(mk_testDir.c_str());
-        std::string cd_testDir = std::string("cd ") + work_dir +  std::string("/test_dir");
-        full_CMD = cd_testDir +  " && " + CMD;
+        std::string test_dir = work_dir + "/test_dir" + instance;
+        utils::remove_all(test_dir);
+        utils::make_dirs(test_dir);
+        cmd.workdir = test_dir;
     }
     else{
         /** For RERS **/
-        std::string CMD = std::string("timeout ") + std::to_string(this->time_budget_one_target) + " "+ this->aflgo_fuzz_path + this->aflgo_paras + " -c " + std::to_string(this->time_to_exploitation) + " -i " + this->input_folder + "  -o " + this->output_folder + "fuzzing-"+utils::get_current_time()+" " + this->build_dir + target +"/" + this->exec_name +" "+ this->program_paras;
-
-        std::string work_dir = this->build_dir + target;
-        std::string cd_workDir = std::string("cd ") + work_dir;
-        full_CMD = cd_workDir + " && " + CMD;
+        if(!this->dictionary.empty()){
+            cmd.argv.push_back("-x");
+            cmd.argv.push_back(this->dictionary);
+        }
+        cmd.argv.push_back(binary_dir(target) + this->exec_name);
+        cmd.argv.push_back(this->program_paras);
+        cmd.workdir = binary_dir(target);
     }
-    std::cout << full_CMD << std::endl;
-    return full_CMD;
+    std::cout << cmd.str() << std::endl;
+    return cmd;
 }
 
 
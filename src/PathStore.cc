@@ -2,6 +2,14 @@
 #include <targetstore.h>
 #include <string.h>
 #include <utility>
+#include <algorithm>
+#include <math.h>
+#include <select_strategy.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 using std::cout;
 using std::endl;
@@ -10,6 +18,21 @@ using namespace boost::interprocess;
 
 int path::PathsStore::init_run = 1;
 
+//fitness of paths and prefixes whose score is 0 (no accepting cycle
+//reachable), so that they are still tried now and then
+static const double minFitness = 0.01;
+//prefix length in bytes that halves the fitness of a prefix
+static const double prefixCostBytes = 256;
+//a path found this many seconds later ranks e times higher
+static const double recencySeconds = 600;
+//priority factor of a path each time it is picked
+static const double selectionDecay = 0.5;
+
+//the init path of a property is the init state 0 alone
+static bool is_init_path(const char_string& key){
+    return lfz::automata::path_key_depth(key.c_str(), key.size()) == 1 && key[key.size() - 1] == 0;
+}
+
 //managed_shared_memory  segment(open_or_create, shmId.c_str(), size);
 //void_allocator alloc_inst(segment.get_segment_manager());
 
@@ -17,7 +40,15 @@ int path::PathsStore::init_run = 1;
 path::PathsStore::PathsStore(managed_shared_memory* segment){
     this->segment=segment;
     void_allocator alloc_inst(segment->get_segment_manager());
-    this->table = this->segment->find_or_construct<string_string_string_map>(tableName.c_str())(std::less<char_string>(), alloc_inst);
+    //the limits are fixed when the table is created, writers only look it up
+    uint32_t paths = utils::env_option(tablePathsEnv, defaultTablePaths);
+    uint32_t prefixes = utils::env_option(tablePrefixesEnv, defaultTablePrefixes);
+    this->shards = this->segment->find_or_construct<table_shard>(tableName.c_str())[tableShards](alloc_inst, (paths + tableShards - 1) / tableShards, prefixes);
+    this->selected_shard = 0;
+    this->selected_item = nullptr;
+    memset(this->frontier_seen, 0, sizeof(this->frontier_seen));
+    memset(this->frontier_resets, 0, sizeof(this->frontier_resets));
+    memset(this->exported_seq, 0, sizeof(this->exported_seq));
 }
 
 path::PathsStore::PathsStore(){}
@@ -31,100 +62,41 @@ void path::PathsStore::clean_up(){
 
 path::PathsStore::~PathsStore(){}
 
-void path::PathsStore::insert_init_automata_path(std::string automata_path, std::string prefix, std::string metric){
-
-    void_allocator alloc_inst(this->segment->get_segment_manager());
-
-    char_string path_automata_s(automata_path.c_str(), alloc_inst);
-    char_string prefix_s(prefix.c_str(), alloc_inst);
-    char_string metric_s(metric.c_str(), alloc_inst);
-
-    string_string_value_type  ss_map_value(prefix_s, metric_s);
-    string_string_map *col_map = segment->construct<string_string_map>((automata_path+prefix).c_str())(std::less<char_string>(), alloc_inst);
-         col_map->insert(ss_map_value);
-
-    string_string_string_value_type sss_map_value(path_automata_s, *col_map);
-    this->table->insert(sss_map_value);
-
-}
-
-std::pair<std::string, std::string> path::PathsStore::select_automataPath_and_prefix(std::string prefixDir){
-    std::vector<std::string> fileList;
-    std::string inputDirectory = prefixDir;
-    const char* str = inputDirectory.c_str();
-	DIR *p_dir;
-	p_dir = opendir(str);
-	if(p_dir == NULL){
-		std::cout << "cannot open directory: " << inputDirectory << std::endl;
-        return std::make_pair("0,", "");
-	}
-	struct dirent *p_dirent;
-	while ( p_dirent = readdir(p_dir))
-    {
-        std::string tmpFileName = p_dirent->d_name;
-        if( tmpFileName == "." || tmpFileName == "..")
-        {
-            continue;
-        }
-        else
-        {
-            fileList.push_back(tmpFileName);
-        }
-    }
-    closedir(p_dir);
-    if(fileList.empty()){
-        return std::make_pair("0,", "");
-    }
+void path::PathsStore::insert_init_automata_path(int property, std::string prefix, std::string metric){
 
-    std::string selected_path = get_automataPath(fileList);
-    std::string prefix = get_prefix(selected_path, prefixDir);
+    lfz::automata::StatePath init;
+    init.push(0);
+    insert_automata_path(property, init, prefix, metric);
 
-    return std::make_pair(selected_path, prefix);
 }
 
-std::string path::PathsStore::get_automataPath(std::vector<std::string> &fileList){
-    srand (time(NULL)); 
-    auto it = fileList.begin();
-    std::advance(it, rand() % fileList.size());
-    std::string aPath = *it;
-
-    return aPath;
+void path::PathsStore::insert_automata_path(int property, const lfz::automata::StatePath& states, const std::string& prefix, const std::string& metric){
+    void_allocator alloc_inst(this->segment->get_segment_manager());
+    uint64_t hash = table_hash(property, states);
+    table_shard& shard = table_shard_of(this->shards, hash);
+    shard_lock lock(shard);
+    table_insert(shard, alloc_inst, hash, lfz::automata::encode_path_key(property, states), prefix, metric);
 }
 
-std::string path::PathsStore::get_prefix(std::string aPath, std::string prefixDir){
-    std::string fileName = prefixDir + aPath;
-	std::ifstream in;
-	in.open(fileName, std::ios::in);
-	std::string single_token = "";
-	if(in.is_open()){
-		std::ostringstream tmp; 
-		tmp << in.rdbuf();
-		std::string total_prefix = tmp.str();
-        in.close();
-        if(total_prefix == ""){
-            return single_token;
-        }
+//For protocols: children append what they find to the prefix log
+std::pair<ltlfuzz::AutomataPath, std::string> path::PathsStore::select_automataPath_and_prefix(std::string prefixLog){
+    //the init path of property 0 until something is found
+    lfz::automata::StatePath init;
+    init.push(0);
+    ltlfuzz::AutomataPath aPath(0, init);
 
-		std::string delimiter = "@@";
-        size_t pos = 0;
-        std::vector<std::string> tokens_vec;
-        std::string token;
-        while ((pos = total_prefix.find(delimiter)) != std::string::npos) {
-            token = total_prefix.substr(0, pos);
-            total_prefix.erase(0, pos + delimiter.length());
-            tokens_vec.push_back(token);
-        }
+    if(!this->prefix_log.is_open() && !this->prefix_log.open(prefixLog)){
+        std::cout << "cannot open prefix log: " << prefixLog << std::endl;
+        return std::make_pair(aPath, "");
+    }
+    this->prefix_log.refresh();
 
-        srand (time(NULL)); 
-        auto it = tokens_vec.begin();
-        std::advance(it, rand() % tokens_vec.size());
-        std::string prefix = *it;
-		
-        return prefix;
-	}
-	else{
-		return single_token;
-	}
+    std::string key;
+    std::string prefix;
+    if(!this->prefix_log.sample(key, prefix) || !lfz::automata::decode_path_key(key.data(), key.size(), aPath.property, aPath.states)){
+        return std::make_pair(ltlfuzz::AutomataPath(0, init), "");
+    }
+    return std::make_pair(aPath, prefix);
 }
 
 
@@ -139,107 +111,411 @@ std::pair<ltlfuzz::Prefix, ltlfuzz::AutomataPath> path::PathsStore::select_prefi
 
 int path::PathsStore::getSize(){
 
-    return this->table->size();
+    int total = 0;
+    for(unsigned i = 0; i < tableShards; i++){
+        shard_lock lock(this->shards[i]);
+        total += this->shards[i].count;
+    }
+    return total;
+}
+
+path::table_stats path::PathsStore::stats(int flag){
+    table_stats stats;
+    if(flag){
+        this->prefix_log.add_stats(stats);
+        return stats;
+    }
+    for(unsigned i = 0; i < tableShards; i++){
+        shard_lock lock(this->shards[i]);
+        this->shards[i].add_stats(stats);
+    }
+    return stats;
 }
 
 void path::PathsStore::dump(){
     cout << ">>> print shared memory ...." << endl;
-    for(string_string_string_map::iterator sss_ite = this->table->begin(); sss_ite != this->table->end(); ++sss_ite)
+    for(unsigned i = 0; i < tableShards; i++)
     {
-        cout << "-----The automata path: " << sss_ite->first << endl;
+    shard_lock lock(this->shards[i]);
+    for(path_entry& e : this->shards[i].slots)
+    {
+        if(e.hash == 0){
+            continue;
+        }
+        cout << "-----The automata path: " << lfz::automata::path_key_str(e.path.c_str(), e.path.size()) << endl;
 
-        for(string_string_map::iterator ss_ite = (sss_ite->second).begin(); ss_ite != (sss_ite->second).end(); ++ss_ite)
+        for(prefix_entry& p : e.prefixes)
         {
-            cout<< "prefix: " << ss_ite->first << " metric: " << ss_ite->second <<endl;
+            cout<< "prefix: " << this->shards[i].trie.get(p.node) << " metric: " << p.metric <<endl;
         }
     }
+    if(this->shards[i].dropped_paths || this->shards[i].evicted){
+        cout << "shard " << i << ": dropped paths " << this->shards[i].dropped_paths << ", evicted prefixes " << this->shards[i].evicted << endl;
+    }
+    }
 
     cout << ">>> End printfing shm ...." << endl;
 }
 
-/* Only in init run, AFL can select the init path "0," */
-string_string_string_map::iterator path::PathsStore::select_automata_path(){
+template<typename T>
+static void append_record(std::string& out, const T& record){
+    out.append((const char*)&record, sizeof(record));
+}
 
-    std::vector<std::pair<std::any, double>> vector;
-    std::cout << "table size: " << getSize() << std::endl;
-    for(string_string_string_map::iterator sss_ite = this->table->begin(); sss_ite != this->table->end(); sss_ite++)
-    {
-        char_string path = sss_ite->first;
-        std::cout << "path: " << sss_ite->first << std::endl;
-        if(path != "0," && !init_run){
-            ltlfuzz::AutomataPath aPath(std::string(path.begin(), path.end()));
-            vector.push_back(std::make_pair(sss_ite, 1.0));
+bool path::PathsStore::save_snapshot(const std::string& file){
+    std::string tmp = file + ".tmp";
+    FILE* out = fopen(tmp.c_str(), "wb");
+    if(out == NULL){
+        return false;
+    }
+    snapshot_header header = {snapshotMagic, snapshotVersion, 0, (int64_t)time(NULL)};
+    bool ok = fwrite(&header, sizeof(header), 1, out) == 1;
+    std::string records;
+    for(unsigned i = 0; ok && i < tableShards; i++){
+        //copied under the locks, written without them
+        records.clear();
+        {
+            shard_lock lock(this->shards[i]);
+            for(path_entry& e : this->shards[i].slots){
+                if(e.hash == 0){
+                    continue;
+                }
+                std::vector<const prefix_entry*> prefixes;
+                for(prefix_entry& p : e.prefixes){
+                    prefixes.push_back(&p);
+                }
+                std::sort(prefixes.begin(), prefixes.end(),
+                          [](const prefix_entry* a, const prefix_entry* b){ return a->seq < b->seq; });
+                append_record(records, snapshot_path{(uint32_t)e.path.size(), (uint32_t)prefixes.size(), e.found});
+                records.append(e.path.c_str(), e.path.size());
+                for(const prefix_entry* p : prefixes){
+                    std::string prefix = this->shards[i].trie.get(p->node);
+                    append_record(records, snapshot_prefix{(uint32_t)prefix.size(), (uint32_t)p->metric.size()});
+                    records += prefix;
+                    records.append(p->metric.c_str(), p->metric.size());
+                }
+                header.paths++;
+            }
         }
+        ok = fwrite(records.data(), 1, records.size(), out) == records.size();
     }
-    std::cout << "vector size: " << vector.size() << std::endl;
-    if(vector.size() == 0){
-        init_run = 0;
-        string_string_string_map::iterator it = this->table->begin();
-        return it;
+    //the header again, now with the number of paths
+    ok = ok && fseek(out, 0, SEEK_SET) == 0 && fwrite(&header, sizeof(header), 1, out) == 1;
+    ok = fflush(out) == 0 && fsync(fileno(out)) == 0 && ok;
+    fclose(out);
+    if(!ok || rename(tmp.c_str(), file.c_str()) != 0){
+        remove(tmp.c_str());
+        return false;
+    }
+    return true;
+}
+
+size_t path::PathsStore::load_snapshot(const std::string& file){
+    int fd = open(file.c_str(), O_RDONLY);
+    if(fd < 0){
+        cout << "no snapshot to resume from: " << file << endl;
+        return 0;
+    }
+    struct stat st;
+    void* image = MAP_FAILED;
+    if(fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(snapshot_header)){
+        image = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    close(fd);
+    if(image == MAP_FAILED){
+        cout << "unreadable snapshot: " << file << endl;
+        return 0;
+    }
+    const char* pos = (const char*)image;
+    const char* end = pos + st.st_size;
+    snapshot_header header;
+    memcpy(&header, pos, sizeof(header));
+    pos += sizeof(header);
+    if(header.magic != snapshotMagic || header.version != snapshotVersion){
+        munmap(image, st.st_size);
+        cout << "not a snapshot of this version: " << file << endl;
+        return 0;
+    }
+
+    void_allocator alloc_inst(this->segment->get_segment_manager());
+    size_t restored = 0;
+    for(uint64_t n = 0; n < header.paths; n++){
+        snapshot_path record;
+        if((size_t)(end - pos) < sizeof(record)){
+            break;
+        }
+        memcpy(&record, pos, sizeof(record));
+        pos += sizeof(record);
+        if((size_t)(end - pos) < record.key_len){
+            break;
+        }
+        std::string key(pos, record.key_len);
+        pos += record.key_len;
+        int property;
+        lfz::automata::StatePath states;
+        if(!lfz::automata::decode_path_key(key.data(), key.size(), property, states)){
+            break;
+        }
+        uint64_t hash = table_hash(property, states);
+        table_shard& shard = table_shard_of(this->shards, hash);
+        shard_lock lock(shard);
+        bool truncated = false;
+        for(uint32_t k = 0; k < record.prefixes; k++){
+            snapshot_prefix p;
+            if((size_t)(end - pos) < sizeof(p)){
+                truncated = true;
+                break;
+            }
+            memcpy(&p, pos, sizeof(p));
+            pos += sizeof(p);
+            if((size_t)(end - pos) < (size_t)p.prefix_len + p.metric_len){
+                truncated = true;
+                break;
+            }
+            std::string prefix(pos, p.prefix_len);
+            std::string metric(pos + p.prefix_len, p.metric_len);
+            pos += p.prefix_len + p.metric_len;
+            table_insert(shard, alloc_inst, hash, key, prefix, metric);
+        }
+        path_entry* e = shard.find(hash, key);
+        if(e != nullptr){
+            e->found = record.found;
+            restored++;
+        }
+        if(truncated){
+            break;
+        }
     }
-    else{
-        std::any pointer=strategy::RandomStrategy::instance()->select(vector);
-        return std::any_cast<string_string_string_map::iterator>(pointer);
+    munmap(image, st.st_size);
+    if(restored){
+        //no need to start over from the init paths
+        init_run = 0;
     }
-   
+    cout << "resumed " << restored << " automata paths from " << file << endl;
+    return restored;
 }
 
-ltlfuzz::AutomataPath path::PathsStore::get_selected_automata_path(){
+void path::PathsStore::set_partition(unsigned node, unsigned nodes){
+    this->partition_nodes = nodes ? nodes : 1;
+    this->partition_node = node % this->partition_nodes;
+}
 
-    char_string path = this->selected_item->first;
-    ltlfuzz::AutomataPath aPath(std::string(path.begin(), path.end()));
-    return aPath;
+void path::PathsStore::export_records(std::vector<ltlfuzz::ClusterRecord>& records){
+    for(unsigned i = 0; i < tableShards; i++){
+        shard_lock lock(this->shards[i]);
+        table_shard& shard = this->shards[i];
+        if(shard.seq == this->exported_seq[i]){
+            continue;
+        }
+        for(path_entry& e : shard.slots){
+            if(e.hash == 0){
+                continue;
+            }
+            for(prefix_entry& p : e.prefixes){
+                if(p.seq <= this->exported_seq[i]){
+                    continue;
+                }
+                records.push_back(ltlfuzz::ClusterRecord{ltlfuzz::CLUSTER_PREFIX, 0,
+                                  std::string(e.path.c_str(), e.path.size()), shard.trie.get(p.node),
+                                  std::string(p.metric.c_str(), p.metric.size())});
+            }
+        }
+        this->exported_seq[i] = shard.seq;
+    }
 }
 
-double path::PathsStore::compute_prefix_fitness(ltlfuzz::Prefix prefix){
-    
-    return 1.0;
+size_t path::PathsStore::import_records(const std::vector<ltlfuzz::ClusterRecord>& records){
+    void_allocator alloc_inst(this->segment->get_segment_manager());
+    size_t stored = 0;
+    for(auto& r : records){
+        int property;
+        lfz::automata::StatePath states;
+        if(r.kind != ltlfuzz::CLUSTER_PREFIX || !lfz::automata::decode_path_key(r.key.data(), r.key.size(), property, states)){
+            continue;
+        }
+        uint64_t hash = table_hash(property, states);
+        table_shard& shard = table_shard_of(this->shards, hash);
+        shard_lock lock(shard);
+        uint64_t seq = shard.seq;
+        table_insert(shard, alloc_inst, hash, r.key, r.data, r.extra);
+        if(shard.seq != seq){
+            stored++;
+            //what came from the cluster is not pushed back to it, unless a
+            //child stored something in between
+            if(this->exported_seq[&shard - this->shards] == seq){
+                this->exported_seq[&shard - this->shards] = shard.seq;
+            }
+        }
+    }
+    return stored;
 }
 
-ltlfuzz::Prefix path::PathsStore::select_prefix(){
+/* index the paths added or improved since the previous call */
+void path::PathsStore::refresh_frontier(){
+    for(unsigned i = 0; i < tableShards; i++){
+        shard_lock lock(this->shards[i]);
+        table_shard& shard = this->shards[i];
+        if(this->frontier_resets[i] != shard.resets){
+            //the shard was cleared, see table_shard::repair(): its slots
+            //are empty or reused, so its ids leave the frontier
+            this->frontier_resets[i] = shard.resets;
+            this->frontier_seen[i] = 0;
+            for(auto it = this->frontier_items.begin(); it != this->frontier_items.end();){
+                if((it->first >> 32) == i){
+                    this->frontier.erase(std::make_pair(it->second.key, it->first));
+                    it = this->frontier_items.erase(it);
+                }
+                else{
+                    it++;
+                }
+            }
+        }
+        for(; this->frontier_seen[i] < shard.changes.size(); this->frontier_seen[i]++){
+            uint32_t slot = shard.changes[this->frontier_seen[i]];
+            path_entry& e = shard.slots[slot];
+            if(is_init_path(e.path) || e.hash % this->partition_nodes != this->partition_node){
+                continue;
+            }
+            uint64_t id = (uint64_t)i << 32 | slot;
+            FrontierItem item = {0, 0};
+            auto it = this->frontier_items.find(id);
+            if(it != this->frontier_items.end()){
+                item = it->second;
+                this->frontier.erase(std::make_pair(item.key, id));
+            }
+            item.key = compute_path_priority(e, item.selected);
+            this->frontier_items[id] = item;
+            this->frontier.insert(std::make_pair(item.key, id));
+        }
+    }
+}
 
-    string_string_map map_m = this->selected_item->second;
+/* Only in init run, AFL can select the init path "0," */
+path_entry* path::PathsStore::select_automata_path(){
 
-    std::vector<std::pair<std::any, double>> vector_;
+    refresh_frontier();
 
+    //the top of the frontier, which then moves down for the next iterations
+    for(size_t n = init_run ? 0 : this->frontier.size(); n > 0; n--){
+        auto top = std::prev(this->frontier.end());
+        uint64_t id = top->second;
+        unsigned i = id >> 32;
+        path_entry* e = &this->shards[i].slots[(uint32_t)id];
+        this->frontier.erase(top);
 
-   for(string_string_map::iterator ss_ite = map_m.begin(); ss_ite != map_m.end(); ++ss_ite){
+        FrontierItem& item = this->frontier_items[id];
+        bool empty;
+        {
+            shard_lock lock(this->shards[i]);
+            if(e->hash == 0){
+                //emptied since it was indexed
+                this->frontier_items.erase(id);
+                continue;
+            }
+            item.selected++;
+            item.key = compute_path_priority(*e, item.selected);
+            empty = e->prefixes.empty();
+        }
+        this->frontier.insert(std::make_pair(item.key, id));
+        if(!empty){
+            this->selected_shard = i;
+            return e;
+        }
+    }
 
-       char_string prefix = ss_ite->first;
-       char_string feedback = ss_ite->second;
+    init_run = 0;
+    for(unsigned i = 0; i < tableShards; i++){
+        shard_lock lock(this->shards[i]);
+        for(path_entry& e : this->shards[i].slots){
+            if(e.hash != 0 && !e.prefixes.empty()){
+                this->selected_shard = i;
+                return &e;
+            }
+        }
+    }
+    this->selected_shard = 0;
+    return nullptr;
+}
 
-       std::string prefix_s(prefix.begin(), prefix.end());
-       std::string feedback_s(feedback.begin(), feedback.end());
+/* the init path of property 0 when nothing was selectable or the shard of
+   the selected path was cleared since */
+ltlfuzz::AutomataPath path::PathsStore::get_selected_automata_path(){
 
-       ltlfuzz::Prefix prefix_o(prefix_s, feedback_s);
-       double f = compute_prefix_fitness(prefix_o);
-       vector_.push_back(std::make_pair(prefix_o, f));
-   }
+    lfz::automata::StatePath init;
+    init.push(0);
+    if(this->selected_item == nullptr){
+        return ltlfuzz::AutomataPath(0, init);
+    }
+    shard_lock lock(this->shards[this->selected_shard]);
+    char_string& key = this->selected_item->path;
+    ltlfuzz::AutomataPath aPath(0, lfz::automata::StatePath());
+    if(this->selected_item->hash == 0 || !lfz::automata::decode_path_key(key.c_str(), key.size(), aPath.property, aPath.states)){
+        return ltlfuzz::AutomataPath(0, init);
+    }
+    return aPath;
+}
+
+/* log of the priority of a path: paths that lead closer to a violation and
+   were found more recently first, halved each time the path is picked; the
+   caller holds the shard lock */
+double path::PathsStore::compute_path_priority(const path_entry& path, unsigned selected){
 
-   std::any selected = strategy::RandomStrategy::instance()->select(vector_);
-   ltlfuzz::Prefix prefix_selected = std::any_cast<ltlfuzz::Prefix> (selected);
+    return log(std::max(path.best, minFitness)) + path.found / recencySeconds + selected * log(selectionDecay);
+}
+
+/* the prefix score, discounted by its length as it is replayed on every
+   execution; the caller holds the lock of the selected shard */
+double path::PathsStore::compute_prefix_fitness(const prefix_entry& prefix){
+    
+    return std::max(prefix.score, minFitness) / (1.0 + this->shards[this->selected_shard].trie.nodes[prefix.node].length / prefixCostBytes);
+}
+
+/* weighted reservoir sampling over the pool in place: only the chosen prefix
+   is copied out of the shared segment */
+ltlfuzz::Prefix path::PathsStore::select_prefix(){
+
+    if(this->selected_item == nullptr){
+        return ltlfuzz::Prefix("", "");
+    }
+    shard_lock lock(this->shards[this->selected_shard]);
+    prefix_pool& pool = this->selected_item->prefixes;
+
+    const prefix_entry* selected = nullptr;
+    double total = 0;
+    for(const prefix_entry& p : pool){
+        double f = compute_prefix_fitness(p);
+        if(f <= 0){
+            continue;
+        }
+        total += f;
+        if(selected == nullptr || strategy::rng().uniform() * total < f){
+            selected = &p;
+        }
+    }
+    if(selected == nullptr){
+        return ltlfuzz::Prefix("", "");
+    }
 
-   return prefix_selected;
+    std::string feedback_s(selected->metric.begin(), selected->metric.end());
+    return ltlfuzz::Prefix(this->shards[this->selected_shard].trie.get(selected->node), feedback_s);
 }
 
 ltlfuzz::AutomataTransition path::PathsStore::select_transition(const lfz::automata::Automata &atm) {
 
     ltlfuzz::AutomataPath aPath = get_selected_automata_path();
-    std::string last_state = utils::get_last_state(aPath.path);
-    int state = utils::str2int(last_state);
+    int state = aPath.states.last();
 
-    lfz::automata::transitions_t trans_v;
-    atm.get_state_transitions(state, trans_v);
+    const lfz::automata::transitions_t &trans_v = atm.state_transitions(state);
 
-    std::vector<std::pair<std::any, double>> vector_;
+    strategy::Candidates<const lfz::automata::transitions_t::value_type*> candidates;
 
     for(auto& e : trans_v){
-        ltlfuzz::AutomataTransition tran(e.first, std::to_string(e.second));
-        vector_.push_back(std::make_pair(tran,1.0));
+        int distance = atm.distance_to_acceptance(e.second);
+        candidates.add(&e, distance < 0 ? minFitness : 1.0 / (1 + distance));
     }
 
-    std::any selected = strategy::RandomStrategy::instance()->select(vector_);
-    ltlfuzz::AutomataTransition trans_selected = std::any_cast<ltlfuzz::AutomataTransition> (selected);
+    const lfz::automata::transitions_t::value_type* e = strategy::selector().select(candidates);
+    ltlfuzz::AutomataTransition trans_selected(e->first, std::to_string(e->second));
 
     cout << "Selected transition: "<< endl;
     trans_selected.dump();
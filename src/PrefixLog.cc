@@ -0,0 +1,141 @@
+#include <prefix_log.h>
+#include <sys/stat.h>
+#include <stdlib.h>
+#include <iostream>
+#include <strategy.h>
+
+path::PrefixLog::PrefixLog() : fd(-1), scanned(0), total(0), offered(0), depth_paths(), pool_paths(){}
+
+path::PrefixLog::~PrefixLog(){
+    if(this->fd >= 0){
+        close(this->fd);
+    }
+}
+
+bool path::PrefixLog::open(const std::string& file){
+    if(this->fd >= 0){
+        close(this->fd);
+    }
+    this->file = file;
+    this->fd = ::open(file.c_str(), O_RDONLY | O_CREAT | O_CLOEXEC, 0644);
+    this->scanned = 0;
+    this->total = 0;
+    this->keys.clear();
+    this->entries.clear();
+    this->key_ids.clear();
+    this->seen.clear();
+    this->offered = 0;
+    memset(this->depth_paths, 0, sizeof(this->depth_paths));
+    memset(this->pool_paths, 0, sizeof(this->pool_paths));
+    this->recent.clear();
+    return this->fd >= 0;
+}
+
+bool path::PrefixLog::is_open() const{
+    return this->fd >= 0;
+}
+
+static uint64_t record_hash(const char* key, size_t key_size, const char* prefix, size_t prefix_size){
+    uint64_t h = 14695981039346656037ULL;
+    for(size_t i = 0; i < key_size; i++){
+        h = (h ^ (unsigned char)key[i]) * 1099511628211ULL;
+    }
+    h = (h ^ 0xff) * 1099511628211ULL;
+    for(size_t i = 0; i < prefix_size; i++){
+        h = (h ^ (unsigned char)prefix[i]) * 1099511628211ULL;
+    }
+    return h;
+}
+
+void path::PrefixLog::refresh(){
+    if(this->fd < 0){
+        return;
+    }
+    struct stat st;
+    if(fstat(this->fd, &st) < 0 || st.st_size <= this->scanned){
+        return;
+    }
+    std::string buffer(st.st_size - this->scanned, '\0');
+    ssize_t n = pread(this->fd, &buffer[0], buffer.size(), this->scanned);
+    if(n <= 0){
+        return;
+    }
+
+    size_t pos = 0;
+    while(pos + sizeof(PrefixLogRecord) <= (size_t)n){
+        PrefixLogRecord record;
+        memcpy(&record, buffer.data() + pos, sizeof(record));
+        if(record.magic != PREFIX_LOG_MAGIC){
+            std::cout << "corrupted prefix log " << this->file << " at " << this->scanned + pos << std::endl;
+            this->scanned = st.st_size;
+            return;
+        }
+        size_t end = pos + sizeof(record) + record.key_size + record.prefix_size;
+        if(end > (size_t)n){
+            //a record still being written, pick it up next time
+            break;
+        }
+        const char* key = buffer.data() + pos + sizeof(record);
+        const char* prefix = key + record.key_size;
+        this->offered++;
+        if(this->seen.insert(record_hash(key, record.key_size, prefix, record.prefix_size)).second){
+            std::string key_s(key, record.key_size);
+            auto it = this->key_ids.find(key_s);
+            if(it == this->key_ids.end()){
+                it = this->key_ids.insert(std::make_pair(key_s, this->keys.size())).first;
+                this->keys.push_back(key_s);
+                this->entries.emplace_back();
+                this->depth_paths[depth_bucket(lfz::automata::path_key_depth(key, record.key_size))]++;
+                if(this->recent.size() == tableRecent){
+                    this->recent.erase(this->recent.begin());
+                }
+                this->recent.push_back(std::make_pair(time(NULL), it->second));
+            }
+            Entry entry = {this->scanned + (off_t)(prefix - buffer.data()), record.prefix_size};
+            this->entries[it->second].push_back(entry);
+            this->total++;
+            pool_grown(this->pool_paths, this->entries[it->second].size());
+        }
+        pos = end;
+    }
+    this->scanned += pos;
+}
+
+size_t path::PrefixLog::paths() const{
+    return this->keys.size();
+}
+
+size_t path::PrefixLog::prefixes() const{
+    return this->total;
+}
+
+void path::PrefixLog::add_stats(table_stats& stats) const{
+    stats.paths += this->keys.size();
+    stats.prefixes += this->total;
+    stats.offered += this->offered;
+    for(unsigned i = 0; i < tableDepths; i++){
+        stats.depth_paths[i] += this->depth_paths[i];
+    }
+    for(unsigned i = 0; i < tablePoolBuckets; i++){
+        stats.pool_paths[i] += this->pool_paths[i];
+    }
+    for(auto& r : this->recent){
+        stats.add_newest(r.first, lfz::automata::path_key_str(this->keys[r.second].data(), this->keys[r.second].size()));
+    }
+}
+
+bool path::PrefixLog::sample(std::string& key, std::string& prefix){
+    if(this->keys.empty()){
+        return false;
+    }
+    size_t k = strategy::rng().below(this->keys.size());
+    const std::vector<Entry>& list = this->entries[k];
+    const Entry& entry = list[strategy::rng().below(list.size())];
+
+    key = this->keys[k];
+    prefix.assign(entry.size, '\0');
+    if(entry.size > 0 && pread(this->fd, &prefix[0], entry.size, entry.offset) != (ssize_t)entry.size){
+        prefix.clear();
+    }
+    return true;
+}
@@ -1,6 +1,13 @@
 #include <random_strategy.h>
 #include <stdlib.h>
 #include <time.h>
+#include <unistd.h>
+
+strategy::Rng& strategy::rng(){
+    static Rng generator(getenv("LTL_SEED") ? strtoull(getenv("LTL_SEED"), NULL, 0)
+                                             : ((uint64_t)time(NULL) << 20) ^ (uint64_t)getpid());
+    return generator;
+}
 
 strategy::RandomStrategy* strategy::RandomStrategy::s_instance;
 strategy::RandomStrategy* strategy::RandomStrategy::instance(){
@@ -11,11 +18,7 @@ strategy::RandomStrategy* strategy::RandomStrategy::instance(){
 }
 strategy::RandomStrategy::RandomStrategy(){}
 
-std::any strategy::RandomStrategy::select(std::vector<std::pair<std::any, double>> m){
-
-    srand (time(NULL)); 
+size_t strategy::RandomStrategy::select_index(const double*, size_t n, const void*, uint64_t){
 
-    auto it = m.begin();
-    std::advance(it, rand() % m.size());
-    return it->first;
+    return rng().below(n);
 }
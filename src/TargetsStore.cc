@@ -1,4 +1,7 @@
 #include <targetstore.h>
+#include <automata_handler.h>
+#include <math.h>
+#include <sys/stat.h>
 
 
 ltlfuzz::TargetsStore* ltlfuzz::TargetsStore::s_instance;
@@ -34,19 +37,20 @@ void ltlfuzz::TargetsStore::load_targets(std::string filePath, int flag){
         if(!flag){
             event = "o" + coding(event_s);
         }
-         
-        auto it = s_instance->event_target_map.find(event);
-        
-        if(it == s_instance->event_target_map.end()){
-            s_instance->event_target_map.insert({event, std::set<std::string>{location}});
-        }
-        else{
-            it->second.insert(location);
+        //the events of the automata and of all_events.txt share the ids
+        size_t id = ltlfuzz::EVENT_DICT.intern(event);
+        if(id >= s_instance->event_targets.size()){
+            s_instance->event_targets.resize(id + 1);
         }
+        s_instance->event_targets[id].insert(location);
     }
     
     fileReader.close();
-    std::cout << "The number of loading events: " << ((s_instance->event_target_map).size()) << std::endl;
+    size_t events = 0;
+    for(auto& targets : s_instance->event_targets){
+        events += !targets.empty();
+    }
+    std::cout << "The number of loading events: " << events << std::endl;
 }
 
 void ltlfuzz::TargetsStore::load_events(std::string fileName){
@@ -62,47 +66,125 @@ void ltlfuzz::TargetsStore::load_events(std::string fileName){
         input >> result;
         std::string value = result;
         s_instance->event_map[key] = value;
+        //a code of several names resolves to the smallest, as the search over the sorted map did
+        auto code = s_instance->code_map.emplace(value, key);
+        if(!code.second && key < code.first->second){
+            code.first->second = key;
+        }
     }
     fileReader.close();
-    
-    //test information
-    std::cout << "------------------------------Test Event---------------------" << std::endl;
-    std::map<std::string, std::string>::iterator it;
-    for(it = s_instance->event_map.begin(); it != s_instance->event_map.end(); it++){
-        std::cout << (it->first) << "\t" << (it->second) << std::endl;
-    }
-    std::cout << "Event_load success" << std::endl;
+    std::cout << "Event_load success: " << s_instance->event_map.size() << " events" << std::endl;
 }
 
 //flag: 0 for RERS; 1 for protocols
 ltlfuzz::TargetLocation ltlfuzz::TargetsStore::getTarget(std::string event, int flag){
-    return s_instance->get_target_from_event(event, flag);
-}
-
-ltlfuzz::TargetLocation ltlfuzz::TargetsStore::get_target_from_event(std::string event, int flag){
-
     if(get_target_type(event, flag)==ltlfuzz::TargetType::INPUT){
         return ltlfuzz::TargetLocation(ltlfuzz::TargetType::INPUT, event);
     }
+    return s_instance->get_target_from_event(ltlfuzz::EVENT_DICT.id(event), flag);
+}
+
+ltlfuzz::TargetLocation ltlfuzz::TargetsStore::getTarget(int event, int flag){
+    if(event >= 0 && get_target_type(ltlfuzz::EVENT_DICT.name(event), flag)==ltlfuzz::TargetType::INPUT){
+        return ltlfuzz::TargetLocation(ltlfuzz::TargetType::INPUT, ltlfuzz::EVENT_DICT.name(event));
+    }
+    return s_instance->get_target_from_event(event, flag);
+}
 
-    auto iter=s_instance->event_target_map.find(event);
+ltlfuzz::TargetLocation ltlfuzz::TargetsStore::get_target_from_event(int event, int flag){
 
-    if(iter == s_instance->event_target_map.end()){
+    if(event < 0 || (size_t)event >= s_instance->event_targets.size() || s_instance->event_targets[event].empty()){
         std::cout << "Corresponding target does not exist" <<std::endl;
         exit (EXIT_FAILURE);
     }
-    std::vector<std::pair<std::any, double>> vector_;
+    const std::set<std::string>& targets = s_instance->event_targets[event];
+    strategy::Candidates<const std::string*>& candidates = s_instance->target_candidates;
+    candidates.clear();
+    refresh_build();
         
-    for(auto& e : iter->second){
-        vector_.push_back(std::make_pair(e, 1.0));
+    //UCB1 over the targets of an event: the mean reward of a target's runs, scaled
+    //by the best one, plus a bonus for the ones fuzzed less often
+    double explore = 2.0 * log(1.0 + s_instance->total_runs);
+    for(auto& e : targets){
+        if(s_instance->building && !s_instance->built_targets.count(e)){
+            continue;
+        }
+        //the mean over the finished runs; the bonus counts every selection,
+        //handoffs to a running instance included
+        unsigned runs = s_instance->target_runs[e];
+        unsigned rewarded = s_instance->target_rewarded[e];
+        double mean = rewarded && s_instance->best_mean_reward > 0 ?
+                      s_instance->target_rewards[e] / rewarded / s_instance->best_mean_reward : 0;
+        candidates.add(&e, mean + sqrt((explore + 1.0) / (1.0 + runs)));
+    }
+    if(candidates.empty()){
+        return ltlfuzz::TargetLocation(ltlfuzz::TargetType::OUTPUT, "");
     }
-    std::any selected = strategy::RandomStrategy::instance()->select(vector_);
-    std::string target = std::any_cast<std::string> (selected);
+    const std::string& target = *strategy::selector().select(candidates);
+    s_instance->target_runs[target]++;
+    s_instance->total_runs++;
     
 
     return ltlfuzz::TargetLocation(get_target_type(target, flag), target);
 }
 
+void ltlfuzz::TargetsStore::watch_build(const std::string& build_dir){
+    s_instance->build_dir = build_dir;
+    s_instance->building = true;
+    s_instance->failed_build = false;
+    s_instance->built_targets.clear();
+    s_instance->built_read = 0;
+    refresh_build();
+}
+
+bool ltlfuzz::TargetsStore::built(const std::string& target){
+    refresh_build();
+    return !s_instance->building || s_instance->built_targets.count(target);
+}
+
+bool ltlfuzz::TargetsStore::build_failed(){
+    refresh_build();
+    return s_instance->failed_build;
+}
+
+//the targets the build finished since the last call; all of them once its
+//marker is gone, unless it left the failure marker
+void ltlfuzz::TargetsStore::refresh_build(){
+    if(!s_instance->building){
+        return;
+    }
+    struct stat st;
+    s_instance->failed_build = false;
+    if(stat((s_instance->build_dir + buildPendingFile).c_str(), &st) != 0){
+        if(stat((s_instance->build_dir + buildFailedFile).c_str(), &st) != 0){
+            s_instance->building = false;
+            s_instance->built_targets.clear();
+            return;
+        }
+        s_instance->failed_build = true;
+    }
+    std::ifstream built(s_instance->build_dir + builtTargetsFile);
+    if(!built.is_open()){
+        return;
+    }
+    built.seekg(s_instance->built_read);
+    std::string line;
+    //a line without its newline is still being written
+    while(std::getline(built, line) && !built.eof()){
+        s_instance->built_targets.insert(line);
+        s_instance->built_read = built.tellg();
+    }
+}
+
+void ltlfuzz::TargetsStore::reward(const std::string& target, double reward){
+    double& total = s_instance->target_rewards[target];
+    total += reward;
+    unsigned runs = ++s_instance->target_rewarded[target];
+    if(total / runs > s_instance->best_mean_reward){
+        s_instance->best_mean_reward = total / runs;
+    }
+}
+
 ltlfuzz::TargetType ltlfuzz::TargetsStore::get_target_type(std::string target, int flag){
     if(flag){
         return ltlfuzz::TargetType::OUTPUT;
@@ -116,11 +198,14 @@ ltlfuzz::TargetType ltlfuzz::TargetsStore::get_target_type(std::string target, i
 
 void ltlfuzz::TargetsStore::dump_event_target(){
 
-    for(auto& e_t : s_instance->event_target_map){
+    for(size_t id = 0; id < s_instance->event_targets.size(); id++){
+        if(s_instance->event_targets[id].empty()){
+            continue;
+        }
 
-        std::cout <<"Event: "<< e_t.first<<std::endl;
+        std::cout <<"Event: "<< ltlfuzz::EVENT_DICT.name(id)<<std::endl;
 
-        for(auto t : e_t.second){
+        for(auto t : s_instance->event_targets[id]){
             std::cout << "target:" << t <<std::endl;
         }
     }
@@ -129,19 +214,14 @@ void ltlfuzz::TargetsStore::dump_event_target(){
 
 
 std::string ltlfuzz::TargetsStore::coding(std::string value){
-    std::map<std::string, std::string>::iterator it;
-    for(it = s_instance->event_map.begin(); it != s_instance->event_map.end(); it++){
-        if(it->second == value){
-            return it->first;
-        }
-    }
-    if(it == s_instance->event_map.end()){
-        throw std::runtime_error("could not find the event");
+    auto it = s_instance->code_map.find(value);
+    if(it == s_instance->code_map.end()){
+        throw std::runtime_error("could not find the event " + value);
     }
+    return it->second;
 }
 
 std::string ltlfuzz::TargetsStore::decode(std::string input){
-    std::string str = input.substr(1);
-    std::string value = s_instance->event_map[str];
-    return value;
+    auto it = s_instance->event_map.find(input.substr(1));
+    return it != s_instance->event_map.end() ? it->second : "";
 }
@@ -0,0 +1,225 @@
+#include <triage.h>
+#include <utils.h>
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <glob.h>
+#include <stdio.h>
+#include <time.h>
+
+ltlfuzz::Triage::Triage(const std::string& out_dir, const std::string& workdir, const std::string& binary,
+                        unsigned threads, unsigned timeout_ms, unsigned max_execs) : stopping(false){
+    this->out_dir = out_dir;
+    this->workdir = workdir;
+    this->binary = binary;
+    this->timeout_ms = timeout_ms;
+    this->max_execs = max_execs;
+    this->slots.resize(std::max(1u, threads));
+}
+
+ltlfuzz::Triage::~Triage(){
+    stop();
+    for(auto& slot : this->slots){
+        if(slot.verdict != (VERDICT_SMEM*)-1){
+            shmdt(slot.verdict);
+        }
+        release_verdict_smem(slot.verdict_shmid);
+        if(!slot.input_file.empty()){
+            remove(slot.input_file.c_str());
+        }
+    }
+}
+
+void ltlfuzz::Triage::watch(const std::string& pattern){
+    this->patterns.push_back(pattern);
+}
+
+void ltlfuzz::Triage::start(){
+    utils::make_dirs(this->out_dir);
+    for(size_t t = 0; t < this->slots.size(); t++){
+        Slot& slot = this->slots[t];
+        slot.input_file = this->out_dir + ".input-" + std::to_string(t);
+        slot.verdict_shmid = create_verdict_smem();
+        slot.verdict = bind_verdict_smem(slot.verdict_shmid);
+        if(slot.verdict == (VERDICT_SMEM*)-1){
+            std::cout << "triage: no verdict shm, counterexamples are not triaged" << std::endl;
+            return;
+        }
+        std::ofstream(slot.input_file, std::ios::binary | std::ios::trunc).close();
+        this->servers.emplace_back(new ForkServer());
+        //no table writes nor traces from these runs: they only tell violations apart
+        this->servers.back()->start(this->workdir, this->binary, {slot.input_file},
+                                    {{VERDICT_SHM_ENV_VAR, std::to_string(slot.verdict_shmid)}, {"DRY_RUN", "1"}, {TRACE_FILE_ENV_VAR, ""}});
+    }
+    for(unsigned t = 0; t < this->slots.size(); t++){
+        this->threads.emplace_back(&Triage::work, this, t);
+    }
+    std::cout << "triage: " << this->slots.size() << " threads, witnesses in " << this->out_dir << std::endl;
+}
+
+void ltlfuzz::Triage::stop(){
+    this->stopping = true;
+    this->wake.notify_all();
+    for(auto& th : this->threads){
+        th.join();
+    }
+    this->threads.clear();
+    this->servers.clear();
+}
+
+void ltlfuzz::Triage::work(unsigned t){
+    while(true){
+        std::string file;
+        {
+            std::unique_lock<std::mutex> guard(this->lock);
+            while(this->queue.empty() && !this->stopping){
+                long int now = static_cast<long int> (time(NULL));
+                if(now - this->last_scan >= triageScanSecs){
+                    this->last_scan = now;
+                    scan();
+                    continue;
+                }
+                this->wake.wait_for(guard, std::chrono::seconds(1));
+            }
+            if(this->stopping){
+                return;
+            }
+            file = this->queue.front();
+            this->queue.pop_front();
+        }
+        std::ifstream ifs(file, std::ios::binary);
+        std::stringstream content;
+        content << ifs.rdbuf();
+        std::string data = content.str();
+
+        std::string key;
+        if(data.empty() || !execute(t, data, key)){
+            std::lock_guard<std::mutex> guard(this->lock);
+            this->not_reproduced++;
+            continue;
+        }
+        bool shorter;
+        {
+            std::lock_guard<std::mutex> guard(this->lock);
+            Violation& v = this->violations[key];
+            v.counterexamples++;
+            //the first one of a violation, or one shorter than its witness
+            shorter = v.size == 0 || data.size() < v.size;
+            if(v.size == 0){
+                v.size = data.size();
+            }
+            if(!shorter && !v.witness.empty()){
+                write_summary();
+            }
+        }
+        if(shorter){
+            save(key, minimize(t, data, key));
+        }
+    }
+}
+
+void ltlfuzz::Triage::scan(){
+    const std::string suffix = TRACE_FILE_SUFFIX;
+    for(auto& pattern : this->patterns){
+        glob_t dirs;
+        if(glob(pattern.c_str(), GLOB_ONLYDIR, NULL, &dirs) != 0){
+            globfree(&dirs);
+            continue;
+        }
+        for(size_t i = 0; i < dirs.gl_pathc; i++){
+            for(auto& file : utils::list_files(dirs.gl_pathv[i])){
+                bool trace = file.size() > suffix.size() && file.compare(file.size() - suffix.size(), suffix.size(), suffix) == 0;
+                bool readme = file.size() >= 11 && file.compare(file.size() - 11, 11, "/README.txt") == 0;
+                if(!trace && !readme && this->seen.insert(file).second){
+                    this->queue.push_back(file);
+                }
+            }
+        }
+        globfree(&dirs);
+    }
+}
+
+bool ltlfuzz::Triage::execute(unsigned t, const std::string& data, std::string& key){
+    Slot& slot = this->slots[t];
+    ForkServer& server = *this->servers[t];
+    std::ofstream ofs(slot.input_file, std::ios::binary | std::ios::trunc);
+    ofs.write(data.data(), data.size());
+    ofs.close();
+    reset_verdict(slot.verdict);
+    if(!server.running() || server.run(this->timeout_ms) == -1){
+        //died: the next execution gets a new one
+        server.start(this->workdir, this->binary, {slot.input_file},
+                     {{VERDICT_SHM_ENV_VAR, std::to_string(slot.verdict_shmid)}, {"DRY_RUN", "1"}, {TRACE_FILE_ENV_VAR, ""}});
+        return false;
+    }
+    if(!slot.verdict->violated){
+        return false;
+    }
+    key = std::to_string(slot.verdict->property) + " " + slot.verdict->path;
+    return true;
+}
+
+//afl-tmin: blocks of halving sizes are deleted wherever the same violation
+//remains, over and over until no block can go or the executions run out
+std::string ltlfuzz::Triage::minimize(unsigned t, std::string data, const std::string& key){
+    unsigned execs = 0;
+    bool changed = true;
+    while(changed && execs < this->max_execs && !this->stopping){
+        changed = false;
+        for(size_t block = data.size() / 2; block > 0 && execs < this->max_execs && !this->stopping; block /= 2){
+            for(size_t pos = 0; pos < data.size() && execs < this->max_execs && !this->stopping; ){
+                std::string candidate = data.substr(0, pos) + data.substr(std::min(data.size(), pos + block));
+                std::string found;
+                execs++;
+                if(execute(t, candidate, found) && found == key){
+                    data.swap(candidate);
+                    changed = true;
+                }
+                else{
+                    pos += block;
+                }
+            }
+        }
+    }
+    return data;
+}
+
+void ltlfuzz::Triage::save(const std::string& key, const std::string& witness){
+    std::lock_guard<std::mutex> guard(this->lock);
+    Violation& v = this->violations[key];
+    if(v.witness.empty() || witness.size() < v.size){
+        if(v.witness.empty()){
+            size_t named = 0;
+            for(auto& other : this->violations){
+                named += !other.second.witness.empty();
+            }
+            char name[32];
+            snprintf(name, sizeof(name), "id:%06zu,property:%s", named, key.substr(0, key.find(' ')).c_str());
+            v.witness = name;
+        }
+        v.size = witness.size();
+        std::string tmp = this->out_dir + ".witness";
+        std::ofstream ofs(tmp, std::ios::binary | std::ios::trunc);
+        ofs.write(witness.data(), witness.size());
+        ofs.close();
+        utils::move_file(tmp, this->out_dir + v.witness);
+        std::cout << "triage: " << v.witness << ", " << v.size << " events, automata path "
+                  << key.substr(key.find(' ') + 1) << std::endl;
+    }
+    write_summary();
+}
+
+//one line per violation: witness, its events, counterexamples, property and automata path
+void ltlfuzz::Triage::write_summary(){
+    std::string tmp = this->out_dir + ".violations.txt";
+    std::ofstream ofs(tmp, std::ios::trunc);
+    for(auto& v : this->violations){
+        if(!v.second.witness.empty()){
+            ofs << v.second.witness << " " << v.second.size << " " << v.second.counterexamples << " " << v.first << std::endl;
+        }
+    }
+    ofs << "# not reproduced: " << this->not_reproduced << std::endl;
+    ofs.close();
+    utils::move_file(tmp, this->out_dir + "violations.txt");
+}
@@ -0,0 +1,86 @@
+#include <weighted_strategy.h>
+
+void strategy::AliasTable::build(const double* weights, size_t n){
+    this->prob.assign(n, 1.0);
+    this->alias.resize(n);
+    for(size_t i = 0; i < n; i++){
+        this->alias[i] = i;
+    }
+
+    double total = 0;
+    for(size_t i = 0; i < n; i++){
+        if(weights[i] > 0){
+            total += weights[i];
+        }
+    }
+    if(total <= 0){
+        return;
+    }
+
+    std::vector<size_t> small, large;
+    for(size_t i = 0; i < n; i++){
+        this->prob[i] = weights[i] > 0 ? weights[i] * n / total : 0;
+        if(this->prob[i] < 1.0){
+            small.push_back(i);
+        }
+        else{
+            large.push_back(i);
+        }
+    }
+    while(!small.empty() && !large.empty()){
+        size_t s = small.back();
+        size_t l = large.back();
+        small.pop_back();
+        this->alias[s] = l;
+        this->prob[l] -= 1.0 - this->prob[s];
+        if(this->prob[l] < 1.0){
+            large.pop_back();
+            small.push_back(l);
+        }
+    }
+    //what is left is 1 up to rounding
+    size_t positive = 0;
+    while(weights[positive] <= 0){
+        positive++;
+    }
+    for(size_t i : small){
+        if(weights[i] > 0){
+            this->prob[i] = 1.0;
+        }
+        else{
+            this->prob[i] = 0;
+            this->alias[i] = positive;
+        }
+    }
+    for(size_t i : large){
+        this->prob[i] = 1.0;
+    }
+}
+
+size_t strategy::AliasTable::size() const{
+    return this->prob.size();
+}
+
+size_t strategy::AliasTable::sample(Rng& rng) const{
+    size_t i = rng.below(this->prob.size());
+    return rng.uniform() < this->prob[i] ? i : this->alias[i];
+}
+
+strategy::WeightedStrategy* strategy::WeightedStrategy::s_instance;
+strategy::WeightedStrategy* strategy::WeightedStrategy::instance(){
+    if(!s_instance)
+        s_instance = new WeightedStrategy;
+
+    return s_instance;
+}
+strategy::WeightedStrategy::WeightedStrategy(){}
+
+size_t strategy::WeightedStrategy::select_index(const double* fitness, size_t n, const void* set, uint64_t version){
+
+    std::pair<uint64_t, AliasTable>& cached = this->tables[set];
+    if(cached.first != version){
+        cached.second.build(fitness, n);
+        cached.first = version;
+    }
+    return cached.second.sample(rng());
+}
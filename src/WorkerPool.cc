@@ -0,0 +1,172 @@
+#include <worker_pool.h>
+#include <errno.h>
+#include <iostream>
+#include <sched.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+namespace{
+
+const long int killGrace = 5;      //seconds between SIGTERM and SIGKILL
+
+}//namespace
+
+std::string ltlfuzz::Command::str() const{
+    std::string s = "cd " + this->workdir + " &&";
+    for(auto& a : this->argv){
+        s += " " + a;
+    }
+    return s;
+}
+
+ltlfuzz::WorkerPool::WorkerPool(size_t workers, size_t per_target, int cpu_base){
+    this->slots.resize(workers ? workers : 1, Worker{0, "", 0, 0, false});
+    this->per_target = per_target ? per_target : 1;
+    this->cpu_base = cpu_base;
+    this->busy = 0;
+}
+
+ltlfuzz::WorkerPool::~WorkerPool(){
+    wait_all();
+}
+
+size_t ltlfuzz::WorkerPool::size() const{
+    return this->slots.size();
+}
+
+bool ltlfuzz::WorkerPool::full() const{
+    return this->busy == this->slots.size();
+}
+
+bool ltlfuzz::WorkerPool::empty() const{
+    return this->busy == 0;
+}
+
+bool ltlfuzz::WorkerPool::accepts(const std::string& target) const{
+    size_t running = 0;
+    for(auto& w : this->slots){
+        if(w.pid != 0 && w.target == target){
+            running++;
+        }
+    }
+    return running < this->per_target;
+}
+
+int ltlfuzz::WorkerPool::free_slot() const{
+    for(size_t i = 0; i < this->slots.size(); i++){
+        if(this->slots[i].pid == 0){
+            return i;
+        }
+    }
+    return -1;
+}
+
+const ltlfuzz::WorkerPool::Worker& ltlfuzz::WorkerPool::worker(size_t slot) const{
+    return this->slots[slot];
+}
+
+bool ltlfuzz::WorkerPool::spawn(const std::string& target, const Command& cmd,
+                                const std::vector<std::pair<std::string, std::string>>& env){
+    int slot = free_slot();
+    if(slot < 0){
+        return false;
+    }
+    pid_t pid = fork();
+    if(pid < 0){
+        std::cout << "failed to start a worker for " << target << std::endl;
+        return false;
+    }
+    if(pid == 0){
+        signal(SIGPIPE, SIG_DFL);   //ignored by ltl-fuzz, see ForkServer::start()
+        if(this->cpu_base >= 0){
+            long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            CPU_SET((this->cpu_base + slot) % (cpus > 0 ? cpus : 1), &set);
+            if(sched_setaffinity(0, sizeof(set), &set) == 0){
+                setenv("AFL_NO_AFFINITY", "1", 1);
+            }
+        }
+        for(auto& var : env){
+            setenv(var.first.c_str(), var.second.c_str(), 1);
+        }
+        if(!cmd.workdir.empty() && chdir(cmd.workdir.c_str()) != 0){
+            _exit(127);
+        }
+        std::vector<char*> argv;
+        for(auto& a : cmd.argv){
+            argv.push_back(const_cast<char*>(a.c_str()));
+        }
+        argv.push_back(NULL);
+        execvp(argv[0], argv.data());
+        _exit(127);
+    }
+    this->slots[slot] = Worker{pid, target, static_cast<long int> (time(NULL)), cmd.kill_at, false};
+    this->busy++;
+    return true;
+}
+
+bool ltlfuzz::WorkerPool::poll(){
+    //only the workers' pids: ltl-fuzz has other children, e.g. fork servers
+    bool ended = false;
+    for(auto& w : this->slots){
+        if(w.pid == 0){
+            continue;
+        }
+        int status;
+        pid_t pid = waitpid(w.pid, &status, WNOHANG);
+        if(pid == 0 || (pid < 0 && errno != ECHILD)){
+            continue;
+        }
+        if(pid > 0){
+            std::cout << "worker on " << w.target << " ended after "
+                      << static_cast<long int> (time(NULL)) - w.started << "s" << std::endl;
+        }
+        //ECHILD: reaped elsewhere, the slot is stale
+        w.pid = 0;
+        w.target.clear();
+        this->busy--;
+        ended = true;
+    }
+    if(ended){
+        return true;
+    }
+    long int now = static_cast<long int> (time(NULL));
+    for(auto& w : this->slots){
+        if(w.pid == 0 || w.kill_at == 0 || now < w.kill_at){
+            continue;
+        }
+        if(!w.terminated){
+            kill(w.pid, SIGTERM);
+            w.terminated = true;
+        }
+        else if(now >= w.kill_at + killGrace){
+            kill(w.pid, SIGKILL);
+        }
+    }
+    return false;
+}
+
+void ltlfuzz::WorkerPool::wait_one(){
+    while(this->busy > 0 && !wait_one_for(1)){
+    }
+}
+
+bool ltlfuzz::WorkerPool::wait_one_for(unsigned seconds){
+    for(unsigned tick = 0; this->busy > 0 && tick < seconds * 10; tick++){
+        if(poll()){
+            return true;
+        }
+        usleep(100000);
+    }
+    return false;
+}
+
+void ltlfuzz::WorkerPool::wait_all(){
+    while(this->busy > 0){
+        wait_one();
+    }
+}
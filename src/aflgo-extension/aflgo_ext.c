@@ -2,36 +2,79 @@
 #include <stdlib.h>
 #include <stdio.h>
 
-void replace_with_prefix(void* mem, uint32_t len, PREFIX_SMEM* shm){
+/* The test case is written from one buffer kept across executions: the
+   prefix sits at its start and is only copied in again when LTL-Fuzzer
+   publishes a new version, each exec only copies the suffix behind it. */
+static INPUT_TYPE* prefixed_buf = NULL;
+static uint32_t prefixed_cap = 0;
+static uint32_t prefixed_len = 0;           //prefix bytes at the start of prefixed_buf
+static uint32_t prefixed_version = 1;       //odd: nothing loaded yet
 
-    uint8_t prefix_size = shm -> arr_size; 
-    memcpy((INPUT_TYPE*)mem, shm -> array, prefix_size*sizeof(INPUT_TYPE));
-    
-    char number_str[10];
-    sprintf(number_str,"%d",prefix_size);
+static int reserve_prefixed(uint32_t size){
+    if(size <= prefixed_cap){
+        return 1;
+    }
+    uint32_t cap = prefixed_cap ? prefixed_cap : 4096;
+    while(cap < size){
+        cap *= 2;
+    }
+    INPUT_TYPE* buf = realloc(prefixed_buf, cap);
+    if(buf == NULL){
+        return 0;
+    }
+    prefixed_buf = buf;
+    prefixed_cap = cap;
+    return 1;
+}
+
+/* copies the current prefix to prefixed_buf, retrying while it is rewritten */
+static void load_prefix(PREFIX_SMEM* shm, uint32_t version){
+    for(;;){
+        if(version & 1){
+            version = prefix_version(shm);
+            continue;
+        }
+        uint32_t prefix_size = 0;
+        const char* prefix = shm->arr_size ? prefix_message(shm, 0, &prefix_size) : NULL;
+        if(prefix == NULL || !reserve_prefixed(prefix_size)){
+            prefix_size = 0;
+        }
+        else{
+            memcpy(prefixed_buf, prefix, prefix_size);
+        }
+        uint32_t now = prefix_version(shm);
+        if(now == version){
+            prefixed_len = prefix_size;
+            prefixed_version = version;
+            break;
+        }
+        version = now;
+    }
+
+    char number_str[12];
+    sprintf(number_str,"%u",prefixed_len);
     setenv("PREFIX_LENGTH", number_str, 1);
 }
 
 void add_prefix_common(void** mem, uint32_t* len, PREFIX_SMEM* shm){
-  
-    uint32_t prefix_size = shm->arr_size;
-    if(prefix_size == 0){
-        return;
+
+    uint32_t version = prefix_version(shm);
+    if(version != prefixed_version){
+        load_prefix(shm, version);
     }
-    else{
-        void *new_mem = (void*)malloc((*len + prefix_size)*sizeof(INPUT_TYPE));
-        memcpy((INPUT_TYPE*)new_mem, shm->array, (prefix_size)*sizeof(INPUT_TYPE));
-        memcpy((INPUT_TYPE*)(new_mem + prefix_size*sizeof(INPUT_TYPE)), (INPUT_TYPE*)(*mem), (*len)*sizeof(INPUT_TYPE));
-        *len += prefix_size;
-        *mem = new_mem;
-        
-        char number_str[10];
-        sprintf(number_str,"%u",prefix_size);
-        setenv("PREFIX_LENGTH", number_str, 1);
+    if(prefixed_len == 0 || !reserve_prefixed(prefixed_len + *len)){
         return;
     }
+    memcpy(prefixed_buf + prefixed_len, *mem, *len);
+    *len += prefixed_len;
+    *mem = prefixed_buf;
 }
 
+const void* common_prefix(uint32_t* len){
+    *len = prefixed_len;
+    return prefixed_buf;
+}
 
-
-
+uint32_t common_prefix_version(void){
+    return prefixed_version;
+}
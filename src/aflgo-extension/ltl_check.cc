@@ -0,0 +1,73 @@
+#include "aflgo_ext.h"
+#include <automata_image.h>
+#include <compiled_automata.h>
+#include <counterexample_trace.h>
+#include <event_dictionary.h>
+#include <memory>
+#include <string.h>
+#include <unistd.h>
+
+using lfz::automata::CompiledAutomata;
+
+struct Property {
+    std::unique_ptr<CompiledAutomata> automata;
+    std::vector<int> ids;       // of the names last bound
+};
+
+static std::vector<Property> properties;
+static std::string bound_names;   // the names of the last trace, as in the shm
+
+int ltl_check_init(const char* ltl_dir)
+{
+    properties.clear();
+    bound_names.clear();
+    for (unsigned k = 0; ; k++) {
+        std::string image = std::string(ltl_dir) + lfz::automata::automata_image_file(k);
+        if (access(image.c_str(), R_OK) != 0) {
+            break;
+        }
+        Property p;
+        p.automata.reset(new CompiledAutomata());
+        try {
+            p.automata->load(image);
+        } catch (lfz::automata::AutomataException &) {
+            break;
+        }
+        properties.push_back(std::move(p));
+    }
+    return properties.size();
+}
+
+int ltl_check_trace(const DEFERRED_TRACE* shm)
+{
+    inst::CounterexampleTrace trace;
+    const char *name = shm->names;
+    for (uint32_t d = 0; d < shm->num_names; d++) {
+        trace.names.push_back(name);
+        name += strlen(name) + 1;
+    }
+    std::string names(shm->names, name - shm->names);
+    if (names != bound_names) {
+        // the children of a fork server share its dictionary: this is rare
+        lfz::automata::EventDictionary dict;
+        for (auto &n : trace.names) {
+            dict.intern(n);
+        }
+        for (auto &p : properties) {
+            p.ids.clear();
+            p.automata->bind_events(dict, p.ids);
+        }
+        bound_names.swap(names);
+    }
+    trace.events.assign(shm->events, shm->events + shm->num_events);
+    trace.state_events.assign(shm->state_events, shm->state_events + shm->num_states);
+    trace.state_hashes.assign(shm->hashes, shm->hashes + shm->num_states);
+    for (size_t k = 0; k < properties.size(); k++) {
+        inst::TraceReplay r;
+        inst::replay_counterexample_trace(*properties[k].automata, trace, properties[k].ids, r);
+        if (r.violation >= 0) {
+            return k;
+        }
+    }
+    return -1;
+}
@@ -1,4 +1,8 @@
+#include <algorithm>
+#include <deque>
 #include <cassert>
+#include <cstdio>
+#include <fstream>
 #include <spot/tl/parse.hh>
 #include <spot/tl/exclusive.hh>
 #include <spot/twaalgos/translate.hh>
@@ -9,20 +13,40 @@ namespace lfz {
 namespace automata {
 
 static const std::string DELIMETER = ",";
-static bool check_cond_res;
-static bool is_true_cond_res;
-static const std::set<int> *check_cond_events;
-static std::vector<std::vector<std::pair<int, bool>>> transition_cond;
+
+/*
+ * bdd_allsat() only accepts a plain function pointer, so the handlers below
+ * reach the evaluation they belong to through a thread-local context. Every
+ * evaluation installs its own context for the duration of the call and
+ * restores the previous one, which keeps the handlers reentrant and lets
+ * different threads evaluate conditions at the same time.
+ */
+struct CondContext {
+    bool result = false;
+    const std::set<int> *events = nullptr;
+    cubes_t *cubes = nullptr;
+};
+
+static thread_local CondContext *cond_ctx = nullptr;
+
+class CondScope {
+public:
+    explicit CondScope(CondContext *ctx) : prev_(cond_ctx) { cond_ctx = ctx; }
+    ~CondScope() { cond_ctx = prev_; }
+
+private:
+    CondContext *prev_;
+};
 
 static void is_true_cond_helper(char *cond, int size)
 {
     for (int i = 0; i < size; i++) {
         if (cond[i] >= 0) {
-            is_true_cond_res = false;
+            cond_ctx->result = false;
             return;
         }
     }
-    is_true_cond_res = true;
+    cond_ctx->result = true;
 }
 
 static void check_cond_helper(char *cond, int size)
@@ -35,10 +59,10 @@ static void check_cond_helper(char *cond, int size)
         }
     }
     int n_match = 0;
-    for (int index : *check_cond_events) {
+    for (int index : *cond_ctx->events) {
         assert(index < size);
         if (cond[index] == 0) {
-            check_cond_res = false;
+            cond_ctx->result = false;
             return;
         }
         if (cond[index] == 1) {
@@ -46,7 +70,7 @@ static void check_cond_helper(char *cond, int size)
         }
     }
     assert(n_match <= n_true);
-    check_cond_res = n_match == n_true;
+    cond_ctx->result = n_match == n_true;
 }
 
 static void get_cond_helper(char *cond, int size)
@@ -59,33 +83,34 @@ static void get_cond_helper(char *cond, int size)
             conditions.push_back(std::make_pair(i, true));
         }
     }
-    transition_cond.push_back(conditions);
-}
-
-AutomataException::AutomataException(const std::string &msg) noexcept
-{
-    this->msg_.append("[Automata Error] ");
-    this->msg_.append(msg);
-}
-
-AutomataException::AutomataException(const AutomataException &e) noexcept
-    : msg_(e.msg_)
-{
+    cond_ctx->cubes->push_back(conditions);
 }
 
-AutomataException &AutomataException::operator= (const AutomataException &e) noexcept
+static void collect_cubes(const bdd &cond, cubes_t &cubes)
 {
-    this->msg_ = e.msg_;
-    return *this;
+    CondContext ctx;
+    ctx.cubes = &cubes;
+    CondScope scope(&ctx);
+    bdd_allsat(cond, get_cond_helper);
 }
 
-AutomataException::~AutomataException()
+static void cubes_to_events(const cubes_t &cubes,
+                            const std::unordered_map<int, std::string> &reverse_bdd_map,
+                            std::vector<std::set<std::string>> &events)
 {
-}
-
-const char *AutomataException::what() const noexcept
-{
-    return this->msg_.c_str();
+    for (const auto &sat : cubes) {
+        std::set<std::string> s;
+        for (const auto &e : sat) {
+            assert(reverse_bdd_map.count(e.first) > 0);
+            if (e.second) {
+                s.insert(reverse_bdd_map.at(e.first));
+            } else {
+                std::string ne = "!";
+                s.insert(ne.append(reverse_bdd_map.at(e.first)));
+            }
+        }
+        events.push_back(s);
+    }
 }
 
 State::State(const spot::state *state, state_num_t state_num)
@@ -187,8 +212,10 @@ State Iterator::dst() const
 
 bool Iterator::is_true_cond() const
 {
+    CondContext ctx;
+    CondScope scope(&ctx);
     bdd_allsat(this->iter_->cond(), is_true_cond_helper);
-    return is_true_cond_res;
+    return ctx.result;
 }
 
 bool Iterator::check_cond(const std::set<std::string> &events) const
@@ -199,33 +226,18 @@ bool Iterator::check_cond(const std::set<std::string> &events) const
             event_indices.insert(this->bdd_map_->at(e));
         }
     }
-    check_cond_events = &event_indices;
+    CondContext ctx;
+    ctx.events = &event_indices;
+    CondScope scope(&ctx);
     bdd_allsat(this->iter_->cond(), check_cond_helper);
-    return check_cond_res;
+    return ctx.result;
 }
 
 void Iterator::get_cond(std::vector<std::set<std::string>> &events) const
 {
-    transition_cond.clear();
-    bdd_allsat(this->iter_->cond(), get_cond_helper);
-    for (const auto &sat : transition_cond) {
-        std::set<std::string> s;
-        for (const auto &e : sat) {
-            assert(this->reverse_bdd_map_->count(e.first) > 0);
-            if (e.second) {
-                s.insert(this->reverse_bdd_map_->at(e.first));
-            } else {
-                std::string ne = "!";
-                s.insert(ne.append(this->reverse_bdd_map_->at(e.first)));
-            }
-        }
-        events.push_back(s);
-    }
-}
-
-MCState::MCState(int state, int distance, bool acceptance)
-    : state(state), distance(distance), acceptance(acceptance)
-{
+    cubes_t cubes;
+    collect_cubes(this->iter_->cond(), cubes);
+    cubes_to_events(cubes, *this->reverse_bdd_map_, events);
 }
 
 Automata::Automata()
@@ -238,13 +250,28 @@ Automata::Automata(const std::string &formula, const std::string &exclusive)
 }
 
 Automata::Automata(const Automata &a)
-    : automata_(a.automata_)
+    : automata_(a.automata_),
+      bdd_map_(a.bdd_map_), reverse_bdd_map_(a.reverse_bdd_map_),
+      events_(a.events_), event_ids_(a.event_ids_),
+      next_state_(a.next_state_), accepting_(a.accepting_),
+      distance_(a.distance_),
+      edges_(a.edges_)
 {
+    reset_transition_cache();
 }
 
 Automata &Automata::operator= (const Automata &a)
 {
     this->automata_ = a.automata_;
+    this->bdd_map_ = a.bdd_map_;
+    this->reverse_bdd_map_ = a.reverse_bdd_map_;
+    this->events_ = a.events_;
+    this->event_ids_ = a.event_ids_;
+    this->next_state_ = a.next_state_;
+    this->accepting_ = a.accepting_;
+    this->distance_ = a.distance_;
+    this->edges_ = a.edges_;
+    reset_transition_cache();
     return *this;
 }
 
@@ -288,6 +315,199 @@ void Automata::set_formula(const std::string &formula, const std::string &exclus
         this->bdd_map_[kv.first.ap_name()] = kv.second;
         this->reverse_bdd_map_[kv.second] = kv.first.ap_name();
     }
+
+    build_transition_table();
+}
+
+void Automata::build_transition_table()
+{
+    /* Intern events in name order so ids are stable across processes */
+    this->events_.clear();
+    this->event_ids_.clear();
+    for (const auto &kv : this->bdd_map_) {
+        this->events_.push_back(kv.first);
+    }
+    std::sort(this->events_.begin(), this->events_.end());
+    for (size_t i = 0; i < this->events_.size(); i++) {
+        this->event_ids_[this->events_[i]] = i;
+    }
+
+    /*
+     * A trace event makes exactly one AP true. The extra last column stands
+     * for events outside the alphabet, where every AP is false.
+     */
+    const size_t n_events = this->events_.size() + 1;
+    std::vector<bdd> valuations;
+    for (size_t e = 0; e < n_events; e++) {
+        bdd v = bddtrue;
+        for (size_t i = 0; i < this->events_.size(); i++) {
+            int var = this->bdd_map_.at(this->events_[i]);
+            v &= (i == e) ? bdd_ithvar(var) : bdd_nithvar(var);
+        }
+        valuations.push_back(v);
+    }
+
+    const unsigned n_states = this->automata_->num_states();
+    this->next_state_.assign(n_states * n_events, -1);
+    this->accepting_.assign(n_states, false);
+    this->edges_.assign(n_states, std::vector<Edge>());
+    for (unsigned s = 0; s < n_states; s++) {
+        this->accepting_[s] = this->automata_->state_is_accepting(s);
+        for (const auto &edge : this->automata_->out(s)) {
+            Edge ed;
+            ed.dst = edge.dst;
+            collect_cubes(edge.cond, ed.cond);
+            this->edges_[s].push_back(ed);
+        }
+        for (size_t e = 0; e < n_events; e++) {
+            // Same precedence as model_check_events_reference(): a matching
+            // non-TRUE edge wins, otherwise the last TRUE edge is taken.
+            int next = -1;
+            for (const auto &edge : this->automata_->out(s)) {
+                if (edge.cond == bddtrue) {
+                    next = edge.dst;
+                } else if ((edge.cond & valuations[e]) != bddfalse) {
+                    next = edge.dst;
+                    break;
+                }
+            }
+            this->next_state_[s * n_events + e] = next;
+        }
+    }
+
+    compute_distances();
+    reset_transition_cache();
+}
+
+void Automata::compute_distances()
+{
+    const size_t n_states = this->edges_.size();
+    std::vector<std::vector<int>> preds(n_states);
+    for (size_t s = 0; s < n_states; s++) {
+        for (const auto &edge : this->edges_[s]) {
+            preds[edge.dst].push_back(s);
+        }
+    }
+
+    /* Accepting states that lie on a cycle, i.e. can reach themselves */
+    this->distance_.assign(n_states, NO_ACCEPTANCE);
+    std::deque<int> queue;
+    for (size_t a = 0; a < n_states; a++) {
+        if (!this->accepting_[a]) {
+            continue;
+        }
+        std::vector<bool> seen(n_states, false);
+        std::deque<int> fwd;
+        fwd.push_back(a);
+        bool cycle = false;
+        while (!fwd.empty() && !cycle) {
+            int s = fwd.front();
+            fwd.pop_front();
+            for (const auto &edge : this->edges_[s]) {
+                if (edge.dst == (int)a) {
+                    cycle = true;
+                    break;
+                }
+                if (!seen[edge.dst]) {
+                    seen[edge.dst] = true;
+                    fwd.push_back(edge.dst);
+                }
+            }
+        }
+        if (cycle) {
+            this->distance_[a] = 0;
+            queue.push_back(a);
+        }
+    }
+
+    /* Reverse BFS from all of them at once */
+    while (!queue.empty()) {
+        int s = queue.front();
+        queue.pop_front();
+        for (int p : preds[s]) {
+            if (this->distance_[p] == NO_ACCEPTANCE) {
+                this->distance_[p] = this->distance_[s] + 1;
+                queue.push_back(p);
+            }
+        }
+    }
+}
+
+int Automata::distance_to_acceptance(int state) const
+{
+    return this->distance_.at(state);
+}
+
+void Automata::reset_transition_cache()
+{
+    this->transition_cache_.clear();
+    this->transition_cache_.resize(this->edges_.size());
+    this->transition_cache_once_.reset(new std::once_flag[this->edges_.size()]);
+}
+
+void Automata::fill_transition_cache(int state) const
+{
+    TransitionCache &cache = this->transition_cache_[state];
+    for (const auto &edge : this->edges_[state]) {
+        Transition t;
+        t.dst = edge.dst;
+        for (const auto &cube : edge.cond) {
+            std::vector<int> lits;
+            for (const auto &lit : cube) {
+                int id = this->event_ids_.at(this->reverse_bdd_map_.at(lit.first)) + 1;
+                lits.push_back(lit.second ? id : -id);
+            }
+            t.cond.push_back(lits);
+        }
+        cache.ids.push_back(t);
+
+        std::pair<std::vector<std::set<std::string>>, int> n;
+        cubes_to_events(edge.cond, this->reverse_bdd_map_, n.first);
+        n.second = edge.dst;
+        cache.names.push_back(n);
+    }
+}
+
+const transitions_t &Automata::state_transitions(int state) const
+{
+    const TransitionCache &cache = this->transition_cache_.at(state);
+    std::call_once(this->transition_cache_once_[state],
+                   &Automata::fill_transition_cache, this, state);
+    return cache.names;
+}
+
+const id_transitions_t &Automata::state_transition_ids(int state) const
+{
+    const TransitionCache &cache = this->transition_cache_.at(state);
+    std::call_once(this->transition_cache_once_[state],
+                   &Automata::fill_transition_cache, this, state);
+    return cache.ids;
+}
+
+const std::string &Automata::event_name(int id) const
+{
+    return this->events_.at(id);
+}
+
+int Automata::event_id(const std::string &event) const
+{
+    auto it = this->event_ids_.find(event);
+    if (it == this->event_ids_.end()) {
+        return other_event_id();
+    }
+    return it->second;
+}
+
+int Automata::other_event_id() const
+{
+    return this->events_.size();
+}
+
+void Automata::bind_events(const EventDictionary &dict, std::vector<int> &ids) const
+{
+    for (size_t d = ids.size(); d < dict.size(); d++) {
+        ids.push_back(event_id(dict.name(d)));
+    }
 }
 
 bool Automata::valid() const
@@ -310,6 +530,36 @@ Iterator Automata::get_iterator(const State &state) const
 
 void Automata::model_check_events(const std::vector<std::string> &events,
                                   std::vector<MCState> &states) const
+{
+    std::vector<int> ids;
+    ids.reserve(events.size());
+    for (const auto &e : events) {
+        ids.push_back(event_id(e));
+    }
+    model_check_events(ids, states);
+}
+
+void Automata::model_check_events(const std::vector<int> &events,
+                                  std::vector<MCState> &states) const
+{
+    states.clear();
+    states.reserve(events.size());
+    const size_t n_events = other_event_id() + 1;
+    int s = this->automata_->get_init_state_number();
+
+    for (int e : events) {
+        assert(e >= 0 && (size_t)e < n_events);
+        s = this->next_state_[s * n_events + e];
+        if (s < 0) {
+            states.push_back(MCState(-1, NO_ACCEPTANCE, false));
+            break;
+        }
+        states.push_back(MCState(s, this->distance_[s], this->accepting_[s]));
+    }
+}
+
+void Automata::model_check_events_reference(const std::vector<std::string> &events,
+                                            std::vector<MCState> &states) const
 {
     states.clear();
     State s = get_init_state();
@@ -339,9 +589,9 @@ void Automata::model_check_events(const std::vector<std::string> &events,
 
         if (cond_sat) {
             bool accepting = this->automata_->state_is_accepting(s.state());
-            states.push_back(MCState(s.state_num(), 0, accepting));
+            states.push_back(MCState(s.state_num(), this->distance_[s.state_num()], accepting));
         } else {
-            states.push_back(MCState(-1, 0, false));
+            states.push_back(MCState(-1, NO_ACCEPTANCE, false));
             break;
         }
     }
@@ -349,28 +599,14 @@ void Automata::model_check_events(const std::vector<std::string> &events,
 
 void Automata::get_state_transitions(int state, transitions_t &transitions) const
 {
-    transitions.clear();
-    // Get state iterator
-    State s(this->automata_->state_from_number(state), state);
-    Iterator it = get_iterator(s);
-
-    // Iterate through all transitions
-    for (it.first(); !it.done(); it.next()) {
-        std::pair<std::vector<std::set<std::string>>, int> t;
-        it.get_cond(t.first);
-        t.second = it.dst().state_num();
-        transitions.push_back(t);
-    }
+    transitions = state_transitions(state);
 }
 
 void Automata::get_state_events(int curState, int nextState, events_t &events) const
 {
-    State s(this->automata_->state_from_number(curState), curState);
-    Iterator it = get_iterator(s);
-    for (it.first(); !it.done(); it.next()) {
-        int tempState = it.dst().state_num();
-        if(tempState == nextState){
-            it.get_cond(events);
+    for (const auto &edge : this->edges_.at(curState)) {
+        if (edge.dst == nextState) {
+            cubes_to_events(edge.cond, this->reverse_bdd_map_, events);
             break;
         }
     }
@@ -379,66 +615,171 @@ void Automata::get_state_events(int curState, int nextState, events_t &events) c
 void Automata::get_state_set(int curState, stateSet_t &stateSet) const
 {
     stateSet.clear();
-    State s(this->automata_->state_from_number(curState), curState);
-    Iterator it = get_iterator(s);
-    
-    for(it.first(); !it.done(); it.next()){
-        int nextState = it.dst().state_num();
-        if(nextState != curState){
-            stateSet.insert(nextState);
+    for (const auto &edge : this->edges_.at(curState)) {
+        if (edge.dst != curState) {
+            stateSet.insert(edge.dst);
         }
     }
 }
 
-void Automata::find_paths(std::stack<int> &sstack, paths_t &paths, std::vector<int> &isVisited, std::stack<int> &path) const
+void Automata::get_state_paths(int curState, paths_t &paths, std::vector<int> aPath) const
 {
-    if(sstack.empty()){
-        return;
+    PathEnumerator enumerator(*this, curState, aPath);
+    std::vector<int> path;
+    while (enumerator.next(path)) {
+        std::stack<int> spath;
+        for (int state : path) {
+            spath.push(state);
+        }
+        paths.push_back(spath);
     }
+}
 
-    int stop = sstack.top();
-    isVisited[stop] = 1;
-    path.push(stop);
+PathEnumerator::PathEnumerator(const Automata &atm, int curState,
+                               const std::vector<int> &aPath,
+                               size_t max_length, size_t max_count)
+    : atm_(atm), start_(curState), max_length_(max_length),
+      max_count_(max_count), count_(0), depth_(0), truncated_(true),
+      visited_(atm.edges_.size(), 0)
+{
+    for (int state : aPath) {
+        this->visited_.at(state) = 1;
+    }
+}
+
+void PathEnumerator::push(int state)
+{
+    Frame frame;
+    frame.state = state;
+    frame.next = 0;
 
     stateSet_t stateSet;
-    get_state_set(stop, stateSet);
-
-    for(stateSet_t::iterator it = stateSet.begin(); it != stateSet.end(); it++){
-        bool accepting = this->automata_->state_is_accepting(*it);
-        if(accepting){
-            path.push(*it);
-            paths.push_back(path);
-            path.pop();
+    this->atm_.get_state_set(state, stateSet);
+    frame.succ.assign(stateSet.begin(), stateSet.end());
+
+    this->visited_[state] = 1;
+    this->stack_.push_back(std::move(frame));
+}
+
+bool PathEnumerator::next(std::vector<int> &path)
+{
+    if (this->max_count_ != 0 && this->count_ >= this->max_count_) {
+        return false;
+    }
+
+    while (true) {
+        if (this->stack_.empty()) {
+            /* Deepen only if the last round was cut short somewhere */
+            if (!this->truncated_ ||
+                (this->max_length_ != 0 && this->depth_ >= this->max_length_)) {
+                return false;
+            }
+            this->depth_++;
+            this->truncated_ = false;
+            push(this->start_);
         }
-        else{
-            if(isVisited[*it] == 0){
-                sstack.push(*it);
-                find_paths(sstack, paths, isVisited, path);
+
+        Frame &top = this->stack_.back();
+        if (top.next == top.succ.size()) {
+            this->visited_[top.state] = 0;
+            this->stack_.pop_back();
+            continue;
+        }
+
+        int succ = top.succ[top.next++];
+        /* Number of transitions from start_ to succ */
+        size_t length = this->stack_.size();
+        if (this->atm_.accepting_[succ]) {
+            /* Shorter paths were returned by the previous rounds */
+            if (length == this->depth_) {
+                path.clear();
+                for (const auto &frame : this->stack_) {
+                    path.push_back(frame.state);
+                }
+                path.push_back(succ);
+                this->count_++;
+                return true;
+            }
+        } else if (!this->visited_[succ]) {
+            if (length < this->depth_) {
+                push(succ);
+            } else {
+                this->truncated_ = true;
             }
         }
     }
-
-    int pt = sstack.top();
-    sstack.pop();
-    path.pop();
-    isVisited[pt] = 0;
-    return; 
 }
 
-void Automata::get_state_paths(int curState, paths_t &paths, std::vector<int> aPath) const
+template <typename T>
+static void write_section(std::ofstream &out, const std::vector<T> &v)
 {
-    std::vector<int> isVisited(10);
-    for(size_t i = 0; i < aPath.size(); i++){
-        isVisited[i] = 1;
-    }
-
-    std::stack<int> sstack;
-    sstack.push(curState);
+    out.write((const char *)v.data(), v.size() * sizeof(T));
+}
 
-    std::stack<int> path;
+void Automata::save(const std::string &path) const
+{
+    const uint32_t n_states = this->accepting_.size();
+    std::vector<uint32_t> accepting(this->accepting_.begin(), this->accepting_.end());
+    std::vector<int32_t> distance(this->distance_.begin(), this->distance_.end());
+    std::vector<uint32_t> state_edges;
+    std::vector<int32_t> edge_dst;
+    std::vector<uint32_t> edge_cubes;
+    std::vector<uint32_t> cube_literals;
+    std::vector<int32_t> literals;
 
-    find_paths(sstack, paths, isVisited, path);
+    for (uint32_t s = 0; s < n_states; s++) {
+        state_edges.push_back(edge_dst.size());
+        for (const auto &t : state_transition_ids(s)) {
+            edge_dst.push_back(t.dst);
+            edge_cubes.push_back(cube_literals.size());
+            for (const auto &cube : t.cond) {
+                cube_literals.push_back(literals.size());
+                literals.insert(literals.end(), cube.begin(), cube.end());
+            }
+        }
+    }
+    state_edges.push_back(edge_dst.size());
+    edge_cubes.push_back(cube_literals.size());
+    cube_literals.push_back(literals.size());
+
+    std::string names;
+    for (const auto &e : this->events_) {
+        names.append(e);
+        names.push_back('\0');
+    }
 
+    AutomataImageHeader h;
+    h.magic = AUTOMATA_IMAGE_MAGIC;
+    h.version = AUTOMATA_IMAGE_VERSION;
+    h.num_states = n_states;
+    h.num_events = this->events_.size();
+    h.init_state = this->automata_->get_init_state_number();
+    h.num_edges = edge_dst.size();
+    h.num_cubes = cube_literals.size() - 1;
+    h.num_literals = literals.size();
+    h.names_size = names.size();
+
+    /* Targets may map the image at any time: write aside, then rename */
+    std::string tmp = path + ".tmp";
+    std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+    if (!out.is_open()) {
+        throw AutomataException("Failed to write automata image " + tmp);
+    }
+    std::vector<int32_t> next_state(this->next_state_.begin(), this->next_state_.end());
+    out.write((const char *)&h, sizeof(h));
+    write_section(out, next_state);
+    write_section(out, accepting);
+    write_section(out, distance);
+    write_section(out, state_edges);
+    write_section(out, edge_dst);
+    write_section(out, edge_cubes);
+    write_section(out, cube_literals);
+    write_section(out, literals);
+    out.write(names.data(), names.size());
+    out.close();
+    if (!out || std::rename(tmp.c_str(), path.c_str()) != 0) {
+        throw AutomataException("Failed to write automata image " + path);
+    }
 }
 
 } // namespace automata
@@ -0,0 +1,236 @@
+#include <cassert>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <compiled_automata.h>
+
+namespace lfz {
+namespace automata {
+
+MCState::MCState(int state, int distance, bool acceptance)
+    : state(state), distance(distance), acceptance(acceptance)
+{
+}
+
+CompiledAutomata::CompiledAutomata()
+    : image_(nullptr), image_size_(0), header_(nullptr)
+{
+}
+
+CompiledAutomata::~CompiledAutomata()
+{
+    unload();
+}
+
+void CompiledAutomata::unload()
+{
+    if (this->image_ != nullptr) {
+        munmap(this->image_, this->image_size_);
+    }
+    this->image_ = nullptr;
+    this->image_size_ = 0;
+    this->header_ = nullptr;
+    this->events_.clear();
+    this->event_ids_.clear();
+    this->transition_cache_.clear();
+}
+
+void CompiledAutomata::load(const std::string &path)
+{
+    unload();
+
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw AutomataException("Failed to open automata image " + path);
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(AutomataImageHeader)) {
+        close(fd);
+        throw AutomataException("Truncated automata image " + path);
+    }
+    void *image = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (image == MAP_FAILED) {
+        throw AutomataException("Failed to map automata image " + path);
+    }
+    this->image_ = image;
+    this->image_size_ = st.st_size;
+
+    const AutomataImageHeader *h = (const AutomataImageHeader *)image;
+    if (h->magic != AUTOMATA_IMAGE_MAGIC || h->version != AUTOMATA_IMAGE_VERSION) {
+        unload();
+        throw AutomataException("Bad automata image " + path);
+    }
+
+    /* Section sizes in 4-byte words, see automata_image.h */
+    size_t n_next = (size_t)h->num_states * (h->num_events + 1);
+    size_t words = n_next + 2 * h->num_states + (h->num_states + 1) + h->num_edges +
+                   (h->num_edges + 1) + (h->num_cubes + 1) + h->num_literals;
+    if (sizeof(AutomataImageHeader) + words * 4 + h->names_size > this->image_size_) {
+        unload();
+        throw AutomataException("Truncated automata image " + path);
+    }
+
+    const uint32_t *p = (const uint32_t *)(h + 1);
+    this->next_state_ = (const int32_t *)p;
+    p += n_next;
+    this->accepting_ = p;
+    p += h->num_states;
+    this->distance_ = (const int32_t *)p;
+    p += h->num_states;
+    this->state_edges_ = p;
+    p += h->num_states + 1;
+    this->edge_dst_ = (const int32_t *)p;
+    p += h->num_edges;
+    this->edge_cubes_ = p;
+    p += h->num_edges + 1;
+    this->cube_literals_ = p;
+    p += h->num_cubes + 1;
+    this->literals_ = (const int32_t *)p;
+    p += h->num_literals;
+
+    const char *names = (const char *)p;
+    const char *names_end = names + h->names_size;
+    while (names < names_end && this->events_.size() < h->num_events) {
+        std::string name(names);
+        this->event_ids_[name] = this->events_.size();
+        this->events_.push_back(name);
+        names += name.length() + 1;
+    }
+    if (this->events_.size() != h->num_events) {
+        unload();
+        throw AutomataException("Corrupted event names in automata image " + path);
+    }
+    this->transition_cache_.resize(h->num_states);
+    this->header_ = h;
+}
+
+bool CompiledAutomata::valid() const
+{
+    return this->header_ != nullptr;
+}
+
+int CompiledAutomata::event_id(const std::string &event) const
+{
+    auto it = this->event_ids_.find(event);
+    if (it == this->event_ids_.end()) {
+        return other_event_id();
+    }
+    return it->second;
+}
+
+int CompiledAutomata::other_event_id() const
+{
+    return this->header_->num_events;
+}
+
+void CompiledAutomata::bind_events(const EventDictionary &dict, std::vector<int> &ids) const
+{
+    for (size_t d = ids.size(); d < dict.size(); d++) {
+        ids.push_back(event_id(dict.name(d)));
+    }
+}
+
+int CompiledAutomata::init_state() const
+{
+    return this->header_->init_state;
+}
+
+int CompiledAutomata::next_state(int state, int event) const
+{
+    assert(state >= 0 && (uint32_t)state < this->header_->num_states);
+    assert(event >= 0 && event <= other_event_id());
+    return this->next_state_[(size_t)state * (other_event_id() + 1) + event];
+}
+
+bool CompiledAutomata::accepting(int state) const
+{
+    return this->accepting_[state] != 0;
+}
+
+int CompiledAutomata::distance_to_acceptance(int state) const
+{
+    return this->distance_[state];
+}
+
+void CompiledAutomata::model_check_events(const std::vector<std::string> &events,
+                                          std::vector<MCState> &states) const
+{
+    std::vector<int> ids;
+    ids.reserve(events.size());
+    for (const auto &e : events) {
+        ids.push_back(event_id(e));
+    }
+    model_check_events(ids, states);
+}
+
+void CompiledAutomata::model_check_events(const std::vector<int> &events,
+                                          std::vector<MCState> &states) const
+{
+    states.clear();
+    states.reserve(events.size());
+    const size_t n_events = other_event_id() + 1;
+    int s = init_state();
+
+    for (int e : events) {
+        assert(e >= 0 && (size_t)e < n_events);
+        s = this->next_state_[s * n_events + e];
+        if (s < 0) {
+            states.push_back(MCState(-1, NO_ACCEPTANCE, false));
+            break;
+        }
+        states.push_back(MCState(s, this->distance_[s], this->accepting_[s] != 0));
+    }
+}
+
+void CompiledAutomata::get_state_transitions(int state, transitions_t &transitions) const
+{
+    transitions = state_transitions(state);
+}
+
+const transitions_t &CompiledAutomata::state_transitions(int state) const
+{
+    return transition_cache(state).names;
+}
+
+const id_transitions_t &CompiledAutomata::state_transition_ids(int state) const
+{
+    return transition_cache(state).ids;
+}
+
+const CompiledAutomata::TransitionCache &CompiledAutomata::transition_cache(int state) const
+{
+    TransitionCache &cache = this->transition_cache_.at(state);
+    if (cache.filled) {
+        return cache;
+    }
+    for (uint32_t e = this->state_edges_[state]; e < this->state_edges_[state + 1]; e++) {
+        Transition t;
+        std::pair<std::vector<std::set<std::string>>, int> n;
+        for (uint32_t c = this->edge_cubes_[e]; c < this->edge_cubes_[e + 1]; c++) {
+            std::vector<int> lits(this->literals_ + this->cube_literals_[c],
+                                  this->literals_ + this->cube_literals_[c + 1]);
+            std::set<std::string> s;
+            for (int lit : lits) {
+                if (lit > 0) {
+                    s.insert(this->events_[lit - 1]);
+                } else {
+                    s.insert("!" + this->events_[-lit - 1]);
+                }
+            }
+            t.cond.push_back(lits);
+            n.first.push_back(s);
+        }
+        t.dst = this->edge_dst_[e];
+        n.second = t.dst;
+        cache.ids.push_back(t);
+        cache.names.push_back(n);
+    }
+    cache.filled = true;
+    return cache;
+}
+
+} // namespace automata
+} // namespace lfz
@@ -0,0 +1,38 @@
+#include <event_dictionary.h>
+
+namespace lfz {
+namespace automata {
+
+int EventDictionary::intern(const std::string &name)
+{
+    auto it = this->ids_.find(name);
+    if (it != this->ids_.end()) {
+        return it->second;
+    }
+    int id = this->names_.size();
+    this->names_.push_back(name);
+    this->ids_[name] = id;
+    return id;
+}
+
+int EventDictionary::id(const std::string &name) const
+{
+    auto it = this->ids_.find(name);
+    if (it == this->ids_.end()) {
+        return -1;
+    }
+    return it->second;
+}
+
+const std::string &EventDictionary::name(int id) const
+{
+    return this->names_.at(id);
+}
+
+size_t EventDictionary::size() const
+{
+    return this->names_.size();
+}
+
+} // namespace automata
+} // namespace lfz
@@ -1,4 +1,5 @@
 #include <exception.h>
+#include <automata_types.h>
 
 namespace lfz {
 
@@ -27,4 +28,33 @@ const char *Exception::what() const noexcept
     return this->msg_.c_str();
 }
 
+namespace automata {
+
+AutomataException::AutomataException(const std::string &msg) noexcept
+{
+    this->msg_.append("[Automata Error] ");
+    this->msg_.append(msg);
+}
+
+AutomataException::AutomataException(const AutomataException &e) noexcept
+    : msg_(e.msg_)
+{
+}
+
+AutomataException &AutomataException::operator= (const AutomataException &e) noexcept
+{
+    this->msg_ = e.msg_;
+    return *this;
+}
+
+AutomataException::~AutomataException()
+{
+}
+
+const char *AutomataException::what() const noexcept
+{
+    return this->msg_.c_str();
+}
+
+} // namespace automata
 } // namespace lfz
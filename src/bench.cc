@@ -0,0 +1,352 @@
+#include <automata.h>
+#include <compiled_automata.h>
+#include <counterexample_trace.h>
+#include <codebean.h>
+#include <pathstore.h>
+#include <pathwriter.h>
+#include <shared_table.h>
+#include <utils.h>
+#include <chrono>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <random>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * ltl-bench: microbenchmarks of the hot paths of LTL-Fuzzer, to compare a
+ * build before and after a change. Every benchmark repeats its operation
+ * until it has run for benchTimeMs and prints one tab-separated line:
+ * name, parameter, nanoseconds per operation, operations. Benchmarks whose
+ * name starts with one of the arguments run, all of them without any:
+ *
+ *   set_formula k          translating property k of the subject
+ *   model_check events     a random trace of that many events, or a
+ *   model_check file       recorded one (-t, see counterexample_trace.h)
+ *   collect_state bytes    hashing a program state of that size
+ *   evaluate_trace pairs   a RERS execution of that many input/output
+ *                          pairs: collected, its lassos checked as the
+ *                          states repeat (check_acceptance), evaluated
+ *   table_write paths      a new prefix through PathWriter, and
+ *   table_select paths     a selection by the orchestrator, both on a
+ *                          shared table holding that many paths
+ *
+ * The automata are those of the LTL formulas of $LTL, or else of
+ * <subject>/ltl_dir/ltl.txt. The table benchmarks need the shared table
+ * name free: they are skipped while a campaign runs.
+ */
+
+namespace{
+
+const uint64_t benchTimeMs = 200;
+std::mt19937_64 rng(0x4c544c42);   //the same traces in every build
+std::vector<std::string> filters;
+
+bool selected(const std::string& name){
+    if(filters.empty()){
+        return true;
+    }
+    for(auto& f : filters){
+        if(name.compare(0, f.size(), f) == 0){
+            return true;
+        }
+    }
+    return false;
+}
+
+//op(n) runs n operations and returns the nanoseconds of the part measured
+void bench(const std::string& name, const std::string& param, const std::function<uint64_t(uint64_t)>& op){
+    uint64_t n = 1;
+    uint64_t ns = op(n);
+    while(ns < benchTimeMs * 1000000 && n < (1ull << 40)){
+        n = ns == 0 ? n * 16 : std::max(n + 1, std::min(n * 16, n * benchTimeMs * 1000000 * 5 / 4 / ns));
+        ns = op(n);
+    }
+    printf("%s\t%s\t%.1f\t%llu\n", name.c_str(), param.c_str(), (double)ns / n, (unsigned long long)n);
+    fflush(stdout);
+}
+
+uint64_t since(std::chrono::steady_clock::time_point start){
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+//"formula:events" lines, or $LTL with the events of all_events.txt
+void read_properties(const std::string& subject, std::vector<std::pair<std::string, std::string>>& properties){
+    if(getenv("LTL") != NULL){
+        std::string events;
+        std::ifstream ifs(subject + "all_event_dir/all_events.txt");
+        std::string e;
+        while(ifs >> e){
+            events += (events.empty() ? "" : ",") + e;
+        }
+        for(auto& f : utils::split_formulas(getenv("LTL"))){
+            properties.push_back(std::make_pair(f, events));
+        }
+        return;
+    }
+    std::ifstream ifs(subject + "ltl_dir/ltl.txt");
+    std::string line;
+    while(std::getline(ifs, line)){
+        size_t colon = line.rfind(':');
+        if(colon != std::string::npos){
+            properties.push_back(std::make_pair(line.substr(0, colon), line.substr(colon + 1)));
+        }
+    }
+}
+
+void bench_model_check(const lfz::automata::CompiledAutomata& automata, const std::string& param, const std::vector<int>& ids){
+    std::vector<lfz::automata::MCState> states;
+    states.reserve(ids.size());
+    bench("model_check", param, [&](uint64_t n){
+        auto start = std::chrono::steady_clock::now();
+        for(uint64_t i = 0; i < n; i++){
+            states.clear();
+            automata.model_check_events(ids, states);
+        }
+        return since(start);
+    });
+}
+
+void bench_collect_state(){
+    for(size_t bytes : {64, 1024, 16384, 262144}){
+        std::vector<long> state(bytes / sizeof(long));
+        long ptr = (long)state.data();
+        int size = bytes;
+        bench("collect_state", std::to_string(bytes), [&](uint64_t n){
+            inst::CodeBean::reset_trace();
+            auto start = std::chrono::steady_clock::now();
+            for(uint64_t i = 0; i < n; i++){
+                state[i % state.size()] = i;
+                inst::CodeBean::collect_state(&ptr, &size, 1);
+                if(i % 4096 == 4095){
+                    inst::CodeBean::reset_trace();
+                }
+            }
+            return since(start);
+        });
+    }
+}
+
+//random input/output pairs of the event map; the program states repeat
+//every 16 pairs, so that the lassos are checked
+void bench_evaluate_trace(const std::vector<int>& codes){
+    size_t violations = 0;
+    for(size_t pairs : {64, 512, 4096, 32768}){
+        std::vector<int> trace;
+        for(size_t i = 0; i < 2 * pairs; i++){
+            trace.push_back(codes[rng() % codes.size()]);
+        }
+        long state = 0;
+        long ptr = (long)&state;
+        int size = sizeof(state);
+        bench("evaluate_trace", std::to_string(pairs), [&](uint64_t n){
+            auto start = std::chrono::steady_clock::now();
+            for(uint64_t i = 0; i < n; i++){
+                inst::CodeBean::reset_trace();
+                try{
+                    for(size_t p = 0; p < pairs; p++){
+                        inst::CodeBean::collect_trace(trace[2*p], trace[2*p+1]);
+                        state = p % 16;
+                        inst::CodeBean::collect_state(&ptr, &size, 1);
+                    }
+                    inst::CodeBean::evaluate_trace(0);
+                }catch(std::runtime_error&){
+                    violations++;
+                }
+            }
+            return since(start);
+        });
+    }
+    if(violations){
+        std::cout << "# evaluate_trace: " << violations << " traces violated a property" << std::endl;
+    }
+}
+
+lfz::automata::StatePath random_path(unsigned depth){
+    lfz::automata::StatePath path;
+    path.push(0);
+    for(unsigned d = 1; d < depth; d++){
+        path.push(rng() % 8);
+    }
+    return path;
+}
+
+std::string random_prefix(){
+    std::string prefix;
+    for(unsigned i = 0, len = 4 + rng() % 28; i < len; i++){
+        prefix += std::to_string(1 + rng() % 10) + ",";
+    }
+    return prefix;
+}
+
+void bench_table(){
+    try{
+        managed_shared_memory live(open_only, shmId.c_str());
+        std::cout << "# table: a shared table exists already, skipped" << std::endl;
+        return;
+    }catch(const interprocess_exception&){
+    }
+    const size_t sizes[] = {1024, 16384, 65536};
+    setenv(tablePathsEnv, "131072", 0);
+    {
+        managed_shared_memory segment(create_only, shmId.c_str(), utils::env_option(tableSizeEnv, size >> 20) << 20);
+        path::PathsStore store(&segment);
+        std::vector<lfz::automata::StatePath> paths;
+        for(size_t paths_wanted : sizes){
+            while((size_t)store.getSize() < paths_wanted){
+                paths.push_back(random_path(2 + rng() % 10));
+                store.insert_automata_path(0, paths.back(), random_prefix(), "0.5");
+            }
+            if(selected("table_write")){
+                bench("table_write", std::to_string(paths_wanted), [&](uint64_t n){
+                    std::vector<std::string> prefixes;
+                    for(uint64_t i = 0; i < n; i++){
+                        prefixes.push_back(random_prefix() + std::to_string(rng()));
+                    }
+                    auto start = std::chrono::steady_clock::now();
+                    for(uint64_t i = 0; i < n; i++){
+                        inst::PathWriter::write_to_shared_table(0, paths[i % paths.size()], prefixes[i], "0.5");
+                    }
+                    return since(start);
+                });
+            }
+            if(selected("table_select")){
+                //without the line every selection logs, bench() prints with stdio
+                std::ofstream null("/dev/null");
+                std::streambuf* out = std::cout.rdbuf(null.rdbuf());
+                bench("table_select", std::to_string(paths_wanted), [&](uint64_t n){
+                    auto start = std::chrono::steady_clock::now();
+                    for(uint64_t i = 0; i < n; i++){
+                        store.select_prefix_aPath();
+                    }
+                    return since(start);
+                });
+                std::cout.rdbuf(out);
+            }
+        }
+    }
+    shared_memory_object::remove(shmId.c_str());
+}
+
+}//namespace
+
+int main(int argc, char* argv[]){
+    std::string subject = getenv("SUBJECT") ? getenv("SUBJECT") : "";
+    std::vector<std::string> traces;
+    int arg = 1;
+    for(; arg < argc && argv[arg][0] == '-'; arg++){
+        if(!strcmp(argv[arg], "-s") && arg + 1 < argc){
+            subject = std::string(argv[++arg]) + "/";
+        }
+        else if(!strcmp(argv[arg], "-t") && arg + 1 < argc){
+            traces.push_back(argv[++arg]);
+        }
+        else{
+            std::cout << "usage: ltl-bench [-s <subject>] [-t <trace>]... [benchmark...]" << std::endl;
+            return 0;
+        }
+    }
+    for(; arg < argc; arg++){
+        filters.push_back(argv[arg]);
+    }
+    //the runtime stays quiet, never writes the table and never reports to a campaign
+    setenv("LTL_VERBOSE", "0", 1);
+    unsetenv("DRY_RUN");
+    unsetenv(TRACE_FILE_ENV_VAR);
+    setenv(VERDICT_SHM_ENV_VAR, "-1", 1);
+
+    std::cout << "# benchmark\tparameter\tns/op\tops" << std::endl;
+    std::vector<std::pair<std::string, std::string>> properties;
+    if(!subject.empty()){
+        read_properties(subject, properties);
+    }
+    if(properties.empty()){
+        std::cout << "# no LTL property (-s <subject> or $SUBJECT, or $LTL): automata benchmarks skipped" << std::endl;
+    }
+    for(size_t k = 0; k < properties.size(); k++){
+        if(selected("set_formula")){
+            bench("set_formula", std::to_string(k), [&](uint64_t n){
+                auto start = std::chrono::steady_clock::now();
+                for(uint64_t i = 0; i < n; i++){
+                    lfz::automata::Automata atm;
+                    atm.set_formula(properties[k].first, properties[k].second);
+                }
+                return since(start);
+            });
+        }
+    }
+
+    //the runtime reads the image of the first property from a subject of its own
+    char dir[] = "/tmp/ltl-bench-XXXXXX";
+    std::string bench_subject;
+    if(!properties.empty() && mkdtemp(dir) != NULL){
+        bench_subject = std::string(dir) + "/";
+        utils::make_dirs(bench_subject + "ltl_dir");
+        utils::make_dirs(bench_subject + "event_map_dir");
+        lfz::automata::Automata atm;
+        atm.set_formula(properties[0].first, properties[0].second);
+        atm.save(bench_subject + "ltl_dir/" + lfz::automata::automata_image_file(0));
+        std::ifstream src(subject + "event_map_dir/event_mapping.txt");
+        std::ofstream dst(bench_subject + "event_map_dir/event_mapping.txt");
+        dst << src.rdbuf();
+        dst.close();
+        setenv("SUBJECT", bench_subject.c_str(), 1);
+    }
+
+    if(!bench_subject.empty() && selected("model_check")){
+        lfz::automata::CompiledAutomata automata;
+        automata.load(bench_subject + "ltl_dir/" + lfz::automata::automata_image_file(0));
+        for(size_t len : {100, 1000, 10000, 100000}){
+            std::vector<int> ids;
+            for(size_t i = 0; i < len; i++){
+                ids.push_back(rng() % (automata.other_event_id() + 1));
+            }
+            bench_model_check(automata, std::to_string(len), ids);
+        }
+        for(auto& file : traces){
+            inst::CounterexampleTrace trace;
+            if(!inst::read_counterexample_trace(file, trace)){
+                std::cout << "# " << file << ": not a counterexample trace" << std::endl;
+                continue;
+            }
+            lfz::automata::EventDictionary dict;
+            for(auto& name : trace.names){
+                dict.intern(name);
+            }
+            std::vector<int> bound, ids;
+            automata.bind_events(dict, bound);
+            for(int e : trace.events){
+                ids.push_back(bound[e]);
+            }
+            bench_model_check(automata, file, ids);
+        }
+    }
+    if(selected("collect_state")){
+        bench_collect_state();
+    }
+    if(!bench_subject.empty() && selected("evaluate_trace")){
+        std::vector<int> codes;
+        std::ifstream ifs(bench_subject + "event_map_dir/event_mapping.txt");
+        std::string name;
+        int code;
+        while(ifs >> name >> code){
+            codes.push_back(code);
+        }
+        if(codes.empty()){
+            std::cout << "# evaluate_trace: no event_map_dir/event_mapping.txt, skipped" << std::endl;
+        }
+        else{
+            bench_evaluate_trace(codes);
+        }
+    }
+    if(selected("table")){
+        bench_table();
+    }
+
+    if(!bench_subject.empty()){
+        utils::run_process({"rm", "-rf", bench_subject});
+    }
+    return 0;
+}
@@ -0,0 +1,194 @@
+#include <cluster.h>
+#include <arpa/inet.h>
+#include <atomic>
+#include <deque>
+#include <iostream>
+#include <mutex>
+#include <netinet/in.h>
+#include <random>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <thread>
+#include <unistd.h>
+#include <unordered_set>
+
+/*
+ * ltl-coord: the coordinator of a distributed campaign, see cluster.h. It
+ * keeps the distinct records pushed by the nodes in memory, in arrival
+ * order, and serves them by position. The log is bounded: past its size the
+ * oldest records are dropped, and a node that had not pulled them yet goes
+ * on from the oldest one left. Each connection is served by a thread of its
+ * own, up to maxClients at once.
+ */
+
+namespace{
+
+const long int defaultLogMB = 1024;
+const unsigned maxClients = 16;
+
+struct Entry{
+    ltlfuzz::ClusterRecord record;
+    uint64_t hash;
+};
+
+std::mutex log_mutex;
+std::deque<Entry> log;              //log[0] is at position first
+uint64_t first = 0;
+size_t log_bytes = 0;
+size_t max_log_bytes = 0;
+std::unordered_set<uint64_t> seen;  //hashes of the records in log
+uint64_t epoch;
+std::string secret;
+std::atomic<unsigned> clients(0);
+
+uint64_t record_hash(const ltlfuzz::ClusterRecord& r){
+    uint64_t h = 14695981039346656037ULL ^ r.kind;
+    for(const std::string* s : {&r.key, &r.data}){
+        for(unsigned char c : *s){
+            h = (h ^ c) * 1099511628211ULL;
+        }
+        h = (h ^ s->size()) * 1099511628211ULL;
+    }
+    return h;
+}
+
+uint64_t random64(){
+    std::random_device rd;
+    return ((uint64_t)rd() << 32) | rd();
+}
+
+void add_record(ltlfuzz::ClusterRecord& r, uint64_t hash){
+    size_t bytes = ltlfuzz::record_size(r);
+    while(!log.empty() && log_bytes + bytes > max_log_bytes){
+        log_bytes -= ltlfuzz::record_size(log.front().record);
+        seen.erase(log.front().hash);
+        log.pop_front();
+        first++;
+    }
+    log_bytes += bytes;
+    log.push_back(Entry{std::move(r), hash});
+}
+
+void serve(int fd){
+    uint64_t challenge = random64();
+    ltlfuzz::cluster_header request;
+    std::vector<ltlfuzz::ClusterRecord> records;
+    if(send(fd, &challenge, sizeof(challenge), MSG_NOSIGNAL) != sizeof(challenge) ||
+       !ltlfuzz::receive_message(fd, request, records)){
+        return;
+    }
+    if(request.auth != ltlfuzz::cluster_auth(secret, challenge)){
+        std::cout << "node " << request.node << ": wrong " << ltlfuzz::secretEnv << ", rejected" << std::endl;
+        return;
+    }
+    ltlfuzz::cluster_header reply = {ltlfuzz::clusterMagic, ltlfuzz::CLUSTER_BATCH, request.node, 0, 0, epoch, 0};
+    std::vector<ltlfuzz::ClusterRecord> out;
+    {
+        std::lock_guard<std::mutex> lock(log_mutex);
+        if(request.type == ltlfuzz::CLUSTER_PUSH){
+            size_t added = 0;
+            for(auto& r : records){
+                r.node = request.node;
+                uint64_t hash = record_hash(r);
+                if(seen.insert(hash).second){
+                    add_record(r, hash);
+                    added++;
+                }
+            }
+            reply.since = first + log.size();
+            std::cout << "node " << request.node << ": " << added << " of " << records.size()
+                      << " records new, " << log.size() << " kept" << std::endl;
+        }
+        else if(request.type == ltlfuzz::CLUSTER_PULL){
+            uint64_t end = first + log.size();
+            uint64_t i = std::min<uint64_t>(std::max<uint64_t>(request.since, first), end);
+            size_t bytes = 0;
+            for(; i < end && out.size() < ltlfuzz::clusterBatch; i++){
+                const ltlfuzz::ClusterRecord& r = log[i - first].record;
+                if(r.node == request.node){
+                    continue;
+                }
+                if(bytes + ltlfuzz::record_size(r) > ltlfuzz::clusterMaxMessage){
+                    break;
+                }
+                bytes += ltlfuzz::record_size(r);
+                out.push_back(r);
+            }
+            reply.since = i;
+            reply.count = out.size();
+        }
+    }
+    ltlfuzz::send_message(fd, reply, out);
+}
+
+}//namespace
+
+int main(int argc, char* argv[]){
+    std::string address;
+    long int log_mb = defaultLogMB;
+    int arg = 1;
+    for(; arg < argc && argv[arg][0] == '-'; arg++){
+        if(!strcmp(argv[arg], "-b") && arg + 1 < argc){
+            address = argv[++arg];
+        }
+        else if(!strcmp(argv[arg], "-m") && arg + 1 < argc){
+            log_mb = atol(argv[++arg]);
+        }
+    }
+    if(arg + 1 != argc || log_mb <= 0){
+        std::cout << "usage: ltl-coord [-b address] [-m log_MB] <port>" << std::endl;
+        return 0;
+    }
+    const char* port = argv[arg];
+    max_log_bytes = (size_t)log_mb << 20;
+    const char* env_secret = getenv(ltlfuzz::secretEnv);
+    secret = env_secret ? env_secret : "";
+    do{
+        epoch = random64();
+    }while(epoch == 0);
+
+    signal(SIGPIPE, SIG_IGN);
+    int server = socket(AF_INET, SOCK_STREAM, 0);
+    int one = 1;
+    setsockopt(server, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(atoi(port));
+    if(!address.empty() && inet_pton(AF_INET, address.c_str(), &addr.sin_addr) != 1){
+        std::cout << "not an IPv4 address: " << address << std::endl;
+        return 1;
+    }
+    if(server < 0 || bind(server, (struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(server, 64) != 0){
+        std::cout << "cannot listen on port " << port << std::endl;
+        return 1;
+    }
+    std::cout << "coordinator listening on " << (address.empty() ? "*" : address) << ":" << port << std::endl;
+    if(secret.empty()){
+        std::cout << "no " << ltlfuzz::secretEnv << ": any host that reaches the port may push and pull" << std::endl;
+    }
+
+    for(;;){
+        int fd = accept(server, NULL, NULL);
+        if(fd < 0){
+            continue;
+        }
+        if(clients >= maxClients){
+            close(fd);
+            continue;
+        }
+        struct timeval tv = {10, 0};
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+        clients++;
+        std::thread([fd](){
+            serve(fd);
+            close(fd);
+            clients--;
+        }).detach();
+    }
+}
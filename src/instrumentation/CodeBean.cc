@@ -1,4 +1,10 @@
 #include <codebean.h>
+#include <instrument.h>
+
+//afl-llvm-rt, absent when the subject is not built with it
+extern "C" int __afl_snapshot(void) __attribute__((weak));
+extern "C" void __afl_snapshot_missed(void) __attribute__((weak));
+extern "C" uint8_t* __afl_area_ptr __attribute__((weak));
 
 std::string inst::CodeBean::SHM_ENV_VAR = std::string("__AFL_SHM_ID");
 int inst::CodeBean::MAP_SIZE = 65536 + 16; //shm for AFL+AFLGO
@@ -6,107 +12,444 @@ int inst::CodeBean::offset=64;
 std::string inst::CodeBean::delimiter=std::string(",");
 std::string inst::CodeBean::delimiter_prefix=std::string(";;");
 std::string inst::CodeBean::delimiter_ltl=std::string(":");
-std::string inst::CodeBean::distance_file_path="distance.cfg.txt";
-std::map<std::string, int32_t> inst::CodeBean::distance_map;
 std::vector<int> inst::CodeBean::trace_common;
-std::vector<std::string> inst::CodeBean::trace_protocol;
-std::vector<std::string> inst::CodeBean::input_protocol;
+std::vector<std::string_view> inst::CodeBean::input_protocol;
+inst::TraceArena inst::CodeBean::trace_arena;
 std::vector<size_t> inst::CodeBean::state_vector; 
 std::string inst::CodeBean::DRY_RUN_ENV="DRY_RUN";
-std::map<int, std::string> inst::CodeBean::event_reverse_map; 
-std::vector< std::pair<std::string, int> > inst::CodeBean::prop_loc_vec;
-std::vector<std::string> inst::CodeBean::trace_string;
+std::string inst::CodeBean::VERBOSE_ENV="LTL_VERBOSE";
+size_t inst::CodeBean::TRACE_RESERVE=4096;
+int inst::CodeBean::verbose_mode = -1;
+int inst::CodeBean::trace_mode = -1;
+std::vector<int> inst::CodeBean::state_events;
+std::string inst::CodeBean::SNAPSHOT_ENV="LTL_SNAPSHOT";
+long inst::CodeBean::snapshot_prefix = -1;
+std::vector<inst::CodeBean::InputFile> inst::CodeBean::input_files;
+std::string inst::CodeBean::STATE_HASH_ENV="LTL_STATE_HASH";
+int inst::CodeBean::state_hash_mode = -1;
+int inst::CodeBean::automata_map_mode = -1;
+std::vector<inst::CodeBean::StateVar> inst::CodeBean::state_vars;
+std::vector<unsigned char> inst::CodeBean::state_snapshot;
+bool inst::CodeBean::state_snapshot_valid = false;
+lfz::automata::EventDictionary inst::CodeBean::events;
+std::map<int, int> inst::CodeBean::input_events;
+std::map<int, int> inst::CodeBean::output_events;
+std::vector<int> inst::CodeBean::trace_events;
+size_t inst::CodeBean::protocol_inputs = 0;
+std::unordered_map<const char*, int> inst::CodeBean::prop_events;
+std::vector<int> inst::CodeBean::state_prev;
+std::unordered_map<size_t, int> inst::CodeBean::state_last_pos;
+int inst::CodeBean::stream_mode = -1;
+uint64_t inst::CodeBean::stream_events = 0;
+size_t inst::CodeBean::STREAM_INPUTS_MAX = 1 << 12;
+size_t inst::CodeBean::STREAM_STATES_MAX = 1 << 16;
+std::vector<std::unique_ptr<inst::CodeBean::PropertyRun>> inst::CodeBean::properties;
+int inst::CodeBean::live_properties = 0;
+VERDICT_SMEM* inst::CodeBean::verdict = nullptr;
+inst::CodeBean::Preloaded* inst::CodeBean::preloaded = nullptr;
+bool inst::CodeBean::config_tried = false;
+int inst::CodeBean::prefix_log_fd = -1;
 
-lfz::automata::Automata automata;
+//Runs from the AFL runtime before the fork server starts (and before the
+//C++ static constructors), so only touch constant-initialized state here;
+//the configuration is read into a heap-held Preloaded instead.
+void inst::CodeBean::preload(){
+    if(verdict == nullptr){
+        verdict = bind_verdict_smem(get_verdict_smem());
+    }
+    if(!config_tried){
+        config_tried = true;
+        char* subject = getenv("SUBJECT");
+        if(subject == NULL){
+            return;
+        }
+        //anything missing or broken here is left to the lazy loaders, which
+        //report it from within the execution as before
+        Preloaded* config = new Preloaded();
+        try{
+            read_automata(subject, config->properties);
+        }catch(...){
+            config->properties.clear();
+        }
+        try{
+            read_event_map(subject, config->events, config->input_events, config->output_events);
+        }catch(...){
+            config->input_events.clear();
+        }
+        config->trace_common.reserve(TRACE_RESERVE);
+        config->trace_events.reserve(TRACE_RESERVE);
+        config->state_prev.reserve(TRACE_RESERVE);
+        config->state_vector.reserve(TRACE_RESERVE);
+        config->input_protocol.reserve(TRACE_RESERVE);
+        for(auto& run : config->properties){
+            run->mc_states.reserve(TRACE_RESERVE);
+        }
+        trace_arena.reserve(TraceArena::CHUNK_SIZE);
+        //ltl-fuzz creates the log in protocol mode before any run
+        std::string log_file = std::string(subject) + path::PREFIX_LOG_FILE;
+        if(access(log_file.c_str(), W_OK) == 0){
+            prefix_log_fd = path::prefix_log_open(log_file.c_str());
+        }
+        preloaded = config;
+    }
+}
 
+//Under a campaign the verdict goes to the verdict shm and the execution ends
+//normally; without one it aborts as before so that manual runs still report it.
+void inst::CodeBean::report_counterexample(int property, const lfz::automata::StatePath& aPath, TraceViolation violation){
+    if(tracing()){
+        save_counterexample_trace(property, violation);
+    }
+    if(verdict == nullptr){
+        preload();
+    }
+    if(verdict == (VERDICT_SMEM*)-1){
+        throw std::runtime_error("a counterexample! property " + std::to_string(property));
+    }
+    verdict->property = property;
+    verdict->trace_len = trace_events.size();
+    strncpy(verdict->path, aPath.str().c_str(), VERDICT_PATH_SIZE - 1);
+    verdict->path[VERDICT_PATH_SIZE - 1] = '\0';
+    verdict->violated = 1;
+
+    std::cout << std::flush;
+    _exit(0);
+}
 
-void inst::CodeBean::init_distance_map(){
-    
-    std::fstream readFile;
-    readFile.open(distance_file_path, std::ios::in);
-    if(readFile.is_open()){
-        std::string line;
-        while(std::getline(readFile, line)){
-            std::string block_id = line.substr(0, line.find(delimiter));
-            std::string distance_s = line.substr(line.find(delimiter)+delimiter.length(), line.length());
+bool inst::CodeBean::tracing(){
+    if(trace_mode < 0){
+        char* file = getenv(TRACE_FILE_ENV_VAR);
+        trace_mode = file != NULL && *file != '\0';
+    }
+    return trace_mode;
+}
 
-            int32_t distance = (int32_t) atoi(distance_s.c_str());
-            
-            distance_map.insert({block_id, distance});
+bool inst::CodeBean::streaming(){
+    if(stream_mode < 0){
+        char* env = getenv(STREAMING_ENV_VAR);
+        stream_mode = env != NULL && atoi(env) != 0;
+    }
+    return stream_mode;
+}
+
+//a counterexample trace needs the history even when streaming, and so does
+//afl-fuzz when it checks the trace (AFL_LTL_DEFER)
+bool inst::CodeBean::keep_history(){
+    return !streaming() || tracing() || deferred();
+}
+
+//Dictionary ids, program states and automaton states of the violated
+//property, enough for ltl-trace to check the violation again offline
+void inst::CodeBean::save_counterexample_trace(int property, TraceViolation violation){
+    CounterexampleTrace trace;
+    trace.property = property;
+    trace.violation = violation;
+    trace.protocol = trace_common.empty();
+    for(size_t d = 0; d < events.size(); d++){
+        trace.names.push_back(events.name(d));
+    }
+    trace.events = trace_events;
+    trace.state_events = state_events;
+    trace.state_hashes.assign(state_vector.begin(), state_vector.end());
+    for(auto& s : properties[property]->mc_states){
+        trace.mc_states.push_back(s.state);
+    }
+    if(!write_counterexample_trace(getenv(TRACE_FILE_ENV_VAR), trace)){
+        std::cout << "failed to write the counterexample trace" << std::endl;
+    }
+}
+
+
+//Per-event output is off under the fuzzer (AFL exports the shm id) unless
+//LTL_VERBOSE=1; LTL_VERBOSE=0 silences it everywhere.
+bool inst::CodeBean::verbose(){
+    if(verbose_mode < 0){
+        char* env = getenv(VERBOSE_ENV.c_str());
+        if(env != NULL){
+            verbose_mode = atoi(env) != 0;
+        }
+        else{
+            verbose_mode = getenv(SHM_ENV_VAR.c_str()) == NULL;
         }
     }
+    return verbose_mode;
 }
 
-int32_t inst::CodeBean::get_distance_to_target(char* block_id){
+//Streaming 64-bit hash over one variable, 8 bytes at a time
+static inline uint64_t hash_bytes(const unsigned char* p, size_t n, uint64_t seed){
+    const uint64_t k1 = 0x9e3779b97f4a7c15ULL;
+    const uint64_t k2 = 0xc2b2ae3d27d4eb4fULL;
+    uint64_t h = seed ^ (n * k1);
+    for(; n >= 8; p += 8, n -= 8){
+        uint64_t w;
+        memcpy(&w, p, 8);
+        h ^= w * k2;
+        h = ((h << 31) | (h >> 33)) * k1;
+    }
+    if(n > 0){
+        uint64_t w = 0;
+        memcpy(&w, p, n);
+        h ^= w * k2;
+        h = ((h << 31) | (h >> 33)) * k1;
+    }
+    h ^= h >> 29;
+    h *= k2;
+    h ^= h >> 32;
+    return h;
+}
 
-    if(distance_map.size()==0)
-    {
-        //std::cout <<"initialize the distance table ..." << std::endl;
-        init_distance_map();
+//The state hash combines one hash per tracked variable, read in place.
+//With LTL_STATE_HASH=incremental a variable is only rehashed when its bytes
+//differ from the copy kept at the previous event of the same call site.
+size_t inst::CodeBean::hash_state(long *ptr, int *size, int num){
+    if(state_hash_mode < 0){
+        char* env = getenv(STATE_HASH_ENV.c_str());
+        state_hash_mode = env != NULL && std::string(env) == "incremental";
     }
-    auto it = distance_map.find(std::string(block_id));
 
-    if(it == distance_map.end()){
-		int32_t var = 100;        
-		return var;
+    bool incremental = state_hash_mode == 1;
+    if(incremental){
+        //the cache only holds for the same variables as last time
+        bool same = state_vars.size() == (size_t)num;
+        for(int i = 0; same && i < num; i++){
+            same = state_vars[i].ptr == ptr[i] && state_vars[i].size == size[i];
+        }
+        if(!same){
+            state_vars.assign(num, StateVar());
+            size_t offset = 0;
+            for(int i = 0; i < num; i++){
+                state_vars[i].ptr = ptr[i];
+                state_vars[i].size = size[i];
+                state_vars[i].offset = offset;
+                state_vars[i].hash = 0;
+                offset += size[i];
+            }
+            state_snapshot.assign(offset, 0);
+            state_snapshot_valid = false;
+        }
+    }
+
+    uint64_t h = 0;
+    for(int i = 0; i < num; i++){
+        const unsigned char* p = (const unsigned char*)ptr[i];
+        uint64_t hv;
+        if(incremental){
+            StateVar& var = state_vars[i];
+            unsigned char* copy = state_snapshot.data() + var.offset;
+            if(!state_snapshot_valid || memcmp(copy, p, size[i]) != 0){
+                memcpy(copy, p, size[i]);
+                var.hash = hash_bytes(p, size[i], i);
+            }
+            hv = var.hash;
+        }
+        else{
+            hv = hash_bytes(p, size[i], i);
+        }
+        h = (h ^ hv) * 0x100000001b3ULL;
+    }
+    if(incremental){
+        state_snapshot_valid = true;
+    }
+    return h;
+}
+
+void inst::CodeBean::input_opened(FILE* file, const char* path, const char* mode){
+    if(snapshot_pending() || automata_map()){
+        input_files.push_back(InputFile{file, path, mode, 0});
+    }
+}
+
+bool inst::CodeBean::snapshot_pending(){
+    if(snapshot_prefix < 0){
+        char* mode = getenv(SNAPSHOT_ENV.c_str());
+        char* prefix = getenv("PREFIX_LENGTH");
+        snapshot_prefix = mode && prefix && __afl_snapshot ? atol(prefix) : 0;
+    }
+    return snapshot_prefix > 0;
+}
+
+//an input boundary before the fork server is up: the subject consumed the
+//prefix when the last file it opened is read up to its end
+void inst::CodeBean::snapshot_point(){
+    if(input_files.empty()){
+        return;
+    }
+    long consumed = ftell(input_files.back().file);
+    if(consumed < snapshot_prefix){
+        return;
+    }
+    bool boundary = consumed == snapshot_prefix;
+    snapshot_prefix = 0;
+    if(!boundary){
+        __afl_snapshot_missed();
+        return;
+    }
+    //read in the snapshot: the children share the descriptors' offsets
+    for(auto& f : input_files){
+        f.offset = ftell(f.file);
+    }
+    if(__afl_snapshot() != 1){
+        return;
+    }
+    //a child: afl-fuzz wrote the test case, prefix included, to a new file
+    for(auto& f : input_files){
+        if(freopen(f.path.c_str(), f.mode.c_str(), f.file) == NULL || fseek(f.file, f.offset, SEEK_SET) != 0){
+            _exit(1);
+        }
     }
-        
-    return distance_map[std::string(block_id)];
 }
 
 //For RERS
 void inst::CodeBean::collect_trace(int input, int output){
+    if(snapshot_pending()){
+        snapshot_point();
+    }
+    //after the snapshot: the children of the fork server there would
+    //otherwise be charged for the time it waited on afl-fuzz
+    PhaseTimer timer(runtime_stats(), LTL_PHASE_EVENTS);
+    record_event_offset();
+    if(stream_mode != 0 && streaming()){
+        //RERS traces are short, and their lassos are checked over the whole trace
+        std::cout << STREAMING_ENV_VAR << " only applies to protocols, ignored" << std::endl;
+        stream_mode = 0;
+    }
+    if(!load_automata() || live_properties == 0){
+        //the trace left every automaton, later events cannot change the verdicts
+        return;
+    }
+    if(input_events.empty()){
+        load_event_map();
+    }
     trace_common.push_back(input);
     trace_common.push_back(output);
-    std::cout << "input: " << input << "; output: " << output << std::endl;
+    //map output-0 to the event oinvalid
+    int input_event = trace_event(input_events, input, "i");
+    int output_event = trace_event(output_events, output, "o");
+    trace_events.push_back(input_event);
+    trace_events.push_back(output_event);
+    if(verbose()){
+        std::cout << "input: " << input << "; output: " << output << std::endl;
+    }
+
+    step_properties(input_event, 0);
+    step_properties(output_event, 0);
 }
 
-void inst::CodeBean::collect_state(long *ptr, int *size, int num){
+int inst::CodeBean::trace_event(std::map<int, int>& code_events, int code, const std::string& kind){
+    auto it = code_events.find(code);
+    if(it != code_events.end()){
+        return it->second;
+    }
+    //unmapped codes all become the bare kind, as with an empty event name
+    int id = events.intern(kind);
+    code_events[code] = id;
+    return id;
+}
 
-    int total_len = 0;
-	for(int i = 0; i < num; i++){
-		total_len += size[i];
-	}
+void inst::CodeBean::collect_state(long *ptr, int *size, int num){
+    if(preloaded != nullptr){
+        adopt_preloaded();
+    }
+    if(!properties.empty() && live_properties == 0){
+        return;
+    }
+    if(repeated()){
+        return;
+    }
 
-	unsigned char state_value[total_len];
-    int cur_len = 0;
-	for(int i = 0; i < num; i++){
-		if(i == 0){
-			memcpy(state_value, (void*)ptr[i], size[i]);
-		}
-		else{
-			memcpy(state_value + cur_len, (void*)ptr[i], size[i]);
-		}
-        cur_len += size[i];
-	}
+    PhaseTimer timer(runtime_stats(), LTL_PHASE_STATES);
+    size_t hash_value = hash_state(ptr, size, num);
+    if(keep_history()){
+        auto seen = state_last_pos.insert(std::make_pair(hash_value, (int)state_vector.size()));
+        state_prev.push_back(seen.second ? -1 : seen.first->second);
+        seen.first->second = state_vector.size();
+        state_vector.push_back(hash_value);
+        if(tracing() || deferred()){
+            state_events.push_back(trace_events.size());
+        }
+    }
+    if(deferred()){
+        return;
+    }
 
-    size_t hash_value = boost::hash_range(state_value, state_value + total_len);
-    state_vector.push_back(hash_value);
+    //the program came back to a state it already had while an automaton
+    //stayed in the same accepting state: an accepting lasso
+    PhaseTimer acceptance(runtime_stats(), LTL_PHASE_ACCEPTANCE);
+    for(size_t k = 0; k < properties.size(); k++){
+        PropertyRun& run = *properties[k];
+        if(streaming()){
+            stream_lasso(k, run, hash_value);
+        }
+        else if(run.mc_state >= 0 && run.automata.accepting(run.mc_state)){
+            if(!run.lasso_states.insert(hash_value).second){
+                report_counterexample(k, run.mc_path, TRACE_LASSO);
+            }
+        }
+    }
 }
 
 //For protocol
-void inst::CodeBean::collect_proposition(std::string prop){
-    std::cout << "prop: " << prop << std::endl;
-    trace_protocol.push_back(prop);
-    std::pair<std::string, int> node;
-    node = std::make_pair(prop, input_protocol.size());
-    prop_loc_vec.push_back(node);
+void inst::CodeBean::collect_proposition(const char* prop){
+    if(!load_automata() || live_properties == 0){
+        return;
+    }
+    //the pass's propositions are constant strings, so their event ids are
+    //kept by address and each is interned only once
+    auto it = prop_events.find(prop);
+    if(it == prop_events.end()){
+        it = prop_events.emplace(prop, events.intern(prop)).first;
+    }
+    proposition_event(prop, it->second);
 }
 
-void inst::CodeBean::collect_input(std::string input){
-    input_protocol.push_back(input);
+void inst::CodeBean::proposition_event(const char* prop, int event){
+    PhaseTimer timer(runtime_stats(), LTL_PHASE_EVENTS);
+    if(verbose()){
+        std::cout << "prop: " << prop << std::endl;
+    }
+    if(keep_history()){
+        trace_events.push_back(event);
+    }
+
+    step_properties(event, 1);
+    if(streaming()){
+        PhaseTimer acceptance(runtime_stats(), LTL_PHASE_ACCEPTANCE);
+        for(auto& run : properties){
+            stream_event(*run, event);
+        }
+        stream_events++;
+    }
 }
 
-void inst::CodeBean::load_event_reverse_map(){
+
+void inst::CodeBean::collect_input(const char* input){
+    if(preloaded != nullptr){
+        adopt_preloaded();
+    }
+    protocol_inputs++;
+    if(streaming() && input_protocol.size() >= STREAM_INPUTS_MAX){
+        //too long a prefix to replay anyway, the later paths get none
+        return;
+    }
+    input_protocol.push_back(trace_arena.copy(input, strlen(input)));
+}
+
+void inst::CodeBean::load_event_map(){
     char* curDir = getenv("SUBJECT");
     if(curDir == NULL){
         std::cout << "Please specify the SUBJECT direcotry" << std::endl;
         return;
     }
-    std::string str(curDir);
+    if(!read_event_map(curDir, events, input_events, output_events)){
+        throw std::runtime_error("could not open the event_file at evaluate_trace");
+    }
+}
+
+bool inst::CodeBean::read_event_map(const char* subject, lfz::automata::EventDictionary& dict, std::map<int, int>& inputs, std::map<int, int>& outputs){
+    std::string str(subject);
     std::string fileName = str + std::string("event_map_dir/event_mapping.txt");
     std::ifstream fileReader(fileName);
-    if(!fileReader.is_open()) throw std::runtime_error("could not open the event_file at evaluate_trace");
+    if(!fileReader.is_open()) return false;
 
     std::string line;
     while(std::getline(fileReader, line)){  //int to string 
@@ -116,25 +459,217 @@ void inst::CodeBean::load_event_reverse_map(){
         std::string value = result;
         input >> result;
         int key = std::stoi(result);
-        event_reverse_map[key] = value;
+        inputs[key] = dict.intern("i" + value);
+        outputs[key] = dict.intern("o" + value);
     }
     fileReader.close();
+    return true;
+}
+
+bool inst::CodeBean::load_automata(){
+    if(!properties.empty()){
+        return true;
+    }
+    adopt_preloaded();
+    if(properties.empty()){
+        char* curDir = getenv("SUBJECT");
+        if(curDir == NULL){
+            std::cout << "Please specify the SUBJECT direcotry" << std::endl;
+            return false;
+        }
+        read_automata(curDir, properties);
+    }
+    live_properties = properties.size();
+
+    //keep the per-event pushes free of reallocations for typical traces
+    trace_common.reserve(TRACE_RESERVE);
+    trace_events.reserve(TRACE_RESERVE);
+    state_vector.reserve(TRACE_RESERVE);
+    state_prev.reserve(TRACE_RESERVE);
+    input_protocol.reserve(TRACE_RESERVE);
+    for(auto& run : properties){
+        run->mc_states.reserve(TRACE_RESERVE);
+    }
+    return true;
+}
+
+void inst::CodeBean::read_automata(const char* subject, std::vector<std::unique_ptr<PropertyRun>>& runs){
+    //the automata are translated once by ltl-fuzz and only mapped here,
+    //one image per property up to the first missing one
+    std::string str(subject);
+    for(unsigned k = 0; ; k++){
+        std::string image = str + std::string("ltl_dir/") + lfz::automata::automata_image_file(k);
+        if(k > 0 && access(image.c_str(), R_OK) != 0){
+            break;
+        }
+        std::unique_ptr<PropertyRun> run(new PropertyRun());
+        run->automata.load(image);
+        run->mc_state = run->automata.init_state();
+        run->stream_state = run->mc_state;
+        runs.push_back(std::move(run));
+    }
 }
 
-void inst::CodeBean::normalize_trace(){
-    
-    for(long unsigned int i=0; i<trace_common.size(); i++){
-        std::string prefix="";
-        if(i%2==0) 
-            prefix="i";
-        else
-            prefix="o";
+//Moves what preload() read into the runtime statics; the automata stay
+//mapped, so every forked child gets them without touching the files.
+void inst::CodeBean::adopt_preloaded(){
+    config_tried = true;
+    if(preloaded == nullptr){
+        return;
+    }
+    if(!preloaded->properties.empty()){
+        properties = std::move(preloaded->properties);
+        live_properties = properties.size();
+    }
+    if(!preloaded->input_events.empty()){
+        prop_events.clear();
+        events = std::move(preloaded->events);
+        input_events = std::move(preloaded->input_events);
+        output_events = std::move(preloaded->output_events);
+    }
+    trace_common.swap(preloaded->trace_common);
+    trace_events.swap(preloaded->trace_events);
+    state_prev.swap(preloaded->state_prev);
+    state_vector.swap(preloaded->state_vector);
+    input_protocol.swap(preloaded->input_protocol);
+    delete preloaded;
+    preloaded = nullptr;
+}
+
+void inst::CodeBean::step_properties(int event, int flag){
+    PhaseTimer timer(runtime_stats(), LTL_PHASE_MODEL_CHECK);
+    for(size_t k = 0; k < properties.size(); k++){
+        PropertyRun& run = *properties[k];
+        if(run.mc_state != -1){
+            int state = run.mc_state;
+            step_automata(run, event, flag);
+            if(run.mc_state != -1){
+                record_transition(k, state, event, run.mc_state, run.automata.distance_to_acceptance(run.mc_state));
+            }
+        }
+    }
+}
 
-        int key = trace_common[i];
-		//map output-0 to the event oinvalid
-        trace_string.push_back(std::string(prefix+event_reverse_map[key]));
+//afl-fuzz reads what follows its distance slots, see AUTOMATA_MAP_OFFSET in shmdata.h
+bool inst::CodeBean::automata_map(){
+    if(automata_map_mode < 0){
+        automata_map_mode = &__afl_area_ptr != nullptr && getenv(AUTOMATA_MAP_ENV_VAR) != NULL;
     }
+    return automata_map_mode;
+}
 
+//sets the byte of (property, state, event, next) in the automaton transition
+//map of afl-fuzz and lowers the automaton distance of the execution to that
+//of next
+void inst::CodeBean::record_transition(size_t property, int state, int event, int next, int distance){
+    if(!automata_map()){
+        return;
+    }
+    uint32_t h = 2166136261u;
+    for(uint32_t v : {(uint32_t)property, (uint32_t)state, (uint32_t)event, (uint32_t)next}){
+        h = (h ^ v) * 16777619u;
+    }
+    __afl_area_ptr[AUTOMATA_MAP_OFFSET + (h & (AUTOMATA_MAP_SIZE - 1))] = 1;
+    if(distance != lfz::automata::NO_ACCEPTANCE){
+        uint32_t* closest = (uint32_t*)(__afl_area_ptr + AUTOMATA_DISTANCE_OFFSET);
+        if(*closest == 0 || (uint32_t)distance + 1 < *closest){
+            *closest = distance + 1;
+        }
+    }
+}
+
+RUNTIME_STATS* inst::CodeBean::runtime_stats(){
+    return automata_map() ? (RUNTIME_STATS*)(__afl_area_ptr + RUNTIME_STATS_OFFSET) : nullptr;
+}
+
+bool inst::CodeBean::deferred(){
+    return automata_map() && ((DEFERRED_TRACE*)(__afl_area_ptr + DEFERRED_TRACE_OFFSET))->mode;
+}
+
+bool inst::CodeBean::repeated(){
+    return automata_map() && ((DEFERRED_TRACE*)(__afl_area_ptr + DEFERRED_TRACE_OFFSET))->repeat;
+}
+
+//what ltl-trace would get from a counterexample trace, less the automaton
+//states, which afl-fuzz steps again
+void inst::CodeBean::write_deferred_trace(){
+    DEFERRED_TRACE* shm = (DEFERRED_TRACE*)(__afl_area_ptr + DEFERRED_TRACE_OFFSET);
+    shm->status = DEFERRED_OVERFLOW;
+    if(trace_events.size() > DEFERRED_EVENTS_MAX || state_vector.size() > DEFERRED_STATES_MAX){
+        return;
+    }
+    size_t used = 0;
+    for(size_t d = 0; d < events.size(); d++){
+        const std::string& name = events.name(d);
+        if(used + name.size() + 1 > DEFERRED_NAMES_SIZE){
+            return;
+        }
+        memcpy(shm->names + used, name.c_str(), name.size() + 1);
+        used += name.size() + 1;
+    }
+    shm->num_names = events.size();
+    std::copy(trace_events.begin(), trace_events.end(), shm->events);
+    shm->num_events = trace_events.size();
+    std::copy(state_events.begin(), state_events.end(), shm->state_events);
+    std::copy(state_vector.begin(), state_vector.end(), shm->hashes);
+    shm->num_states = state_vector.size();
+    shm->status = DEFERRED_WRITTEN;
+}
+
+//where in the input file the input event collect_trace got ended, so that
+//afl-fuzz can mutate whole events
+void inst::CodeBean::record_event_offset(){
+    if(!automata_map() || input_files.empty()){
+        return;
+    }
+    EVENT_OFFSETS* offsets = (EVENT_OFFSETS*)(__afl_area_ptr + EVENT_OFFSETS_OFFSET);
+    if(offsets->count < EVENT_OFFSETS_MAX){
+        offsets->end[offsets->count] = ftell(input_files.back().file);
+    }
+    offsets->count++;
+}
+
+//flag: 0 for commong programs; 1 for protocols
+void inst::CodeBean::step_automata(PropertyRun& run, int event, int flag){
+    size_t i = run.mc_states.size();
+    if((size_t)event >= run.event_ids.size()){
+        run.automata.bind_events(events, run.event_ids);
+    }
+    int next = run.automata.next_state(run.mc_state, run.event_ids[event]);
+    if(next < 0){
+        if(!flag || keep_history()){
+            run.mc_states.push_back(lfz::automata::MCState(-1, lfz::automata::NO_ACCEPTANCE, false));
+        }
+        run.mc_state = -1;
+        run.lasso_states.clear();
+        live_properties--;
+        return;
+    }
+
+    if(run.mc_path.empty() || next != run.mc_state){
+        if(!flag){
+            for(size_t j = run.mc_path_loc + 1; j < i; j++){
+                if(j%2 == 0 && trace_common[j+1] > 0){
+                    run.mc_prefix = run.mc_prefix + std::to_string(trace_common[j]) + delimiter;
+                }
+            }
+            if(i%2 == 0){
+                run.mc_prefix = run.mc_prefix + std::to_string(trace_common[i]) + delimiter;
+            }
+        }
+        else{
+            run.mc_path_input = protocol_inputs;
+        }
+        run.mc_path_loc = i;
+        run.mc_path.push(next);
+        run.lasso_states.clear();
+    }
+    run.mc_state = next;
+    bool accepting = run.automata.accepting(next);
+    run.seen_accepting = run.seen_accepting || accepting;
+    if(!flag || keep_history()){
+        run.mc_states.push_back(lfz::automata::MCState(next, run.automata.distance_to_acceptance(next), accepting));
+    }
 }
 
 void inst::CodeBean::init_shared_memory(){
@@ -159,212 +694,364 @@ void inst::CodeBean::init_shared_memory(){
     }
 }
 
-void inst::CodeBean::saved_prefix_path(std::string aPath, std::string prefix){
-    char* curDir = getenv("SUBJECT");
-    if(curDir == NULL){
-        std::cout << "Please speficy the SUBJECT direcotry" << std::endl;
-        return;
-    }
-    std::string str(curDir);
-
-    std::string dirName = str + std::string("prefix/");
-    std::string fileName = dirName + aPath;
-    std::ofstream out;
-	out.open(fileName, std::ios::app);
-	if(out.is_open()){
-		if(prefix != ""){
-		    out << prefix << "@@";
+//For protocols: one record in the prefix log, appended without locking
+void inst::CodeBean::saved_prefix_path(const std::string& aPath, const std::string& prefix){
+    if(prefix_log_fd < 0){
+        char* curDir = getenv("SUBJECT");
+        if(curDir == NULL){
+            std::cout << "Please speficy the SUBJECT direcotry" << std::endl;
+            return;
         }
-		out.close();
-	}
-	else{
-		std::cout << "failed to create" << std::endl;
-	}
+        prefix_log_fd = path::prefix_log_open((std::string(curDir) + path::PREFIX_LOG_FILE).c_str());
+        if(prefix_log_fd < 0){
+            std::cout << "failed to open the prefix log" << std::endl;
+            return;
+        }
+    }
+    path::prefix_log_append(prefix_log_fd, aPath, prefix);
 }
 
 //flag: 0 for commong programs; 1 for protocols
 void inst::CodeBean::evaluate_trace(int flag){
-    char* curDir = getenv("SUBJECT");
-    if(curDir == NULL){
-        std::cout << "Please specify the SUBJECT direcotry" << std::endl;
-        return;
+    if(!flag && snapshot_pending()){
+        //the subject ended before the prefix did
+        snapshot_prefix = 0;
+        __afl_snapshot_missed();
     }
-    std::string str(curDir);
-    std::cout << "come to evaluating_trace...." << std::endl;
-    std::string ltl_formula_file = str + std::string("ltl_dir/ltl.txt");
-    std::ifstream ifs(ltl_formula_file);
-    std::string content( 
-            (std::istreambuf_iterator<char>(ifs)),
-            (std::istreambuf_iterator<char>()));
-     
-    std::string formula = content.substr(0, content.find(delimiter_ltl));
-    std::string exclusive_events = content.substr(content.find(delimiter_ltl)+delimiter_ltl.length(), content.length());
-    std::cout << "formula is:  " << formula << std::endl;
-    std::cout << "exclusive events:" << exclusive_events <<std::endl;
-
-    automata.set_formula(formula, exclusive_events);
-    std::vector<lfz::automata::MCState> states;
-    
-    if(flag){
-        automata.model_check_events(trace_protocol, states);
+    if(verbose()){
+        std::cout << "come to evaluating_trace...." << std::endl;
     }
-    else{
-        load_event_reverse_map();
-        normalize_trace();
-        automata.model_check_events(trace_string, states);
+    if(!load_automata() || repeated()){
+        return;
+    }
+    if(!flag && deferred()){
+        write_deferred_trace();
+        return;
     }
 
-    std::string aPath = "";
-    std::string prefix = "";
-    extract_prefix_automata_path(states, aPath, prefix, flag);
-
-    check_acceptance(states, aPath, flag);
+    //the trace has already been model checked event by event
+    //and protocols evaluate at every proposition, so only the part of the
+    //trace added since the previous call is looked at
+    //properties whose automaton path extended, with their new prefix and its metric
+    std::vector<std::pair<size_t, std::pair<std::string, std::string>>> found;
+    for(size_t k = 0; k < properties.size(); k++){
+        PropertyRun& run = *properties[k];
+        run.automata.bind_events(events, run.event_ids);
+        {
+            PhaseTimer acceptance(runtime_stats(), LTL_PHASE_ACCEPTANCE);
+            check_acceptance(k, run, flag);
+        }
+        if(!run.mc_path.empty() && run.mc_path.size() != run.written_path_len){
+            //the automaton path extended: a new prefix to hand to the fuzzer
+            PhaseTimer paths(runtime_stats(), LTL_PHASE_PATHS);
+            std::string prefix = "";
+            bool kept = extract_prefix_automata_path(run, prefix, flag);
+            run.written_path_len = run.mc_path.size();
+            if(kept){
+                found.push_back(std::make_pair(k, std::make_pair(prefix, prefix_metric(run))));
+            }
+        }
+    }
 
     if(getenv(DRY_RUN_ENV.c_str()) ==nullptr || std::string(getenv(DRY_RUN_ENV.c_str()))=="1"){
-        std::cout<< "using DRY RUN model " << std::endl;
+        if(verbose()){
+            std::cout<< "using DRY RUN model " << std::endl;
+        }
         return;
     }
-    if(!aPath.empty()){
+    PhaseTimer paths(runtime_stats(), LTL_PHASE_PATHS);
+    for(auto& f : found){
+        size_t k = f.first;
+        const std::string& prefix = f.second.first;
         if(!flag){
-            PathWriter::write_to_shared_table(aPath, prefix, "1");
+            PathWriter::write_to_shared_table(k, properties[k]->mc_path, prefix, f.second.second);
         }
         else{
-            saved_prefix_path(aPath, prefix);
+            saved_prefix_path(lfz::automata::encode_path_key(k, properties[k]->mc_path), prefix);
         }
     }
 	
 }
 
-int inst::CodeBean::get_last_state(std::string aPath){
-    aPath=aPath.substr(0,aPath.size()-1);
+//Loop boundary of a persistent-mode subject (__AFL_LOOP): the iteration that
+//just ended is evaluated like a run returning from main, then forgotten.
+//Protocol traces are already evaluated at every proposition.
+void inst::CodeBean::end_iteration(int flag){
+    if(!flag && !trace_events.empty()){
+        evaluate_trace(flag);
+    }
+    reset_trace();
+}
 
-    std::size_t found = aPath.find_last_of(delimiter);
-    std::string state = aPath.substr(found+1);
+void inst::CodeBean::reset_trace(){
+    trace_common.clear();
+    trace_events.clear();
+    state_vector.clear();
+    state_prev.clear();
+    state_events.clear();
+    state_last_pos.clear();
+    protocol_inputs = 0;
+    stream_events = 0;
+    input_protocol.clear();
+    trace_arena.reset();
+    state_snapshot_valid = false;
+    for(auto& run : properties){
+        run->mc_states.clear();
+        run->mc_state = run->automata.init_state();
+        run->mc_path_loc = 0;
+        run->mc_path.clear();
+        run->mc_prefix.clear();
+        run->lasso_states.clear();
+        run->seen_accepting = false;
+        run->checked_state = -1;
+        run->checked_states = 0;
+        run->self_loop = nullptr;
+        run->written_path_len = 0;
+        run->mc_path_input = 0;
+        run->stream_windows.clear();
+        run->stream_state = run->mc_state;
+        run->stream_entered = 0;
+    }
+    live_properties = properties.size();
+}
 
-    return std::stoi(state);
+void inst::CodeBean::EventCounts::build(int num_events, const std::vector<std::vector<int>>& cond){
+    columns.assign(num_events, -1);
+    width = 0;
+    for(auto& cube : cond){
+        for(int lit : cube){
+            int evt = (lit > 0 ? lit : -lit) - 1;
+            if(columns[evt] < 0){
+                columns[evt] = width++;
+            }
+        }
+    }
+    rows = 0;
+    counts.assign(width, 0);
 }
 
-void inst::CodeBean::check_conditions(std::vector<std::set<std::string>> events, unsigned int begin_loc, unsigned int end_loc, int flag){
-    
-    for(auto&e : events){             //e: set; events: vector;
-        for(auto&e2 : e){             //e2: event
-            if(e2.front() == '!'){
-                std::string c_evt = e2.substr(1);
-                for(unsigned int i = begin_loc; i <= end_loc; i++){
-                    if(flag){
-                            if(c_evt == trace_protocol[i]){
-                            goto end;
-                            }
-                        }
-                        else{
-                            if(c_evt == trace_string[i]){
-                                goto end;
-                            }
-                        }
+void inst::CodeBean::EventCounts::extend(const std::vector<int>& event_ids){
+    if(width == 0){
+        rows = trace_events.size();
+        return;
+    }
+    counts.resize((trace_events.size() + 1) * width);
+    for(; rows < trace_events.size(); rows++){
+        unsigned* cur = &counts[rows * width];
+        std::copy(cur, cur + width, cur + width);
+        int col = columns[event_ids[trace_events[rows]]];
+        if(col >= 0){
+            cur[width + col]++;
+        }
+    }
+}
 
-                }
+unsigned inst::CodeBean::EventCounts::count(int event, unsigned int begin_loc, unsigned int end_loc) const{
+    int col = columns[event];
+    return counts[(end_loc + 1) * width + col] - counts[begin_loc * width + col];
+}
+
+//report a counterexample if one cube of cond holds on every event of trace_events[begin_loc..end_loc]
+void inst::CodeBean::check_conditions(int property, const lfz::automata::StatePath& aPath, const EventCounts& summary, const std::vector<std::vector<int>>& cond, unsigned int begin_loc, unsigned int end_loc){
+    unsigned len = end_loc - begin_loc + 1;
+    for(auto&e : cond){               //e: cube; cond: vector;
+        bool holds = true;
+        for(int lit : e){             //lit: event id + 1, negative when negated
+            unsigned n = summary.count((lit > 0 ? lit : -lit) - 1, begin_loc, end_loc);
+            if(lit > 0 ? n != len : n != 0){
+                holds = false;
+                break;
             }
-            else{
-                std::string c_evt = e2;
-                for(unsigned int i = begin_loc; i <= end_loc; i++){
-                    if(flag){
-                        if(c_evt != trace_protocol[i]){
-                            goto end;
-                        }
-                    }
-                    else{
-                        if(c_evt != trace_string[i]){
-                            goto end;
-                        }
-                    }
-                }
+        }
+        if(holds){
+            report_counterexample(property, aPath, TRACE_SELF_LOOP);
+        }
+    }
+}
+
+//An accepting state is revisited with the same program state (a lasso) if its
+//self loop holds up to the next position of that program state. Windows only
+//grow with later positions, so the next one is the only one worth checking.
+void inst::CodeBean::check_acceptance(int property, PropertyRun& run, int flag){
+    const lfz::automata::StatePath& aPath = run.mc_path;
+    if(!run.seen_accepting || (trace_events.empty() && !streaming()) || aPath.empty()){
+        return;
+    }
+
+    int last_state = aPath.last();
+    if(verbose()){
+        std::cout << "last state: " << last_state << std::endl;
+    }
+
+    if(last_state != run.checked_state){
+        //the path moved on: check every lasso against the new self-loop
+        const lfz::automata::id_transitions_t &trans = run.automata.state_transition_ids(last_state);
+        run.self_loop = nullptr;
+        for(auto&e : trans){
+            if(e.dst == last_state){
+                run.self_loop = &e.cond;
             }
         }
-        throw std::runtime_error("a counterexample!");
-        end:
+        if(run.self_loop == nullptr || run.self_loop->empty()){
+            report_counterexample(property, aPath, TRACE_NO_SELF_LOOP);
+        }
+        run.checked_state = last_state;
+        run.checked_states = 0;
+        if(streaming()){
+            //the lassos were checked as the program states came, see stream_lasso()
+            return;
+        }
+        run.summary.build(run.automata.other_event_id() + 1, *run.self_loop);
+    }
+    if(streaming()){
+        return;
+    }
+    run.summary.extend(run.event_ids);
+
+    //a program state at i that was already seen at state_prev[i] closes a
+    //lasso; each one is checked once, when its closing state arrives
+    for(size_t i = run.checked_states; i < state_vector.size(); i++){
+        int j = state_prev[i];
+        if(j < 0){
             continue;
+        }
+        unsigned int end_loc = flag ? i : 2*i+1;
+        if(end_loc >= trace_events.size()){
+            end_loc = trace_events.size() - 1;
+        }
+        unsigned int first = flag ? j : 2*j;
+        unsigned int last = flag ? j : 2*j+1;
+        for(unsigned int loc = first; loc <= last && loc < run.mc_states.size() && loc <= end_loc; loc++){
+            if(run.mc_states[loc].acceptance){
+                check_conditions(property, aPath, run.summary, *run.self_loop, loc, end_loc);
+            }
+        }
+    }
+    run.checked_states = state_vector.size();
+}
 
+static bool cube_holds(const std::vector<int>& cube, int evt){
+    for(int lit : cube){
+        if((evt == (lit > 0 ? lit : -lit) - 1) != (lit > 0)){
+            return false;
+        }
     }
+    return true;
 }
 
-void inst::CodeBean::check_acceptance(std::vector<lfz::automata::MCState> states, std::string aPath, int flag){
-    unsigned int loc = 0;
-    for(auto& state : states){
-        if(state.acceptance){
-            int last_state = inst::CodeBean::get_last_state(aPath);
-            std::cout << "last state: " << last_state << std::endl;
-            
-            lfz::automata::transitions_t trans; //std::vector<std::pair<std::vector<std::set<std::string>>, int>>
-            automata.get_state_transitions(last_state, trans);
-            std::vector<std::set<std::string>> events;
-            for(auto&e : trans){
-                if(e.second == last_state){
-                    events = e.first;
-                }
-            }
-            if(events.empty()){
-                throw std::runtime_error("a counterexample!");
-            }
-            
-            unsigned int sloc = 0;
-            if(flag){
-                sloc = loc;
-            }
-            else{
-                sloc = loc/2;
+//streaming(): the cubes of every window that event breaks, and when the
+//automaton state the next program states belong to was entered
+void inst::CodeBean::stream_event(PropertyRun& run, int event){
+    if(run.mc_state < 0){
+        run.stream_windows.clear();
+        return;
+    }
+    int evt = run.event_ids[event];
+    for(auto& w : run.stream_windows){
+        StreamWindow& win = w.second;
+        for(size_t c = 0; c < win.last_fail.size(); c++){
+            if(!cube_holds((*win.self_loop)[c], evt)){
+                win.last_fail[c] = stream_events;
             }
+        }
+    }
+    if(run.mc_state != run.stream_state){
+        run.stream_state = run.mc_state;
+        run.stream_entered = stream_events + 1;
+    }
+}
 
-            size_t pstate = state_vector[sloc];
-            for(unsigned int i = sloc + 1; i < state_vector.size(); i++){
-                if(pstate == state_vector[i]){
-                    if(flag){
-                        check_conditions(events, loc, i, 1);
-                    }
-                    else{
-                        check_conditions(events, loc, 2*i+1, 0);
-                    }
-
-                }
+//streaming(): a program state seen again in an accepting state closes a
+//lasso if the automaton stayed in that state since its first position
+//there, or if one cube of the self loop held on every event since. A first
+//position that can close neither is dead for good: the window forgets it
+//once it grows, so that it only holds the states of the current stay and
+//those since the cubes last held.
+void inst::CodeBean::stream_lasso(int property, PropertyRun& run, size_t hash){
+    if(run.mc_state < 0 || !run.automata.accepting(run.mc_state)){
+        return;
+    }
+    auto it = run.stream_windows.find(run.mc_state);
+    if(it == run.stream_windows.end()){
+        it = run.stream_windows.emplace(run.mc_state, StreamWindow()).first;
+        for(auto& t : run.automata.state_transition_ids(run.mc_state)){
+            if(t.dst == run.mc_state){
+                it->second.self_loop = &t.cond;
             }
         }
-        ++loc;
+        if(it->second.self_loop != nullptr){
+            it->second.last_fail.assign(it->second.self_loop->size(), -1);
+        }
+    }
+    StreamWindow& win = it->second;
+    auto seen = win.first_seen.emplace(hash, stream_events);
+    if(!seen.second){
+        uint64_t first = seen.first->second;
+        bool lasso = first >= run.stream_entered;
+        for(size_t c = 0; c < win.last_fail.size() && !lasso; c++){
+            lasso = win.last_fail[c] < (int64_t)first;
+        }
+        if(lasso){
+            report_counterexample(property, run.mc_path, TRACE_LASSO);
+        }
+        seen.first->second = stream_events;
+        return;
+    }
+    if(win.first_seen.size() < win.prune_at){
+        return;
+    }
+    int64_t dead = stream_events;
+    for(int64_t fail : win.last_fail){
+        dead = std::min(dead, fail);
+    }
+    for(auto e = win.first_seen.begin(); e != win.first_seen.end(); ){
+        if((int64_t)e->second <= dead && e->second < run.stream_entered){
+            e = win.first_seen.erase(e);
+        }
+        else{
+            ++e;
+        }
+    }
+    if(win.first_seen.size() > STREAM_STATES_MAX){
+        //a stay through more states than that: this one is not remembered
+        win.first_seen.erase(hash);
     }
+    win.prune_at = std::max((size_t)64, 2 * win.first_seen.size());
 }
 
-void inst::CodeBean::extract_prefix_automata_path(std::vector<lfz::automata::MCState> states, std::string& aPath, std::string& prefix, int flag){
-    int loc=0;
-    int curState=-2;
-    for(size_t i=0; i<states.size(); i++){
-        if(states[i].state==-1){
-            break;
+//Score of a prefix for the orchestrator, higher is better: how close the
+//automaton state it ends in is to an accepting cycle, i.e. to a violation.
+//0 if no accepting cycle is reachable from that state.
+std::string inst::CodeBean::prefix_metric(const PropertyRun& run){
+    if(run.mc_path.empty()){
+        return "1";
+    }
+    int distance = run.automata.distance_to_acceptance(run.mc_path.last());
+    if(distance < 0){
+        return "0";
+    }
+    char metric[32];
+    snprintf(metric, sizeof(metric), "%g", 1.0 / (1 + distance));
+    return metric;
+}
+
+//false if the inputs of the prefix are no longer kept, see collect_input()
+bool inst::CodeBean::extract_prefix_automata_path(const PropertyRun& run, std::string& prefix, int flag){
+    if(!flag){
+        prefix = run.mc_prefix;
+    }
+    else if(!run.mc_path.empty()){
+        if(run.mc_path_input > input_protocol.size()){
+            return false;
         }
-        if(curState!=states[i].state){
-            curState=states[i].state;
-			if(!flag){
-				for(size_t j = loc + 1; j < i; j++){
-		            if(j%2 == 0 && trace_common[j+1] > 0){
-		                prefix = prefix + std::to_string(trace_common[j]) + delimiter;
-		            }
-            	}
-			}
-            loc=i;
-            aPath= aPath + std::to_string(states[i].state) + delimiter; 
-			if(!flag){
-				if(i%2 == 0){
-		            prefix = prefix + std::to_string(trace_common[i]) + delimiter;
-		        }
-			}
-        }
-    }
-    
-    if(flag && !aPath.empty()){
-        int location = prop_loc_vec[loc].second;
-        for(int j = 0; j < location; j++){
-            prefix = prefix + input_protocol[j] + delimiter_prefix;
+        for(size_t j = 0; j < run.mc_path_input; j++){
+            prefix.append(input_protocol[j].data(), input_protocol[j].size());
+            prefix += delimiter_prefix;
         }
     }
    
-    std::cout << "aPath: " << aPath << "; prefix: " << prefix << std::endl;
-    
+    if(verbose()){
+        std::cout << "aPath: " << run.mc_path.str() << "; prefix: " << prefix << std::endl;
+    }
+    return true;
 }
-
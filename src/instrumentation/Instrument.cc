@@ -1,11 +1,22 @@
 #include <instrument.h>
 #include <codebean.h>
+#include <server_events.h>
 
 //For RERS
 extern "C" void automata_handler(int input, int output){  
     inst::CodeBean::collect_trace(input, output); 
 }
 
+//fopen of the subject, redirected by the pass: snapshot mode reopens its
+//files, and the event offsets for afl-fuzz are read from them
+extern "C" FILE* ltl_fopen(const char* path, const char* mode){
+    FILE* file = fopen(path, mode);
+    if(file != NULL && mode[0] == 'r'){
+        inst::CodeBean::input_opened(file, path, mode);
+    }
+    return file;
+}
+
 //For protocols
 extern "C" void proposition_handler(const char* prop){
     inst::CodeBean::collect_proposition(prop);
@@ -15,6 +26,43 @@ extern "C" void input_handler(const char* input){
     inst::CodeBean::collect_input(input);
 }
 
+//socket calls of the server, redirected by the pass: AFLGo learns when the
+//server waits for a client or a request
+extern "C" int ltl_accept(int fd, struct sockaddr* addr, socklen_t* len){
+    inst::server_events::accepting(fd);
+    int session = accept(fd, addr, len);
+    inst::server_events::accepted(session);
+    return session;
+}
+
+extern "C" int ltl_accept4(int fd, struct sockaddr* addr, socklen_t* len, int flags){
+    inst::server_events::accepting(fd);
+    int session = accept4(fd, addr, len, flags);
+    inst::server_events::accepted(session);
+    return session;
+}
+
+extern "C" ssize_t ltl_recv(int fd, void* buf, size_t len, int flags){
+    inst::server_events::receiving(fd, true);
+    ssize_t n = recv(fd, buf, len, flags);
+    inst::server_events::received(fd, n);
+    return n;
+}
+
+extern "C" ssize_t ltl_recvfrom(int fd, void* buf, size_t len, int flags, struct sockaddr* addr, socklen_t* addr_len){
+    inst::server_events::receiving(fd, true);
+    ssize_t n = recvfrom(fd, buf, len, flags, addr, addr_len);
+    inst::server_events::received(fd, n);
+    return n;
+}
+
+extern "C" ssize_t ltl_read(int fd, void* buf, size_t len){
+    inst::server_events::receiving(fd, false);
+    ssize_t n = read(fd, buf, len);
+    inst::server_events::received(fd, n);
+    return n;
+}
+
 //Common 
 extern "C" void state_handler(long *ptr, int *size, int num){
     inst::CodeBean::collect_state(ptr, size, num); 
@@ -24,6 +72,15 @@ extern "C" void evaluate_trace(int flag){
     inst::CodeBean::evaluate_trace(flag); 
 }
 
+//For persistent mode
+extern "C" void ltl_iteration(int flag){
+    inst::CodeBean::end_iteration(flag);
+}
+
+extern "C" void ltl_reset_trace(){
+    inst::CodeBean::reset_trace();
+}
+
 extern "C" long begin_time(){
     struct timeval star;
     gettimeofday(&star, NULL);
@@ -40,12 +97,9 @@ extern "C" void end_time(long btime){
 }
 
 
-extern "C" int32_t get_distance_to_target(char* block_id){
-    return inst::CodeBean::get_distance_to_target(block_id);
-}
-
-extern "C" void init_distance_map(){
-    inst::CodeBean::init_distance_map();
+//called by afl-llvm-rt before the fork server starts
+extern "C" void __ltl_preload(){
+    inst::CodeBean::preload();
 }
 
 extern "C" void init_shared_memory(){
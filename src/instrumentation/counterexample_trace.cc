@@ -0,0 +1,299 @@
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <unordered_map>
+#include <unordered_set>
+#include <counterexample_trace.h>
+
+namespace inst {
+
+static void put_varint(std::string &out, uint32_t v)
+{
+    while (v >= 0x80) {
+        out.push_back((char)(v | 0x80));
+        v >>= 7;
+    }
+    out.push_back((char)v);
+}
+
+static bool get_varint(const std::string &in, size_t &pos, uint32_t &v)
+{
+    v = 0;
+    for (int shift = 0; shift < 35 && pos < in.size(); shift += 7) {
+        unsigned char c = in[pos++];
+        v |= (uint32_t)(c & 0x7f) << shift;
+        if (!(c & 0x80)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static uint32_t zigzag(int v)
+{
+    return ((uint32_t)v << 1) ^ (uint32_t)(v >> 31);
+}
+
+static int unzigzag(uint32_t v)
+{
+    return (int)(v >> 1) ^ -(int)(v & 1);
+}
+
+void CounterexampleTrace::encode(std::string &out) const
+{
+    std::string names_data;
+    for (const std::string &name : names) {
+        names_data.append(name.c_str(), name.size() + 1);
+    }
+    //program states repeat, the lassos are made of them
+    std::vector<uint64_t> hashes;
+    std::vector<uint32_t> state_index;
+    std::unordered_map<uint64_t, uint32_t> index;
+    state_index.reserve(state_hashes.size());
+    for (uint64_t h : state_hashes) {
+        auto it = index.emplace(h, (uint32_t)hashes.size()).first;
+        if (it->second == hashes.size()) {
+            hashes.push_back(h);
+        }
+        state_index.push_back(it->second);
+    }
+
+    CounterexampleTraceHeader header = {};
+    header.magic = COUNTEREXAMPLE_TRACE_MAGIC;
+    header.version = COUNTEREXAMPLE_TRACE_VERSION;
+    header.property = property;
+    header.violation = violation;
+    header.protocol = protocol;
+    header.num_names = names.size();
+    header.names_size = names_data.size();
+    header.num_events = events.size();
+    header.num_states = state_hashes.size();
+    header.num_hashes = hashes.size();
+    header.num_mc_states = mc_states.size();
+
+    out.clear();
+    out.reserve(sizeof(header) + names_data.size() + events.size() + 2 * state_hashes.size() +
+                8 * hashes.size() + mc_states.size());
+    out.append((const char *)&header, sizeof(header));
+    out.append(names_data);
+    for (int e : events) {
+        put_varint(out, e);
+    }
+    int prev = 0;
+    for (int pos : state_events) {
+        put_varint(out, pos - prev);
+        prev = pos;
+    }
+    out.append((const char *)hashes.data(), hashes.size() * sizeof(uint64_t));
+    for (uint32_t i : state_index) {
+        put_varint(out, i);
+    }
+    for (int s : mc_states) {
+        put_varint(out, zigzag(s));
+    }
+}
+
+bool CounterexampleTrace::decode(const std::string &data)
+{
+    CounterexampleTraceHeader header;
+    if (data.size() < sizeof(header)) {
+        return false;
+    }
+    memcpy(&header, data.data(), sizeof(header));
+    if (header.magic != COUNTEREXAMPLE_TRACE_MAGIC || header.version != COUNTEREXAMPLE_TRACE_VERSION) {
+        return false;
+    }
+    size_t pos = sizeof(header);
+    if (data.size() - pos < header.names_size) {
+        return false;
+    }
+    property = header.property;
+    violation = header.violation;
+    protocol = header.protocol != 0;
+
+    names.clear();
+    size_t names_end = pos + header.names_size;
+    while (pos < names_end) {
+        const char *name = data.data() + pos;
+        size_t len = strnlen(name, names_end - pos);
+        if (pos + len == names_end) {
+            return false;
+        }
+        names.emplace_back(name, len);
+        pos += len + 1;
+    }
+    if (names.size() != header.num_names) {
+        return false;
+    }
+
+    uint32_t v;
+    events.clear();
+    for (uint32_t i = 0; i < header.num_events; i++) {
+        if (!get_varint(data, pos, v) || v >= header.num_names) {
+            return false;
+        }
+        events.push_back(v);
+    }
+    state_events.clear();
+    int state_pos = 0;
+    for (uint32_t i = 0; i < header.num_states; i++) {
+        if (!get_varint(data, pos, v) || (state_pos += v) > (int)header.num_events) {
+            return false;
+        }
+        state_events.push_back(state_pos);
+    }
+    if ((data.size() - pos) / sizeof(uint64_t) < header.num_hashes) {
+        return false;
+    }
+    std::vector<uint64_t> hashes(header.num_hashes);
+    memcpy(hashes.data(), data.data() + pos, hashes.size() * sizeof(uint64_t));
+    pos += hashes.size() * sizeof(uint64_t);
+    state_hashes.clear();
+    for (uint32_t i = 0; i < header.num_states; i++) {
+        if (!get_varint(data, pos, v) || v >= hashes.size()) {
+            return false;
+        }
+        state_hashes.push_back(hashes[v]);
+    }
+    mc_states.clear();
+    for (uint32_t i = 0; i < header.num_mc_states; i++) {
+        if (!get_varint(data, pos, v)) {
+            return false;
+        }
+        mc_states.push_back(unzigzag(v));
+    }
+    return pos == data.size();
+}
+
+bool write_counterexample_trace(const char *file, const CounterexampleTrace &trace)
+{
+    std::string data;
+    trace.encode(data);
+    int fd = open(file, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        return false;
+    }
+    bool written = write(fd, data.data(), data.size()) == (ssize_t)data.size();
+    close(fd);
+    return written;
+}
+
+bool read_counterexample_trace(const std::string &file, CounterexampleTrace &trace)
+{
+    std::ifstream in(file, std::ios::binary);
+    if (!in.is_open()) {
+        return false;
+    }
+    std::stringstream content;
+    content << in.rdbuf();
+    return trace.decode(content.str());
+}
+
+// one cube of cond holds on every event of events[begin..end]
+static bool cond_holds(const std::vector<std::vector<int>> &cond, const std::vector<int> &events,
+                       const std::vector<int> &ids, size_t begin, size_t end)
+{
+    for (auto &cube : cond) {
+        bool holds = true;
+        for (size_t loc = begin; loc <= end && holds; loc++) {
+            int evt = ids[events[loc]];
+            for (int lit : cube) {
+                if ((evt == (lit > 0 ? lit : -lit) - 1) != (lit > 0)) {
+                    holds = false;
+                    break;
+                }
+            }
+        }
+        if (holds) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Steps the automaton as CodeBean::step_automata() does, checks the lassos at
+// every program state as collect_state() does, then the end of the trace as
+// check_acceptance() does
+void replay_counterexample_trace(const lfz::automata::CompiledAutomata &automata, const CounterexampleTrace &trace,
+                                 const std::vector<int> &ids, TraceReplay &r)
+{
+    int mc_state = automata.init_state();
+    bool seen_accepting = false;
+    std::unordered_set<uint64_t> lasso_states;
+    std::unordered_map<uint64_t, int> last_pos;
+    std::vector<int> state_prev;
+    size_t s = 0;
+    for (size_t e = 0; e <= trace.events.size(); e++) {
+        for (; s < trace.state_events.size() && (size_t)trace.state_events[s] == e; s++) {
+            uint64_t h = trace.state_hashes[s];
+            auto seen = last_pos.insert(std::make_pair(h, (int)s));
+            state_prev.push_back(seen.second ? -1 : seen.first->second);
+            seen.first->second = s;
+            if (mc_state >= 0 && automata.accepting(mc_state) && !lasso_states.insert(h).second) {
+                r.violation = TRACE_LASSO;
+                return;
+            }
+        }
+        if (e == trace.events.size() || mc_state == -1) {
+            continue;
+        }
+        int next = automata.next_state(mc_state, ids[trace.events[e]]);
+        if (next < 0) {
+            mc_state = -1;
+            lasso_states.clear();
+        } else {
+            if (r.mc_states.empty() || next != mc_state) {
+                r.path.push(next);
+                lasso_states.clear();
+            }
+            mc_state = next;
+            seen_accepting = seen_accepting || automata.accepting(next);
+        }
+        if (r.mismatch < 0 && (r.mc_states.size() >= trace.mc_states.size() || trace.mc_states[r.mc_states.size()] != mc_state)) {
+            r.mismatch = r.mc_states.size();
+        }
+        r.mc_states.push_back(mc_state);
+        r.accepting.push_back(mc_state >= 0 && automata.accepting(mc_state));
+    }
+    if (r.mismatch < 0 && r.mc_states.size() != trace.mc_states.size()) {
+        r.mismatch = std::min(r.mc_states.size(), trace.mc_states.size());
+    }
+
+    if (!seen_accepting || trace.events.empty() || r.path.empty()) {
+        return;
+    }
+    const std::vector<std::vector<int>> *self_loop = nullptr;
+    for (auto &t : automata.state_transition_ids(r.path.last())) {
+        if (t.dst == r.path.last()) {
+            self_loop = &t.cond;
+        }
+    }
+    if (self_loop == nullptr || self_loop->empty()) {
+        r.violation = TRACE_NO_SELF_LOOP;
+        return;
+    }
+    for (size_t i = 0; i < state_prev.size(); i++) {
+        int j = state_prev[i];
+        if (j < 0) {
+            continue;
+        }
+        size_t end_loc = trace.protocol ? i : 2 * i + 1;
+        if (end_loc >= trace.events.size()) {
+            end_loc = trace.events.size() - 1;
+        }
+        size_t first = trace.protocol ? j : 2 * j;
+        size_t last = trace.protocol ? j : 2 * j + 1;
+        for (size_t loc = first; loc <= last && loc < r.mc_states.size() && loc <= end_loc; loc++) {
+            if (r.accepting[loc] && cond_holds(*self_loop, trace.events, ids, loc, end_loc)) {
+                r.violation = TRACE_SELF_LOOP;
+                return;
+            }
+        }
+    }
+}
+
+} // namespace inst
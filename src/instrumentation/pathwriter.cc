@@ -10,41 +10,56 @@ using namespace boost::interprocess;
 inst::PathWriter::PathWriter(){}
 inst::PathWriter::~PathWriter(){}
 
-managed_shared_memory segment_w(open_only, shmId.c_str());
-void_allocator alloc_inst_w(segment_w.get_segment_manager());
+//attached on the first write: most executions never write anything, and
+//the segment may not exist at all outside a campaign
+static managed_shared_memory* segment_w = nullptr;
+static void_allocator* alloc_inst_w = nullptr;
+static table_shard* shards_w = nullptr;
+static bool attach_tried = false;
 
-void inst::PathWriter::write_to_shared_table(std::string automata_path, std::string prefix, std::string metric){
-    
-    //get the shared table
-    string_string_string_map *table = segment_w.find<string_string_string_map>(tableName.c_str()).first;
+//paths+prefixes this process already wrote, by hash
+std::unordered_set<uint64_t> inst::PathWriter::written;
 
-    //create char_string
-    char_string path_automata_s(automata_path.c_str(), alloc_inst_w);
-    char_string prefix_s(prefix.c_str(), alloc_inst_w);
-    char_string metric_s(metric.c_str(), alloc_inst_w);
-    
-        
-    if(table==nullptr)
-        std::cout<<"failed to find the shared table" << std::endl;
-
-    //insert into the map
-    string_string_string_map::iterator sss_ite = table->find(path_automata_s);
-    
-    if(sss_ite == table->end()){
-
-        string_string_value_type  ss_map_value(prefix_s, metric_s);
-        string_string_map *col_map = segment_w.construct<string_string_map>
-        ((automata_path+prefix).c_str())(std::less<char_string>(), alloc_inst_w);
-        col_map->insert(ss_map_value);
-
-        string_string_string_value_type sss_map_value(path_automata_s, *col_map);
-        table->insert(sss_map_value);
+bool inst::PathWriter::attach(){
+    if(attach_tried){
+        return shards_w != nullptr;
     }
-    else{
-        sss_ite->second.insert(string_string_value_type(prefix_s, metric_s));
+    attach_tried = true;
+    try{
+        segment_w = new managed_shared_memory(open_only, shmId.c_str());
+    }catch(const interprocess_exception&){
+        std::cout << "failed to open the shared table" << std::endl;
+        return false;
     }
+    alloc_inst_w = new void_allocator(segment_w->get_segment_manager());
+    std::pair<table_shard*, size_t> found = segment_w->find<table_shard>(tableName.c_str());
+    if(found.first == nullptr || found.second != tableShards){
+        std::cout << "failed to find the shared table" << std::endl;
+        return false;
+    }
+    shards_w = found.first;
+    return true;
 }
 
+uint64_t inst::PathWriter::entry_hash(uint64_t path_hash, const std::string& prefix){
+    //FNV-1a over the prefix, seeded with the hash of the path
+    uint64_t h = 14695981039346656037ULL ^ path_hash;
+    for(unsigned char c : prefix){
+        h = (h ^ c) * 1099511628211ULL;
+    }
+    return h;
+}
 
-
-
+void inst::PathWriter::write_to_shared_table(int property, const lfz::automata::StatePath& automata_path, const std::string& prefix, const std::string& metric){
+    uint64_t hash = table_hash(property, automata_path);
+    //fast path: nothing to do for an entry this process already wrote
+    if(!written.insert(entry_hash(hash, prefix)).second){
+        return;
+    }
+    if(!attach()){
+        return;
+    }
+    table_shard& shard = table_shard_of(shards_w, hash);
+    shard_lock lock(shard);
+    table_insert(shard, *alloc_inst_w, hash, lfz::automata::encode_path_key(property, automata_path), prefix, metric);
+}
@@ -0,0 +1,80 @@
+#include <server_events.h>
+#include <shmdata.h>
+#include <errno.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+namespace {
+
+const int maxSessionFds = 1024;
+
+int event_fd = -2;                                  //-2 until read from the environment
+unsigned char session_fds[maxSessionFds / 8];
+uint64_t received_bytes = 0;
+
+bool is_session(int fd)
+{
+    return fd >= 0 && fd < maxSessionFds && (session_fds[fd / 8] & (1u << (fd % 8)));
+}
+
+void mark_session(int fd)
+{
+    if (fd >= 0 && fd < maxSessionFds) {
+        session_fds[fd / 8] |= 1u << (fd % 8);
+    }
+}
+
+void notify(uint32_t kind)
+{
+    if (event_fd == -2) {
+        const char *env = getenv(SERVER_EVENT_ENV_VAR);
+        event_fd = env ? atoi(env) : -1;
+    }
+    if (event_fd < 0) {
+        return;
+    }
+    SERVER_EVENT e = {(uint32_t)getpid(), kind, received_bytes};
+    if (write(event_fd, &e, sizeof(e)) != sizeof(e)) {
+        //a full pipe drops the event, afl-fuzz falls back to the timeout for
+        //it; anything else means afl-fuzz went away
+        if (errno != EAGAIN && errno != EWOULDBLOCK) {
+            event_fd = -1;
+        }
+    }
+}
+
+} // namespace
+
+void inst::server_events::accepting(int fd)
+{
+    (void)fd;
+    notify(SERVER_READY);
+}
+
+void inst::server_events::accepted(int fd)
+{
+    mark_session(fd);
+}
+
+void inst::server_events::receiving(int fd, bool datagram)
+{
+    if (datagram) {
+        mark_session(fd);
+    }
+    else if (!is_session(fd)) {
+        return;
+    }
+    //only a read that is going to block means the server is done
+    struct pollfd pfd = {fd, POLLIN, 0};
+    if (poll(&pfd, 1, 0) == 0) {
+        notify(SERVER_IDLE);
+    }
+}
+
+void inst::server_events::received(int fd, ssize_t n)
+{
+    if (n > 0 && is_session(fd)) {
+        received_bytes += n;
+    }
+}
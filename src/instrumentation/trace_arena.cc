@@ -0,0 +1,70 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include <new>
+#include <trace_arena.h>
+
+namespace inst {
+
+TraceArena::~TraceArena()
+{
+    while (head_ != nullptr) {
+        Chunk *next = head_->next;
+        free(head_);
+        head_ = next;
+    }
+}
+
+void TraceArena::reserve(size_t size)
+{
+    if (head_ == nullptr) {
+        allocate(size);
+        reset();
+    }
+}
+
+std::string_view TraceArena::copy(const char *data, size_t size)
+{
+    char *p = allocate(size);
+    memcpy(p, data, size);
+    return std::string_view(p, size);
+}
+
+void TraceArena::reset()
+{
+    current_ = head_;
+    used_ = 0;
+}
+
+char *TraceArena::allocate(size_t size)
+{
+    /* Move on through the kept chunks to one with room, else append one */
+    while (current_ != nullptr && current_->size - used_ < size) {
+        if (current_->next == nullptr) {
+            break;
+        }
+        current_ = current_->next;
+        used_ = 0;
+    }
+    if (current_ == nullptr || current_->size - used_ < size) {
+        size_t chunk_size = size > CHUNK_SIZE ? size : CHUNK_SIZE;
+        Chunk *chunk = (Chunk *)malloc(sizeof(Chunk) + chunk_size);
+        if (chunk == nullptr) {
+            throw std::bad_alloc();
+        }
+        chunk->next = nullptr;
+        chunk->size = chunk_size;
+        if (current_ == nullptr) {
+            head_ = chunk;
+        } else {
+            current_->next = chunk;
+        }
+        current_ = chunk;
+        used_ = 0;
+    }
+    char *p = current_->data() + used_;
+    used_ += size;
+    return p;
+}
+
+} // namespace inst
@@ -11,27 +11,82 @@ int main(int argc, char* argv[]){
         std::cout << "Please specify the type of fuzzed programs: " << std::endl;
         std::cout << "\t1 is for network protocols" << std::endl;
         std::cout << "\t0 is for regular subjects" << std::endl;
+        std::cout << "\tdump prints the shared table of a running campaign" << std::endl;
+        std::cout << "\treplay <0|1> [dir...] first seeds the table with earlier inputs and traces" << std::endl;
+        std::cout << "\tbench <0|1> <seconds> [seed] runs a fresh campaign with fixed seeds and records its results" << std::endl;
         return 0;
     } 
 
-    int flag = std::stoi(argv[1]);
+    if(std::string(argv[1]) == "dump"){
+        try{
+            managed_shared_memory segment(open_only, shmId.c_str());
+            path::PathsStore path_store(&segment);
+            path_store.dump();
+        }catch(const interprocess_exception& e){
+            std::cout << "no shared table to dump: " << e.what() << std::endl;
+            return 1;
+        }
+        return 0;
+    }
+
+    //replay: the inputs and traces of earlier campaigns seed the table first
+    bool replay = std::string(argv[1]) == "replay";
+    if(replay && argc < 3){
+        std::cout << "usage: ltl-fuzz replay <0|1> [dir...]" << std::endl;
+        return 0;
+    }
+    //bench: a reproducible campaign of fixed budget, see benchmark.h
+    bool bench = std::string(argv[1]) == "bench";
+    if(bench && argc < 4){
+        std::cout << "usage: ltl-fuzz bench <0|1> <seconds> [seed]" << std::endl;
+        return 0;
+    }
+    int bench_secs = bench ? std::stoi(argv[3]) : 0;
+    if(bench){
+        if(argc > 4 || getenv(ltlfuzz::seedEnv) == NULL){
+            setenv(ltlfuzz::seedEnv, argc > 4 ? argv[4] : "1", 1);
+        }
+        unsetenv(ltlfuzz::resumeEnv);
+        unsetenv(ltlfuzz::clusterEnv);
+    }
+    std::vector<std::string> replay_dirs;
+    if(replay){
+        replay_dirs.assign(argv + 3, argv + argc);
+    }
+    int flag = std::stoi(argv[replay || bench ? 2 : 1]);
     if(flag){
         //1 for protocols
         shared_memory_object::remove(shmId.c_str());
-        managed_shared_memory segment(open_or_create, shmId.c_str(), size);
+        managed_shared_memory segment(open_or_create, shmId.c_str(), utils::env_option(tableSizeEnv, size >> 20) << 20);
         path::PathsStore path_store(&segment);
         ltlfuzz::LTLFuzzer fuzzer(&path_store);
         fuzzer.init(1);
-        fuzzer.fuzz(1); 
+        if(replay){
+            fuzzer.replay(1, replay_dirs);
+        }
+        if(bench){
+            fuzzer.benchmark(1, bench_secs);
+        }
+        else{
+            fuzzer.fuzz(1);
+        }
     }
     else{
         //0 for common programs
         shared_memory_object::remove(shmId.c_str());
-        managed_shared_memory segment(open_or_create, shmId.c_str(), size);
+        managed_shared_memory segment(open_or_create, shmId.c_str(), utils::env_option(tableSizeEnv, size >> 20) << 20);
         path::PathsStore path_store(&segment);
         ltlfuzz::LTLFuzzer fuzzer(&path_store);
         fuzzer.init(0);
-        fuzzer.fuzz(0); 
+        if(replay){
+            fuzzer.replay(0, replay_dirs);
+        }
+        if(bench){
+            fuzzer.benchmark(0, bench_secs);
+        }
+        else{
+            fuzzer.fuzz(0);
+        }
     }
 
     return 0;
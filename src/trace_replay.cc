@@ -0,0 +1,113 @@
+#include <compiled_automata.h>
+#include <counterexample_trace.h>
+#include <event_dictionary.h>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * ltl-trace: decodes the counterexample traces the runtime writes (see
+ * counterexample_trace.h) and checks each one again against the automaton
+ * image of its property, the way the runtime did while the subject ran,
+ * so that thousands of counterexamples can be triaged without executing
+ * anything. One line per trace; -v also lists the events.
+ */
+
+using lfz::automata::CompiledAutomata;
+
+static const char* violation_name(uint32_t violation){
+    switch(violation){
+        case inst::TRACE_LASSO: return "lasso";
+        case inst::TRACE_NO_SELF_LOOP: return "no self loop";
+        case inst::TRACE_SELF_LOOP: return "self loop";
+    }
+    return "unknown";
+}
+
+int main(int argc, char* argv[]){
+    bool verbose = false;
+    std::string ltl_dir = getenv("SUBJECT") ? std::string(getenv("SUBJECT")) + "ltl_dir/" : "";
+    int arg = 1;
+    for(; arg < argc && argv[arg][0] == '-'; arg++){
+        if(!strcmp(argv[arg], "-v")){
+            verbose = true;
+        }
+        else if(!strcmp(argv[arg], "-a") && arg + 1 < argc){
+            ltl_dir = std::string(argv[++arg]) + "/";
+        }
+    }
+    if(arg == argc || ltl_dir.empty()){
+        std::cout << "usage: ltl-trace [-v] [-a <ltl_dir>] <trace>..." << std::endl;
+        std::cout << "  the automata are read from <ltl_dir>, $SUBJECT/ltl_dir by default" << std::endl;
+        return 0;
+    }
+
+    std::map<int, std::unique_ptr<CompiledAutomata>> automata;
+    int unconfirmed = 0;
+    for(; arg < argc; arg++){
+        std::string file = argv[arg];
+        inst::CounterexampleTrace trace;
+        if(!read_counterexample_trace(file, trace)){
+            std::cout << file << ": not a counterexample trace" << std::endl;
+            unconfirmed++;
+            continue;
+        }
+        auto& atm = automata[trace.property];
+        if(!atm){
+            atm.reset(new CompiledAutomata());
+            try{
+                atm->load(ltl_dir + lfz::automata::automata_image_file(trace.property));
+            }catch(lfz::automata::AutomataException& e){
+                std::cout << "cannot load the automaton of property " << trace.property << ": " << e.what() << std::endl;
+            }
+        }
+        if(!atm->valid()){
+            std::cout << file << ": property " << trace.property << " has no automaton" << std::endl;
+            unconfirmed++;
+            continue;
+        }
+
+        lfz::automata::EventDictionary dict;
+        for(auto& name : trace.names){
+            dict.intern(name);
+        }
+        std::vector<int> ids;
+        atm->bind_events(dict, ids);
+        inst::TraceReplay r;
+        inst::replay_counterexample_trace(*atm, trace, ids, r);
+        bool confirmed = r.violation >= 0 && r.mismatch < 0;
+        unconfirmed += !confirmed;
+        std::cout << file << ": property " << trace.property << ", " << trace.events.size() << " events, "
+                  << trace.state_hashes.size() << " states, recorded " << violation_name(trace.violation) << ", ";
+        if(r.violation >= 0){
+            std::cout << "replayed " << violation_name(r.violation);
+        }
+        else{
+            std::cout << "not reproduced";
+        }
+        if(r.mismatch >= 0){
+            std::cout << ", automaton differs at event " << r.mismatch;
+        }
+        std::cout << ", path " << r.path.str() << std::endl;
+
+        if(verbose){
+            size_t s = 0;
+            for(size_t e = 0; e < trace.events.size(); e++){
+                for(; s < trace.state_events.size() && (size_t)trace.state_events[s] == e; s++){
+                    std::cout << "    state " << std::hex << trace.state_hashes[s] << std::dec << std::endl;
+                }
+                std::cout << "  " << e << " " << trace.names[trace.events[e]];
+                if(e < r.mc_states.size()){
+                    std::cout << " -> " << r.mc_states[e] << (r.accepting[e] ? " (accepting)" : "");
+                }
+                std::cout << std::endl;
+            }
+            for(; s < trace.state_events.size(); s++){
+                std::cout << "    state " << std::hex << trace.state_hashes[s] << std::dec << std::endl;
+            }
+        }
+    }
+    return unconfirmed ? 1 : 0;
+}
@@ -1,9 +1,18 @@
 #include <utils.h>
+#include <algorithm>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <ftw.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
 using std::cout;
 using std::endl;
 
 namespace utils{
     std::string aDelimiter =",";
+    std::string ltlDelimiter =";";
     std::string get_last_state(std::string aPath)
     {
         if(aPath.empty()){
@@ -19,6 +28,26 @@ namespace utils{
         return std::stoi(s);
     }
 
+    size_t env_option(const char* env, size_t default_value){
+        char* value = getenv(env);
+        if(value == NULL || atol(value) <= 0){
+            return default_value;
+        }
+        return atol(value);
+    }
+
+    long int read_afl_stat(const std::string& file, const std::string& key){
+        std::ifstream ifs(file);
+        std::string line;
+        while(getline(ifs, line)){
+            size_t colon = line.find(':');
+            if(colon != std::string::npos && boost::trim_copy(line.substr(0, colon)) == key){
+                return atol(line.c_str() + colon + 1);
+            }
+        }
+        return 0;
+    }
+
     std::string get_current_time() {
         time_t     now = time(0);
         struct tm  tstruct;
@@ -36,10 +65,132 @@ namespace utils{
         return result.substr(0, result.size()-1);
     }
 
+    std::vector<std::string> split_formulas(std::string s){
+        std::vector<std::string> tokens;
+        std::vector<std::string> results;
+        boost::split(tokens, s, boost::is_any_of(ltlDelimiter));
+        for(auto& e : tokens){
+            boost::trim(e);
+            if(!e.empty()){
+                results.push_back(e);
+            }
+        }
+        return results;
+    }
+
     void gen_ltl_files(std::string script, std::string build_dir, std::string formula){
-        std::string cmd=script + " " + build_dir + " '" + formula +"'";
-        std::cout <<"script: " <<cmd << std::endl;
-        system(cmd.c_str());
+        std::cout <<"script: " << script << " " << build_dir << " '" << formula << "'" << std::endl;
+        run_process({script, build_dir, formula});
+    }
+
+    int run_process(const std::vector<std::string>& argv, const std::string& workdir,
+                    std::string* output, bool quiet){
+        if(argv.empty()){
+            return -1;
+        }
+        int out[2] = {-1, -1};
+        if(output != NULL && pipe(out) != 0){
+            return -1;
+        }
+        pid_t pid = fork();
+        if(pid < 0){
+            if(output != NULL){
+                close(out[0]);
+                close(out[1]);
+            }
+            return -1;
+        }
+        if(pid == 0){
+            if(!workdir.empty() && chdir(workdir.c_str()) != 0){
+                _exit(127);
+            }
+            int fd = output != NULL ? out[1] : (quiet ? open("/dev/null", O_WRONLY) : -1);
+            if(fd >= 0){
+                dup2(fd, 1);
+                dup2(fd, 2);
+                close(fd);
+            }
+            if(output != NULL){
+                close(out[0]);
+            }
+            std::vector<char*> args;
+            for(auto& a : argv){
+                args.push_back(const_cast<char*>(a.c_str()));
+            }
+            args.push_back(NULL);
+            execvp(args[0], args.data());
+            _exit(127);
+        }
+        if(output != NULL){
+            close(out[1]);
+            char buf[4096];
+            ssize_t n;
+            while((n = read(out[0], buf, sizeof(buf))) > 0 || (n < 0 && errno == EINTR)){
+                if(n > 0){
+                    output->append(buf, n);
+                }
+            }
+            close(out[0]);
+        }
+        int status;
+        while(waitpid(pid, &status, 0) < 0){
+            if(errno != EINTR){
+                return -1;
+            }
+        }
+        return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+    }
+
+    static int remove_entry(const char* path, const struct stat*, int, struct FTW*){
+        remove(path);
+        return 0;
+    }
+
+    void remove_all(const std::string& path){
+        nftw(path.c_str(), remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+    }
+
+    bool make_dirs(const std::string& path){
+        for(size_t i = 1; i <= path.size(); i++){
+            if(i == path.size() || path[i] == '/'){
+                std::string dir = path.substr(0, i);
+                if(mkdir(dir.c_str(), 0755) != 0 && errno != EEXIST){
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+
+    std::vector<std::string> list_files(const std::string& dir){
+        std::vector<std::string> files;
+        DIR* d = opendir(dir.c_str());
+        if(d == NULL){
+            return files;
+        }
+        while(struct dirent* e = readdir(d)){
+            std::string file = dir + "/" + e->d_name;
+            struct stat st;
+            if(e->d_name[0] != '.' && stat(file.c_str(), &st) == 0 && S_ISREG(st.st_mode)){
+                files.push_back(file);
+            }
+        }
+        closedir(d);
+        std::sort(files.begin(), files.end());
+        return files;
+    }
+
+    bool move_file(const std::string& from, const std::string& to){
+        if(rename(from.c_str(), to.c_str()) == 0){
+            return true;
+        }
+        if(errno != EXDEV){
+            return false;
+        }
+        std::ifstream ifs(from, std::ios::binary);
+        std::ofstream ofs(to, std::ios::binary);
+        ofs << ifs.rdbuf();
+        return ofs.good() && unlink(from.c_str()) == 0;
     }
 
     void string_to_input_type(std::string p, std::vector<INPUT_TYPE>& results){
@@ -108,66 +259,42 @@ namespace utils{
         ofs.close();
     }
 
-    //For RERS
-    void write_to_shmem_common(INPUT_TYPE arr[], uint32_t arr_size){
-        int shmid = get_prefix_smem();
-        if(shmid == -1){
+    //For RERS: the inputs are a single message of the channel
+    void write_to_shmem_common(PREFIX_SMEM* shm, const INPUT_TYPE arr[], uint32_t arr_size){
+        if(shm == (PREFIX_SMEM*)-1){
             return;
         }
-        else{
-            PREFIX_SMEM* shm = bind_prefix_smem(shmid);
-            if(shm == (PREFIX_SMEM*)-1){
-                return;
-            }
-            else{
-                memcpy(shm->array[0], arr, arr_size*sizeof(INPUT_TYPE));
-                shm->arr_size = arr_size;
-                printf("write to shared memory: %d\n", (shm->arr_size));
-                detach_prefix_shmem(shm);
-                return;
-            }
+        prefix_publish_begin(shm);
+        if(arr_size == 0){
+            prefix_reset(shm, 0);
         }
+        else if(prefix_reset(shm, 1) == -1 || prefix_append(shm, 0, arr, arr_size*sizeof(INPUT_TYPE)) == -1){
+            prefix_reset(shm, 0);
+            prefix_publish_end(shm);
+            throw std::runtime_error("Total length at shared memory overflow");
+        }
+        prefix_publish_end(shm);
+        printf("write to shared memory: %u (version %u)\n", shm->data_size, shm->version / 2);
     }
 
-    //For protocol
-    void write_to_shmem_protocol(std::vector<std::string> arr, uint32_t arr_size){
-        int shmid = get_prefix_smem();
-        if(shmid == -1){
+    //For protocol: one message per request
+    void write_to_shmem_protocol(PREFIX_SMEM* shm, const std::vector<std::string>& arr){
+        if(shm == (PREFIX_SMEM*)-1){
             std::cout << "Cannot Got Shared Memory. " << std::endl;
             return;
         }
-        else{
-            PREFIX_SMEM* shm = bind_prefix_smem(shmid);
-            if(shm == (PREFIX_SMEM*)-1){
-                return;
-            }
-            else{
-                if(arr_size > 30){
-                    throw std::runtime_error("Total length at shared memory overflow");
-                }
-				if(arr_size == 0){
-					shm->arr_size = 0;
-					printf("write to shm size: %u\n", shm->arr_size);
-                    detach_prefix_shmem(shm);
-					return;
-				}
-                //printf("write to shm length: %u; string: %s\n", arr_size, arr[0]);
-                for(uint32_t i = 0; i < arr_size; i++){
-                    if(arr[i].length() > 20000){
-                        throw std::runtime_error("Single length at shared memory overflow");
-                    }
-                    else{
-                        stpcpy((shm->array)[i], arr[i].c_str());
-                    }
-                    //printf("shm value: %s\n", (shm->array)[i]);
-                }
-                shm->arr_size = arr_size;
-                printf("write to shm size: %u\n", shm->arr_size);
-                detach_prefix_shmem(shm);
-                return;
-            }
+        prefix_publish_begin(shm);
+        bool fits = prefix_reset(shm, arr.size()) == 0;
+        for(uint32_t i = 0; fits && i < arr.size(); i++){
+            fits = prefix_append(shm, i, arr[i].data(), arr[i].length()) == 0;
         }
-        
+        if(!fits){
+            prefix_reset(shm, 0);
+            prefix_publish_end(shm);
+            throw std::runtime_error("Total length at shared memory overflow");
+        }
+        prefix_publish_end(shm);
+        printf("write to shm size: %u (%u bytes, version %u)\n", shm->arr_size, shm->data_size, shm->version / 2);
     }
 
 }//namepsace